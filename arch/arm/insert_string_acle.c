@@ -23,6 +23,7 @@
 #define UPDATE_HASH         update_hash_acle
 #define INSERT_STRING       insert_string_acle
 #define QUICK_INSERT_STRING quick_insert_string_acle
+#define CLEAR_STRING        clear_string_acle
 
 #include "../../insert_string_tpl.h"
 #endif
@@ -41,7 +41,7 @@ static inline void slide_hash_chain(Pos *table, uint32_t entries, uint16_t wsize
 Z_INTERNAL void slide_hash_armv6(deflate_state *s) {
     unsigned int wsize = s->w_size;
 
-    slide_hash_chain(s->head, HASH_SIZE, wsize);
+    slide_hash_chain(s->head, s->hash_size, wsize);
     slide_hash_chain(s->prev, wsize, wsize);
 }
 #endif
@@ -30,7 +30,7 @@ static inline void slide_hash_chain(Pos *table, uint32_t entries, uint16_t wsize
 void Z_INTERNAL SLIDE_PPC(deflate_state *s) {
     uint16_t wsize = s->w_size;
 
-    slide_hash_chain(s->head, HASH_SIZE, wsize);
+    slide_hash_chain(s->head, s->hash_size, wsize);
     slide_hash_chain(s->prev, wsize, wsize);
 }
 
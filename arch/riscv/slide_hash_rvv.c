@@ -27,7 +27,7 @@ static inline void slide_hash_chain(Pos *table, uint32_t entries, uint16_t wsize
 Z_INTERNAL void slide_hash_rvv(deflate_state *s) {
     uint16_t wsize = (uint16_t)s->w_size;
 
-    slide_hash_chain(s->head, HASH_SIZE, wsize);
+    slide_hash_chain(s->head, s->hash_size, wsize);
     slide_hash_chain(s->prev, wsize, wsize);
 }
 
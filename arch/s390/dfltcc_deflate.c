@@ -33,8 +33,8 @@ struct dfltcc_deflate_state {
 
 #define GET_DFLTCC_DEFLATE_STATE(state) ((struct dfltcc_deflate_state *)GET_DFLTCC_STATE(state))
 
-void Z_INTERNAL *PREFIX(dfltcc_alloc_deflate_state)(PREFIX3(streamp) strm) {
-    return dfltcc_alloc_state(strm, sizeof(deflate_state), sizeof(struct dfltcc_deflate_state));
+uint32_t Z_INTERNAL PREFIX(dfltcc_deflate_state_size)(void) {
+    return ALIGN_UP(sizeof(deflate_state), 8) + sizeof(struct dfltcc_deflate_state);
 }
 
 void Z_INTERNAL PREFIX(dfltcc_reset_deflate_state)(PREFIX3(streamp) strm) {
@@ -60,7 +60,7 @@ static inline int dfltcc_can_deflate_with_params(PREFIX3(streamp) strm, int leve
     struct dfltcc_deflate_state *dfltcc_state = GET_DFLTCC_DEFLATE_STATE(state);
 
     /* Unsupported compression settings */
-    if ((dfltcc_state->level_mask & (1 << level)) == 0)
+    if (level < 0 || (dfltcc_state->level_mask & (1 << level)) == 0)
         return 0;
     if (window_bits != HB_BITS)
         return 0;
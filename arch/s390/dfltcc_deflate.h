@@ -3,7 +3,7 @@
 
 #include "dfltcc_common.h"
 
-void Z_INTERNAL *PREFIX(dfltcc_alloc_deflate_state)(PREFIX3(streamp));
+uint32_t Z_INTERNAL PREFIX(dfltcc_deflate_state_size)(void);
 void Z_INTERNAL PREFIX(dfltcc_reset_deflate_state)(PREFIX3(streamp));
 void Z_INTERNAL PREFIX(dfltcc_copy_deflate_state)(void *dst, const void *src);
 int Z_INTERNAL PREFIX(dfltcc_can_deflate)(PREFIX3(streamp) strm);
@@ -15,9 +15,13 @@ int Z_INTERNAL PREFIX(dfltcc_deflate_set_dictionary)(PREFIX3(streamp) strm,
                                                 const unsigned char *dictionary, uInt dict_length);
 int Z_INTERNAL PREFIX(dfltcc_deflate_get_dictionary)(PREFIX3(streamp) strm, unsigned char *dictionary, uInt* dict_length);
 
-#define ZALLOC_DEFLATE_STATE PREFIX(dfltcc_alloc_deflate_state)
+#define DEFLATE_STATE_SIZE PREFIX(dfltcc_deflate_state_size)()
 #define ZCOPY_DEFLATE_STATE PREFIX(dfltcc_copy_deflate_state)
 
+/* DFLTCC needs a page aligned window and always uses 32K of it */
+#define DEFLATE_WINDOW_ALIGN 4096
+#define DEFLATE_ADJUST_WINDOW_SIZE(size) MAX((size), 1 << 15)
+
 #define DEFLATE_SET_DICTIONARY_HOOK(strm, dict, dict_len) \
     do { \
         if (PREFIX(dfltcc_can_deflate)((strm))) \
@@ -27,6 +27,10 @@ struct inflate_state Z_INTERNAL *PREFIX(dfltcc_alloc_inflate_state)(PREFIX3(stre
     return (struct inflate_state *)dfltcc_alloc_state(strm, sizeof(struct inflate_state), sizeof(struct dfltcc_state));
 }
 
+uint32_t Z_INTERNAL PREFIX(dfltcc_inflate_state_size)(void) {
+    return ALIGN_UP(sizeof(struct inflate_state), 8) + sizeof(struct dfltcc_state);
+}
+
 void Z_INTERNAL PREFIX(dfltcc_reset_inflate_state)(PREFIX3(streamp) strm) {
     struct inflate_state *state = (struct inflate_state *)strm->state;
     struct dfltcc_state *dfltcc_state = GET_DFLTCC_STATE(state);
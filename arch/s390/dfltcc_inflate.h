@@ -4,6 +4,7 @@
 #include "dfltcc_common.h"
 
 struct inflate_state Z_INTERNAL *PREFIX(dfltcc_alloc_inflate_state)(PREFIX3(streamp) strm);
+uint32_t Z_INTERNAL PREFIX(dfltcc_inflate_state_size)(void);
 void Z_INTERNAL PREFIX(dfltcc_reset_inflate_state)(PREFIX3(streamp) strm);
 void Z_INTERNAL PREFIX(dfltcc_copy_inflate_state)(struct inflate_state *dst, const struct inflate_state *src);
 int Z_INTERNAL PREFIX(dfltcc_can_inflate)(PREFIX3(streamp) strm);
@@ -22,6 +23,9 @@ int Z_INTERNAL PREFIX(dfltcc_inflate_get_dictionary)(PREFIX3(streamp) strm,
 
 #define ZALLOC_INFLATE_STATE PREFIX(dfltcc_alloc_inflate_state)
 #define ZCOPY_INFLATE_STATE PREFIX(dfltcc_copy_inflate_state)
+#define INFLATE_STATE_SIZE PREFIX(dfltcc_inflate_state_size)()
+#define INFLATE_WINDOW_ALIGN 4096
+#define INFLATE_ADJUST_WINDOW_SIZE(size) MAX((size), 1 << 15)
 
 #define INFLATE_RESET_KEEP_HOOK PREFIX(dfltcc_reset_inflate_state)
 
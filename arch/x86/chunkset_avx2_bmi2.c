@@ -0,0 +1,26 @@
+/* chunkset_avx2_bmi2.c -- AVX2 chunk copies for inflate_fast() built with BMI2.
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+#include "zbuild.h"
+#include "zutil.h"
+
+#if defined(X86_AVX2) && defined(X86_BMI2)
+#include "chunkset_avx2_p.h"
+
+/* Same as chunkset_avx2.c, but the whole file is compiled with BMI2 so that the
+   variable shifts and masks of the bit accumulator in inflate_fast() become
+   shrx and bzhi, which shortens the dependency chain between table lookups. */
+
+#define CHUNKSIZE        chunksize_avx2_bmi2
+#define CHUNKCOPY        chunkcopy_avx2_bmi2
+#define CHUNKUNROLL      chunkunroll_avx2_bmi2
+#define CHUNKMEMSET      chunkmemset_avx2_bmi2
+#define CHUNKMEMSET_SAFE chunkmemset_safe_avx2_bmi2
+
+#include "chunkset_tpl.h"
+
+#define INFLATE_FAST     inflate_fast_avx2_bmi2
+
+#include "inffast_tpl.h"
+
+#endif
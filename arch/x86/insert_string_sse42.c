@@ -22,6 +22,7 @@
 #define UPDATE_HASH         update_hash_sse42
 #define INSERT_STRING       insert_string_sse42
 #define QUICK_INSERT_STRING quick_insert_string_sse42
+#define CLEAR_STRING        clear_string_sse42
 
 #include "../../insert_string_tpl.h"
 #endif
@@ -37,7 +37,7 @@ Z_INTERNAL void slide_hash_avx2(deflate_state *s) {
     uint16_t wsize = (uint16_t)s->w_size;
     const __m256i ymm_wsize = _mm256_set1_epi16((short)wsize);
 
-    slide_hash_chain(s->head, HASH_SIZE, ymm_wsize);
+    slide_hash_chain(s->head, s->hash_size, ymm_wsize);
     slide_hash_chain(s->prev, wsize, ymm_wsize);
 }
 
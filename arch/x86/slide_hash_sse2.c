@@ -61,7 +61,7 @@ Z_INTERNAL void slide_hash_sse2(deflate_state *s) {
     assert(((uintptr_t)s->head & 15) == 0);
     assert(((uintptr_t)s->prev & 15) == 0);
 
-    slide_hash_chain(s->head, s->prev, HASH_SIZE, wsize, xmm_wsize);
+    slide_hash_chain(s->head, s->prev, s->hash_size, wsize, xmm_wsize);
 }
 
 #endif
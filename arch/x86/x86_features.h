@@ -12,6 +12,7 @@ struct x86_cpu_features {
     int has_avx2;
     int has_avx512;
     int has_avx512vnni;
+    int has_bmi2;
     int has_sse2;
     int has_ssse3;
     int has_sse42;
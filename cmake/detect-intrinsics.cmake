@@ -186,6 +186,35 @@ macro(check_avx2_intrinsics)
     set(CMAKE_REQUIRED_FLAGS)
 endmacro()
 
+macro(check_bmi2_intrinsics)
+    if(CMAKE_C_COMPILER_ID MATCHES "Intel")
+        if(CMAKE_HOST_UNIX OR APPLE)
+            set(BMI2FLAG "-mbmi2")
+        endif()
+    elseif(CMAKE_C_COMPILER_ID MATCHES "GNU" OR CMAKE_C_COMPILER_ID MATCHES "Clang")
+        if(NOT NATIVEFLAG)
+            set(BMI2FLAG "-mbmi2")
+        endif()
+    endif()
+    # Compilers without a flag for it, such as MSVC, only emit BMI2 through the intrinsics,
+    # which would leave the BMI2 variant the same code as the AVX2 one
+    if(BMI2FLAG OR NATIVEFLAG)
+        # Check whether compiler supports BMI2 intrinics
+        set(CMAKE_REQUIRED_FLAGS "${BMI2FLAG} ${NATIVEFLAG}")
+        check_c_source_compiles(
+            "#include <immintrin.h>
+            unsigned int f(unsigned int x, unsigned int n) {
+                return _bzhi_u32(x, n);
+            }
+            int main(void) { return 0; }"
+            HAVE_BMI2_INTRIN
+        )
+        set(CMAKE_REQUIRED_FLAGS)
+    else()
+        set(HAVE_BMI2_INTRIN OFF)
+    endif()
+endmacro()
+
 macro(check_neon_compiler_flag)
     if(CMAKE_C_COMPILER_ID MATCHES "GNU" OR CMAKE_C_COMPILER_ID MATCHES "Clang")
         if(NOT NATIVEFLAG)
@@ -0,0 +1,422 @@
+/* compress_parallel.c -- compress a memory buffer using multiple threads
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * The input is split into fixed size blocks which are compressed independently
+ * as raw deflate, each primed with the preceding 32K of input as dictionary so
+ * that compression ratio stays close to single-threaded deflate. Every block but
+ * the last is terminated with a sync flush, which leaves the output byte-aligned
+ * and makes it possible to simply concatenate the compressed blocks. The check
+ * value of each block is computed alongside and combined in order, the result
+ * is a single valid zlib, gzip or raw deflate stream. This is the approach used
+ * by pigz.
+ */
+
+#include "zbuild.h"
+#include "zutil.h"
+#include "zthread.h"
+#include "compress_parallel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct deflate_workers_s {
+    int32_t count;
+    int32_t level;
+    int32_t window_bits;
+    int32_t strategy;
+    int32_t init[ZTHREAD_MAX_WORKERS];
+    PREFIX3(stream) strm[ZTHREAD_MAX_WORKERS];
+};
+
+typedef struct {
+    deflate_workers *workers;
+    deflate_block *blocks;
+    int32_t check;
+} deflate_blocks_ctx;
+
+/* ===========================================================================
+ * Returns the raw deflate stream of a worker, initializing it on first use.
+ */
+static PREFIX3(stream) *deflate_worker_stream(deflate_workers *workers, int32_t worker, int32_t *err) {
+    PREFIX3(stream) *strm = &workers->strm[worker];
+
+    if (!workers->init[worker]) {
+        memset(strm, 0, sizeof(*strm));
+        *err = PREFIX(deflateInit2)(strm, workers->level, Z_DEFLATED, -workers->window_bits, DEF_MEM_LEVEL,
+                                    workers->strategy);
+        if (*err != Z_OK)
+            return NULL;
+        workers->init[worker] = 1;
+    }
+    *err = PREFIX(deflateReset)(strm);
+    return *err == Z_OK ? strm : NULL;
+}
+
+int32_t Z_INTERNAL deflate_workers_init(deflate_workers **workers, int32_t count, int32_t level, int32_t window_bits,
+                                        int32_t strategy) {
+    deflate_workers *w;
+    int32_t err;
+
+    *workers = NULL;
+    if (count < 1)
+        count = 1;
+    if (count > ZTHREAD_MAX_WORKERS)
+        count = ZTHREAD_MAX_WORKERS;
+
+    w = (deflate_workers *)calloc(1, sizeof(deflate_workers));
+    if (w == NULL)
+        return Z_MEM_ERROR;
+    w->count = count;
+    w->level = level;
+    w->window_bits = window_bits;
+    w->strategy = strategy;
+
+    /* Initialize the first stream up front so that invalid parameters are reported here */
+    if (deflate_worker_stream(w, 0, &err) == NULL) {
+        deflate_workers_end(w);
+        return err;
+    }
+    *workers = w;
+    return Z_OK;
+}
+
+void Z_INTERNAL deflate_workers_end(deflate_workers *workers) {
+    int32_t i;
+
+    if (workers == NULL)
+        return;
+    for (i = 0; i < workers->count; i++) {
+        if (workers->init[i])
+            PREFIX(deflateEnd)(&workers->strm[i]);
+    }
+    free(workers);
+}
+
+int32_t Z_INTERNAL deflate_workers_count(deflate_workers *workers) {
+    return workers->count;
+}
+
+size_t Z_INTERNAL deflate_block_bound(size_t len) {
+    /* Raw deflate bound plus an empty stored block and a partial byte for the sync flush */
+    return (size_t)PREFIX(compressBound)((z_uintmax_t)len) - ZLIB_WRAPLEN + 6;
+}
+
+size_t Z_INTERNAL deflate_zlib_header(uint8_t *buf, int32_t level, int32_t window_bits) {
+    uint32_t header = (Z_DEFLATED + ((window_bits - 8) << 4)) << 8;
+    uint32_t level_flags;
+
+    if (level < 2)
+        level_flags = 0;
+    else if (level < 6)
+        level_flags = 1;
+    else if (level == 6)
+        level_flags = 2;
+    else
+        level_flags = 3;
+    header |= (level_flags << 6);
+    header += 31 - (header % 31);
+
+    buf[0] = (uint8_t)(header >> 8);
+    buf[1] = (uint8_t)(header & 0xff);
+    return 2;
+}
+
+/* ===========================================================================
+ * Compresses a single block with the stream of the given worker.
+ */
+static void deflate_block_job(void *ctx, int32_t worker, int32_t job) {
+    deflate_blocks_ctx *c = (deflate_blocks_ctx *)ctx;
+    deflate_block *block = &c->blocks[job];
+    const unsigned int max = (unsigned int)-1;
+    PREFIX3(stream) *strm;
+    size_t size, left_in, dict_len;
+    uint8_t *out;
+    int32_t flush = block->last ? Z_FINISH : Z_SYNC_FLUSH;
+    int32_t err;
+
+    block->out = NULL;
+    block->out_len = 0;
+
+    if (c->check == PARALLEL_CHECK_CRC)
+        block->check = (uint32_t)PREFIX(crc32_z)(0, block->in, block->in_len);
+    else if (c->check == PARALLEL_CHECK_ADLER)
+        block->check = (uint32_t)PREFIX(adler32_z)(1, block->in, block->in_len);
+
+    strm = deflate_worker_stream(c->workers, worker, &err);
+    if (strm == NULL) {
+        block->err = err;
+        return;
+    }
+
+    dict_len = MIN(block->dict_len, (size_t)1 << c->workers->window_bits);
+    if (dict_len > 0) {
+        err = PREFIX(deflateSetDictionary)(strm, block->in - dict_len, (uint32_t)dict_len);
+        if (err != Z_OK) {
+            block->err = err;
+            return;
+        }
+    }
+
+    size = deflate_block_bound(block->in_len);
+    out = (uint8_t *)malloc(size);
+    if (out == NULL) {
+        block->err = Z_MEM_ERROR;
+        return;
+    }
+
+    strm->next_in = (z_const unsigned char *)block->in;
+    strm->avail_in = 0;
+    strm->next_out = out;
+    strm->avail_out = 0;
+    left_in = block->in_len;
+
+    for (;;) {
+        size_t produced = (size_t)(strm->next_out - out);
+
+        if (strm->avail_out == 0) {
+            size_t left_out = size - produced;
+            if (left_out == 0) {
+                /* Compressed data is larger than expected, grow output buffer */
+                uint8_t *grown = (uint8_t *)realloc(out, size * 2);
+                if (grown == NULL) {
+                    free(out);
+                    block->err = Z_MEM_ERROR;
+                    return;
+                }
+                out = grown;
+                strm->next_out = out + produced;
+                left_out = size;
+                size *= 2;
+            }
+            strm->avail_out = left_out > (size_t)max ? max : (unsigned int)left_out;
+        }
+        if (strm->avail_in == 0) {
+            strm->avail_in = left_in > (size_t)max ? max : (unsigned int)left_in;
+            left_in -= strm->avail_in;
+        }
+        err = PREFIX(deflate)(strm, left_in ? Z_NO_FLUSH : flush);
+        if (err == Z_STREAM_END)
+            break;
+        if (err != Z_OK && err != Z_BUF_ERROR)
+            break;
+        /* Sync flush is complete once all input is consumed and output space remains */
+        if (flush == Z_SYNC_FLUSH && left_in == 0 && strm->avail_in == 0 && strm->avail_out != 0) {
+            err = Z_OK;
+            break;
+        }
+    }
+
+    if (err != Z_OK && err != Z_STREAM_END) {
+        free(out);
+        block->err = err;
+        return;
+    }
+    block->out = out;
+    block->out_len = (size_t)(strm->next_out - out);
+    block->err = Z_OK;
+}
+
+int32_t Z_INTERNAL deflate_blocks(deflate_workers *workers, deflate_block *blocks, int32_t count, int32_t check) {
+    deflate_blocks_ctx ctx;
+    int32_t i;
+
+    ctx.workers = workers;
+    ctx.blocks = blocks;
+    ctx.check = check;
+
+    zthread_run_jobs(deflate_block_job, &ctx, workers->count, count);
+
+    for (i = 0; i < count; i++) {
+        if (blocks[i].err != Z_OK)
+            return blocks[i].err;
+    }
+    return Z_OK;
+}
+
+void Z_INTERNAL deflate_blocks_free(deflate_block *blocks, int32_t count) {
+    int32_t i;
+
+    for (i = 0; i < count; i++) {
+        free(blocks[i].out);
+        blocks[i].out = NULL;
+        blocks[i].out_len = 0;
+    }
+}
+
+#ifndef ZLIB_COMPAT
+/* ===========================================================================
+ * Splits windowBits as passed to deflateInit2 into wrapper type and window size.
+ */
+static int32_t parallel_window_bits(int32_t windowBits, int32_t *wrap) {
+    if (windowBits < 0) {
+        *wrap = 0;
+        windowBits = -windowBits;
+    } else if (windowBits > 15) {
+        *wrap = 2;
+        windowBits -= 16;
+    } else {
+        *wrap = 1;
+        if (windowBits == 8)
+            windowBits = 9;
+    }
+    if (windowBits < 8 || windowBits > 15)
+        return -1;
+    return windowBits;
+}
+
+/* ===========================================================================
+     Compresses the source buffer into the destination buffer using up to
+   threads threads. The output is a single zlib, gzip or raw deflate stream,
+   selected by windowBits as in deflateInit2. Upon entry, destLen is the total
+   size of the destination buffer, which must be at least the value returned by
+   compressParallelBound. Upon exit, destLen is the actual size of the
+   compressed buffer.
+*/
+int32_t Z_EXPORT PREFIX(compressParallel)(uint8_t *dest, size_t *destLen, const uint8_t *source, size_t sourceLen,
+                                          int32_t level, int32_t windowBits, int32_t threads, size_t blockSize) {
+    deflate_workers *workers;
+    deflate_block *blocks;
+    size_t left, nblocks, first, i, pos = 0;
+    uint32_t check;
+    int32_t wrap, bits, round, count, err;
+
+    left = *destLen;
+    *destLen = 0;
+
+    if (threads < 0)
+        return Z_STREAM_ERROR;
+    bits = parallel_window_bits(windowBits, &wrap);
+    if (bits < 0)
+        return Z_STREAM_ERROR;
+    if (level == Z_DEFAULT_COMPRESSION)
+        level = 6;
+    if (threads == 0)
+        threads = zthread_cpu_count();
+    if (blockSize == 0)
+        blockSize = PARALLEL_BLOCK_SIZE_DEFAULT;
+
+    nblocks = sourceLen ? (sourceLen - 1) / blockSize + 1 : 1;
+    if ((size_t)threads > nblocks)
+        threads = (int32_t)nblocks;
+
+    err = deflate_workers_init(&workers, threads, level, bits, Z_DEFAULT_STRATEGY);
+    if (err != Z_OK)
+        return err;
+    threads = deflate_workers_count(workers);
+
+    /* Blocks are processed in rounds to bound the memory held by compressed output */
+    round = threads * 4;
+    blocks = (deflate_block *)calloc((size_t)round, sizeof(deflate_block));
+    if (blocks == NULL) {
+        deflate_workers_end(workers);
+        return Z_MEM_ERROR;
+    }
+
+    /* Write the header */
+    if (wrap == 1) {
+        if (left < 2) {
+            err = Z_BUF_ERROR;
+            goto done;
+        }
+        pos += deflate_zlib_header(dest, level, bits);
+        check = ADLER32_INITIAL_VALUE;
+    } else if (wrap == 2) {
+        if (left < 10) {
+            err = Z_BUF_ERROR;
+            goto done;
+        }
+        dest[0] = 31;
+        dest[1] = 139;
+        dest[2] = 8;
+        memset(dest + 3, 0, 5);
+        dest[8] = level >= 9 ? 2 : (level < 2 ? 4 : 0);
+        dest[9] = OS_CODE;
+        pos += 10;
+        check = CRC32_INITIAL_VALUE;
+    } else {
+        check = 0;
+    }
+
+    for (first = 0; first < nblocks && err == Z_OK; first += (size_t)count) {
+        count = (int32_t)MIN((size_t)round, nblocks - first);
+
+        for (i = 0; i < (size_t)count; i++) {
+            size_t start = (first + i) * blockSize;
+            blocks[i].in = source + start;
+            blocks[i].in_len = MIN(blockSize, sourceLen - start);
+            blocks[i].dict_len = start;
+            blocks[i].last = (first + i == nblocks - 1);
+        }
+
+        err = deflate_blocks(workers, blocks, count,
+                             wrap == 2 ? PARALLEL_CHECK_CRC : (wrap == 1 ? PARALLEL_CHECK_ADLER : PARALLEL_CHECK_NONE));
+
+        for (i = 0; i < (size_t)count && err == Z_OK; i++) {
+            if (blocks[i].out_len > left - pos) {
+                err = Z_BUF_ERROR;
+                break;
+            }
+            memcpy(dest + pos, blocks[i].out, blocks[i].out_len);
+            pos += blocks[i].out_len;
+
+            if (wrap == 2)
+                check = PREFIX(crc32_combine)(check, blocks[i].check, (z_off64_t)blocks[i].in_len);
+            else if (wrap == 1)
+                check = PREFIX(adler32_combine)(check, blocks[i].check, (z_off64_t)blocks[i].in_len);
+        }
+        deflate_blocks_free(blocks, count);
+    }
+
+    /* Write the trailer */
+    if (err == Z_OK && wrap == 1) {
+        if (left - pos < 4) {
+            err = Z_BUF_ERROR;
+        } else {
+            dest[pos++] = (uint8_t)(check >> 24);
+            dest[pos++] = (uint8_t)(check >> 16);
+            dest[pos++] = (uint8_t)(check >> 8);
+            dest[pos++] = (uint8_t)check;
+        }
+    } else if (err == Z_OK && wrap == 2) {
+        if (left - pos < 8) {
+            err = Z_BUF_ERROR;
+        } else {
+            dest[pos++] = (uint8_t)check;
+            dest[pos++] = (uint8_t)(check >> 8);
+            dest[pos++] = (uint8_t)(check >> 16);
+            dest[pos++] = (uint8_t)(check >> 24);
+            dest[pos++] = (uint8_t)sourceLen;
+            dest[pos++] = (uint8_t)(sourceLen >> 8);
+            dest[pos++] = (uint8_t)(sourceLen >> 16);
+            dest[pos++] = (uint8_t)(sourceLen >> 24);
+        }
+    }
+
+done:
+    free(blocks);
+    deflate_workers_end(workers);
+    if (err == Z_OK)
+        *destLen = pos;
+    return err;
+}
+
+/* ===========================================================================
+ */
+size_t Z_EXPORT PREFIX(compressParallelBound)(size_t sourceLen, int32_t windowBits, size_t blockSize) {
+    size_t full, rest, wraplen;
+
+    if (blockSize == 0)
+        blockSize = PARALLEL_BLOCK_SIZE_DEFAULT;
+    full = sourceLen / blockSize;
+    rest = sourceLen % blockSize;
+
+    if (windowBits < 0)
+        wraplen = 0;
+    else if (windowBits > 15)
+        wraplen = GZIP_WRAPLEN;
+    else
+        wraplen = ZLIB_WRAPLEN;
+
+    return full * deflate_block_bound(blockSize) + (rest || !full ? deflate_block_bound(rest) : 0) + wraplen;
+}
+#endif
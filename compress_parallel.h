@@ -0,0 +1,52 @@
+/* compress_parallel.h -- Internal block-parallel deflate, shared by the parallel
+ *                        compress utility functions and the gzip file writer
+ *
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef COMPRESS_PARALLEL_H_
+#define COMPRESS_PARALLEL_H_
+
+#define PARALLEL_BLOCK_SIZE_DEFAULT (128 * 1024)
+
+/* Check value computed for each block, combined in order by the caller */
+#define PARALLEL_CHECK_NONE  0
+#define PARALLEL_CHECK_ADLER 1
+#define PARALLEL_CHECK_CRC   2
+
+/* One independently compressed piece of a raw deflate stream. The dict_len bytes
+ * preceding in must be readable, they prime the window so matches can reach back
+ * across the block boundary. Non-last blocks end with a sync flush so their output
+ * can be concatenated byte-wise, the last block terminates the deflate stream. */
+typedef struct deflate_block_s {
+    const uint8_t *in;
+    size_t in_len;
+    size_t dict_len;
+    int32_t last;
+
+    uint8_t *out;       /* allocated by deflate_blocks, release with deflate_blocks_free */
+    size_t out_len;
+    uint32_t check;     /* adler32 or crc32 of in, depending on check type */
+    int32_t err;
+} deflate_block;
+
+typedef struct deflate_workers_s deflate_workers;
+
+/* Creates up to count workers, each owning a raw deflate stream with the given parameters that is
+ * reset between blocks. Returns Z_OK, Z_MEM_ERROR, or Z_STREAM_ERROR if a parameter is invalid. */
+int32_t Z_INTERNAL deflate_workers_init(deflate_workers **workers, int32_t count, int32_t level, int32_t window_bits,
+                                        int32_t strategy);
+void    Z_INTERNAL deflate_workers_end(deflate_workers *workers);
+int32_t Z_INTERNAL deflate_workers_count(deflate_workers *workers);
+
+/* Compresses count blocks using all workers. Returns Z_OK or the error of the first failed block. */
+int32_t Z_INTERNAL deflate_blocks(deflate_workers *workers, deflate_block *blocks, int32_t count, int32_t check);
+void    Z_INTERNAL deflate_blocks_free(deflate_block *blocks, int32_t count);
+
+/* Upper bound on the raw deflate output for a single block of len bytes, including its flush marker */
+size_t  Z_INTERNAL deflate_block_bound(size_t len);
+
+/* Writes a zlib header into buf and returns its length */
+size_t  Z_INTERNAL deflate_zlib_header(uint8_t *buf, int32_t level, int32_t window_bits);
+
+#endif
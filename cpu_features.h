@@ -149,6 +149,9 @@ extern void inflate_fast_ssse3(PREFIX3(stream) *strm, uint32_t start);
 #endif
 #ifdef X86_AVX2
 extern void inflate_fast_avx2(PREFIX3(stream) *strm, uint32_t start);
+#  ifdef X86_BMI2
+extern void inflate_fast_avx2_bmi2(PREFIX3(stream) *strm, uint32_t start);
+#  endif
 #endif
 #ifdef ARM_NEON
 extern void inflate_fast_neon(PREFIX3(stream) *strm, uint32_t start);
@@ -202,6 +205,14 @@ extern uint32_t compare256_rvv(const uint8_t *src0, const uint8_t *src1);
 #endif
 
 #ifdef DEFLATE_H_
+/* clear_string */
+extern void clear_string_c(deflate_state *const s, const uint32_t str, uint32_t count);
+#ifdef X86_SSE42
+extern void clear_string_sse42(deflate_state *const s, const uint32_t str, uint32_t count);
+#elif defined(ARM_ACLE)
+extern void clear_string_acle(deflate_state *const s, const uint32_t str, uint32_t count);
+#endif
+
 /* insert_string */
 extern void insert_string_c(deflate_state *const s, const uint32_t str, uint32_t count);
 #ifdef X86_SSE42
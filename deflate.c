@@ -54,6 +54,7 @@
 #include "deflate.h"
 #include "deflate_p.h"
 #include "functable.h"
+#include "state_pool.h"
 
 /* Avoid conflicts with zlib.h macros */
 #ifdef ZLIB_COMPAT
@@ -78,13 +79,12 @@ const char PREFIX(deflate_copyright)[] = " deflate 1.2.13 Copyright 1995-2022 Je
 #ifdef S390_DFLTCC_DEFLATE
 #  include "arch/s390/dfltcc_deflate.h"
 #else
-/* Memory management for the deflate state. Useful for allocating arch-specific extension blocks. */
-#  define ZALLOC_DEFLATE_STATE(strm) ((deflate_state *)ZALLOC(strm, 1, sizeof(deflate_state)))
-#  define ZFREE_STATE(strm, addr) ZFREE(strm, addr)
+/* Size of the deflate state. Useful for allocating arch-specific extension blocks after it. */
+#  define DEFLATE_STATE_SIZE sizeof(deflate_state)
 #  define ZCOPY_DEFLATE_STATE(dst, src) memcpy(dst, src, sizeof(deflate_state))
-/* Memory management for the window. Useful for allocation the aligned window. */
-#  define ZALLOC_WINDOW(strm, items, size) ZALLOC(strm, items, size)
-#  define TRY_FREE_WINDOW(strm, addr) TRY_FREE(strm, addr)
+/* Alignment and size of the window. Useful for arch-specific window requirements. */
+#  define DEFLATE_WINDOW_ALIGN 64
+#  define DEFLATE_ADJUST_WINDOW_SIZE(size) (size)
 /* Invoked at the beginning of deflateSetDictionary(). Useful for checking arch-specific window data. */
 #  define DEFLATE_SET_DICTIONARY_HOOK(strm, dict, dict_len) do {} while (0)
 /* Invoked at the beginning of deflateGetDictionary(). Useful for adjusting arch-specific window data. */
@@ -116,12 +116,15 @@ static int deflateStateCheck      (PREFIX3(stream) *strm);
 Z_INTERNAL block_state deflate_stored(deflate_state *s, int flush);
 Z_INTERNAL block_state deflate_fast  (deflate_state *s, int flush);
 Z_INTERNAL block_state deflate_quick (deflate_state *s, int flush);
+Z_INTERNAL block_state deflate_quick_accel(deflate_state *s, int flush);
 #ifndef NO_MEDIUM_STRATEGY
 Z_INTERNAL block_state deflate_medium(deflate_state *s, int flush);
 #endif
 Z_INTERNAL block_state deflate_slow  (deflate_state *s, int flush);
+Z_INTERNAL block_state deflate_optimal(deflate_state *s, int flush);
 Z_INTERNAL block_state deflate_rle   (deflate_state *s, int flush);
 Z_INTERNAL block_state deflate_huff  (deflate_state *s, int flush);
+Z_INTERNAL block_state deflate_sampled(deflate_state *s, int flush, compress_func func);
 static void lm_set_level         (deflate_state *s, int level);
 static void lm_init              (deflate_state *s);
 Z_INTERNAL unsigned read_buf  (PREFIX3(stream) *strm, unsigned char *buf, unsigned size);
@@ -135,7 +138,7 @@ extern Pos      quick_insert_string_roll(deflate_state *const s, uint32_t str);
  */
 
 /* Values for max_lazy_match, good_match and max_chain_length, depending on
- * the desired pack level (0..9). The values given below have been tuned to
+ * the desired pack level (0..10). The values given below have been tuned to
  * exclude worst case performance for pathological files. Better values may be
  * found for specific files.
  */
@@ -147,7 +150,7 @@ typedef struct config_s {
     compress_func func;
 } config;
 
-static const config configuration_table[10] = {
+static const config configuration_table[11] = {
 /*      good lazy nice chain */
 /* 0 */ {0,    0,  0,    0, deflate_stored},  /* store only */
 
@@ -173,30 +176,123 @@ static const config configuration_table[10] = {
 
 /* 7 */ {8,   32, 128,  256, deflate_slow},
 /* 8 */ {32, 128, 258, 1024, deflate_slow},
-/* 9 */ {32, 258, 258, 4096, deflate_slow}}; /* max compression */
+/* 9 */ {32, 258, 258, 4096, deflate_slow},  /* max compression */
+/* 10 */ {32, 258, 258, 4096, deflate_optimal}}; /* optimal parsing */
 
 /* Note: the deflate() code requires max_lazy >= STD_MIN_MATCH and max_chain >= 4
  * For deflate_fast() (levels <= 3) good is ignored and lazy has a different
  * meaning.
  */
 
+/* Z_FASTEST_COMPRESSION, below Z_DEFAULT_COMPRESSION */
+static const config accel_config = {0, 0, 0, 0, deflate_quick_accel};
+
+#define LEVEL_CONFIG(level) ((level) < 0 ? &accel_config : &configuration_table[level])
+
 /* rank Z_BLOCK between Z_NO_FLUSH and Z_PARTIAL_FLUSH */
 #define RANK(f) (((f) * 2) - ((f) > 4 ? 9 : 0))
 
 
 /* ===========================================================================
- * Initialize the hash table. prev[] will be initialized on the fly.
+ * Initialize the hash table. prev[] will be initialized on the fly. If only a
+ * few strings have been inserted since the table was last cleared, only their
+ * entries are cleared, so that resetting a stream after compressing a short
+ * message does not cost more than compressing it.
  */
+#define CLEAR_HASH_LAZY_MAX 2048
+
 #define CLEAR_HASH(s) do { \
-    memset((unsigned char *)s->head, 0, HASH_SIZE * sizeof(*s->head)); \
+    if (s->clear_lazy && s->clear_string != NULL && s->strstart + s->lookahead <= CLEAR_HASH_LAZY_MAX) \
+        s->clear_string(s, 0, s->strstart + s->lookahead); \
+    else \
+        memset((unsigned char *)s->head, 0, s->hash_size * sizeof(*s->head)); \
+    s->clear_lazy = 1; \
+    s->bt_next = 0; \
   } while (0)
 
-/* ========================================================================= */
-/* This function is hidden in ZLIB_COMPAT builds. */
-int32_t ZNG_CONDEXPORT PREFIX(deflateInit2)(PREFIX3(stream) *strm, int32_t level, int32_t method, int32_t windowBits,
-                                            int32_t memLevel, int32_t strategy) {
+/* ===========================================================================
+ * Allocate the deflate state together with the hash table, prev, the right
+ * links of the binary trees if bt is set, the pending buffer and the window,
+ * so that a stream needs a single allocator call. The
+ * tables used for every string inserted come right after the state, and each
+ * part starts on a cache line. The state is cleared, the other parts are not.
+ * The window is followed by MIN_LOOKAHEAD bytes, so that a match compared
+ * past the lookahead cannot read beyond the block. If pool is not NULL, the
+ * block is taken from it instead of the allocator.
+ */
+#define ARENA_PAD(size) (((size) + 63) & ~(size_t)63)
+
+static deflate_state *alloc_deflate(PREFIX3(stream) *strm, state_pool *pool, unsigned int w_bits,
+                                    unsigned int hash_bits, unsigned int lit_bufsize, int bt) {
+    size_t w_size = (size_t)1 << w_bits;
+    size_t window_padding = 0;
+    size_t head_pos, prev_pos, bt_pos, pending_pos, window_pos, size;
+    unsigned char *arena;
+    deflate_state *s;
+
+#ifdef X86_PCLMULQDQ_CRC
+    window_padding = 8;
+#endif
+
+    head_pos = ARENA_PAD(DEFLATE_STATE_SIZE);
+    prev_pos = head_pos + ARENA_PAD(((size_t)1 << hash_bits) * sizeof(Pos));
+    bt_pos = prev_pos + ARENA_PAD(w_size * sizeof(Pos));
+    pending_pos = bt_pos + (bt ? ARENA_PAD(w_size * sizeof(Pos)) : 0);
+    window_pos = pending_pos + ARENA_PAD((size_t)lit_bufsize * 4);
+    size = window_pos + (DEFLATE_WINDOW_ALIGN - 64) + DEFLATE_ADJUST_WINDOW_SIZE(2 * (w_size + window_padding)) +
+           MIN_LOOKAHEAD;
+
+    if (pool != NULL)
+        arena = (unsigned char *)state_pool_get(pool, size);
+    else
+        arena = (unsigned char *)ZALLOC(strm, 1, (unsigned)size);
+    if (arena == NULL)
+        return NULL;
+    s = (deflate_state *)arena;
+    memset(s, 0, sizeof(*s));
+    s->pool = pool;
+
+    s->w_bits = w_bits;
+    s->w_size = (unsigned int)w_size;
+    s->w_mask = s->w_size - 1;
+    s->hash_bits = hash_bits;
+    s->hash_size = 1 << s->hash_bits;
+    s->hash_mask = s->hash_size - 1;
+    s->lit_bufsize = lit_bufsize;
+    s->pending_buf_size = lit_bufsize * 4;
+
+    s->head = (Pos *)(arena + head_pos);
+    s->prev = (Pos *)(arena + prev_pos);
+    s->bt_space = bt ? (Pos *)(arena + bt_pos) : NULL;
+    s->pending_buf = arena + pending_pos;
+    /* ZALLOC aligns the arena to 64 bytes, the window may need more */
+    window_pos += (DEFLATE_WINDOW_ALIGN - ((uintptr_t)(arena + window_pos) & (DEFLATE_WINDOW_ALIGN - 1))) &
+                  (DEFLATE_WINDOW_ALIGN - 1);
+    s->window = arena + window_pos;
+    return s;
+}
+
+/* ===========================================================================
+ * Returns the number of bits needed to hold values up to len - 1, that is the
+ * smallest n with 1 << n >= len.
+ */
+static unsigned int size_bits(size_t len) {
+    unsigned int bits = 0;
+
+    while (bits < 31 && ((size_t)1 << bits) < len)
+        bits++;
+    return bits;
+}
+
+/* ===========================================================================
+ * Initialize the stream. If source_len is not 0, it is the expected length of
+ * the input and the window, hash table and symbol buffer are made no larger
+ * than needed for it. If pool is not NULL, the state is taken from it.
+ */
+static int32_t deflate_init(PREFIX3(stream) *strm, int32_t level, int32_t method, int32_t windowBits,
+                            int32_t memLevel, int32_t strategy, size_t source_len, state_pool *pool) {
     /* Todo: ignore strm->next_in if we use it as window */
-    uint32_t window_padding = 0;
+    unsigned int hash_bits = HASH_BITS;
     deflate_state *s;
     int wrap = 1;
 
@@ -226,47 +322,45 @@ int32_t ZNG_CONDEXPORT PREFIX(deflateInit2)(PREFIX3(stream) *strm, int32_t level
 #endif
     }
     if (memLevel < 1 || memLevel > MAX_MEM_LEVEL || method != Z_DEFLATED || windowBits < MIN_WBITS ||
-        windowBits > MAX_WBITS || level < 0 || level > 9 || strategy < 0 || strategy > Z_FIXED ||
+        windowBits > MAX_WBITS || level < Z_FASTEST_COMPRESSION || level > Z_OPTIMAL_COMPRESSION || strategy < 0 || strategy > Z_FIXED ||
         (windowBits == 8 && wrap != 1)) {
         return Z_STREAM_ERROR;
     }
     if (windowBits == 8)
         windowBits = 9;  /* until 256-byte window bug fixed */
 
-    s = ZALLOC_DEFLATE_STATE(strm);
+    if (source_len) {
+        /* Matches reach back at most w_size - MIN_LOOKAHEAD bytes, and a block
+         * holds lit_bufsize - 1 symbols. The hash table gets about two entries
+         * for each string to keep the chains short. */
+        windowBits = MIN(windowBits, (int32_t)MAX(size_bits(source_len + MIN_LOOKAHEAD), 9));
+        memLevel = MIN(memLevel, (int32_t)MAX(size_bits(source_len + 1), 7) - 6);
+        hash_bits = MIN(HASH_BITS, MAX(size_bits(source_len) + 1, MIN_HASH_BITS));
+    }
+
+#ifdef NO_BT_MATCH
+    s = alloc_deflate(strm, pool, (unsigned int)windowBits, hash_bits, 1 << (memLevel + 6), 0);
+#else
+    /* Only a stream that starts at level 8 or above gets room for the binary trees */
+    s = alloc_deflate(strm, pool, (unsigned int)windowBits, hash_bits, 1 << (memLevel + 6),
+                      level >= 8);
+#endif
     if (s == NULL)
         return Z_MEM_ERROR;
-    memset(s, 0, sizeof(*s));
     strm->state = (struct internal_state *)s;
     s->strm = strm;
     s->status = INIT_STATE;     /* to pass state test in deflateReset() */
 
     s->wrap = wrap;
     s->gzhead = NULL;
-    s->w_bits = (unsigned int)windowBits;
-    s->w_size = 1 << s->w_bits;
-    s->w_mask = s->w_size - 1;
-
-#ifdef X86_PCLMULQDQ_CRC
-    window_padding = 8;
-#endif
 
-    /* Avoid use of unitialized values in the window, see crbug.com/1137613 and
-     * crbug.com/1144420 */
-    s->window = (unsigned char *) ZALLOC_WINDOW(strm, s->w_size + window_padding, 2*sizeof(unsigned char));
-
-    s->prev   = (Pos *)  ZALLOC(strm, s->w_size, sizeof(Pos));
     /* Avoid use of uninitialized value, see:
      * https://bugs.chromium.org/p/oss-fuzz/issues/detail?id=11360
      */
     memset(s->prev, 0, s->w_size * sizeof(Pos));
 
-    s->head   = (Pos *)  ZALLOC(strm, HASH_SIZE, sizeof(Pos));
-
     s->high_water = 0;      /* nothing written to s->window yet */
 
-    s->lit_bufsize = 1 << (memLevel + 6); /* 16K elements by default */
-
     /* We overlay pending_buf and sym_buf. This works since the average size
      * for length/distance pairs over any compressed block is assured to be 31
      * bits or less.
@@ -306,15 +400,6 @@ int32_t ZNG_CONDEXPORT PREFIX(deflateInit2)(PREFIX3(stream) *strm, int32_t level
      * symbols from which it is being constructed.
      */
 
-    s->pending_buf = (unsigned char *) ZALLOC(strm, s->lit_bufsize, 4);
-    s->pending_buf_size = s->lit_bufsize * 4;
-
-    if (s->window == NULL || s->prev == NULL || s->head == NULL || s->pending_buf == NULL) {
-        s->status = FINISH_STATE;
-        strm->msg = ERR_MSG(Z_MEM_ERROR);
-        PREFIX(deflateEnd)(strm);
-        return Z_MEM_ERROR;
-    }
     s->sym_buf = s->pending_buf + s->lit_bufsize;
     s->sym_end = (s->lit_bufsize - 1) * 3;
     /* We avoid equality with lit_bufsize*3 because of wraparound at 64K
@@ -330,7 +415,37 @@ int32_t ZNG_CONDEXPORT PREFIX(deflateInit2)(PREFIX3(stream) *strm, int32_t level
     return PREFIX(deflateReset)(strm);
 }
 
+/* ========================================================================= */
+/* This function is hidden in ZLIB_COMPAT builds. */
+int32_t ZNG_CONDEXPORT PREFIX(deflateInit2)(PREFIX3(stream) *strm, int32_t level, int32_t method, int32_t windowBits,
+                                            int32_t memLevel, int32_t strategy) {
+    return deflate_init(strm, level, method, windowBits, memLevel, strategy, 0, NULL);
+}
+
 #ifndef ZLIB_COMPAT
+int32_t Z_EXPORT PREFIX(deflateInitSized)(PREFIX3(stream) *strm, int32_t level, int32_t method, int32_t windowBits,
+                                          int32_t memLevel, int32_t strategy, size_t sourceLen) {
+    return deflate_init(strm, level, method, windowBits, memLevel, strategy, sourceLen, NULL);
+}
+
+PREFIX(deflate_pool) * Z_EXPORT PREFIX(deflatePoolCreate)(uint32_t maxStates) {
+    return (PREFIX(deflate_pool) *)state_pool_create(maxStates);
+}
+
+int32_t Z_EXPORT PREFIX(deflatePoolDestroy)(PREFIX(deflate_pool) *pool) {
+    if (pool == NULL)
+        return Z_STREAM_ERROR;
+    state_pool_destroy((state_pool *)pool);
+    return Z_OK;
+}
+
+int32_t Z_EXPORT PREFIX(deflateInitPool)(PREFIX3(stream) *strm, int32_t level, int32_t method, int32_t windowBits,
+                                         int32_t memLevel, int32_t strategy, PREFIX(deflate_pool) *pool) {
+    if (pool == NULL)
+        return Z_STREAM_ERROR;
+    return deflate_init(strm, level, method, windowBits, memLevel, strategy, 0, (state_pool *)pool);
+}
+
 int32_t Z_EXPORT PREFIX(deflateInit)(PREFIX3(stream) *strm, int32_t level) {
     return PREFIX(deflateInit2)(strm, level, Z_DEFLATED, MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY);
 }
@@ -442,6 +557,129 @@ int32_t Z_EXPORT PREFIX(deflateGetDictionary)(PREFIX3(stream) *strm, uint8_t *di
     return Z_OK;
 }
 
+#ifndef ZLIB_COMPAT
+/* ===========================================================================
+ * Prepared dictionary: a snapshot of the window and hash tables of a stream
+ * right after deflateSetDictionary. It is never modified after it has been
+ * built, so any number of streams can attach it at the same time.
+ */
+struct zng_dictionary_s {
+    free_func         zfree;          /* allocator that built the dictionary */
+    void              *opaque;
+    insert_string_cb  insert_string;  /* hash function the tables were built with */
+    unsigned int      w_bits;
+    unsigned int      hash_bits;
+    unsigned int      strstart;       /* number of dictionary bytes in the window */
+    unsigned int      insert;
+    unsigned int      ins_h;
+    unsigned int      bt_next;
+    uint32_t          adler;          /* Adler-32 of the whole dictionary */
+    Pos               *head;
+    Pos               *prev;
+    Pos               *bt_right;      /* NULL unless the binary trees are in use */
+    unsigned char     *window;
+};
+
+/* ========================================================================= */
+int32_t Z_EXPORT PREFIX(deflatePrepareDictionary)(PREFIX3(stream) *strm, const uint8_t *dictionary, uint32_t dictLength,
+                                                  zng_dictionary **dict) {
+    zng_dictionary *d;
+    deflate_state *s;
+    unsigned int len;
+    size_t size;
+    int32_t ret;
+
+    if (dict == NULL)
+        return Z_STREAM_ERROR;
+    *dict = NULL;
+    if (deflateStateCheck(strm) || dictionary == NULL)
+        return Z_STREAM_ERROR;
+    s = strm->state;
+    /* The snapshot must not depend on earlier input */
+    if (s->wrap == 2 || s->status != INIT_STATE || s->strstart || s->lookahead || s->insert)
+        return Z_STREAM_ERROR;
+
+    ret = PREFIX(deflateSetDictionary)(strm, dictionary, dictLength);
+    if (ret != Z_OK)
+        return ret;
+
+    len = s->strstart;
+    size = sizeof(zng_dictionary) + s->hash_size * sizeof(Pos) + len * sizeof(Pos) * (s->bt_right != NULL ? 2 : 1) + len;
+    d = (zng_dictionary *)ZALLOC(strm, 1, (unsigned)size);
+    if (d == NULL)
+        return Z_MEM_ERROR;
+
+    d->zfree = strm->zfree;
+    d->opaque = strm->opaque;
+    d->insert_string = s->insert_string;
+    d->w_bits = s->w_bits;
+    d->hash_bits = s->hash_bits;
+    d->strstart = s->strstart;
+    d->insert = s->insert;
+    d->ins_h = s->ins_h;
+    d->bt_next = s->bt_next;
+    d->adler = functable.adler32(ADLER32_INITIAL_VALUE, dictionary, dictLength);
+
+    d->head = (Pos *)(d + 1);
+    d->prev = d->head + s->hash_size;
+    d->bt_right = s->bt_right != NULL ? d->prev + len : NULL;
+    d->window = (unsigned char *)(d->prev + len * (s->bt_right != NULL ? 2 : 1));
+
+    memcpy(d->head, s->head, s->hash_size * sizeof(Pos));
+    memcpy(d->prev, s->prev, len * sizeof(Pos));
+    if (d->bt_right != NULL)
+        memcpy(d->bt_right, s->bt_right, len * sizeof(Pos));
+    memcpy(d->window, s->window, len);
+
+    *dict = d;
+    return Z_OK;
+}
+
+/* ========================================================================= */
+int32_t Z_EXPORT PREFIX(deflateSetPreparedDictionary)(PREFIX3(stream) *strm, const zng_dictionary *dict) {
+    deflate_state *s;
+    unsigned int len;
+
+    if (deflateStateCheck(strm) || dict == NULL)
+        return Z_STREAM_ERROR;
+    s = strm->state;
+    if (s->wrap == 2 || s->status != INIT_STATE || s->strstart || s->lookahead || s->insert)
+        return Z_STREAM_ERROR;
+    /* The hash tables are only valid for the same window size and hash function */
+    if (s->w_bits != dict->w_bits || s->hash_bits != dict->hash_bits || s->insert_string != dict->insert_string ||
+        (s->bt_right != NULL) != (dict->bt_right != NULL))
+        return Z_STREAM_ERROR;
+
+    if (s->wrap == 1)
+        strm->adler = dict->adler;
+
+    len = dict->strstart;
+    s->clear_lazy = 0;
+    memcpy(s->head, dict->head, s->hash_size * sizeof(Pos));
+    memcpy(s->prev, dict->prev, len * sizeof(Pos));
+    if (s->bt_right != NULL)
+        memcpy(s->bt_right, dict->bt_right, len * sizeof(Pos));
+    memcpy(s->window, dict->window, len);
+
+    s->strstart = len;
+    s->block_start = (int)len;
+    s->insert = dict->insert;
+    s->ins_h = dict->ins_h;
+    s->bt_next = dict->bt_next;
+    s->prev_length = 0;
+    s->match_available = 0;
+    return Z_OK;
+}
+
+/* ========================================================================= */
+int32_t Z_EXPORT PREFIX(deflateFreeDictionary)(zng_dictionary *dict) {
+    if (dict == NULL)
+        return Z_STREAM_ERROR;
+    dict->zfree(dict->opaque, dict);
+    return Z_OK;
+}
+#endif
+
 /* ========================================================================= */
 int32_t Z_EXPORT PREFIX(deflateResetKeep)(PREFIX3(stream) *strm) {
     deflate_state *s;
@@ -548,12 +786,12 @@ int32_t Z_EXPORT PREFIX(deflateParams)(PREFIX3(stream) *strm, int32_t level, int
 
     if (level == Z_DEFAULT_COMPRESSION)
         level = 6;
-    if (level < 0 || level > 9 || strategy < 0 || strategy > Z_FIXED)
+    if (level < Z_FASTEST_COMPRESSION || level > Z_OPTIMAL_COMPRESSION || strategy < 0 || strategy > Z_FIXED)
         return Z_STREAM_ERROR;
     DEFLATE_PARAMS_HOOK(strm, level, strategy, &hook_flush);  /* hook for IBM Z DFLTCC */
-    func = configuration_table[s->level].func;
+    func = LEVEL_CONFIG(s->level)->func;
 
-    if (((strategy != s->strategy || func != configuration_table[level].func) && s->last_flush != -2)
+    if (((strategy != s->strategy || func != LEVEL_CONFIG(level)->func) && s->last_flush != -2)
         || hook_flush != Z_NO_FLUSH) {
         /* Flush the last buffer. Use Z_BLOCK mode, unless the hook requests a "stronger" one. */
         int flush = RANK(hook_flush) > RANK(Z_BLOCK) ? hook_flush : Z_BLOCK;
@@ -564,6 +802,8 @@ int32_t Z_EXPORT PREFIX(deflateParams)(PREFIX3(stream) *strm, int32_t level, int
             return Z_BUF_ERROR;
     }
     if (s->level != level) {
+        /* deflate_stored changes the window without updating the hash table */
+        s->clear_lazy = 0;
         if (s->level == 0 && s->matches != 0) {
             if (s->matches == 1) {
                 functable.slide_hash(s);
@@ -662,7 +902,7 @@ unsigned long Z_EXPORT PREFIX(deflateBound)(PREFIX3(stream) *strm, unsigned long
 
     /* if not default parameters, return conservative bound */
     if (DEFLATE_NEED_CONSERVATIVE_BOUND(strm) ||  /* hook for IBM Z DFLTCC */
-            s->w_bits != MAX_WBITS || HASH_BITS < 15) {
+            s->w_bits != MAX_WBITS || s->hash_bits < 15) {
         if (s->level == 0) {
             /* upper bound for stored blocks with length 127 (memLevel == 1) --
                ~4% overhead plus a small constant */
@@ -812,7 +1052,7 @@ int32_t Z_EXPORT PREFIX(deflate)(PREFIX3(stream) *strm, int32_t flush) {
         if (s->gzhead == NULL) {
             put_uint32(s, 0);
             put_byte(s, 0);
-            put_byte(s, s->level == 9 ? 2 :
+            put_byte(s, s->level >= 9 ? 2 :
                      (s->strategy >= Z_HUFFMAN_ONLY || s->level < 2 ? 4 : 0));
             put_byte(s, OS_CODE);
             s->status = BUSY_STATE;
@@ -831,7 +1071,7 @@ int32_t Z_EXPORT PREFIX(deflate)(PREFIX3(stream) *strm, int32_t flush) {
                      (s->gzhead->comment == NULL ? 0 : 16)
                      );
             put_uint32(s, s->gzhead->time);
-            put_byte(s, s->level == 9 ? 2 : (s->strategy >= Z_HUFFMAN_ONLY || s->level < 2 ? 4 : 0));
+            put_byte(s, s->level >= 9 ? 2 : (s->strategy >= Z_HUFFMAN_ONLY || s->level < 2 ? 4 : 0));
             put_byte(s, s->gzhead->os & 0xff);
             if (s->gzhead->extra != NULL)
                 put_short(s, (uint16_t)s->gzhead->extra_len);
@@ -944,7 +1184,8 @@ int32_t Z_EXPORT PREFIX(deflate)(PREFIX3(stream) *strm, int32_t flush) {
                  s->level == 0 ? deflate_stored(s, flush) :
                  s->strategy == Z_HUFFMAN_ONLY ? deflate_huff(s, flush) :
                  s->strategy == Z_RLE ? deflate_rle(s, flush) :
-                 (*(configuration_table[s->level].func))(s, flush);
+                 s->strategy != Z_FIXED ? deflate_sampled(s, flush, LEVEL_CONFIG(s->level)->func) :
+                 (*(LEVEL_CONFIG(s->level)->func))(s, flush);
 
         if (bstate == finish_started || bstate == finish_done) {
             s->status = FINISH_STATE;
@@ -1025,13 +1266,12 @@ int32_t Z_EXPORT PREFIX(deflateEnd)(PREFIX3(stream) *strm) {
 
     status = strm->state->status;
 
-    /* Deallocate in reverse order of allocations: */
-    TRY_FREE(strm, strm->state->pending_buf);
-    TRY_FREE(strm, strm->state->head);
-    TRY_FREE(strm, strm->state->prev);
-    TRY_FREE_WINDOW(strm, strm->state->window);
-
-    ZFREE_STATE(strm, strm->state);
+    /* Deallocate in reverse order of allocations, the state holds the window and tables */
+    TRY_FREE(strm, strm->state->opt_state);
+    if (strm->state->pool != NULL)
+        state_pool_put(strm->state);
+    else
+        ZFREE(strm, strm->state);
     strm->state = NULL;
 
     return status == BUSY_STATE ? Z_DATA_ERROR : Z_OK;
@@ -1043,7 +1283,9 @@ int32_t Z_EXPORT PREFIX(deflateEnd)(PREFIX3(stream) *strm) {
 int32_t Z_EXPORT PREFIX(deflateCopy)(PREFIX3(stream) *dest, PREFIX3(stream) *source) {
     deflate_state *ds;
     deflate_state *ss;
-    uint32_t window_padding = 0;
+    unsigned char *window;
+    unsigned char *pending_buf;
+    Pos *prev, *head, *bt_space;
 
     if (deflateStateCheck(source) || dest == NULL)
         return Z_STREAM_ERROR;
@@ -1052,31 +1294,33 @@ int32_t Z_EXPORT PREFIX(deflateCopy)(PREFIX3(stream) *dest, PREFIX3(stream) *sou
 
     memcpy((void *)dest, (void *)source, sizeof(PREFIX3(stream)));
 
-    ds = ZALLOC_DEFLATE_STATE(dest);
+    ds = alloc_deflate(dest, NULL, ss->w_bits, ss->hash_bits, ss->lit_bufsize, ss->bt_space != NULL);
     if (ds == NULL)
         return Z_MEM_ERROR;
-    memset(ds, 0, sizeof(*ds));
+    window = ds->window;
+    pending_buf = ds->pending_buf;
+    prev = ds->prev;
+    head = ds->head;
+    bt_space = ds->bt_space;
+
     dest->state = (struct internal_state *) ds;
     ZCOPY_DEFLATE_STATE(ds, ss);
     ds->strm = dest;
-
-#ifdef X86_PCLMULQDQ_CRC
-    window_padding = 8;
-#endif
-
-    ds->window = (unsigned char *) ZALLOC_WINDOW(dest, ds->w_size + window_padding, 2*sizeof(unsigned char));
-    ds->prev   = (Pos *)  ZALLOC(dest, ds->w_size, sizeof(Pos));
-    ds->head   = (Pos *)  ZALLOC(dest, HASH_SIZE, sizeof(Pos));
-    ds->pending_buf = (unsigned char *) ZALLOC(dest, ds->lit_bufsize, 4);
-
-    if (ds->window == NULL || ds->prev == NULL || ds->head == NULL || ds->pending_buf == NULL) {
-        PREFIX(deflateEnd)(dest);
-        return Z_MEM_ERROR;
-    }
+    ds->pool = NULL;
+    ds->opt_state = NULL;
+    ds->bt_space = bt_space;
+    ds->bt_right = ss->bt_right != NULL ? bt_space : NULL;
+    ds->window = window;
+    ds->pending_buf = pending_buf;
+    ds->prev = prev;
+    ds->head = head;
+
+    if (ss->bt_right != NULL)
+        memcpy((void *)ds->bt_right, (void *)ss->bt_right, ds->w_size * sizeof(Pos));
 
     memcpy(ds->window, ss->window, ds->w_size * 2 * sizeof(unsigned char));
     memcpy((void *)ds->prev, (void *)ss->prev, ds->w_size * sizeof(Pos));
-    memcpy((void *)ds->head, (void *)ss->head, HASH_SIZE * sizeof(Pos));
+    memcpy((void *)ds->head, (void *)ss->head, ds->hash_size * sizeof(Pos));
     memcpy(ds->pending_buf, ss->pending_buf, ds->pending_buf_size);
 
     ds->pending_out = ds->pending_buf + (ss->pending_out - ss->pending_buf);
@@ -1124,22 +1368,52 @@ Z_INTERNAL unsigned PREFIX(read_buf)(PREFIX3(stream) *strm, unsigned char *buf,
  * Set longest match variables based on level configuration
  */
 static void lm_set_level(deflate_state *s, int level) {
-    s->max_lazy_match   = configuration_table[level].max_lazy;
-    s->good_match       = configuration_table[level].good_length;
-    s->nice_match       = configuration_table[level].nice_length;
-    s->max_chain_length = configuration_table[level].max_chain;
+    const config *c = LEVEL_CONFIG(level);
+
+    s->max_lazy_match   = c->max_lazy;
+    s->good_match       = c->good_length;
+    s->nice_match       = c->nice_length;
+    s->max_chain_length = c->max_chain;
+
+#ifndef NO_BT_MATCH
+    /* Level 10 replaces the hash chains by binary trees, which bound the search at
+     * every position on data where the chains get long. Levels 8 and 9 start with the
+     * hash chains and only move to the trees when they get long, see deflate_slow().
+     * The two cannot be mixed, so the history is dropped when changing the level
+     * between them. A stream that did not start at level 8 or above has no room for
+     * the trees and keeps the hash chains. */
+    if (level == Z_OPTIMAL_COMPRESSION && s->bt_space != NULL) {
+        if (s->bt_right == NULL) {
+            s->bt_right = s->bt_space;
+            CLEAR_HASH(s);
+        }
+    } else if (s->bt_right != NULL) {
+        s->bt_right = NULL;
+        CLEAR_HASH(s);
+    }
+#endif
 
     /* Use rolling hash for deflate_slow algorithm with level 9. It allows us to
      * properly lookup different hash chains to speed up longest_match search. Since hashing
-     * method changes depending on the level we cannot put this into functable. */
-    if (s->max_chain_length > 1024) {
+     * method changes depending on the level we cannot put this into functable. The binary
+     * trees search while inserting, so they replace the insert functions as well. */
+    if (s->bt_right != NULL) {
+        s->update_hash = functable.update_hash;
+        s->insert_string = &insert_string_bt;
+        s->quick_insert_string = &quick_insert_string_bt;
+        s->clear_string = NULL;
+    } else if (s->max_chain_length > 1024) {
         s->update_hash = &update_hash_roll;
         s->insert_string = &insert_string_roll;
         s->quick_insert_string = &quick_insert_string_roll;
+        s->clear_string = NULL;
     } else {
+        if (s->insert_string != functable.insert_string)
+            s->clear_lazy = 0;  /* the table may hold strings hashed differently */
         s->update_hash = functable.update_hash;
         s->insert_string = functable.insert_string;
         s->quick_insert_string = functable.quick_insert_string;
+        s->clear_string = functable.clear_string;
     }
 
     s->level = level;
@@ -1165,8 +1439,32 @@ static void lm_init(deflate_state *s) {
     s->match_available = 0;
     s->match_start = 0;
     s->ins_h = 0;
+    s->sample_bypass = 0;
+    s->sample_left = 0;
+    s->quick_misses = 0;
+    s->chain_steps = 0;
 }
 
+#ifndef NO_BT_MATCH
+/* ===========================================================================
+ * Move levels 8 and 9 from the hash chains to the binary trees. The strings that
+ * matches can still reach are inserted in the trees again, so that no history
+ * is lost.
+ */
+void Z_INTERNAL PREFIX(bt_switch)(deflate_state *s) {
+    uint32_t start = s->strstart > MAX_DIST(s) ? s->strstart - MAX_DIST(s) : 0;
+
+    Assert(s->bt_space != NULL && s->bt_right == NULL, "no room for the trees");
+    s->bt_right = s->bt_space;
+    CLEAR_HASH(s);
+    s->update_hash = functable.update_hash;
+    s->insert_string = &insert_string_bt;
+    s->quick_insert_string = &quick_insert_string_bt;
+    s->clear_string = NULL;
+    insert_string_bt(s, start, s->strstart - start);
+}
+#endif
+
 /* ===========================================================================
  * Fill the window when the lookahead becomes insufficient.
  * Updates strstart and lookahead.
@@ -1204,11 +1502,20 @@ void Z_INTERNAL PREFIX(fill_window)(deflate_state *s) {
             if (s->insert > s->strstart)
                 s->insert = s->strstart;
             functable.slide_hash(s);
+            if (s->bt_right != NULL)
+                slide_hash_bt(s);
+            s->clear_lazy = 0;
+            s->chain_steps = 0;
             more += wsize;
         }
         if (s->strm->avail_in == 0)
             break;
 
+        /* The last strings inserted may have been hashed with the bytes that are
+         * about to be overwritten */
+        if (s->strstart + s->lookahead > 0)
+            s->clear_lazy = 0;
+
         /* If there was no sliding:
          *    strstart <= WSIZE+MAX_DIST-1 && lookahead <= MIN_LOOKAHEAD - 1 &&
          *    more == window_size - lookahead - strstart
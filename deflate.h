@@ -73,6 +73,7 @@
 #  define HASH_SIZE 65536u         /* number of elements in hash table */
 #endif
 #define HASH_MASK (HASH_SIZE - 1u) /* HASH_SIZE-1 */
+#define MIN_HASH_BITS 9u           /* smallest hash table chosen for a short input */
 
 
 /* Data structure describing a single value and its code string. */
@@ -114,6 +115,7 @@ typedef Pos      (* quick_insert_string_cb)(deflate_state *const s, uint32_t str
 
 struct internal_state {
     PREFIX3(stream)      *strm;            /* pointer back to this zlib stream */
+    struct state_pool_s  *pool;            /* pool the state was taken from, or NULL */
     unsigned char        *pending_buf;     /* output still pending */
     unsigned char        *pending_out;     /* next pending byte to output to the stream */
     uint32_t             pending_buf_size; /* size of pending_buf */
@@ -167,6 +169,28 @@ struct internal_state {
 
     Pos *head; /* Heads of the hash chains or 0. */
 
+    unsigned int  hash_bits;         /* log2(hash_size) */
+    unsigned int  hash_size;         /* number of elements in hash table, at most HASH_SIZE */
+    unsigned int  hash_mask;         /* hash_size-1 */
+
+    int clear_lazy;
+    /* Nonzero while every string in head starts in window[0..strstart+lookahead)
+     * and the window has not changed since the string was inserted, so that the
+     * table can be cleared by hashing those strings again instead of clearing
+     * all of it.
+     */
+
+    Pos *bt_right;
+    /* Right subtree links of the binary tree match finder used by level 10, and by
+     * levels 8 and 9 once the hash chains get long, which keeps the left subtree
+     * links in prev and the tree roots in head. NULL while the hash chains are in use.
+     */
+    Pos *bt_space;                   /* room for bt_right in the arena, NULL if the stream has none */
+    unsigned int bt_next;            /* strings before this one are already in the trees */
+    unsigned int bt_match_length;    /* longest match found by the last insertion */
+    unsigned int bt_match_start;
+    unsigned int chain_steps;        /* hash chain links followed by longest_match since the last slide */
+
     uint32_t ins_h; /* hash index of string to be inserted */
 
     int block_start;
@@ -185,6 +209,10 @@ struct internal_state {
      * are discarded. This is used in the lazy match evaluation.
      */
 
+    int          sample_bypass;      /* set if matches are not looked for in the current span */
+    unsigned int sample_left;        /* input bytes left in the span, see deflate_sampled() */
+    unsigned int quick_misses;       /* probes without a match at Z_FASTEST_COMPRESSION, see quick_dynamic() */
+
     unsigned int max_chain_length;
     /* To speed up deflation, hash chains are never searched beyond this length.
      * A higher limit improves compression ratio but degrades the speed.
@@ -203,10 +231,12 @@ struct internal_state {
     update_hash_cb          update_hash;
     insert_string_cb        insert_string;
     quick_insert_string_cb  quick_insert_string;
+    insert_string_cb        clear_string;
     /* Hash function callbacks that can be configured depending on the deflate
-     * algorithm being used */
+     * algorithm being used. clear_string is NULL if the strings cannot be hashed
+     * again to clear their entries */
 
-    int level;    /* compression level (1..9) */
+    int level;    /* compression level (-2..10) */
     int strategy; /* favor or force Huffman coding*/
 
     unsigned int good_match;
@@ -233,18 +263,24 @@ struct internal_state {
     struct tree_desc_s d_desc;               /* desc. for distance tree */
     struct tree_desc_s bl_desc;              /* desc. for bit length tree */
 
+    struct ct_data_s prev_ltree[L_CODES+1];  /* trees of the last dynamic block, */
+    struct ct_data_s prev_dtree[D_CODES+1];  /* kept to send later blocks with */
+    struct ct_data_s prev_bl_tree[BL_CODES];
+    int prev_lcodes;                         /* number of codes sent for each of */
+    int prev_dcodes;                         /* them, prev_lcodes is 0 if there */
+    int prev_blcodes;                        /* are no trees to reuse */
+    unsigned long prev_tree_len;             /* bit length of their representation */
+    unsigned int prev_est_scale;             /* bit length of that block over its estimate, in 1/256 */
+
     uint16_t bl_count[MAX_BITS+1];
     /* number of codes at each bit length for an optimal tree */
 
-    int heap[2*L_CODES+1];      /* heap used to build the Huffman trees */
-    int heap_len;               /* number of elements in the heap */
-    int heap_max;               /* element of largest frequency */
-    /* The sons of heap[n] are heap[2*n] and heap[2*n+1]. heap[0] is not used.
-     * The same heap array is used to build all trees.
-     */
-
-    unsigned char depth[2*L_CODES+1];
-    /* Depth of each subtree used as tie breaker for trees of equal frequency
+    int heap[2*L_CODES+1];      /* nodes used to build the Huffman trees */
+    int heap_len;               /* number of leaves */
+    int heap_max;               /* node of largest frequency */
+    /* The leaves are gathered in heap[1..heap_len], and the nodes of the tree
+     * are kept in heap[heap_max..] by increasing frequency. heap[0] is not
+     * used. The same heap array is used to build all trees.
      */
 
     unsigned int  lit_bufsize;
@@ -280,6 +316,9 @@ struct internal_state {
     unsigned long compressed_len; /* total bit length of compressed file mod 2^32 */
     unsigned long bits_sent;      /* bit length of compressed data sent mod 2^32 */
 
+    struct opt_state_s *opt_state;
+    /* Scratch space of the optimal parser, allocated on first use by deflate_optimal */
+
     /* Reserved for future use and alignment purposes */
     char *reserved_p;
 
@@ -383,14 +422,23 @@ static inline void put_uint64(deflate_state *s, uint64_t lld) {
 
 
 void Z_INTERNAL PREFIX(fill_window)(deflate_state *s);
+void Z_INTERNAL PREFIX(bt_switch)(deflate_state *s);
 void Z_INTERNAL slide_hash_c(deflate_state *s);
 
+        /* in insert_string_bt.c */
+void     Z_INTERNAL insert_string_bt(deflate_state *const s, uint32_t str, uint32_t count);
+Pos      Z_INTERNAL quick_insert_string_bt(deflate_state *const s, uint32_t str);
+uint32_t Z_INTERNAL longest_match_bt(deflate_state *const s, Pos cur_match);
+void     Z_INTERNAL slide_hash_bt(deflate_state *s);
+
         /* in trees.c */
 void Z_INTERNAL zng_tr_init(deflate_state *s);
 void Z_INTERNAL zng_tr_flush_block(deflate_state *s, char *buf, uint32_t stored_len, int last);
 void Z_INTERNAL zng_tr_flush_bits(deflate_state *s);
 void Z_INTERNAL zng_tr_align(deflate_state *s);
 void Z_INTERNAL zng_tr_stored_block(deflate_state *s, char *buf, uint32_t stored_len, int last);
+void Z_INTERNAL zng_tr_symbol_costs(deflate_state *s, const uint16_t *lfreq, const uint16_t *dfreq,
+                                    uint8_t *lcost, uint8_t *dcost);
 uint16_t Z_INTERNAL PREFIX(bi_reverse)(unsigned code, int len);
 void Z_INTERNAL PREFIX(flush_pending)(PREFIX3(streamp) strm);
 #define d_code(dist) ((dist) < 256 ? zng_dist_code[dist] : zng_dist_code[256+((dist)>>7)])
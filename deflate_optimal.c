@@ -0,0 +1,299 @@
+/* deflate_optimal.c -- compress data using optimal parsing
+ *
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * Instead of choosing matches greedily or with one step of lazy evaluation,
+ * the input is parsed in segments. The longest match is searched at every
+ * position of a segment using the regular longest_match kernel, after which
+ * the sequence of literals and matches with the lowest total cost in bits is
+ * found with a shortest path search over the segment. Every match found also
+ * allows all shorter lengths at the same distance.
+ *
+ * The cost of each symbol is derived from Huffman code lengths built by
+ * trees.c. The first pass uses the statistics of the block so far (or the
+ * static trees for a new block), further passes use the statistics of the
+ * previous parse, which makes the parse converge towards the trees that will
+ * actually be emitted for the block.
+ */
+
+#include "zbuild.h"
+#include "zutil.h"
+#include "deflate.h"
+#include "deflate_p.h"
+#include "functable.h"
+
+#define OPT_SEGMENT   4096    /* largest number of positions parsed at once */
+#define OPT_PASSES    3       /* number of shortest path searches per segment */
+#define OPT_COST_INF  0xffffffffu
+
+/* The per position arrays follow the structure in the same allocation. A segment
+ * never holds more positions than the symbol buffer, so they are sized for the
+ * smaller of the two. */
+struct opt_state_s {
+    uint32_t segment;                   /* number of positions parsed at once */
+    uint32_t *cost;                     /* [segment+1] lowest cost to reach each position of the segment */
+    uint16_t *step_len;                 /* [segment+1] length of the last step on the cheapest path, 1 for a literal */
+    uint16_t *step_dist;                /* [segment+1] distance of the last step on the cheapest path */
+    uint16_t *match_len;                /* [segment] longest match at each position, reused for the final sequence */
+    uint16_t *match_dist;               /* [segment] */
+    uint16_t lfreq[L_CODES];            /* trial frequencies of the last parse */
+    uint16_t dfreq[D_CODES];
+    uint8_t  lit_cost[LITERALS];
+    uint8_t  len_cost[STD_MAX_MATCH+1];
+    uint8_t  dist_cost[D_CODES];
+};
+
+typedef struct opt_state_s opt_state;
+
+Z_INTERNAL block_state deflate_slow(deflate_state *s, int flush);
+
+/* ===========================================================================
+ * Set up the cost model from the given frequencies, or the static trees if lfreq is NULL.
+ */
+static void opt_set_costs(deflate_state *s, opt_state *opt, const uint16_t *lfreq, const uint16_t *dfreq) {
+    uint8_t lcost[L_CODES];
+    uint32_t n;
+
+    zng_tr_symbol_costs(s, lfreq, dfreq, lcost, opt->dist_cost);
+
+    for (n = 0; n < LITERALS; n++)
+        opt->lit_cost[n] = lcost[n];
+    for (n = STD_MIN_MATCH; n <= STD_MAX_MATCH; n++)
+        opt->len_cost[n] = lcost[zng_length_code[n - STD_MIN_MATCH] + LITERALS + 1];
+}
+
+/* ===========================================================================
+ * Insert every position of the segment into the hash table and store the
+ * longest match found at each of them, limited to the end of the segment.
+ */
+static void opt_find_matches(deflate_state *s, opt_state *opt, uint32_t count, match_func longest_match) {
+    unsigned int start = s->strstart;
+    unsigned int lookahead = s->lookahead;
+    uint32_t i;
+
+    /* Every match of at least STD_MIN_MATCH bytes is of interest */
+    s->prev_length = STD_MIN_MATCH - 1;
+
+    for (i = 0; i < count; i++) {
+        Pos hash_head = 0;
+        uint32_t match_len = 0;
+        int64_t dist;
+
+        /* longest_match searches from strstart and is limited by lookahead */
+        s->strstart = start + i;
+        s->lookahead = lookahead - i;
+
+        if (LIKELY(s->lookahead >= WANT_MIN_MATCH))
+            hash_head = s->quick_insert_string(s, s->strstart);
+
+        dist = (int64_t)s->strstart - hash_head;
+        if (dist <= MAX_DIST(s) && dist > 0 && hash_head != 0) {
+            match_len = longest_match(s, hash_head);
+            if (match_len < STD_MIN_MATCH || (match_len <= 5 && s->strategy == Z_FILTERED))
+                match_len = 0;
+            match_len = MIN(match_len, count - i);
+            if (match_len < STD_MIN_MATCH)
+                match_len = 0;
+        }
+        opt->match_len[i] = (uint16_t)match_len;
+        opt->match_dist[i] = match_len ? (uint16_t)(s->strstart - s->match_start) : 0;
+    }
+
+    s->strstart = start;
+    s->lookahead = lookahead;
+}
+
+/* ===========================================================================
+ * Find the cheapest sequence of literals and matches covering the segment.
+ */
+static void opt_shortest_path(opt_state *opt, const unsigned char *window, uint32_t count) {
+    uint32_t *cost = opt->cost;
+    uint32_t i, len;
+
+    cost[0] = 0;
+    for (i = 1; i <= count; i++)
+        cost[i] = OPT_COST_INF;
+
+    for (i = 0; i < count; i++) {
+        uint32_t base = cost[i];
+        uint32_t lit = base + opt->lit_cost[window[i]];
+        uint32_t match_len = opt->match_len[i];
+
+        if (lit < cost[i+1]) {
+            cost[i+1] = lit;
+            opt->step_len[i+1] = 1;
+            opt->step_dist[i+1] = 0;
+        }
+        if (match_len) {
+            uint32_t dist = opt->match_dist[i];
+            uint32_t dist_base = base + opt->dist_cost[d_code(dist - 1)];
+
+            for (len = STD_MIN_MATCH; len <= match_len; len++) {
+                uint32_t c = dist_base + opt->len_cost[len];
+                if (c < cost[i+len]) {
+                    cost[i+len] = c;
+                    opt->step_len[i+len] = (uint16_t)len;
+                    opt->step_dist[i+len] = (uint16_t)dist;
+                }
+            }
+        }
+    }
+}
+
+/* ===========================================================================
+ * Copy the symbol frequencies of the current block.
+ */
+static void opt_block_freqs(deflate_state *s, opt_state *opt) {
+    int n;
+
+    for (n = 0; n < L_CODES; n++)
+        opt->lfreq[n] = s->dyn_ltree[n].Freq;
+    for (n = 0; n < D_CODES; n++)
+        opt->dfreq[n] = s->dyn_dtree[n].Freq;
+}
+
+/* ===========================================================================
+ * Count the symbols of the cheapest path on top of the frequencies of the current block.
+ */
+static void opt_path_freqs(deflate_state *s, opt_state *opt, const unsigned char *window, uint32_t count) {
+    uint32_t i = count;
+
+    opt_block_freqs(s, opt);
+
+    while (i > 0) {
+        uint32_t len = opt->step_len[i];
+        i -= len;
+        if (len == 1) {
+            opt->lfreq[window[i]]++;
+        } else {
+            opt->lfreq[zng_length_code[len - STD_MIN_MATCH] + LITERALS + 1]++;
+            opt->dfreq[d_code(opt->step_dist[i + len] - 1)]++;
+        }
+    }
+}
+
+/* ===========================================================================
+ * Parse one segment of count positions starting at strstart and tally the result.
+ * IN assertion: the symbol buffer has room for count symbols.
+ */
+static void opt_segment(deflate_state *s, opt_state *opt, uint32_t count, match_func longest_match) {
+    const unsigned char *window = s->window + s->strstart;
+    uint32_t pass, i, steps;
+
+    opt_find_matches(s, opt, count, longest_match);
+
+    if (s->sym_next == 0) {
+        opt_set_costs(s, opt, NULL, NULL);
+    } else {
+        opt_block_freqs(s, opt);
+        opt_set_costs(s, opt, opt->lfreq, opt->dfreq);
+    }
+
+    for (pass = 0; pass < OPT_PASSES; pass++) {
+        if (pass > 0) {
+            opt_path_freqs(s, opt, window, count);
+            opt_set_costs(s, opt, opt->lfreq, opt->dfreq);
+        }
+        opt_shortest_path(opt, window, count);
+    }
+
+    /* Collect the steps of the cheapest path backwards, the match arrays are no longer needed */
+    steps = 0;
+    for (i = count; i > 0; i -= opt->step_len[i]) {
+        opt->match_len[steps] = opt->step_len[i];
+        opt->match_dist[steps] = opt->step_dist[i];
+        steps++;
+    }
+
+    while (steps > 0) {
+        uint32_t len, dist;
+
+        steps--;
+        len = opt->match_len[steps];
+        dist = opt->match_dist[steps];
+        if (len == 1) {
+            zng_tr_tally_lit(s, s->window[s->strstart]);
+        } else {
+            check_match(s, s->strstart, s->strstart - dist, len);
+            zng_tr_tally_dist(s, dist, len - STD_MIN_MATCH);
+        }
+        s->strstart += len;
+        s->lookahead -= len;
+    }
+}
+
+/* ===========================================================================
+ * Compress as much as possible from the input stream using optimal parsing.
+ * Falls back to deflate_slow if the scratch space cannot be allocated.
+ */
+Z_INTERNAL block_state deflate_optimal(deflate_state *s, int flush) {
+    opt_state *opt = s->opt_state;
+    match_func longest_match;
+    uint32_t count;
+
+    if (UNLIKELY(opt == NULL)) {
+        uint32_t segment = MIN(OPT_SEGMENT, s->lit_bufsize);
+
+        opt = (opt_state *)ZALLOC(s->strm, 1, sizeof(opt_state) + (segment + 1) * (sizeof(uint32_t) + 2 * sizeof(uint16_t)) +
+                                              segment * 2 * sizeof(uint16_t));
+        if (opt == NULL)
+            return deflate_slow(s, flush);
+        opt->segment = segment;
+        opt->cost = (uint32_t *)(opt + 1);
+        opt->step_len = (uint16_t *)(opt->cost + segment + 1);
+        opt->step_dist = opt->step_len + segment + 1;
+        opt->match_len = opt->step_dist + segment + 1;
+        opt->match_dist = opt->match_len + segment;
+        s->opt_state = opt;
+    }
+
+    if (s->bt_right != NULL)
+        longest_match = &longest_match_bt;
+    else if (s->max_chain_length <= 1024)
+        longest_match = functable.longest_match;
+    else
+        longest_match = functable.longest_match_slow;
+
+    for (;;) {
+        /* Make sure that we always have enough lookahead, except
+         * at the end of the input file. Positions at the end of the
+         * lookahead are only parsed when flushing, so that matches
+         * are not cut short.
+         */
+        if (s->lookahead < MIN_LOOKAHEAD) {
+            PREFIX(fill_window)(s);
+            if (UNLIKELY(s->lookahead < MIN_LOOKAHEAD && flush == Z_NO_FLUSH)) {
+                return need_more;
+            }
+            if (UNLIKELY(s->lookahead == 0))
+                break; /* flush the current block */
+        }
+
+        if (s->lookahead >= MIN_LOOKAHEAD)
+            count = s->lookahead - MIN_LOOKAHEAD + 1;
+        else
+            count = s->lookahead;
+        count = MIN(count, opt->segment);
+        count = MIN(count, s->sym_end / 3);
+
+        /* longest_match needs MIN_LOOKAHEAD bytes of window after every position searched,
+         * the rest of the lookahead is parsed after fill_window() has slid the window */
+        Assert(s->strstart <= s->window_size - MIN_LOOKAHEAD, "need lookahead");
+        count = MIN(count, s->window_size - MIN_LOOKAHEAD - s->strstart + 1);
+
+        /* The whole segment must fit into the symbol buffer */
+        if ((s->sym_end - s->sym_next) / 3 < count)
+            FLUSH_BLOCK(s, 0);
+
+        opt_segment(s, opt, count, longest_match);
+    }
+    Assert(flush != Z_NO_FLUSH, "no flush?");
+    s->insert = s->strstart < (STD_MIN_MATCH - 1) ? s->strstart : (STD_MIN_MATCH - 1);
+    if (UNLIKELY(flush == Z_FINISH)) {
+        FLUSH_BLOCK(s, 1);
+        return finish_done;
+    }
+    if (UNLIKELY(s->sym_next))
+        FLUSH_BLOCK(s, 0);
+    return block_done;
+}
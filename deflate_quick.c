@@ -44,11 +44,134 @@ extern const ct_data static_dtree[D_CODES];
     } \
 }
 
+/* After this many misses in a row the step between probes grows by one */
+#define QUICK_SKIP_TRIGGER 5
+
+/* ===========================================================================
+ * Same matching as deflate_quick(), but the symbols are recorded in sym_buf
+ * like deflate_fast() does, so that each block is sent with the trees that
+ * suit it, or with the trees of the previous block when they still fit.
+ * Used for all strategies but Z_FIXED.
+ *
+ * If accel is not 0, the positions between probes are skipped without being
+ * hashed, as LZ4 does: the step starts at one and grows by one for every
+ * 2^QUICK_SKIP_TRIGGER misses since the last match, which are counted across
+ * deflate() calls in s->quick_misses. A match that is found is first
+ * extended back over the skipped positions, which are then sent as literals.
+ * Data that does not compress is then only probed every few bytes, while the
+ * matches in data that does lose little of their length.
+ */
+static inline block_state quick_dynamic(deflate_state *s, int flush, unsigned accel) {
+    Pos hash_head;
+    int64_t dist;
+    unsigned match_len, ahead, step;
+    uint32_t pos;
+    int bflush;
+
+    for (;;) {
+        if (UNLIKELY(s->lookahead < MIN_LOOKAHEAD)) {
+            PREFIX(fill_window)(s);
+            if (UNLIKELY(s->lookahead < MIN_LOOKAHEAD && flush == Z_NO_FLUSH)) {
+                return need_more;
+            }
+            if (UNLIKELY(s->lookahead == 0))
+                break; /* flush the current block */
+        }
+
+        if (LIKELY(s->lookahead >= WANT_MIN_MATCH)) {
+            /* probe at strstart, then further on while there is lookahead for it */
+            ahead = 0;
+            for (;;) {
+                pos = s->strstart + ahead;
+                hash_head = functable.quick_insert_string(s, pos);
+                dist = (int64_t)pos - hash_head;
+                match_len = 0;
+
+                if (dist <= MAX_DIST(s) && dist > 0) {
+                    const uint8_t *str_start = s->window + pos;
+                    const uint8_t *match_start = s->window + hash_head;
+
+                    if (zng_memcmp_2(str_start, match_start) == 0)
+                        match_len = functable.compare256(str_start+2, match_start+2) + 2;
+                }
+                if (match_len >= WANT_MIN_MATCH || !accel)
+                    break;
+                step = 1 + (s->quick_misses++ >> QUICK_SKIP_TRIGGER);
+                if (ahead + step + MIN_LOOKAHEAD > s->lookahead)
+                    break;
+                ahead += step;
+            }
+
+            if (match_len >= WANT_MIN_MATCH) {
+                if (UNLIKELY(match_len > s->lookahead - ahead))
+                    match_len = s->lookahead - ahead;
+                if (UNLIKELY(match_len > STD_MAX_MATCH))
+                    match_len = STD_MAX_MATCH;
+                while (ahead && hash_head > 0 && match_len < STD_MAX_MATCH &&
+                       s->window[pos - 1] == s->window[hash_head - 1]) {
+                    ahead--;
+                    pos--;
+                    hash_head--;
+                    match_len++;
+                }
+            } else {
+                match_len = 0;
+                ahead++;
+            }
+
+            for (; ahead; ahead--) {
+                bflush = zng_tr_tally_lit(s, s->window[s->strstart]);
+                s->strstart++;
+                s->lookahead--;
+                if (UNLIKELY(bflush))
+                    FLUSH_BLOCK(s, 0);
+            }
+
+            if (match_len) {
+                check_match(s, s->strstart, hash_head, match_len);
+
+                bflush = zng_tr_tally_dist(s, (uint32_t)dist, match_len - STD_MIN_MATCH);
+                s->lookahead -= match_len;
+                s->strstart += match_len;
+                s->quick_misses = 0;
+                if (UNLIKELY(bflush))
+                    FLUSH_BLOCK(s, 0);
+            }
+            continue;
+        }
+
+        bflush = zng_tr_tally_lit(s, s->window[s->strstart]);
+        s->strstart++;
+        s->lookahead--;
+        if (UNLIKELY(bflush))
+            FLUSH_BLOCK(s, 0);
+    }
+
+    s->insert = s->strstart < (STD_MIN_MATCH - 1) ? s->strstart : (STD_MIN_MATCH - 1);
+    if (UNLIKELY(flush == Z_FINISH)) {
+        FLUSH_BLOCK(s, 1);
+        return finish_done;
+    }
+    if (UNLIKELY(s->sym_next))
+        FLUSH_BLOCK(s, 0);
+    return block_done;
+}
+
+/* ===========================================================================
+ * Used for Z_FASTEST_COMPRESSION, which probes fewer positions the longer no
+ * match is found. Z_FIXED is left to zng_tr_flush_block().
+ */
+Z_INTERNAL block_state deflate_quick_accel(deflate_state *s, int flush) {
+    return quick_dynamic(s, flush, 1);
+}
+
 Z_INTERNAL block_state deflate_quick(deflate_state *s, int flush) {
     Pos hash_head;
     int64_t dist;
     unsigned match_len, last;
 
+    if (s->strategy != Z_FIXED)
+        return quick_dynamic(s, flush, 0);
 
     last = (flush == Z_FINISH) ? 1 : 0;
     if (UNLIKELY(last && s->block_open != 2)) {
@@ -0,0 +1,110 @@
+/* deflate_sample.c -- skip the match search on input that does not compress
+ *
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * Data that is compressed or encrypted already has its bytes spread evenly
+ * over all 256 values, and gives few matches, which zng_tr_flush_block() then
+ * drops for a stored block anyway. The input is therefore taken in spans, and
+ * a sparse sample of each span is counted before it is compressed. Spans that
+ * look like such data are sent with deflate_huff(), which does not look for
+ * matches, and the compression function of the level takes over again at the
+ * first span that looks compressible.
+ */
+
+#include "zbuild.h"
+#include "deflate.h"
+#include "deflate_p.h"
+
+Z_INTERNAL block_state deflate_huff(deflate_state *s, int flush);
+
+#define SAMPLE_SPAN     (64 * 1024)  /* input bytes decided on at once */
+#define SAMPLE_MIN      4096         /* fewer input bytes than this are not sampled */
+#define SAMPLE_COUNT    2048         /* bytes counted in each span */
+
+/* Spans whose sample is spread as evenly as over this many byte values or more
+ * are taken as incompressible. The samples of random data give about 256, and
+ * those of JPEG images about 245. Text gives less than 20, object code less
+ * than 150, and a PDF file with compressed streams among its text about 210.
+ */
+#define SAMPLE_ALPHABET 230
+
+/* ===========================================================================
+ * Count a sparse sample of len bytes of buf, and return whether the bytes are
+ * spread over SAMPLE_ALPHABET values or more. n^2 / sum(count^2) is the
+ * number of values that the sample is spread over as evenly, which is
+ * corrected for the size of the sample by taking n * (n - 1) / (sum(count^2) - n)
+ * instead.
+ */
+static int sample_incompressible(const uint8_t *buf, uint32_t len) {
+    uint32_t count[256];
+    uint32_t stride = MAX(len / SAMPLE_COUNT, 1);
+    uint32_t n = 0, i;
+    uint64_t squares = 0;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < len; i += stride) {
+        count[buf[i]]++;
+        n++;
+    }
+    for (i = 0; i < 256; i++)
+        squares += (uint64_t)count[i] * count[i];
+    return (uint64_t)n * (n - 1) >= SAMPLE_ALPHABET * (squares - n);
+}
+
+/* ===========================================================================
+ * Send the literal that the lazy evaluation of deflate_slow() holds back, so
+ * that deflate_huff() can carry on from strstart. Returns 0 if that would fill
+ * the symbol buffer, in which case the switch waits for the next span.
+ */
+static int sample_end_lazy(deflate_state *s) {
+    if (s->match_available) {
+        if (s->sym_end - s->sym_next <= 3)
+            return 0;
+        (void) zng_tr_tally_lit(s, s->window[s->strstart-1]);
+        s->match_available = 0;
+    }
+    s->prev_length = 0;
+    return 1;
+}
+
+/* ===========================================================================
+ * Compress with func, or with deflate_huff() on the spans of input whose
+ * sample looks incompressible. Input that comes in pieces smaller than
+ * SAMPLE_MIN is compressed the way the last span was. Both functions record
+ * their symbols in the same block, so that switching between them needs no
+ * flush.
+ */
+Z_INTERNAL block_state deflate_sampled(deflate_state *s, int flush, compress_func func) {
+    PREFIX3(stream) *strm = s->strm;
+    block_state bstate;
+    uint32_t rest, avail;
+
+    do {
+        if (s->sample_left == 0 && strm->avail_in >= SAMPLE_MIN) {
+            int bypass;
+
+            s->sample_left = MIN(strm->avail_in, SAMPLE_SPAN);
+            bypass = sample_incompressible(strm->next_in, s->sample_left);
+            if (bypass != s->sample_bypass && (!bypass || sample_end_lazy(s)))
+                s->sample_bypass = bypass;
+        }
+
+        /* Only let the function see the input of the current span */
+        rest = 0;
+        if (s->sample_left != 0 && strm->avail_in > s->sample_left) {
+            rest = strm->avail_in - s->sample_left;
+            strm->avail_in = s->sample_left;
+        }
+        avail = strm->avail_in;
+
+        if (s->sample_bypass)
+            bstate = deflate_huff(s, rest ? Z_NO_FLUSH : flush);
+        else
+            bstate = (*func)(s, rest ? Z_NO_FLUSH : flush);
+
+        s->sample_left -= MIN(avail - strm->avail_in, s->sample_left);
+        strm->avail_in += rest;
+    } while (rest != 0 && bstate == need_more && s->sample_left == 0 && strm->avail_out != 0);
+
+    return bstate;
+}
@@ -10,6 +10,12 @@
 #include "deflate_p.h"
 #include "functable.h"
 
+/* Levels 8 and 9 move from the hash chains to the binary trees when longest_match
+ * follows this many links per byte of a window of input on average */
+#ifndef SLOW_BT_STEPS
+#  define SLOW_BT_STEPS 48
+#endif
+
 /* ===========================================================================
  * Same as deflate_medium, but achieves better compression. We use a lazy
  * evaluation for matches: a match is finally adopted only if there is
@@ -20,12 +26,14 @@ Z_INTERNAL block_state deflate_slow(deflate_state *s, int flush) {
     int bflush;              /* set if current block must be flushed */
     int64_t dist;
     uint32_t match_len;
-    match_func *longest_match;
+    match_func longest_match;
 
-    if (s->max_chain_length <= 1024)
-        longest_match = &functable.longest_match;
+    if (s->bt_right != NULL)
+        longest_match = &longest_match_bt;
+    else if (s->max_chain_length <= 1024)
+        longest_match = functable.longest_match;
     else
-        longest_match = &functable.longest_match_slow;
+        longest_match = functable.longest_match_slow;
 
     /* Process the input block. */
     for (;;) {
@@ -35,6 +43,12 @@ Z_INTERNAL block_state deflate_slow(deflate_state *s, int flush) {
          * string following the next match.
          */
         if (s->lookahead < MIN_LOOKAHEAD) {
+#ifndef NO_BT_MATCH
+            if (UNLIKELY(s->chain_steps >= s->w_size * SLOW_BT_STEPS) && s->bt_space != NULL && s->bt_right == NULL) {
+                PREFIX(bt_switch)(s);
+                longest_match = &longest_match_bt;
+            }
+#endif
             PREFIX(fill_window)(s);
             if (UNLIKELY(s->lookahead < MIN_LOOKAHEAD && flush == Z_NO_FLUSH)) {
                 return need_more;
@@ -62,7 +76,7 @@ Z_INTERNAL block_state deflate_slow(deflate_state *s, int flush) {
              * of window index 0 (in particular we have to avoid a match
              * of the string with itself at the start of the input file).
              */
-            match_len = (*longest_match)(s, hash_head);
+            match_len = longest_match(s, hash_head);
             /* longest_match() sets match_start */
 
             if (match_len <= 5 && (s->strategy == Z_FILTERED)) {
@@ -89,8 +103,8 @@ Z_INTERNAL block_state deflate_slow(deflate_state *s, int flush) {
              * the hash table.
              */
             s->prev_length -= 1;
-            s->lookahead -= s->prev_length;
 
+            /* lookahead is updated afterwards, the binary trees use it to bound the strings inserted */
             unsigned int mov_fwd = s->prev_length - 1;
             if (max_insert > s->strstart) {
                 unsigned int insert_cnt = mov_fwd;
@@ -98,6 +112,7 @@ Z_INTERNAL block_state deflate_slow(deflate_state *s, int flush) {
                     insert_cnt = max_insert - s->strstart;
                 s->insert_string(s, s->strstart + 1, insert_cnt);
             }
+            s->lookahead -= s->prev_length;
             s->prev_length = 0;
             s->match_available = 0;
             s->strstart += mov_fwd + 1;
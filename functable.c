@@ -25,6 +25,7 @@ static void init_functable(void) {
     ft.adler32_fold_copy = &adler32_fold_copy_c;
     ft.chunkmemset_safe = &chunkmemset_safe_c;
     ft.chunksize = &chunksize_c;
+    ft.clear_string = &clear_string_c;
     ft.crc32 = &PREFIX(crc32_braid);
     ft.crc32_fold = &crc32_fold_c;
     ft.crc32_fold_copy = &crc32_fold_copy_c;
@@ -90,6 +91,7 @@ static void init_functable(void) {
 #ifdef X86_SSE42
     if (cf.x86.has_sse42) {
         ft.adler32_fold_copy = &adler32_fold_copy_sse42;
+        ft.clear_string = &clear_string_sse42;
         ft.insert_string = &insert_string_sse42;
         ft.quick_insert_string = &quick_insert_string_sse42;
         ft.update_hash = &update_hash_sse42;
@@ -113,6 +115,10 @@ static void init_functable(void) {
         ft.chunkmemset_safe = &chunkmemset_safe_avx2;
         ft.chunksize = &chunksize_avx2;
         ft.inflate_fast = &inflate_fast_avx2;
+#  ifdef X86_BMI2
+        if (cf.x86.has_bmi2)
+            ft.inflate_fast = &inflate_fast_avx2_bmi2;
+#  endif
         ft.slide_hash = &slide_hash_avx2;
 #  ifdef HAVE_BUILTIN_CTZ
         ft.compare256 = &compare256_avx2;
@@ -176,6 +182,7 @@ static void init_functable(void) {
 #ifdef ARM_ACLE
     if (cf.arm.has_crc32) {
         ft.crc32 = &crc32_acle;
+        ft.clear_string = &clear_string_acle;
         ft.insert_string = &insert_string_acle;
         ft.quick_insert_string = &quick_insert_string_acle;
         ft.update_hash = &update_hash_acle;
@@ -241,6 +248,7 @@ static void init_functable(void) {
     functable.adler32_fold_copy = ft.adler32_fold_copy;
     functable.chunkmemset_safe = ft.chunkmemset_safe;
     functable.chunksize = ft.chunksize;
+    functable.clear_string = ft.clear_string;
     functable.compare256 = ft.compare256;
     functable.crc32 = ft.crc32;
     functable.crc32_fold = ft.crc32_fold;
@@ -277,6 +285,11 @@ static uint32_t chunksize_stub(void) {
     return functable.chunksize();
 }
 
+static void clear_string_stub(deflate_state* const s, uint32_t str, uint32_t count) {
+    init_functable();
+    functable.clear_string(s, str, count);
+}
+
 static uint32_t compare256_stub(const uint8_t* src0, const uint8_t* src1) {
     init_functable();
     return functable.compare256(src0, src1);
@@ -348,6 +361,7 @@ Z_INTERNAL Z_TLS struct functable_s functable = {
     adler32_fold_copy_stub,
     chunkmemset_safe_stub,
     chunksize_stub,
+    clear_string_stub,
     compare256_stub,
     crc32_stub,
     crc32_fold_stub,
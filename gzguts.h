@@ -66,13 +66,24 @@
 #endif
 
 /* get errno and strerror definition */
+#include <errno.h>
 #ifndef NO_STRERROR
-#  include <errno.h>
 #  define zstrerror() strerror(errno)
 #else
 #  define zstrerror() "stdio error (consult errno)"
 #endif
 
+/* 64-bit file offsets */
+#if defined(_WIN32)
+#  define LSEEK _lseeki64
+#else
+#if defined(_LARGEFILE64_SOURCE) && _LFS64_LARGEFILE-0
+#  define LSEEK lseek64
+#else
+#  define LSEEK lseek
+#endif
+#endif
+
 /* default memLevel */
 #if MAX_MEM_LEVEL >= 8
 #  define DEF_MEM_LEVEL 8
@@ -86,6 +97,9 @@
 #  define GZBUFSIZE 131072
 #endif
 
+/* maximum number of buffers between the caller and a reader or writer thread */
+#define GZ_RING_MAX 8
+
 /* gzip modes, also provide a little integrity check on the passed structure */
 #define GZ_NONE 0
 #define GZ_READ 7247
@@ -115,15 +129,34 @@ typedef struct {
     unsigned char *in;      /* input buffer (double-sized when writing) */
     unsigned char *out;     /* output buffer (double-sized when reading) */
     int direct;             /* 0 if processing gzip, 1 if transparent */
+    int threads;            /* threads requested with 'P' in the mode, 0 for
+                               one per processor, -1 if not requested */
+    int ring;               /* buffers for reading or writing on a separate
+                               thread, requested with 'A' in the mode, 0 if not */
         /* just for reading */
     int how;                /* 0: get header, 1: copy, 2: decompress */
     z_off64_t start;        /* where the gzip data started, for rewinding */
     int eof;                /* true if end of input file reached */
     int past;               /* true if read requested past end */
+    struct inflate_index_s *index;  /* access points for gzseek(), or NULL */
+    unsigned trailer;       /* gzip trailer bytes to skip after resuming raw
+                               inflate at an access point, 0 if not raw */
+    struct inflate_parallel_s *par;  /* parallel inflate if requested, or NULL */
+    unsigned in_size;       /* input buffer size, more than size for a batch
+                               of parallel inflate */
+    struct gz_ahead_s *ahead;  /* read ahead state once reading, or NULL */
+    int map;                /* true to read through a memory mapping,
+                               requested with 'M' in the mode */
+    unsigned char *map_base;  /* mapped window of the file, or NULL */
+    size_t map_len;         /* length of the mapped window */
+    z_off64_t map_off;      /* file offset of the mapped window */
         /* just for writing */
     int level;              /* compression level */
     int strategy;           /* compression strategy */
     int reset;              /* true if a reset is pending after a Z_FINISH */
+    struct gz_async_s *async;  /* writer thread state if requested, or NULL */
+    struct gz_workers_s *workers;  /* parallel deflate if requested, or NULL */
+    struct gz_queue_s *queue;  /* writes in flight with io_uring, or NULL */
         /* seek request */
     z_off64_t skip;         /* amount to skip (already rewound if backwards) */
     int seek;               /* true if seek request pending */
@@ -134,9 +167,12 @@ typedef struct {
     PREFIX3(stream) strm;  /* stream structure in-place (not a pointer) */
 } gz_state;
 typedef gz_state *gz_statep;
+typedef struct gz_ahead_s gz_ahead;
 
 /* shared functions */
 void Z_INTERNAL gz_error(gz_state *, int, const char *);
+int Z_INTERNAL gz_ahead_stop(gz_state *);
+z_off64_t Z_INTERNAL gz_ahead_tell(gz_state *);
 
 /* GT_OFF(x), where x is an unsigned value, is true if x > maximum z_off64_t
    value -- needed when comparing unsigned to z_off64_t, which is signed
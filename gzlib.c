@@ -7,22 +7,14 @@
 #include "zutil.h"
 #include "zutil_p.h"
 #include "gzguts.h"
+#include "inflate_index.h"
 
 #ifdef WITH_GZFILEOP
 
-#if defined(_WIN32)
-#  define LSEEK _lseeki64
-#else
-#if defined(_LARGEFILE64_SOURCE) && _LFS64_LARGEFILE-0
-#  define LSEEK lseek64
-#else
-#  define LSEEK lseek
-#endif
-#endif
-
 /* Local functions */
 static void gz_reset(gz_state *);
 static gzFile gz_open(const void *, int, const char *);
+static int gz_index_jump(gz_state *, z_off64_t);
 
 /* Reset gzip file state */
 static void gz_reset(gz_state *state) {
@@ -31,6 +23,10 @@ static void gz_reset(gz_state *state) {
         state->eof = 0;             /* not at end of file */
         state->past = 0;            /* have not read past end yet */
         state->how = LOOK;          /* look for gzip header */
+        if (state->trailer) {       /* back from raw inflate at an access point */
+            state->trailer = 0;
+            PREFIX(inflateReset2)(&state->strm, 15 + 16);
+        }
     }
     else                            /* for writing ... */
         state->reset = 0;           /* no deflateReset pending */
@@ -70,6 +66,7 @@ static gzFile gz_open(const void *path, int fd, const char *mode) {
     state->level = Z_DEFAULT_COMPRESSION;
     state->strategy = Z_DEFAULT_STRATEGY;
     state->direct = 0;
+    state->threads = -1;
     while (*mode) {
         if (*mode >= '0' && *mode <= '9') {
             state->level = *mode - '0';
@@ -116,6 +113,27 @@ static gzFile gz_open(const void *path, int fd, const char *mode) {
             case 'T':
                 state->direct = 1;
                 break;
+            case 'A':
+                state->ring = 0;
+                while (mode[1] >= '0' && mode[1] <= '9') {
+                    if (state->ring < 1000)
+                        state->ring = state->ring * 10 + (mode[1] - '0');
+                    mode++;
+                }
+                if (state->ring == 0)
+                    state->ring = 2;
+                break;
+            case 'M':
+                state->map = 1;
+                break;
+            case 'P':
+                state->threads = 0;
+                while (mode[1] >= '0' && mode[1] <= '9') {
+                    if (state->threads < 1000)
+                        state->threads = state->threads * 10 + (mode[1] - '0');
+                    mode++;
+                }
+                break;
             default:        /* could consider as an error, but just ignore */
                 {}
             }
@@ -298,12 +316,33 @@ int Z_EXPORT PREFIX(gzrewind)(gzFile file) {
         return -1;
 
     /* back up and start over */
-    if (LSEEK(state->fd, state->start, SEEK_SET) == -1)
+    if (gz_ahead_stop(state) == -1 || LSEEK(state->fd, state->start, SEEK_SET) == -1)
         return -1;
     gz_reset(state);
     return 0;
 }
 
+/* Resume decompression at the last access point of the index at or before
+   pos, if that gets closer to pos than reading on from the current position.
+   Return -1 on error, 0 otherwise. */
+static int gz_index_jump(gz_state *state, z_off64_t pos) {
+    const index_point *point = inflate_index_find(state->index, pos);
+
+    if (point == NULL || (pos >= state->x.pos && point->out <= state->x.pos + (z_off64_t)state->x.have))
+        return 0;
+    if (gz_ahead_stop(state) == -1 || LSEEK(state->fd, state->start + point->in, SEEK_SET) == -1)
+        return -1;
+    gz_reset(state);
+    if (inflate_index_resume(&(state->strm), point) != Z_OK) {
+        gz_error(state, Z_STREAM_ERROR, "internal error: cannot resume at index point");
+        return -1;
+    }
+    state->trailer = 8;
+    state->how = GZIP;
+    state->x.pos = point->out;
+    return 0;
+}
+
 /* -- see zlib.h -- */
 z_off64_t Z_EXPORT PREFIX4(gzseek)(gzFile file, z_off64_t offset, int whence) {
     unsigned n;
@@ -334,6 +373,8 @@ z_off64_t Z_EXPORT PREFIX4(gzseek)(gzFile file, z_off64_t offset, int whence) {
 
     /* if within raw area while reading, just go there */
     if (state->mode == GZ_READ && state->how == COPY && state->x.pos + offset >= 0) {
+        if (gz_ahead_stop(state) == -1)
+            return -1;
         ret = LSEEK(state->fd, offset - (z_off64_t)state->x.have, SEEK_CUR);
         if (ret == -1)
             return -1;
@@ -347,6 +388,15 @@ z_off64_t Z_EXPORT PREFIX4(gzseek)(gzFile file, z_off64_t offset, int whence) {
         return state->x.pos;
     }
 
+    /* if there is an index, continue from the access point closest to the
+       target, which may save rewinding or skipping most of the way */
+    if (state->mode == GZ_READ && state->index != NULL && state->x.pos + offset >= 0) {
+        offset += state->x.pos;
+        if (gz_index_jump(state, offset) == -1)
+            return -1;
+        offset -= state->x.pos;
+    }
+
     /* calculate skip amount, rewinding if needed for back seek when reading */
     if (offset < 0) {
         if (state->mode != GZ_READ)         /* writing -- can't go backwards */
@@ -423,8 +473,9 @@ z_off64_t Z_EXPORT PREFIX4(gzoffset)(gzFile file) {
     if (state->mode != GZ_READ && state->mode != GZ_WRITE)
         return -1;
 
-    /* compute and return effective offset in file */
-    offset = LSEEK(state->fd, 0, SEEK_CUR);
+    /* compute and return effective offset in file, not counting what was
+       read ahead */
+    offset = gz_ahead_tell(state);
     if (offset == -1)
         return -1;
     if (state->mode == GZ_READ)             /* reading */
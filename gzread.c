@@ -6,10 +6,34 @@
 #include "zbuild.h"
 #include "zutil_p.h"
 #include "gzguts.h"
+#include "gzuring.h"
+#include "inflate_index.h"
+#include "inflate_parallel.h"
+#include "zthread.h"
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
 
 #ifdef WITH_GZFILEOP
 
+/* size of the windows of the file that are mapped when reading with 'M' in
+   the mode, small enough to find room for in a 32-bit address space */
+#ifndef GZ_MAP_WINDOW
+#  define GZ_MAP_WINDOW (64UL * 1024 * 1024)
+#endif
+
 /* Local functions */
+static void gz_ahead_run(void *);
+static int gz_ahead_init(gz_state *);
+static int gz_ahead_submit(gz_ahead *, int);
+static int gz_ahead_reap(gz_ahead *);
+static int gz_ahead_start(gz_ahead *);
+static int gz_ahead_read(gz_ahead *, unsigned char *, unsigned, unsigned *);
+static void gz_ahead_join(gz_ahead *);
+static void gz_ahead_end(gz_state *);
+static int gz_map_avail(gz_state *);
+static void gz_map_end(gz_state *);
 static int gz_load(gz_state *, unsigned char *, unsigned, unsigned *);
 static int gz_avail(gz_state *);
 static int gz_look(gz_state *);
@@ -18,6 +42,386 @@ static int gz_fetch(gz_state *);
 static int gz_skip(gz_state *, z_off64_t);
 static size_t gz_read(gz_state *, void *, size_t);
 
+/* Reading ahead on a separate thread.  The reader thread fills a ring of
+   buffers of state->size bytes from the file, while gz_load() copies from the
+   buffers that are full, so that waiting for the file overlaps with inflate.
+   The buffers are only touched by the reader thread while they are not full,
+   and only by gz_load() while they are, with the counts protected by a mutex.
+   If no thread can be created, gz_load() reads the file itself.
+
+   When the library is built with io_uring and the file is seekable, there is
+   no reader thread.  Instead a read into every buffer is kept in flight, each
+   at the file offset of the next part of the file, and gz_load() waits for
+   them to complete in order.  A buffer is read again as soon as it is used. */
+struct gz_ahead_s {
+    int fd;
+    unsigned size;                      /* size of each buffer */
+    int count;                          /* number of buffers */
+    unsigned char *buf[GZ_RING_MAX];
+    unsigned len[GZ_RING_MAX];         /* bytes in each full buffer */
+    int head;                           /* next full buffer to copy from */
+    int full;                           /* number of full buffers */
+    unsigned used;                      /* bytes copied from buf[head] */
+    int eof;                            /* true if the reader reached end of file */
+    int err;                            /* errno of a failed read, or 0 */
+    int stop;                           /* true to make the reader thread exit */
+    int running;                        /* true while the reader thread exists */
+    int direct;                         /* true if no thread could be created */
+    z_off64_t pos;                      /* file offset of the next byte to copy, or -1 */
+    gz_uring *uring;                    /* reads in flight with io_uring, or NULL */
+    z_off64_t next;                     /* file offset of the next read with io_uring */
+    z_off64_t off[GZ_RING_MAX];         /* file offset of each buffer with io_uring */
+    int busy[GZ_RING_MAX];              /* true while a read into a buffer is in flight */
+    int inflight;                       /* number of reads in flight */
+    zthread_t thread;
+    zmutex_t mutex;
+    zcond_t cond;
+};
+
+/* Reader thread -- fill empty buffers until stopped, end of file, or error */
+static void gz_ahead_run(void *arg) {
+    gz_ahead *ahead = (gz_ahead *)arg;
+    unsigned char *buf;
+    unsigned have;
+    ssize_t ret;
+
+    zmutex_lock(&ahead->mutex);
+    for (;;) {
+        while (!ahead->stop && (ahead->full == ahead->count || ahead->eof || ahead->err))
+            zcond_wait(&ahead->cond, &ahead->mutex);
+        if (ahead->stop)
+            break;
+        buf = ahead->buf[(ahead->head + ahead->full) % ahead->count];
+        zmutex_unlock(&ahead->mutex);
+
+        have = 0;
+        do {
+            ret = read(ahead->fd, buf + have, ahead->size - have);
+            if (ret <= 0)
+                break;
+            have += (unsigned)ret;
+        } while (have < ahead->size);
+
+        zmutex_lock(&ahead->mutex);
+        if (have) {
+            ahead->len[(ahead->head + ahead->full) % ahead->count] = have;
+            ahead->full++;
+        }
+        if (ret < 0)
+            ahead->err = errno;
+        else if (ret == 0)
+            ahead->eof = 1;
+        zcond_broadcast(&ahead->cond);
+    }
+    zmutex_unlock(&ahead->mutex);
+}
+
+/* Create the read ahead buffers for state->fd -- return -1 on error, 0 otherwise */
+static int gz_ahead_init(gz_state *state) {
+    gz_ahead *ahead;
+    int i;
+
+    ahead = (gz_ahead *)zng_alloc(sizeof(gz_ahead));
+    if (ahead == NULL)
+        return -1;
+    memset(ahead, 0, sizeof(gz_ahead));
+    ahead->fd = state->fd;
+    ahead->size = state->size;
+    ahead->count = MIN(state->ring, GZ_RING_MAX);
+    for (i = 0; i < ahead->count; i++) {
+        ahead->buf[i] = (unsigned char *)zng_alloc(ahead->size);
+        if (ahead->buf[i] == NULL)
+            break;
+    }
+    if (i < ahead->count || zmutex_init(&ahead->mutex) != 0) {
+        while (i--)
+            zng_free(ahead->buf[i]);
+        zng_free(ahead);
+        return -1;
+    }
+    if (zcond_init(&ahead->cond) != 0) {
+        zmutex_destroy(&ahead->mutex);
+        for (i = 0; i < ahead->count; i++)
+            zng_free(ahead->buf[i]);
+        zng_free(ahead);
+        return -1;
+    }
+    state->ahead = ahead;
+    return 0;
+}
+
+/* Start reading the next buffer of the file into buf[i] with io_uring --
+   return -1 with errno set on error, otherwise 0 */
+static int gz_ahead_submit(gz_ahead *ahead, int i) {
+    ahead->len[i] = 0;
+    ahead->off[i] = ahead->next;
+    ahead->next += ahead->size;
+    if (gz_uring_submit(ahead->uring, GZ_URING_READ, ahead->buf[i], ahead->size, ahead->off[i], (unsigned)i) == -1)
+        return -1;
+    ahead->busy[i] = 1;
+    ahead->inflight++;
+    return 0;
+}
+
+/* Wait for a read with io_uring to complete, and read the rest of its buffer
+   if it came up short of the end of the file -- return -1 with errno set on
+   error, otherwise 0 */
+static int gz_ahead_reap(gz_ahead *ahead) {
+    unsigned i;
+    int32_t res;
+
+    if (gz_uring_wait(ahead->uring, &i, &res) == -1)
+        return -1;
+    ahead->busy[i] = 0;
+    ahead->inflight--;
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    ahead->len[i] += (unsigned)res;
+    if (res > 0 && ahead->len[i] < ahead->size) {
+        if (gz_uring_submit(ahead->uring, GZ_URING_READ, ahead->buf[i] + ahead->len[i],
+                            ahead->size - ahead->len[i], ahead->off[i] + ahead->len[i], i) == -1)
+            return -1;
+        ahead->busy[i] = 1;
+        ahead->inflight++;
+    }
+    return 0;
+}
+
+/* Start reading ahead from the current file offset, with io_uring if
+   possible, otherwise on a reader thread, or else directly -- return -1 with
+   errno set on error, otherwise 0 */
+static int gz_ahead_start(gz_ahead *ahead) {
+    int i;
+
+    ahead->pos = LSEEK(ahead->fd, 0, SEEK_CUR);
+    if (ahead->uring != NULL || gz_uring_init(&ahead->uring, ahead->fd, (unsigned)ahead->count) == 0) {
+        ahead->running = 1;
+        ahead->next = ahead->pos;
+        for (i = 0; i < ahead->count; i++)
+            if (gz_ahead_submit(ahead, i) == -1)
+                return -1;
+        return 0;
+    }
+    if (zthread_create(&ahead->thread, gz_ahead_run, ahead) == 0)
+        ahead->running = 1;
+    else
+        ahead->direct = 1;
+    return 0;
+}
+
+/* Copy up to len bytes from the read ahead buffers to buf, waiting for the
+   reader thread as needed, and starting it if it is not running.  Stops short
+   of len only at end of file.  Return -1 with errno set on error, otherwise 0. */
+static int gz_ahead_read(gz_ahead *ahead, unsigned char *buf, unsigned len, unsigned *have) {
+    unsigned n;
+    int err = 0;
+
+    *have = 0;
+    if (!ahead->running && !ahead->direct && gz_ahead_start(ahead) == -1)
+        return -1;
+    if (ahead->uring != NULL) {
+        while (*have < len) {
+            while (ahead->busy[ahead->head])
+                if (gz_ahead_reap(ahead) == -1)
+                    return -1;
+            n = MIN(len - *have, ahead->len[ahead->head] - ahead->used);
+            memcpy(buf + *have, ahead->buf[ahead->head] + ahead->used, n);
+            *have += n;
+            ahead->used += n;
+            ahead->pos += n;
+            if (ahead->used < ahead->len[ahead->head])
+                continue;
+            if (ahead->len[ahead->head] < ahead->size)
+                break;                  /* end of file */
+            ahead->used = 0;
+            if (gz_ahead_submit(ahead, ahead->head) == -1)
+                return -1;
+            ahead->head = (ahead->head + 1) % ahead->count;
+        }
+        return 0;
+    }
+    if (ahead->direct) {
+        ssize_t ret;
+
+        do {
+            ret = read(ahead->fd, buf + *have, len - *have);
+            if (ret <= 0)
+                break;
+            *have += (unsigned)ret;
+        } while (*have < len);
+        return ret < 0 ? -1 : 0;
+    }
+
+    zmutex_lock(&ahead->mutex);
+    while (*have < len) {
+        while (ahead->full == 0 && !ahead->eof && !ahead->err)
+            zcond_wait(&ahead->cond, &ahead->mutex);
+        if (ahead->full == 0) {
+            err = ahead->err;
+            break;
+        }
+        zmutex_unlock(&ahead->mutex);
+
+        n = MIN(len - *have, ahead->len[ahead->head] - ahead->used);
+        memcpy(buf + *have, ahead->buf[ahead->head] + ahead->used, n);
+        *have += n;
+        ahead->used += n;
+        if (ahead->pos != -1)
+            ahead->pos += n;
+
+        zmutex_lock(&ahead->mutex);
+        if (ahead->used == ahead->len[ahead->head]) {
+            ahead->head = (ahead->head + 1) % ahead->count;
+            ahead->full--;
+            ahead->used = 0;
+            zcond_broadcast(&ahead->cond);
+        }
+    }
+    zmutex_unlock(&ahead->mutex);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/* Make the reader thread exit, or wait for the reads with io_uring to
+   complete, and discard what has been read */
+static void gz_ahead_join(gz_ahead *ahead) {
+    if (ahead->uring != NULL) {
+        unsigned i;
+        int32_t res;
+
+        while (ahead->inflight && gz_uring_wait(ahead->uring, &i, &res) == 0) {
+            ahead->busy[i] = 0;
+            ahead->inflight--;
+        }
+    } else {
+        zmutex_lock(&ahead->mutex);
+        ahead->stop = 1;
+        zcond_broadcast(&ahead->cond);
+        zmutex_unlock(&ahead->mutex);
+        zthread_join(&ahead->thread);
+    }
+
+    ahead->running = 0;
+    ahead->stop = 0;
+    ahead->head = 0;
+    ahead->full = 0;
+    ahead->used = 0;
+    ahead->eof = 0;
+    ahead->err = 0;
+}
+
+/* Stop the reader thread and put the file offset back to where gz_load() has
+   read up to, so that the file can be repositioned.  Data read ahead from a
+   file that cannot be repositioned would be lost, so then the reader thread is
+   left running.  Return -1 on error, 0 otherwise. */
+int Z_INTERNAL gz_ahead_stop(gz_state *state) {
+    gz_ahead *ahead = state->ahead;
+
+    if (ahead == NULL || !ahead->running)
+        return 0;
+    if (ahead->pos == -1)
+        return -1;
+    gz_ahead_join(ahead);
+    return LSEEK(ahead->fd, ahead->pos, SEEK_SET) == -1 ? -1 : 0;
+}
+
+/* Return the file offset up to which gz_load() has read, or -1 if unknown */
+z_off64_t Z_INTERNAL gz_ahead_tell(gz_state *state) {
+    if (state->ahead == NULL || !state->ahead->running)
+        return LSEEK(state->fd, 0, SEEK_CUR);
+    return state->ahead->pos;
+}
+
+/* Stop reading ahead and free the read ahead buffers */
+static void gz_ahead_end(gz_state *state) {
+    gz_ahead *ahead = state->ahead;
+    int i;
+
+    if (ahead == NULL)
+        return;
+    if (ahead->running)
+        gz_ahead_join(ahead);
+    gz_uring_end(ahead->uring);
+    zcond_destroy(&ahead->cond);
+    zmutex_destroy(&ahead->mutex);
+    for (i = 0; i < ahead->count; i++)
+        zng_free(ahead->buf[i]);
+    zng_free(ahead);
+    state->ahead = NULL;
+}
+
+/* Map the window of the file that starts at the page of the first byte of
+   input that is left over, and point strm->next_in into it in place of reading
+   the file into state->in.  The file offset is kept at the end of the window,
+   so that repositioning and telling the file work as after reading it.  Return
+   1 if the file cannot be mapped and should be read instead, -1 on error, or 0
+   otherwise, with state->eof set if the window reaches the end of the file. */
+static int gz_map_avail(gz_state *state) {
+#ifdef HAVE_SYS_MMAN_H
+    PREFIX3(stream) *strm = &(state->strm);
+    struct stat st;
+    z_off64_t pos, off;
+    size_t len;
+    void *base;
+
+    if (strm->avail_in && state->map_base != NULL)
+        pos = state->map_off + (strm->next_in - state->map_base);
+    else
+        pos = LSEEK(state->fd, 0, SEEK_CUR);
+    if (pos == -1 || fstat(state->fd, &st) == -1 || !S_ISREG(st.st_mode))
+        return 1;
+    if (pos >= (z_off64_t)st.st_size) {
+        state->eof = 1;
+        return 0;
+    }
+
+    off = pos - pos % (z_off64_t)sysconf(_SC_PAGESIZE);
+    len = (size_t)MIN((z_off64_t)st.st_size - off, (z_off64_t)GZ_MAP_WINDOW);
+    base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, state->fd, (off_t)off);
+    if (base == MAP_FAILED)
+        return 1;
+#  ifdef POSIX_MADV_SEQUENTIAL
+    posix_madvise(base, len, POSIX_MADV_SEQUENTIAL);
+#  endif
+    if (LSEEK(state->fd, off + (z_off64_t)len, SEEK_SET) == -1) {
+        gz_error(state, Z_ERRNO, zstrerror());
+        munmap(base, len);
+        return -1;
+    }
+
+    /* the left over input is in the new window as well */
+    gz_map_end(state);
+    state->map_base = (unsigned char *)base;
+    state->map_len = len;
+    state->map_off = off;
+    strm->next_in = state->map_base + (pos - off);
+    strm->avail_in = (unsigned)(len - (size_t)(pos - off));
+    if (off + (z_off64_t)len == (z_off64_t)st.st_size)
+        state->eof = 1;
+    return 0;
+#else
+    Z_UNUSED(state);
+    return 1;
+#endif
+}
+
+/* Unmap the current window of the file, if any */
+static void gz_map_end(gz_state *state) {
+#ifdef HAVE_SYS_MMAN_H
+    if (state->map_base != NULL) {
+        munmap(state->map_base, state->map_len);
+        state->map_base = NULL;
+    }
+#else
+    Z_UNUSED(state);
+#endif
+}
+
 /* Use read() to load a buffer -- return -1 on error, otherwise 0.  Read from
    state->fd, and update state->eof, state->err, and state->msg as appropriate.
    This function needs to loop on read(), since read() is not guaranteed to
@@ -25,6 +429,20 @@ static size_t gz_read(gz_state *, void *, size_t);
 static int gz_load(gz_state *state, unsigned char *buf, unsigned len, unsigned *have) {
     ssize_t ret;
 
+    if (state->ring) {
+        if (state->ahead == NULL && gz_ahead_init(state) == -1) {
+            gz_error(state, Z_MEM_ERROR, "out of memory");
+            return -1;
+        }
+        if (gz_ahead_read(state->ahead, buf, len, have) == -1) {
+            gz_error(state, Z_ERRNO, zstrerror());
+            return -1;
+        }
+        if (*have < len)
+            state->eof = 1;
+        return 0;
+    }
+
     *have = 0;
     do {
         ret = read(state->fd, buf + *have, len - *have);
@@ -47,14 +465,22 @@ static int gz_load(gz_state *state, unsigned char *buf, unsigned len, unsigned *
    that data has been used, no more attempts will be made to read the file.
    If strm->avail_in != 0, then the current data is moved to the beginning of
    the input buffer, and then the remainder of the buffer is loaded with the
-   available data from the input file. */
+   available data from the input file.  When reading through a mapping, the
+   next window of the file is mapped instead, until that is not possible. */
 static int gz_avail(gz_state *state) {
     unsigned got;
+    int ret;
     PREFIX3(stream) *strm = &(state->strm);
 
     if (state->err != Z_OK && state->err != Z_BUF_ERROR)
         return -1;
     if (state->eof == 0) {
+        if (state->map) {
+            ret = gz_map_avail(state);
+            if (ret != 1)
+                return ret;
+            state->map = 0;         /* read the file from here on */
+        }
         if (strm->avail_in) {       /* copy what's there to the start */
             unsigned char *p = state->in;
             unsigned const char *q = strm->next_in;
@@ -63,6 +489,7 @@ static int gz_avail(gz_state *state) {
                 *p++ = *q++;
             } while (--n);
         }
+        gz_map_end(state);
         if (gz_load(state, state->in + strm->avail_in, state->size - strm->avail_in, &got) == -1)
             return -1;
         strm->avail_in += got;
@@ -85,6 +512,15 @@ static int gz_look(gz_state *state) {
 
     /* allocate read buffers and inflate memory */
     if (state->size == 0) {
+        /* parallel inflate decodes a batch of input at a time, make room for it */
+        if (state->threads >= 0 && state->par == NULL) {
+            if (inflate_parallel_init(&state->par, 15 + 16, state->threads, 0) != Z_OK) {
+                gz_error(state, Z_MEM_ERROR, "out of memory");
+                return -1;
+            }
+            state->want = (unsigned)MAX(state->want, inflate_parallel_batch(state->par));
+        }
+
         /* allocate buffers */
         state->in = (unsigned char *)zng_alloc(state->want);
         state->out = (unsigned char *)zng_alloc(state->want << 1);
@@ -111,6 +547,27 @@ static int gz_look(gz_state *state) {
         }
     }
 
+    /* after raw inflate from an access point, skip the gzip trailer of the
+       member and go back to gzip decoding */
+    while (state->trailer) {
+        unsigned n;
+
+        if (strm->avail_in == 0) {
+            if (gz_avail(state) == -1)
+                return -1;
+            if (strm->avail_in == 0) {
+                gz_error(state, Z_BUF_ERROR, "unexpected end of file");
+                return 0;
+            }
+        }
+        n = MIN(strm->avail_in, state->trailer);
+        strm->next_in += n;
+        strm->avail_in -= n;
+        state->trailer -= n;
+        if (state->trailer == 0)
+            PREFIX(inflateReset2)(strm, 15 + 16);
+    }
+
     /* get at least the magic bytes in the input buffer */
     if (strm->avail_in < 2) {
         if (gz_avail(state) == -1)
@@ -129,6 +586,8 @@ static int gz_look(gz_state *state) {
     if (strm->avail_in > 1 &&
             strm->next_in[0] == 31 && strm->next_in[1] == 139) {
         PREFIX(inflateReset)(strm);
+        if (state->par != NULL)
+            inflate_parallel_reset(state->par);
         state->how = GZIP;
         state->direct = 0;
         return 0;
@@ -143,6 +602,18 @@ static int gz_look(gz_state *state) {
         return 0;
     }
 
+    /* doing raw i/o from a mapping, which can be larger than the output buffer
+       -- put the file offset back to the leftover input and read from there */
+    if (state->map_base != NULL) {
+        if (LSEEK(state->fd, -(z_off64_t)strm->avail_in, SEEK_CUR) == -1) {
+            gz_error(state, Z_ERRNO, zstrerror());
+            return -1;
+        }
+        gz_map_end(state);
+        strm->avail_in = 0;
+        state->eof = 0;
+    }
+
     /* doing raw i/o, copy any leftover input to output -- this assumes that
        the output buffer is larger than the input buffer, which also assures
        space for gzungetc() */
@@ -166,20 +637,26 @@ static int gz_decomp(gz_state *state) {
     int ret = Z_OK;
     unsigned had;
     PREFIX3(stream) *strm = &(state->strm);
+    /* not after resuming raw inflate at an access point, parallel inflate
+       starts at the gzip header */
+    int parallel = state->par != NULL && state->trailer == 0;
 
     /* fill output buffer up to end of deflate stream */
     had = strm->avail_out;
     do {
-        /* get more input for inflate() */
-        if (strm->avail_in == 0 && gz_avail(state) == -1)
+        /* get more input for inflate(), parallel inflate wants a full buffer */
+        if ((strm->avail_in == 0 || (parallel && strm->avail_in < state->size)) && gz_avail(state) == -1)
             return -1;
-        if (strm->avail_in == 0) {
+        if (strm->avail_in == 0 && !(parallel && inflate_parallel_pending(state->par))) {
             gz_error(state, Z_BUF_ERROR, "unexpected end of file");
             break;
         }
 
         /* decompress and handle errors */
-        ret = PREFIX(inflate)(strm, Z_NO_FLUSH);
+        if (parallel)
+            ret = inflate_parallel_run(state->par, strm, state->eof ? Z_FINISH : Z_NO_FLUSH);
+        else
+            ret = PREFIX(inflate)(strm, Z_NO_FLUSH);
         if (ret == Z_STREAM_ERROR || ret == Z_NEED_DICT) {
             gz_error(state, Z_STREAM_ERROR, "internal error: inflate stream corrupt");
             return -1;
@@ -576,6 +1053,68 @@ int Z_EXPORT PREFIX(gzdirect)(gzFile file) {
     return state->direct;
 }
 
+#ifndef ZLIB_COMPAT
+/* Provide the file contents to inflate_index_build() as gz_avail() loads them */
+static uint32_t gz_index_in(void *desc, z_const unsigned char **buf) {
+    gz_state *state = (gz_state *)desc;
+    PREFIX3(stream) *strm = &(state->strm);
+    unsigned got;
+
+    strm->avail_in = 0;
+    if (gz_avail(state) == -1)
+        return 0;
+    *buf = strm->next_in;
+    got = strm->avail_in;
+    strm->avail_in = 0;
+    return got;
+}
+
+/* -- see zlib.h -- */
+int Z_EXPORT PREFIX(gzbuildindex)(gzFile file, z_off64_t span) {
+    gz_state *state;
+    inflate_index *index;
+    int ret;
+
+    /* get internal structure */
+    if (file == NULL)
+        return -1;
+    state = (gz_state *)file;
+
+    /* check that we're reading and that there's no error */
+    if (state->mode != GZ_READ || (state->err != Z_OK && state->err != Z_BUF_ERROR) || span < 1)
+        return -1;
+
+    /* find out whether there is gzip data, allocating the buffers if needed */
+    if (PREFIX(gzrewind)(file) == -1 || gz_look(state) == -1)
+        return -1;
+    if (state->how != GZIP)
+        return PREFIX(gzrewind)(file);
+
+    /* decompress everything once, then go back to the start */
+    if (PREFIX(gzrewind)(file) == -1)
+        return -1;
+    ret = inflate_index_build(gz_index_in, state, 15 + 16, span, &index);
+    if (state->err != Z_OK)
+        return -1;
+    if (PREFIX(gzrewind)(file) == -1) {
+        inflate_index_free(index);
+        return -1;
+    }
+    if (ret != Z_OK) {
+        if (ret == Z_MEM_ERROR)
+            gz_error(state, Z_MEM_ERROR, "out of memory");
+        else if (ret == Z_BUF_ERROR)
+            gz_error(state, Z_BUF_ERROR, "unexpected end of file");
+        else
+            gz_error(state, Z_DATA_ERROR, "compressed data error");
+        return -1;
+    }
+    inflate_index_free(state->index);
+    state->index = index;
+    return 0;
+}
+#endif
+
 /* -- see zlib.h -- */
 int Z_EXPORT PREFIX(gzclose_r)(gzFile file) {
     int ret, err;
@@ -597,6 +1136,10 @@ int Z_EXPORT PREFIX(gzclose_r)(gzFile file) {
         zng_free(state->out);
         zng_free(state->in);
     }
+    inflate_index_free(state->index);
+    inflate_parallel_end(state->par);
+    gz_ahead_end(state);
+    gz_map_end(state);
     err = state->err == Z_BUF_ERROR ? Z_BUF_ERROR : Z_OK;
     gz_error(state, Z_OK, NULL);
     free(state->path);
@@ -0,0 +1,204 @@
+/* gzuring.c -- Minimal io_uring queue used internally for reading and writing gzip files
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * The queue talks to the kernel with the io_uring system calls directly, so
+ * that it does not depend on liburing.  Each gzFile gets its own ring, which
+ * is only used by one thread at a time.  Submissions are passed to the kernel
+ * right away, since there are only a few of them in flight, and completions
+ * are taken from the completion ring without a system call when they are
+ * there already.
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE 1  /* syscall, MAP_POPULATE */
+#endif
+
+#include "zbuild.h"
+#include "zutil_p.h"
+#include "gzguts.h"
+#include "gzuring.h"
+
+#ifdef HAVE_IO_URING
+#  include <linux/io_uring.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#ifdef WITH_GZFILEOP
+
+#ifdef HAVE_IO_URING
+struct gz_uring_s {
+    int fd;                             /* io_uring file descriptor */
+    int file;                           /* file to read or write */
+    unsigned entries;                   /* size of the submission ring */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;            /* mapped rings, the same if single mapped */
+    size_t sq_size, cq_size, sqes_size;
+};
+
+static int gz_uring_enter(gz_uring *ring, unsigned submit, unsigned wait, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ring->fd, submit, wait, flags, NULL, 0);
+}
+
+static void gz_uring_unmap(gz_uring *ring) {
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_size);
+    if (ring->sq_ring != NULL)
+        munmap(ring->sq_ring, ring->sq_size);
+}
+
+static void *gz_uring_map(gz_uring *ring, size_t size, off_t off) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, off);
+    return p == MAP_FAILED ? NULL : p;
+}
+#endif
+
+int Z_INTERNAL gz_uring_init(gz_uring **ring, int fd, unsigned entries) {
+#ifdef HAVE_IO_URING
+    struct io_uring_params p;
+    gz_uring *r;
+    int flags;
+
+    *ring = NULL;
+
+    /* operations at explicit offsets need a seekable file, and may complete
+       out of order, which only keeps the data in order if not appending */
+    flags = fcntl(fd, F_GETFL);
+    if (LSEEK(fd, 0, SEEK_CUR) == -1 || flags == -1 || (flags & O_APPEND))
+        return -1;
+
+    r = (gz_uring *)zng_alloc(sizeof(gz_uring));
+    if (r == NULL)
+        return -1;
+    memset(r, 0, sizeof(gz_uring));
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        zng_free(r);
+        return -1;
+    }
+    r->file = fd;
+    r->entries = p.sq_entries;
+
+    /* IORING_OP_READ and IORING_OP_WRITE came with this feature in Linux 5.6 */
+    if (p.features & IORING_FEAT_RW_CUR_POS) {
+        r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            r->sq_size = r->cq_size = MAX(r->sq_size, r->cq_size);
+        r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        r->sq_ring = gz_uring_map(r, r->sq_size, IORING_OFF_SQ_RING);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            r->cq_ring = r->sq_ring;
+        else
+            r->cq_ring = gz_uring_map(r, r->cq_size, IORING_OFF_CQ_RING);
+        r->sqes = (struct io_uring_sqe *)gz_uring_map(r, r->sqes_size, IORING_OFF_SQES);
+    }
+    if (r->sq_ring == NULL || r->cq_ring == NULL || r->sqes == NULL) {
+        gz_uring_unmap(r);
+        close(r->fd);
+        zng_free(r);
+        return -1;
+    }
+
+    r->sq_head = (unsigned *)((unsigned char *)r->sq_ring + p.sq_off.head);
+    r->sq_tail = (unsigned *)((unsigned char *)r->sq_ring + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((unsigned char *)r->sq_ring + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((unsigned char *)r->sq_ring + p.sq_off.array);
+    r->cq_head = (unsigned *)((unsigned char *)r->cq_ring + p.cq_off.head);
+    r->cq_tail = (unsigned *)((unsigned char *)r->cq_ring + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((unsigned char *)r->cq_ring + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((unsigned char *)r->cq_ring + p.cq_off.cqes);
+    *ring = r;
+    return 0;
+#else
+    Z_UNUSED(fd);
+    Z_UNUSED(entries);
+    *ring = NULL;
+    return -1;
+#endif
+}
+
+void Z_INTERNAL gz_uring_end(gz_uring *ring) {
+#ifdef HAVE_IO_URING
+    if (ring == NULL)
+        return;
+    gz_uring_unmap(ring);
+    close(ring->fd);
+    zng_free(ring);
+#else
+    Z_UNUSED(ring);
+#endif
+}
+
+int Z_INTERNAL gz_uring_submit(gz_uring *ring, int op, unsigned char *buf, unsigned len, z_off64_t off,
+                               unsigned tag) {
+#ifdef HAVE_IO_URING
+    struct io_uring_sqe *sqe;
+    unsigned tail, index;
+    int ret;
+
+    tail = *ring->sq_tail;
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->entries) {
+        errno = EBUSY;
+        return -1;
+    }
+    index = tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = op == GZ_URING_WRITE ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = ring->file;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)off;
+    sqe->user_data = tag;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    do {
+        ret = gz_uring_enter(ring, 1, 0, 0);
+    } while (ret == -1 && errno == EINTR);
+    return ret == -1 ? -1 : 0;
+#else
+    Z_UNUSED(ring);
+    Z_UNUSED(op);
+    Z_UNUSED(buf);
+    Z_UNUSED(len);
+    Z_UNUSED(off);
+    Z_UNUSED(tag);
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int Z_INTERNAL gz_uring_wait(gz_uring *ring, unsigned *tag, int32_t *res) {
+#ifdef HAVE_IO_URING
+    struct io_uring_cqe *cqe;
+    unsigned head;
+
+    head = *ring->cq_head;
+    while (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        if (gz_uring_enter(ring, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR)
+            return -1;
+    }
+    cqe = &ring->cqes[head & *ring->cq_mask];
+    *tag = (unsigned)cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+#else
+    Z_UNUSED(ring);
+    Z_UNUSED(tag);
+    Z_UNUSED(res);
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+#endif
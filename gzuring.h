@@ -0,0 +1,30 @@
+/* gzuring.h -- Internal io_uring queue for reading and writing gzip files
+ *
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef GZURING_H_
+#define GZURING_H_
+
+/* operations for gz_uring_submit() */
+#define GZ_URING_READ  0
+#define GZ_URING_WRITE 1
+
+typedef struct gz_uring_s gz_uring;
+
+/* Creates a queue for reading or writing fd at explicit file offsets, with up to entries operations
+   in flight at once.  Returns -1 if the library was built without io_uring, the kernel does not
+   provide it, or fd cannot be used that way because it is not seekable or it is appending, in which
+   case the caller uses read() and write() instead.  Returns 0 otherwise. */
+int  Z_INTERNAL gz_uring_init(gz_uring **ring, int fd, unsigned entries);
+void Z_INTERNAL gz_uring_end(gz_uring *ring);
+
+/* Starts reading into or writing from the len bytes at buf, at file offset off.  tag identifies
+   the operation when it completes.  Returns -1 with errno set on error, otherwise 0. */
+int  Z_INTERNAL gz_uring_submit(gz_uring *ring, int op, unsigned char *buf, unsigned len, z_off64_t off,
+                                unsigned tag);
+/* Waits for an operation to complete, setting tag to its tag, and res to the number of bytes read
+   or written, or to -errno if it failed.  Returns -1 with errno set on error, otherwise 0. */
+int  Z_INTERNAL gz_uring_wait(gz_uring *ring, unsigned *tag, int32_t *res);
+
+#endif
@@ -8,11 +8,32 @@
 #include "zutil_p.h"
 #include <stdarg.h>
 #include "gzguts.h"
+#include "gzuring.h"
+#include "zthread.h"
+#include "compress_parallel.h"
 
 #ifdef WITH_GZFILEOP
 
 /* Local functions */
 static int gz_init(gz_state *);
+static void gz_async_run(void *);
+static void gz_async_free(struct gz_async_s *);
+static int gz_async_init(gz_state *);
+static int gz_async_wait(gz_state *);
+static int gz_async_comp(gz_state *, int);
+static int gz_async_end(gz_state *);
+static void gz_workers_end(gz_state *);
+static int gz_workers_init(gz_state *);
+static int gz_workers_round(gz_state *, int);
+static int gz_workers_comp(gz_state *, int);
+static int gz_workers_params(gz_state *, int, int);
+static int gz_params(gz_state *, int, int);
+static void gz_queue_init(gz_state *, int);
+static int gz_queue_reap(gz_state *);
+static int gz_queue_put(gz_state *, const unsigned char *, size_t);
+static int gz_queue_sync(gz_state *, int);
+static void gz_queue_end(gz_state *);
+static int gz_put(gz_state *, const unsigned char *, size_t);
 static int gz_comp(gz_state *, int);
 static int gz_zero(gz_state *, z_off64_t);
 static size_t gz_write(gz_state *, void const *, size_t);
@@ -32,8 +53,22 @@ static int gz_init(gz_state *state) {
     }
     memset(state->in, 0, state->want << 1);
 
-    /* only need output buffer and deflate state if compressing */
-    if (!state->direct) {
+    /* compress and write on a separate thread if requested, or here if no
+       thread can be started */
+    if (state->ring && gz_async_init(state) == -1) {
+        zng_free(state->in);
+        return -1;
+    }
+
+    /* compress with multiple threads if requested, unless the writer thread
+       does that */
+    if (state->threads >= 0 && !state->direct && state->async == NULL && gz_workers_init(state) == -1) {
+        zng_free(state->in);
+        return -1;
+    }
+
+    /* only need output buffer and deflate state if compressing here */
+    if (!state->direct && state->async == NULL && state->workers == NULL) {
         /* allocate output buffer */
         state->out = (unsigned char *)zng_alloc(state->want);
         if (state->out == NULL) {
@@ -56,11 +91,16 @@ static int gz_init(gz_state *state) {
         strm->next_in = NULL;
     }
 
+    /* keep several writes in flight with io_uring if requested, unless the
+       writer thread does the writing */
+    if (state->ring && state->async == NULL)
+        gz_queue_init(state, state->ring);
+
     /* mark state as initialized */
     state->size = state->want;
 
-    /* initialize write buffer if compressing */
-    if (!state->direct) {
+    /* initialize write buffer if compressing here */
+    if (!state->direct && state->async == NULL && state->workers == NULL) {
         strm->avail_out = state->size;
         strm->next_out = state->out;
         state->x.next = strm->next_out;
@@ -68,6 +108,581 @@ static int gz_init(gz_state *state) {
     return 0;
 }
 
+/* Writing on a separate thread.  The caller's input is copied into a ring of
+   buffers of state->size bytes, which the writer thread compresses and writes
+   to the file in order.  The writer thread has its own gz_state with the
+   deflate stream and output buffer, driven by gz_comp() just like the caller's
+   state is without a thread.  The buffers are only touched by the writer
+   thread while they are full, and only by the caller while they are not, with
+   the counts protected by a mutex.  Errors of the writer thread are passed on
+   to the caller's state once the thread has caught up, which gz_comp() waits
+   for when flushing. */
+typedef struct gz_async_s {
+    gz_state w;                         /* state of the writer thread */
+    int count;                          /* number of buffers */
+    unsigned char *buf[GZ_RING_MAX];
+    unsigned len[GZ_RING_MAX];          /* bytes in each full buffer */
+    int flush[GZ_RING_MAX];             /* flush after each full buffer */
+    int head;                           /* next full buffer to compress */
+    int full;                           /* number of buffers not compressed yet */
+    int failed;                         /* true once the writer thread failed */
+    int stop;                           /* true to make the writer thread exit */
+    zthread_t thread;
+    zmutex_t mutex;
+    zcond_t cond;
+} gz_async;
+
+/* Writer thread -- compress and write full buffers until stopped, dropping
+   them after an error */
+static void gz_async_run(void *arg) {
+    gz_async *async = (gz_async *)arg;
+    PREFIX3(stream) *strm = &(async->w.strm);
+    int ret = 0;
+
+    zmutex_lock(&async->mutex);
+    for (;;) {
+        while (async->full == 0 && !async->stop)
+            zcond_wait(&async->cond, &async->mutex);
+        if (async->full == 0)
+            break;
+        zmutex_unlock(&async->mutex);
+
+        if (ret == 0) {
+            strm->next_in = async->buf[async->head];
+            strm->avail_in = async->len[async->head];
+            ret = gz_comp(&(async->w), async->flush[async->head]);
+        }
+
+        zmutex_lock(&async->mutex);
+        async->head = (async->head + 1) % async->count;
+        async->full--;
+        async->failed = ret == -1;
+        zcond_broadcast(&async->cond);
+    }
+    zmutex_unlock(&async->mutex);
+}
+
+/* Free the writer state and buffers, the thread must not be running */
+static void gz_async_free(gz_async *async) {
+    int i;
+
+    if (async->w.workers != NULL) {
+        gz_workers_end(&(async->w));
+    } else if (async->w.size && !async->w.direct) {
+        (void)PREFIX(deflateEnd)(&(async->w.strm));
+        zng_free(async->w.out);
+    }
+    if (async->w.queue != NULL)
+        gz_queue_end(&(async->w));
+    gz_error(&(async->w), Z_OK, NULL);
+    for (i = 0; i < async->count; i++)
+        zng_free(async->buf[i]);
+    zng_free(async);
+}
+
+/* Start the writer thread for state.  Return -1 on a memory allocation
+   failure, 1 if no thread can be started, or 0 on success. */
+static int gz_async_init(gz_state *state) {
+    gz_async *async;
+    gz_state *w;
+    int i, ret = -1;
+
+    async = (gz_async *)zng_alloc(sizeof(gz_async));
+    if (async == NULL) {
+        gz_error(state, Z_MEM_ERROR, "out of memory");
+        return -1;
+    }
+    memset(async, 0, sizeof(gz_async));
+    async->count = MIN(state->ring, GZ_RING_MAX);
+    for (i = 0; i < async->count; i++) {
+        async->buf[i] = (unsigned char *)zng_alloc(state->want);
+        if (async->buf[i] == NULL)
+            break;
+    }
+
+    /* the writer state compresses from the ring instead of its input buffer */
+    w = &(async->w);
+    w->mode = GZ_WRITE;
+    w->fd = state->fd;
+    w->path = state->path;
+    w->want = state->want;
+    w->direct = state->direct;
+    w->threads = state->threads;
+    w->level = state->level;
+    w->strategy = state->strategy;
+    if (i == async->count && gz_init(w) == 0) {
+        zng_free(w->in);
+        w->in = NULL;
+        gz_queue_init(w, async->count);
+        if (zmutex_init(&async->mutex) == 0) {
+            if (zcond_init(&async->cond) == 0) {
+                ret = 1;
+                if (zthread_create(&async->thread, gz_async_run, async) == 0) {
+                    state->async = async;
+                    return 0;
+                }
+                zcond_destroy(&async->cond);
+            }
+            zmutex_destroy(&async->mutex);
+        }
+    }
+    gz_async_free(async);
+    if (ret == -1)
+        gz_error(state, Z_MEM_ERROR, "out of memory");
+    return ret;
+}
+
+/* Wait for the writer thread to compress and write all full buffers.  Return
+   -1 with the error of the writer thread in state if it failed, otherwise 0.
+   The mutex must be locked. */
+static int gz_async_wait(gz_state *state) {
+    gz_async *async = state->async;
+
+    while (async->full)
+        zcond_wait(&async->cond, &async->mutex);
+    if (!async->failed)
+        return 0;
+
+    /* take over the error, once */
+    if (async->w.err != Z_OK) {
+        gz_error(state, Z_OK, NULL);
+        state->err = async->w.err;
+        state->msg = async->w.msg;
+        async->w.err = Z_OK;
+        async->w.msg = NULL;
+    }
+    return -1;
+}
+
+/* Copy the input at strm->avail_in and strm->next_in to the ring for the
+   writer thread, applying flush after it, and wait for the thread to catch up
+   if flush is not Z_NO_FLUSH.  Return -1 on an error of the writer thread,
+   otherwise 0. */
+static int gz_async_comp(gz_state *state, int flush) {
+    gz_async *async = state->async;
+    PREFIX3(stream) *strm = &(state->strm);
+    int ret = 0, slot;
+    unsigned n;
+
+    zmutex_lock(&async->mutex);
+    while (strm->avail_in || flush != Z_NO_FLUSH) {
+        while (async->full == async->count && !async->failed)
+            zcond_wait(&async->cond, &async->mutex);
+        if (async->failed)
+            break;
+        slot = (async->head + async->full) % async->count;
+        zmutex_unlock(&async->mutex);
+
+        n = MIN(strm->avail_in, state->size);
+        memcpy(async->buf[slot], strm->next_in, n);
+        strm->next_in += n;
+        strm->avail_in -= n;
+
+        zmutex_lock(&async->mutex);
+        async->len[slot] = n;
+        async->flush[slot] = strm->avail_in ? Z_NO_FLUSH : flush;
+        async->full++;
+        zcond_broadcast(&async->cond);
+        if (strm->avail_in == 0)
+            break;
+    }
+    if (flush != Z_NO_FLUSH || async->failed)
+        ret = gz_async_wait(state);
+    zmutex_unlock(&async->mutex);
+    return ret;
+}
+
+/* Wait for the writer thread to finish, and free it.  Return -1 on an error
+   of the writer thread, otherwise 0. */
+static int gz_async_end(gz_state *state) {
+    gz_async *async = state->async;
+    int ret;
+
+    zmutex_lock(&async->mutex);
+    ret = gz_async_wait(state);
+    async->stop = 1;
+    zcond_broadcast(&async->cond);
+    zmutex_unlock(&async->mutex);
+    zthread_join(&async->thread);
+    zcond_destroy(&async->cond);
+    zmutex_destroy(&async->mutex);
+    gz_async_free(async);
+    state->async = NULL;
+    return ret;
+}
+
+/* Compressing with multiple threads.  The input is collected into rounds of
+   blocks of state->size bytes, which are compressed in parallel by
+   deflate_blocks() as raw deflate, each primed with the 32K of input before
+   it.  Every block but the last of a gzip member ends with a sync flush, so
+   the compressed blocks are written one after the other as a single deflate
+   stream, between a gzip header and a trailer with the combined CRC.  The
+   result is a regular gzip file, as with the approach used by pigz. */
+#define GZ_WINDOW (1 << MAX_WBITS)
+
+typedef struct gz_workers_s {
+    deflate_workers *workers;
+    deflate_block *blocks;
+    int32_t count;                      /* blocks per round */
+    unsigned char *buf;                 /* window followed by a round of input */
+    size_t have;                        /* input bytes after the window */
+    size_t dict;                        /* window bytes just before the input */
+    int started;                        /* true once the gzip header is written */
+    uint32_t check;                     /* CRC-32 of the member so far */
+    uint32_t len;                       /* length of the member so far, mod 2^32 */
+} gz_workers;
+
+/* Free the workers and buffers of state */
+static void gz_workers_end(gz_state *state) {
+    gz_workers *par = state->workers;
+
+    deflate_workers_end(par->workers);
+    free(par->blocks);
+    zng_free(par->buf);
+    zng_free(par);
+    state->workers = NULL;
+}
+
+/* Set up compressing with state->threads threads.  Return -1 on error, or 0
+   on success. */
+static int gz_workers_init(gz_state *state) {
+    gz_workers *par;
+    int32_t threads = state->threads ? state->threads : zthread_cpu_count();
+    int32_t ret;
+
+    par = (gz_workers *)zng_alloc(sizeof(gz_workers));
+    if (par == NULL) {
+        gz_error(state, Z_MEM_ERROR, "out of memory");
+        return -1;
+    }
+    memset(par, 0, sizeof(gz_workers));
+    state->workers = par;
+    ret = deflate_workers_init(&par->workers, threads, state->level, MAX_WBITS, state->strategy);
+    if (ret == Z_OK) {
+        par->count = deflate_workers_count(par->workers) * 4;
+        par->blocks = (deflate_block *)calloc((size_t)par->count, sizeof(deflate_block));
+        par->buf = (unsigned char *)zng_alloc(GZ_WINDOW + (size_t)par->count * state->want);
+        if (par->blocks == NULL || par->buf == NULL)
+            ret = Z_MEM_ERROR;
+    }
+    if (ret != Z_OK) {
+        gz_workers_end(state);
+        if (ret == Z_MEM_ERROR)
+            gz_error(state, Z_MEM_ERROR, "out of memory");
+        else
+            gz_error(state, Z_STREAM_ERROR, "invalid compression parameters");
+        return -1;
+    }
+    return 0;
+}
+
+/* Compress the collected input in parallel and write it, ending the gzip
+   member if flush is Z_FINISH.  Return -1 on error, or 0 on success. */
+static int gz_workers_round(gz_state *state, int flush) {
+    gz_workers *par = state->workers;
+    unsigned char *in = par->buf + GZ_WINDOW, head[10];
+    int32_t count, i, ret;
+    size_t keep;
+
+    /* write the gzip header at the start of a member */
+    if (!par->started) {
+        int level = state->level == Z_DEFAULT_COMPRESSION ? 6 : state->level;
+
+        head[0] = 31;
+        head[1] = 139;
+        head[2] = 8;
+        memset(head + 3, 0, 5);
+        head[8] = level >= 9 ? 2 : (state->strategy >= Z_HUFFMAN_ONLY || level < 2 ? 4 : 0);
+        head[9] = OS_CODE;
+        if (gz_put(state, head, 10) == -1)
+            return -1;
+        par->started = 1;
+        par->check = CRC32_INITIAL_VALUE;
+        par->len = 0;
+        par->dict = 0;
+    }
+
+    /* compress, a flush without input still gets an empty block */
+    count = par->have ? (int32_t)((par->have - 1) / state->size + 1) : 1;
+    for (i = 0; i < count; i++) {
+        par->blocks[i].in = in + (size_t)i * state->size;
+        par->blocks[i].in_len = MIN(state->size, par->have - (size_t)i * state->size);
+        par->blocks[i].dict_len = par->dict + (size_t)i * state->size;
+        par->blocks[i].last = flush == Z_FINISH && i == count - 1;
+    }
+    ret = deflate_blocks(par->workers, par->blocks, count, PARALLEL_CHECK_CRC);
+    if (ret != Z_OK) {
+        deflate_blocks_free(par->blocks, count);
+        if (ret == Z_MEM_ERROR)
+            gz_error(state, Z_MEM_ERROR, "out of memory");
+        else
+            gz_error(state, Z_STREAM_ERROR, "internal error: deflate stream corrupt");
+        return -1;
+    }
+
+    /* write the blocks in order */
+    for (i = 0; i < count; i++) {
+        if (gz_put(state, par->blocks[i].out, par->blocks[i].out_len) == -1) {
+            deflate_blocks_free(par->blocks, count);
+            return -1;
+        }
+        par->check = PREFIX(crc32_combine)(par->check, par->blocks[i].check, (z_off64_t)par->blocks[i].in_len);
+        par->len += (uint32_t)par->blocks[i].in_len;
+    }
+    deflate_blocks_free(par->blocks, count);
+
+    /* keep the end of the input as window for the next round, unless the
+       history is to be forgotten */
+    keep = flush == Z_FULL_FLUSH ? 0 : MIN(par->dict + par->have, GZ_WINDOW);
+    memmove(par->buf + GZ_WINDOW - keep, in + par->have - keep, keep);
+    par->dict = keep;
+    par->have = 0;
+
+    /* write the gzip trailer at the end of a member */
+    if (flush == Z_FINISH) {
+        for (i = 0; i < 4; i++) {
+            head[i] = (unsigned char)(par->check >> (8 * i));
+            head[i + 4] = (unsigned char)(par->len >> (8 * i));
+        }
+        if (gz_put(state, head, 8) == -1)
+            return -1;
+        par->started = 0;
+    }
+    return 0;
+}
+
+/* Collect the input at strm->avail_in and strm->next_in, compressing every
+   full round of blocks, and then compress the rest if flush is not
+   Z_NO_FLUSH.  Return -1 on error, or 0 on success. */
+static int gz_workers_comp(gz_state *state, int flush) {
+    gz_workers *par = state->workers;
+    PREFIX3(stream) *strm = &(state->strm);
+    size_t room = (size_t)par->count * state->size;
+
+    /* check for a pending reset */
+    if (state->reset) {
+        /* don't start a new gzip member unless there is data to write */
+        if (strm->avail_in == 0)
+            return 0;
+        state->reset = 0;
+    }
+
+    while (strm->avail_in) {
+        unsigned n = (unsigned)MIN(strm->avail_in, room - par->have);
+
+        memcpy(par->buf + GZ_WINDOW + par->have, strm->next_in, n);
+        par->have += n;
+        strm->next_in += n;
+        strm->avail_in -= n;
+        if (par->have == room && gz_workers_round(state, Z_NO_FLUSH) == -1)
+            return -1;
+    }
+    if (flush != Z_NO_FLUSH && gz_workers_round(state, flush) == -1)
+        return -1;
+
+    /* if that completed a gzip member, allow another to start */
+    if (flush == Z_FINISH)
+        state->reset = 1;
+    return 0;
+}
+
+/* Flush the collected input and start using level and strategy.  Return -1 on
+   error, or 0 on success. */
+static int gz_workers_params(gz_state *state, int level, int strategy) {
+    gz_workers *par = state->workers;
+    deflate_workers *workers;
+    int32_t ret;
+
+    if (par->have && gz_workers_round(state, Z_BLOCK) == -1)
+        return -1;
+    ret = deflate_workers_init(&workers, deflate_workers_count(par->workers), level, MAX_WBITS, strategy);
+    if (ret != Z_OK) {
+        if (ret == Z_MEM_ERROR)
+            gz_error(state, Z_MEM_ERROR, "out of memory");
+        else
+            gz_error(state, Z_STREAM_ERROR, "invalid compression parameters");
+        return -1;
+    }
+    deflate_workers_end(par->workers);
+    par->workers = workers;
+    return 0;
+}
+
+/* Change the compression parameters of state for subsequent input.  Return -1
+   on error, or 0 on success. */
+static int gz_params(gz_state *state, int level, int strategy) {
+    if (state->workers != NULL) {
+        if (gz_workers_params(state, level, strategy) == -1)
+            return -1;
+    } else {
+        PREFIX(deflateParams)(&(state->strm), level, strategy);
+    }
+    state->level = level;
+    state->strategy = strategy;
+    return 0;
+}
+
+/* Writing with io_uring.  What is written is copied into a ring of buffers of
+   state->size bytes, and written from there at explicit file offsets, so that
+   several writes are in flight while compressing goes on.  A buffer is reused
+   once its write has completed.  Errors are returned by the write after the
+   failed one, or when waiting for the writes to complete on a flush. */
+typedef struct gz_queue_s {
+    gz_uring *uring;
+    int count;                          /* number of buffers */
+    unsigned char *buf[GZ_RING_MAX];
+    unsigned len[GZ_RING_MAX];          /* bytes to write from each buffer */
+    unsigned done[GZ_RING_MAX];         /* bytes written from each buffer */
+    z_off64_t off[GZ_RING_MAX];         /* file offset of each buffer */
+    int busy[GZ_RING_MAX];              /* true while a write from a buffer is in flight */
+    int inflight;                       /* number of writes in flight */
+    int next;                           /* next buffer to fill */
+    z_off64_t pos;                      /* file offset after what was queued */
+} gz_queue;
+
+/* Set up writing state->fd with io_uring, with count buffers.  Leave
+   state->queue NULL to write with write() if that is not possible. */
+static void gz_queue_init(gz_state *state, int count) {
+    gz_queue *queue;
+    int i;
+
+    queue = (gz_queue *)zng_alloc(sizeof(gz_queue));
+    if (queue == NULL)
+        return;
+    memset(queue, 0, sizeof(gz_queue));
+    queue->count = MIN(count, GZ_RING_MAX);
+    queue->pos = LSEEK(state->fd, 0, SEEK_CUR);
+    for (i = 0; i < queue->count; i++) {
+        queue->buf[i] = (unsigned char *)zng_alloc(state->want);
+        if (queue->buf[i] == NULL)
+            break;
+    }
+    if (i < queue->count || gz_uring_init(&queue->uring, state->fd, (unsigned)queue->count) == -1) {
+        while (i--)
+            zng_free(queue->buf[i]);
+        zng_free(queue);
+        return;
+    }
+    state->queue = queue;
+}
+
+/* Wait for a write to complete, and write the rest of its buffer if it came
+   up short.  Return -1 on error, or 0 on success. */
+static int gz_queue_reap(gz_state *state) {
+    gz_queue *queue = state->queue;
+    unsigned i;
+    int32_t res;
+
+    if (gz_uring_wait(queue->uring, &i, &res) == -1) {
+        gz_error(state, Z_ERRNO, zstrerror());
+        return -1;
+    }
+    queue->busy[i] = 0;
+    queue->inflight--;
+    if (res <= 0) {
+        errno = res ? -res : EIO;
+        gz_error(state, Z_ERRNO, zstrerror());
+        return -1;
+    }
+    queue->done[i] += (unsigned)res;
+    if (queue->done[i] < queue->len[i]) {
+        if (gz_uring_submit(queue->uring, GZ_URING_WRITE, queue->buf[i] + queue->done[i],
+                            queue->len[i] - queue->done[i], queue->off[i] + queue->done[i], i) == -1) {
+            gz_error(state, Z_ERRNO, zstrerror());
+            return -1;
+        }
+        queue->busy[i] = 1;
+        queue->inflight++;
+    }
+    return 0;
+}
+
+/* Queue writing len bytes from buf, waiting for buffers to be written as
+   needed.  Return -1 on error, or 0 on success. */
+static int gz_queue_put(gz_state *state, const unsigned char *buf, size_t len) {
+    gz_queue *queue = state->queue;
+    int i;
+
+    while (len) {
+        unsigned n = (unsigned)MIN(len, state->want);
+
+        i = queue->next;
+        while (queue->busy[i])
+            if (gz_queue_reap(state) == -1)
+                return -1;
+        memcpy(queue->buf[i], buf, n);
+        queue->len[i] = n;
+        queue->done[i] = 0;
+        queue->off[i] = queue->pos;
+        if (gz_uring_submit(queue->uring, GZ_URING_WRITE, queue->buf[i], n, queue->pos, (unsigned)i) == -1) {
+            gz_error(state, Z_ERRNO, zstrerror());
+            return -1;
+        }
+        queue->busy[i] = 1;
+        queue->inflight++;
+        queue->pos += n;
+        queue->next = (i + 1) % queue->count;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* If writing with io_uring and flush is not Z_NO_FLUSH, wait for all writes to
+   complete, and move the file offset to the end of what was written, so that
+   a flush leaves the file as write() would.  Return -1 on error, or 0 on
+   success. */
+static int gz_queue_sync(gz_state *state, int flush) {
+    gz_queue *queue = state->queue;
+
+    if (queue == NULL || flush == Z_NO_FLUSH)
+        return 0;
+    while (queue->inflight)
+        if (gz_queue_reap(state) == -1)
+            return -1;
+    if (LSEEK(state->fd, queue->pos, SEEK_SET) == -1) {
+        gz_error(state, Z_ERRNO, zstrerror());
+        return -1;
+    }
+    return 0;
+}
+
+/* Wait for the writes in flight, ignoring errors, and free the queue */
+static void gz_queue_end(gz_state *state) {
+    gz_queue *queue = state->queue;
+    unsigned i;
+    int32_t res;
+    int n;
+
+    while (queue->inflight && gz_uring_wait(queue->uring, &i, &res) == 0)
+        queue->inflight--;
+    gz_uring_end(queue->uring);
+    for (n = 0; n < queue->count; n++)
+        zng_free(queue->buf[n]);
+    zng_free(queue);
+    state->queue = NULL;
+}
+
+/* Write len bytes from buf to the output file.  Return -1 on error, or 0 on
+   success. */
+static int gz_put(gz_state *state, const unsigned char *buf, size_t len) {
+    ssize_t got;
+
+    if (state->queue != NULL)
+        return gz_queue_put(state, buf, len);
+    while (len) {
+        unsigned n = (unsigned)MIN(len, (unsigned)-1 >> 1);
+        got = write(state->fd, buf, n);
+        if (got < 0 || (unsigned)got != n) {
+            gz_error(state, Z_ERRNO, zstrerror());
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
 /* Compress whatever is at avail_in and next_in and write to the output file.
    Return -1 if there is an error writing to the output file or if gz_init()
    fails to allocate memory, otherwise 0.  flush is assumed to be a valid
@@ -76,7 +691,6 @@ static int gz_init(gz_state *state) {
    to the output file without compressing, and ignore flush. */
 static int gz_comp(gz_state *state, int flush) {
     int ret;
-    ssize_t got;
     unsigned have;
     PREFIX3(stream) *strm = &(state->strm);
 
@@ -84,15 +698,20 @@ static int gz_comp(gz_state *state, int flush) {
     if (state->size == 0 && gz_init(state) == -1)
         return -1;
 
+    /* leave the rest to the writer thread if there is one */
+    if (state->async != NULL)
+        return gz_async_comp(state, flush);
+
+    /* compress with multiple threads if requested */
+    if (state->workers != NULL)
+        return gz_workers_comp(state, flush) == -1 ? -1 : gz_queue_sync(state, flush);
+
     /* write directly if requested */
     if (state->direct) {
-        got = write(state->fd, strm->next_in, strm->avail_in);
-        if (got < 0 || (unsigned)got != strm->avail_in) {
-            gz_error(state, Z_ERRNO, zstrerror());
+        if (gz_put(state, strm->next_in, strm->avail_in) == -1)
             return -1;
-        }
         strm->avail_in = 0;
-        return 0;
+        return gz_queue_sync(state, flush);
     }
 
     /* check for a pending reset */
@@ -111,10 +730,8 @@ static int gz_comp(gz_state *state, int flush) {
            doing Z_FINISH then don't write until we get to Z_STREAM_END */
         if (strm->avail_out == 0 || (flush != Z_NO_FLUSH && (flush != Z_FINISH || ret == Z_STREAM_END))) {
             have = (unsigned)(strm->next_out - state->x.next);
-            if (have && ((got = write(state->fd, state->x.next, (unsigned long)have)) < 0 || (unsigned)got != have)) {
-                gz_error(state, Z_ERRNO, zstrerror());
+            if (have && gz_put(state, state->x.next, have) == -1)
                 return -1;
-            }
             if (strm->avail_out == 0) {
                 strm->avail_out = state->size;
                 strm->next_out = state->out;
@@ -136,8 +753,8 @@ static int gz_comp(gz_state *state, int flush) {
     /* if that completed a deflate stream, allow another to start */
     if (flush == Z_FINISH)
         state->reset = 1;
-    /* all done, no errors */
-    return 0;
+    /* all done, no errors once written */
+    return gz_queue_sync(state, flush);
 }
 
 /* Compress len zeros to output.  Return -1 on a write error or memory
@@ -482,7 +1099,23 @@ int Z_EXPORT PREFIX(gzsetparams)(gzFile file, int level, int strategy) {
         /* flush previous input with previous parameters before changing */
         if (strm->avail_in && gz_comp(state, Z_BLOCK) == -1)
             return state->err;
-        PREFIX(deflateParams)(strm, level, strategy);
+        if (state->async != NULL) {
+            /* change them for the writer thread once it has caught up */
+            gz_async *async = state->async;
+            int ret;
+
+            zmutex_lock(&async->mutex);
+            ret = gz_async_wait(state);
+            if (ret == 0 && gz_params(&(async->w), level, strategy) == -1) {
+                async->failed = 1;
+                ret = gz_async_wait(state);
+            }
+            zmutex_unlock(&async->mutex);
+            if (ret == -1)
+                return state->err;
+        } else if (gz_params(state, level, strategy) == -1) {
+            return state->err;
+        }
     }
     state->level = level;
     state->strategy = strategy;
@@ -513,13 +1146,19 @@ int Z_EXPORT PREFIX(gzclose_w)(gzFile file) {
     /* flush, free memory, and close file */
     if (gz_comp(state, Z_FINISH) == -1)
         ret = state->err;
-    if (state->size) {
-        if (!state->direct) {
-            (void)PREFIX(deflateEnd)(&(state->strm));
-            zng_free(state->out);
-        }
-        zng_free(state->in);
+    if (state->async != NULL) {
+        if (gz_async_end(state) == -1)
+            ret = state->err;
+    } else if (state->workers != NULL) {
+        gz_workers_end(state);
+    } else if (state->size && !state->direct) {
+        (void)PREFIX(deflateEnd)(&(state->strm));
+        zng_free(state->out);
     }
+    if (state->queue != NULL)
+        gz_queue_end(state);
+    if (state->size)
+        zng_free(state->in);
     gz_error(state, Z_OK, NULL);
     free(state->path);
     if (close(state->fd) == -1)
@@ -49,6 +49,10 @@
       bytes, which is the maximum length that can be coded.  inflate_fast()
       requires strm->avail_out >= 258 for each loop to avoid checking for
       output space.
+    - Literals are looked up in a pair table, which decodes two literals at
+      once when both codes fit in the root table index bits.  Each loop
+      decodes up to two pair table entries before a length, so it can output
+      four literals and a 258 byte match, which is INFLATE_FAST_MIN_LEFT.
  */
 void Z_INTERNAL INFLATE_FAST(PREFIX3(stream) *strm, uint32_t start) {
     /* start: inflate()'s starting value for strm->avail_out */
@@ -107,6 +111,7 @@ void Z_INTERNAL INFLATE_FAST(PREFIX3(stream) *strm, uint32_t start) {
     uint64_t hold;              /* local strm->hold */
     unsigned bits;              /* local strm->bits */
     code const *lcode;          /* local strm->lencode */
+    code const *pcode;          /* local strm->lenpair */
     code const *dcode;          /* local strm->distcode */
     unsigned lmask;             /* mask for first level of length codes */
     unsigned dmask;             /* mask for first level of distance codes */
@@ -145,6 +150,26 @@ void Z_INTERNAL INFLATE_FAST(PREFIX3(stream) *strm, uint32_t start) {
        window is overwritten then future matches with far distances will fail to copy correctly. */
     extra_safe = (wsize != 0 && out >= window && out + INFLATE_FAST_MIN_LEFT <= window + wsize);
 
+    /* Literals are decoded in pairs, writing a second byte after each single
+       literal too.  That byte may still be needed when out is in the window, so
+       pairs are not used then. */
+    pcode = lcode;
+    if (!extra_safe) {
+        if (UNLIKELY(state->lenpair == NULL)) {
+            zng_inflate_pair_table(state->pairs, lcode, state->lenbits);
+            state->lenpair = state->pairs;
+        }
+        pcode = state->lenpair;
+    }
+
+/* Write the literal of a table entry, or both literals of a pair */
+#define PUT_LITERALS(here) do { \
+        out[0] = (unsigned char)((here)->val); \
+        if (!extra_safe) \
+            out[1] = (unsigned char)((here)->val >> 8); \
+        out += 1 + ((here)->op >> 7); \
+    } while (0)
+
 #define REFILL() do { \
         hold |= load_64_bits(in, bits); \
         in += 7; \
@@ -156,25 +181,25 @@ void Z_INTERNAL INFLATE_FAST(PREFIX3(stream) *strm, uint32_t start) {
        input data or output space */
     do {
         REFILL();
-        here = lcode + (hold & lmask);
-        if (here->op == 0) {
-            *out++ = (unsigned char)(here->val);
+        here = pcode + (hold & lmask);
+        if ((here->op & 127) == 0) {
+            PUT_LITERALS(here);
             DROPBITS(here->bits);
-            here = lcode + (hold & lmask);
-            if (here->op == 0) {
-                *out++ = (unsigned char)(here->val);
+            here = pcode + (hold & lmask);
+            if ((here->op & 127) == 0) {
+                PUT_LITERALS(here);
                 DROPBITS(here->bits);
-                here = lcode + (hold & lmask);
+                here = pcode + (hold & lmask);
             }
         }
       dolen:
         DROPBITS(here->bits);
         op = here->op;
-        if (op == 0) {                          /* literal */
-            Tracevv((stderr, here->val >= 0x20 && here->val < 0x7f ?
+        if ((op & 127) == 0) {                  /* literal or pair of literals */
+            Tracevv((stderr, (here->val & 0xff) >= 0x20 && (here->val & 0xff) < 0x7f ?
                     "inflate:         literal '%c'\n" :
-                    "inflate:         literal 0x%02x\n", here->val));
-            *out++ = (unsigned char)(here->val);
+                    "inflate:         literal 0x%02x\n", here->val & 0xff));
+            PUT_LITERALS(here);
         } else if (op & 16) {                     /* length base */
             len = here->val;
             op &= MAX_BITS;                       /* number of extra bits */
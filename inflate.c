@@ -10,6 +10,7 @@
 #include "inflate_p.h"
 #include "inffixed_tbl.h"
 #include "functable.h"
+#include "state_pool.h"
 #include "zutil.h"      // cpu_check_features()
 
 /* Avoid conflicts with zlib.h macros */
@@ -79,6 +80,7 @@ int32_t Z_EXPORT PREFIX(inflateResetKeep)(PREFIX3(stream) *strm) {
     state->hold = 0;
     state->bits = 0;
     state->lencode = state->distcode = state->next = state->codes;
+    state->lenpair = NULL;
     state->sane = 1;
     state->back = -1;
     INFLATE_RESET_KEEP_HOOK(strm);  /* hook for IBM Z DFLTCC */
@@ -121,13 +123,9 @@ int32_t Z_EXPORT PREFIX(inflateReset2)(PREFIX3(stream) *strm, int32_t windowBits
 #endif
     }
 
-    /* set number of window bits, free window if different */
+    /* set number of window bits, the window always has room for the largest */
     if (windowBits && (windowBits < MIN_WBITS || windowBits > MAX_WBITS))
         return Z_STREAM_ERROR;
-    if (state->window != NULL && state->wbits != (unsigned)windowBits) {
-        ZFREE_WINDOW(strm, state->window);
-        state->window = NULL;
-    }
 
     /* update state and reset the rest of it */
     state->wrap = wrap;
@@ -135,8 +133,52 @@ int32_t Z_EXPORT PREFIX(inflateReset2)(PREFIX3(stream) *strm, int32_t windowBits
     return PREFIX(inflateReset)(strm);
 }
 
-/* This function is hidden in ZLIB_COMPAT builds. */
-int32_t ZNG_CONDEXPORT PREFIX(inflateInit2)(PREFIX3(stream) *strm, int32_t windowBits) {
+/*
+   Allocate the inflate state together with a window large enough for any
+   windowBits, so that a stream needs a single allocator call and the window
+   never has to be allocated while inflating.  The state is cleared, the window
+   is not.  If pool is not NULL, the block is taken from it instead of the
+   allocator.
+ */
+#define ARENA_PAD(size) (((size) + 63) & ~(size_t)63)
+
+static struct inflate_state *alloc_inflate(PREFIX3(stream) *strm, state_pool *pool) {
+    uint32_t chunksize = functable.chunksize();
+    size_t window_pos, size;
+    unsigned char *arena;
+    struct inflate_state *state;
+
+    window_pos = ARENA_PAD(INFLATE_STATE_SIZE);
+    size = window_pos + (INFLATE_WINDOW_ALIGN - 64) + INFLATE_ADJUST_WINDOW_SIZE((1U << MAX_WBITS) + chunksize);
+
+    if (pool != NULL)
+        arena = (unsigned char *)state_pool_get(pool, size);
+    else
+        arena = (unsigned char *)ZALLOC(strm, 1, (unsigned)size);
+    if (arena == NULL)
+        return NULL;
+    state = (struct inflate_state *)arena;
+    memset(state, 0, sizeof(*state));
+    state->pool = pool;
+    state->chunksize = chunksize;
+    /* ZALLOC aligns the arena to 64 bytes, the window may need more */
+    window_pos += (INFLATE_WINDOW_ALIGN - ((uintptr_t)(arena + window_pos) & (INFLATE_WINDOW_ALIGN - 1))) &
+                  (INFLATE_WINDOW_ALIGN - 1);
+    state->window = arena + window_pos;
+    return state;
+}
+
+static void free_inflate(PREFIX3(stream) *strm) {
+    struct inflate_state *state = (struct inflate_state *)strm->state;
+
+    if (state->pool != NULL)
+        state_pool_put(state);
+    else
+        ZFREE(strm, state);
+    strm->state = NULL;
+}
+
+static int32_t inflate_init(PREFIX3(stream) *strm, int32_t windowBits, state_pool *pool) {
     int32_t ret;
     struct inflate_state *state;
 
@@ -149,29 +191,47 @@ int32_t ZNG_CONDEXPORT PREFIX(inflateInit2)(PREFIX3(stream) *strm, int32_t windo
     }
     if (strm->zfree == NULL)
         strm->zfree = PREFIX(zcfree);
-    state = ZALLOC_INFLATE_STATE(strm);
+    state = alloc_inflate(strm, pool);
     if (state == NULL)
         return Z_MEM_ERROR;
     Tracev((stderr, "inflate: allocated\n"));
-    memset(state, 0, sizeof(*state));
     strm->state = (struct internal_state *)state;
     state->strm = strm;
-    state->window = NULL;
+    state->rootbits = INFLATE_ROOT_BITS;
     state->mode = HEAD;     /* to pass state test in inflateReset2() */
     state->check = 1L;      /* 1L is the result of adler32() zero length data */
-    state->chunksize = functable.chunksize();
     ret = PREFIX(inflateReset2)(strm, windowBits);
-    if (ret != Z_OK) {
-        ZFREE_STATE(strm, state);
-        strm->state = NULL;
-    }
+    if (ret != Z_OK)
+        free_inflate(strm);
     return ret;
 }
 
+/* This function is hidden in ZLIB_COMPAT builds. */
+int32_t ZNG_CONDEXPORT PREFIX(inflateInit2)(PREFIX3(stream) *strm, int32_t windowBits) {
+    return inflate_init(strm, windowBits, NULL);
+}
+
 #ifndef ZLIB_COMPAT
 int32_t Z_EXPORT PREFIX(inflateInit)(PREFIX3(stream) *strm) {
     return PREFIX(inflateInit2)(strm, DEF_WBITS);
 }
+
+PREFIX(inflate_pool) * Z_EXPORT PREFIX(inflatePoolCreate)(uint32_t maxStates) {
+    return (PREFIX(inflate_pool) *)state_pool_create(maxStates);
+}
+
+int32_t Z_EXPORT PREFIX(inflatePoolDestroy)(PREFIX(inflate_pool) *pool) {
+    if (pool == NULL)
+        return Z_STREAM_ERROR;
+    state_pool_destroy((state_pool *)pool);
+    return Z_OK;
+}
+
+int32_t Z_EXPORT PREFIX(inflateInitPool)(PREFIX3(stream) *strm, int32_t windowBits, PREFIX(inflate_pool) *pool) {
+    if (pool == NULL)
+        return Z_STREAM_ERROR;
+    return inflate_init(strm, windowBits, (state_pool *)pool);
+}
 #endif
 
 /* Function used by zlib.h and zlib-ng version 2.0 macros */
@@ -217,31 +277,24 @@ int32_t Z_EXPORT PREFIX(inflatePrime)(PREFIX3(stream) *strm, int32_t bits, int32
 
 void Z_INTERNAL PREFIX(fixedtables)(struct inflate_state *state) {
     state->lencode = lenfix;
+    state->lenpair = lenfix;    /* fixed literal codes are too long to pair */
     state->lenbits = 9;
     state->distcode = distfix;
     state->distbits = 5;
 }
 
 int Z_INTERNAL PREFIX(inflate_ensure_window)(struct inflate_state *state) {
-    /* if it hasn't been done already, allocate space for the window */
-    if (state->window == NULL) {
-        unsigned wsize = 1U << state->wbits;
-        state->window = (unsigned char *)ZALLOC_WINDOW(state->strm, wsize + state->chunksize, sizeof(unsigned char));
-        if (state->window == NULL)
-            return Z_MEM_ERROR;
-#ifdef Z_MEMORY_SANITIZER
-        /* This is _not_ to subvert the memory sanitizer but to instead unposion some
-           data we willingly and purposefully load uninitialized into vector registers
-           in order to safely read the last < chunksize bytes of the window. */
-        __msan_unpoison(state->window + wsize, state->chunksize);
-#endif
-    }
-
     /* if window not in use yet, initialize */
     if (state->wsize == 0) {
         state->wsize = 1U << state->wbits;
         state->wnext = 0;
         state->whave = 0;
+#ifdef Z_MEMORY_SANITIZER
+        /* This is _not_ to subvert the memory sanitizer but to instead unposion some
+           data we willingly and purposefully load uninitialized into vector registers
+           in order to safely read the last < chunksize bytes of the window. */
+        __msan_unpoison(state->window + state->wsize, state->chunksize);
+#endif
     }
 
     return Z_OK;
@@ -835,18 +888,20 @@ int32_t Z_EXPORT PREFIX(inflate)(PREFIX3(stream) *strm, int32_t flush) {
             }
 
             /* build code tables -- note: do not change the lenbits or distbits
-               values here (10 and 9) without reading the comments in inftrees.h
-               concerning the ENOUGH constants, which depend on those values */
+               values here (rootbits and one less) without reading the comments
+               in inftrees.h concerning the ENOUGH constants, which depend on
+               those values */
             state->next = state->codes;
             state->lencode = (const code *)(state->next);
-            state->lenbits = 10;
+            state->lenpair = NULL;
+            state->lenbits = state->rootbits;
             ret = zng_inflate_table(LENS, state->lens, state->nlen, &(state->next), &(state->lenbits), state->work);
             if (ret) {
                 SET_BAD("invalid literal/lengths set");
                 break;
             }
             state->distcode = (const code *)(state->next);
-            state->distbits = 9;
+            state->distbits = state->rootbits - 1;
             ret = zng_inflate_table(DISTS, state->lens + state->nlen, state->ndist,
                             &(state->next), &(state->distbits), state->work);
             if (ret) {
@@ -1144,14 +1199,9 @@ int32_t Z_EXPORT PREFIX(inflate)(PREFIX3(stream) *strm, int32_t flush) {
 }
 
 int32_t Z_EXPORT PREFIX(inflateEnd)(PREFIX3(stream) *strm) {
-    struct inflate_state *state;
     if (inflateStateCheck(strm))
         return Z_STREAM_ERROR;
-    state = (struct inflate_state *)strm->state;
-    if (state->window != NULL)
-        ZFREE_WINDOW(strm, state->window);
-    ZFREE_STATE(strm, strm->state);
-    strm->state = NULL;
+    free_inflate(strm);
     Tracev((stderr, "inflate: end\n"));
     return Z_OK;
 }
@@ -1328,6 +1378,7 @@ int32_t Z_EXPORT PREFIX(inflateSyncPoint)(PREFIX3(stream) *strm) {
 int32_t Z_EXPORT PREFIX(inflateCopy)(PREFIX3(stream) *dest, PREFIX3(stream) *source) {
     struct inflate_state *state;
     struct inflate_state *copy;
+    unsigned char *window;
 
     /* check input */
     if (inflateStateCheck(source) || dest == NULL)
@@ -1335,30 +1386,28 @@ int32_t Z_EXPORT PREFIX(inflateCopy)(PREFIX3(stream) *dest, PREFIX3(stream) *sou
     state = (struct inflate_state *)source->state;
 
     /* allocate space */
-    copy = ZALLOC_INFLATE_STATE(source);
+    copy = alloc_inflate(source, NULL);
     if (copy == NULL)
         return Z_MEM_ERROR;
-    memset(copy, 0, sizeof(*copy));
+    window = copy->window;
 
     /* copy state */
     memcpy((void *)dest, (void *)source, sizeof(PREFIX3(stream)));
     ZCOPY_INFLATE_STATE(copy, state);
     copy->strm = dest;
+    copy->pool = NULL;
+    copy->window = window;
     if (state->lencode >= state->codes && state->lencode <= state->codes + ENOUGH - 1) {
         copy->lencode = copy->codes + (state->lencode - state->codes);
         copy->distcode = copy->codes + (state->distcode - state->codes);
     }
     copy->next = copy->codes + (state->next - state->codes);
+    if (state->lenpair == state->pairs)
+        copy->lenpair = copy->pairs;
 
     /* window */
-    if (state->window != NULL) {
-        copy->window = NULL;
-        if (PREFIX(inflate_ensure_window)(copy)) {
-            ZFREE_STATE(source, copy);
-            return Z_MEM_ERROR;
-        }
+    if (state->wsize != 0)
         ZCOPY_WINDOW(copy->window, state->window, (size_t)state->wsize);
-    }
 
     dest->state = (struct internal_state *)copy;
     return Z_OK;
@@ -1393,6 +1442,20 @@ int32_t Z_EXPORT PREFIX(inflateValidate)(PREFIX3(stream) *strm, int32_t check) {
     return Z_OK;
 }
 
+#ifndef ZLIB_COMPAT
+int32_t Z_EXPORT PREFIX(inflateRootBits)(PREFIX3(stream) *strm, int32_t bits) {
+    struct inflate_state *state;
+
+    if (inflateStateCheck(strm))
+        return Z_STREAM_ERROR;
+    if (bits < INFLATE_MIN_ROOT_BITS || bits > INFLATE_MAX_ROOT_BITS)
+        return Z_STREAM_ERROR;
+    state = (struct inflate_state *)strm->state;
+    state->rootbits = (unsigned)bits;
+    return Z_OK;
+}
+#endif
+
 long Z_EXPORT PREFIX(inflateMark)(PREFIX3(stream) *strm) {
     struct inflate_state *state;
 
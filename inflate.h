@@ -82,10 +82,11 @@ typedef enum {
         CHECK -> LENGTH -> DONE
  */
 
-/* State maintained between inflate() calls -- approximately 7K bytes, not
-   including the allocated sliding window, which is up to 32K bytes. */
+/* State maintained between inflate() calls -- approximately 23K bytes, not
+   including the sliding window, which is up to 32K bytes. */
 struct inflate_state {
     PREFIX3(stream) *strm;             /* pointer back to this zlib stream */
+    struct state_pool_s *pool;  /* pool the state was taken from, or NULL */
     inflate_mode mode;          /* current inflate mode */
     int last;                   /* true if processing last block */
     int wrap;                   /* bit 0 true for zlib, bit 1 true for gzip,
@@ -102,7 +103,7 @@ struct inflate_state {
     uint32_t wsize;             /* window size or zero if not using window */
     uint32_t whave;             /* valid bytes in the window */
     uint32_t wnext;             /* window write index */
-    unsigned char *window;      /* allocated sliding window, if needed */
+    unsigned char *window;      /* sliding window, allocated with the state */
 
     struct crc32_fold_s ALIGNED_(16) crc_fold;
 
@@ -117,8 +118,11 @@ struct inflate_state {
         /* fixed and dynamic code tables */
     code const *lencode;        /* starting table for length/literal codes */
     code const *distcode;       /* starting table for distance codes */
+    code const *lenpair;        /* root of lencode decoding literal pairs, NULL
+                                   until inflate_fast() builds it */
     unsigned lenbits;           /* index bits for lencode */
     unsigned distbits;          /* index bits for distcode */
+    unsigned rootbits;          /* root table bits for dynamic lencode */
         /* dynamic table building */
     unsigned ncode;             /* number of code length code lengths */
     unsigned nlen;              /* number of length code lengths */
@@ -128,6 +132,7 @@ struct inflate_state {
     uint16_t lens[320];         /* temporary storage for code lengths */
     uint16_t work[288];         /* work area for code table building */
     code codes[ENOUGH];         /* space for code tables */
+    code pairs[ENOUGH_PAIRS];   /* space for the pair table of lencode */
     int sane;                   /* if false, allow invalid distance too far */
     int back;                   /* bits back of last unprocessed length/lit */
     unsigned was;               /* initial length of match */
@@ -0,0 +1,481 @@
+/* inflate_index.c -- Access points for random access into deflate streams
+ *
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/*
+   An index is built by decompressing the data once with inflate(Z_BLOCK),
+   which returns at every deflate block boundary.  Whenever at least span bytes
+   of uncompressed data have been produced since the last access point, the
+   boundary is recorded along with the current window.  Resuming at an access
+   point takes a raw inflate stream, the bits left over from the previous byte
+   and the window as dictionary, so the cost of reaching an offset is bounded
+   by span plus the size of a block, whatever the position in the data.
+
+   This is the technique of examples/zran.c, kept inside the library so that
+   gzseek() can use it.
+ */
+
+#include "zbuild.h"
+#include "zutil.h"
+#include "zutil_p.h"
+#include "inftrees.h"
+#include "inflate.h"
+#include "inflate_index.h"
+
+#define INDEX_INITIAL_POINTS 8
+
+/* Adds an access point at the current position of strm, which inflate(Z_BLOCK)
+   just left at a block boundary */
+static int32_t add_point(inflate_index *index, PREFIX3(stream) *strm, z_off64_t in, z_off64_t out) {
+    struct inflate_state *state = (struct inflate_state *)strm->state;
+    index_point *point;
+
+    if (index->have == index->size) {
+        uint32_t size = index->size ? index->size << 1 : INDEX_INITIAL_POINTS;
+        index_point *list = (index_point *)zng_alloc(size * sizeof(index_point));
+        if (list == NULL)
+            return Z_MEM_ERROR;
+        if (index->have)
+            memcpy(list, index->list, index->have * sizeof(index_point));
+        zng_free(index->list);
+        index->list = list;
+        index->size = size;
+    }
+
+    point = index->list + index->have;
+    point->out = out;
+    point->in = in;
+    point->bits = strm->data_type & 7;
+    point->value = point->bits ? state->hold & ((1U << point->bits) - 1) : 0;
+    point->wsize = 0;
+    point->window = NULL;
+    PREFIX(inflateGetDictionary)(strm, NULL, &point->wsize);
+    if (point->wsize) {
+        point->window = (unsigned char *)zng_alloc(point->wsize);
+        if (point->window == NULL)
+            return Z_MEM_ERROR;
+        PREFIX(inflateGetDictionary)(strm, point->window, &point->wsize);
+    }
+    index->have++;
+    return Z_OK;
+}
+
+int32_t Z_INTERNAL inflate_index_build(in_func in, void *in_desc, int32_t windowBits, z_off64_t span,
+                                      inflate_index **index_out) {
+    PREFIX3(stream) strm;
+    inflate_index *index;
+    unsigned char *discard;
+    z_off64_t totin = 0, totout = 0, last = 0;
+    int32_t ret;
+
+    *index_out = NULL;
+    if (span < 1)
+        return Z_STREAM_ERROR;
+
+    index = (inflate_index *)zng_alloc(sizeof(inflate_index));
+    discard = (unsigned char *)zng_alloc(1U << MAX_WBITS);
+    if (index == NULL || discard == NULL) {
+        zng_free(discard);
+        zng_free(index);
+        return Z_MEM_ERROR;
+    }
+    memset(index, 0, sizeof(inflate_index));
+    index->span = span;
+
+    memset(&strm, 0, sizeof(strm));
+    ret = PREFIX(inflateInit2)(&strm, windowBits);
+    if (ret != Z_OK) {
+        zng_free(discard);
+        zng_free(index);
+        return ret;
+    }
+
+    /* Raw data has no header for inflate(Z_BLOCK) to stop after */
+    if (windowBits < 0)
+        ret = add_point(index, &strm, 0, 0);
+
+    while (ret == Z_OK) {
+        /* A raw stream may end without further input after the last block */
+        if (strm.avail_in == 0)
+            strm.avail_in = in(in_desc, &strm.next_in);
+
+        /* Inflate until the end of a block, the end of the stream, or until the
+           input or the output runs out */
+        strm.next_out = discard;
+        strm.avail_out = 1U << MAX_WBITS;
+        totin += strm.avail_in;
+        totout += strm.avail_out;
+        ret = PREFIX(inflate)(&strm, Z_BLOCK);
+        totin -= strm.avail_in;
+        totout -= strm.avail_out;
+        if (ret == Z_NEED_DICT)
+            ret = Z_DATA_ERROR;
+        if (ret == Z_MEM_ERROR || ret == Z_DATA_ERROR || ret == Z_BUF_ERROR)
+            break;                          /* Z_BUF_ERROR: data ends early */
+
+        /* At the start of a block that is not past the last one, which excludes
+           the end of the header */
+        if ((strm.data_type & 128) && !(strm.data_type & 64) && (index->have == 0 || totout - last >= span)) {
+            ret = add_point(index, &strm, totin, totout);
+            if (ret != Z_OK)
+                break;
+            last = totout;
+        }
+
+        if (ret == Z_STREAM_END) {
+            struct inflate_state *state = (struct inflate_state *)strm.state;
+
+            index->gzip = state->flags > 0;
+            if (!index->gzip)
+                break;
+
+            /* Look for another gzip member */
+            if (strm.avail_in == 0)
+                strm.avail_in = in(in_desc, &strm.next_in);
+            if (strm.avail_in == 0 || strm.next_in[0] != 31 || (strm.avail_in > 1 && strm.next_in[1] != 139))
+                break;
+            PREFIX(inflateReset)(&strm);
+            ret = Z_OK;
+        }
+    }
+
+    PREFIX(inflateEnd)(&strm);
+    zng_free(discard);
+    if (ret != Z_STREAM_END) {
+        inflate_index_free(index);
+        return ret;
+    }
+    index->length = totout;
+    *index_out = index;
+    return Z_OK;
+}
+
+const index_point Z_INTERNAL *inflate_index_find(const inflate_index *index, z_off64_t offset) {
+    uint32_t lo = 0, hi = index->have;
+
+    /* Binary search for the last point with out <= offset */
+    while (hi - lo > 1) {
+        uint32_t mid = lo + ((hi - lo) >> 1);
+        if (index->list[mid].out <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (index->have == 0 || index->list[lo].out > offset)
+        return NULL;
+    return index->list + lo;
+}
+
+int32_t Z_INTERNAL inflate_index_resume(PREFIX3(stream) *strm, const index_point *point) {
+    int32_t ret;
+
+    ret = PREFIX(inflateReset2)(strm, -MAX_WBITS);
+    if (ret == Z_OK && point->bits)
+        ret = PREFIX(inflatePrime)(strm, (int32_t)point->bits, (int32_t)point->value);
+    if (ret == Z_OK && point->wsize)
+        ret = PREFIX(inflateSetDictionary)(strm, point->window, point->wsize);
+    return ret;
+}
+
+void Z_INTERNAL inflate_index_free(inflate_index *index) {
+    if (index == NULL)
+        return;
+    for (uint32_t i = 0; i < index->have; i++)
+        zng_free(index->list[i].window);
+    zng_free(index->list);
+    zng_free(index);
+}
+
+#ifndef ZLIB_COMPAT
+int32_t Z_EXPORT PREFIX(inflateIndexBuild)(in_func in, void *in_desc, int32_t windowBits, z_off64_t span,
+                                           PREFIX(inflate_index) **index) {
+    if (in == NULL || index == NULL)
+        return Z_STREAM_ERROR;
+    return inflate_index_build(in, in_desc, windowBits, span, (inflate_index **)index);
+}
+
+int32_t Z_EXPORT PREFIX(inflateIndexSeek)(PREFIX3(stream) *strm, const PREFIX(inflate_index) *index,
+                                          z_off64_t offset, z_off64_t *in_offset, z_off64_t *skip) {
+    const inflate_index *idx = (const inflate_index *)index;
+    const index_point *point;
+    int32_t ret;
+
+    if (idx == NULL || in_offset == NULL || skip == NULL || offset < 0 || offset > idx->length)
+        return Z_STREAM_ERROR;
+    point = inflate_index_find(idx, offset);
+    if (point == NULL)
+        return Z_STREAM_ERROR;
+    ret = inflate_index_resume(strm, point);
+    if (ret != Z_OK)
+        return ret;
+    *in_offset = point->in;
+    *skip = offset - point->out;
+    return Z_OK;
+}
+
+z_off64_t Z_EXPORT PREFIX(inflateIndexLength)(const PREFIX(inflate_index) *index) {
+    if (index == NULL)
+        return -1;
+    return ((const inflate_index *)index)->length;
+}
+
+int32_t Z_EXPORT PREFIX(inflateIndexFree)(PREFIX(inflate_index) *index) {
+    if (index == NULL)
+        return Z_STREAM_ERROR;
+    inflate_index_free((inflate_index *)index);
+    return Z_OK;
+}
+
+/* Saved indexes are little-endian and laid out for use in place:
+
+     header   32 bytes: "ZNGX", version (2), flags (2), number of points (4),
+                        CRC-32 of the point table (4), span (8), length (8)
+     table    32 bytes per point: out (8), in (8), offset of the window in the
+                        file (8), compressed window size (4), window size (2),
+                        bits (1), value (1)
+     windows  each window as a raw deflate stream
+
+   Flag 1 is set when the points are inside gzip members. */
+#define INDEX_FILE_MAGIC    "ZNGX"
+#define INDEX_FILE_VERSION  1
+#define INDEX_FILE_GZIP     1
+#define INDEX_HEADER_SIZE   32
+#define INDEX_RECORD_SIZE   32
+
+static void put_le(uint8_t *buf, uint64_t val, int32_t bytes) {
+    for (int32_t i = 0; i < bytes; i++, val >>= 8)
+        buf[i] = (uint8_t)val;
+}
+
+static uint64_t get_le(const uint8_t *buf, int32_t bytes) {
+    uint64_t val = 0;
+
+    while (bytes--)
+        val = (val << 8) | buf[bytes];
+    return val;
+}
+
+/* Checks the header and the point table of a saved index, returning the
+   number of points, or 0 if the data is not a valid index */
+static uint32_t index_file_check(const uint8_t *buf, size_t len) {
+    uint64_t count, last = 0;
+    const uint8_t *rec;
+
+    if (buf == NULL || len < INDEX_HEADER_SIZE || memcmp(buf, INDEX_FILE_MAGIC, 4) != 0 ||
+        get_le(buf + 4, 2) != INDEX_FILE_VERSION)
+        return 0;
+    count = get_le(buf + 8, 4);
+    if (count == 0 || count > (len - INDEX_HEADER_SIZE) / INDEX_RECORD_SIZE)
+        return 0;
+    rec = buf + INDEX_HEADER_SIZE;
+    if (PREFIX(crc32_z)(0, rec, (size_t)count * INDEX_RECORD_SIZE) != get_le(buf + 12, 4))
+        return 0;
+
+    /* The CRC does not cover the windows, so their bounds are checked too */
+    for (uint32_t i = 0; i < count; i++, rec += INDEX_RECORD_SIZE) {
+        uint64_t out = get_le(rec, 8), offset = get_le(rec + 16, 8), zsize = get_le(rec + 24, 4);
+        if (out < last || offset > len || zsize > len - offset || get_le(rec + 28, 2) > (1U << MAX_WBITS) ||
+            rec[30] > 7 || rec[31] >> rec[30])
+            return 0;
+        last = out;
+    }
+    return (uint32_t)count;
+}
+
+/* Decompresses the window of the saved point at rec into window with strm,
+   which is left reset for raw inflate */
+static int32_t index_file_window(PREFIX3(stream) *strm, const uint8_t *buf, const uint8_t *rec,
+                                 unsigned char *window) {
+    uint32_t wsize = (uint32_t)get_le(rec + 28, 2);
+    int32_t ret;
+
+    ret = PREFIX(inflateReset2)(strm, -MAX_WBITS);
+    if (ret != Z_OK || wsize == 0)
+        return ret;
+    strm->next_in = buf + get_le(rec + 16, 8);
+    strm->avail_in = (uint32_t)get_le(rec + 24, 4);
+    strm->next_out = window;
+    strm->avail_out = wsize;
+    ret = PREFIX(inflate)(strm, Z_FINISH);
+    if (ret != Z_STREAM_END || strm->avail_out != 0)
+        return Z_DATA_ERROR;
+    return Z_OK;
+}
+
+int32_t Z_EXPORT PREFIX(inflateIndexSave)(const PREFIX(inflate_index) *index, out_func out, void *out_desc) {
+    const inflate_index *idx = (const inflate_index *)index;
+    PREFIX3(stream) strm;
+    uint8_t *table, *windows;
+    size_t table_size, windows_size = 0, offset;
+    int32_t ret;
+
+    if (idx == NULL || out == NULL)
+        return Z_STREAM_ERROR;
+
+    table_size = INDEX_HEADER_SIZE + (size_t)idx->have * INDEX_RECORD_SIZE;
+    for (uint32_t i = 0; i < idx->have; i++)
+        windows_size += (size_t)PREFIX(compressBound)(idx->list[i].wsize);
+    table = (uint8_t *)zng_alloc(table_size);
+    windows = (uint8_t *)zng_alloc(windows_size);
+    memset(&strm, 0, sizeof(strm));
+    if (table == NULL || windows == NULL ||
+        PREFIX(deflateInit2)(&strm, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        zng_free(windows);
+        zng_free(table);
+        return Z_MEM_ERROR;
+    }
+
+    /* Compress the windows one after the other, filling in the table */
+    ret = Z_OK;
+    offset = 0;
+    for (uint32_t i = 0; i < idx->have && ret == Z_OK; i++) {
+        const index_point *point = idx->list + i;
+        uint8_t *rec = table + INDEX_HEADER_SIZE + (size_t)i * INDEX_RECORD_SIZE;
+
+        PREFIX(deflateReset)(&strm);
+        strm.next_in = point->window;
+        strm.avail_in = point->wsize;
+        strm.next_out = windows + offset;
+        strm.avail_out = (uint32_t)MIN(windows_size - offset, UINT32_MAX);
+        if (PREFIX(deflate)(&strm, Z_FINISH) != Z_STREAM_END)
+            ret = Z_BUF_ERROR;
+        put_le(rec, (uint64_t)point->out, 8);
+        put_le(rec + 8, (uint64_t)point->in, 8);
+        put_le(rec + 16, table_size + offset, 8);
+        put_le(rec + 24, strm.total_out, 4);
+        put_le(rec + 28, point->wsize, 2);
+        rec[30] = (uint8_t)point->bits;
+        rec[31] = (uint8_t)point->value;
+        offset += strm.total_out;
+    }
+    PREFIX(deflateEnd)(&strm);
+
+    if (ret == Z_OK) {
+        memcpy(table, INDEX_FILE_MAGIC, 4);
+        put_le(table + 4, INDEX_FILE_VERSION, 2);
+        put_le(table + 6, idx->gzip ? INDEX_FILE_GZIP : 0, 2);
+        put_le(table + 8, idx->have, 4);
+        put_le(table + 12, PREFIX(crc32_z)(0, table + INDEX_HEADER_SIZE, table_size - INDEX_HEADER_SIZE), 4);
+        put_le(table + 16, (uint64_t)idx->span, 8);
+        put_le(table + 24, (uint64_t)idx->length, 8);
+
+        if (out(out_desc, table, (uint32_t)table_size) != 0)
+            ret = Z_BUF_ERROR;
+        for (size_t done = 0; ret == Z_OK && done < offset; done += MIN(offset - done, UINT32_MAX))
+            if (out(out_desc, windows + done, (uint32_t)MIN(offset - done, UINT32_MAX)) != 0)
+                ret = Z_BUF_ERROR;
+    }
+    zng_free(windows);
+    zng_free(table);
+    return ret;
+}
+
+int32_t Z_EXPORT PREFIX(inflateIndexLoad)(const uint8_t *buf, size_t len, PREFIX(inflate_index) **index) {
+    PREFIX3(stream) strm;
+    inflate_index *idx;
+    uint32_t count;
+    int32_t ret = Z_OK;
+
+    if (index == NULL)
+        return Z_STREAM_ERROR;
+    *index = NULL;
+    count = index_file_check(buf, len);
+    if (count == 0)
+        return Z_DATA_ERROR;
+
+    idx = (inflate_index *)zng_alloc(sizeof(inflate_index));
+    if (idx == NULL)
+        return Z_MEM_ERROR;
+    memset(idx, 0, sizeof(inflate_index));
+    idx->list = (index_point *)zng_alloc(count * sizeof(index_point));
+    memset(&strm, 0, sizeof(strm));
+    if (idx->list == NULL || PREFIX(inflateInit2)(&strm, -MAX_WBITS) != Z_OK) {
+        inflate_index_free(idx);
+        return Z_MEM_ERROR;
+    }
+    idx->size = count;
+    idx->gzip = (get_le(buf + 6, 2) & INDEX_FILE_GZIP) != 0;
+    idx->span = (z_off64_t)get_le(buf + 16, 8);
+    idx->length = (z_off64_t)get_le(buf + 24, 8);
+
+    for (uint32_t i = 0; i < count && ret == Z_OK; i++) {
+        const uint8_t *rec = buf + INDEX_HEADER_SIZE + (size_t)i * INDEX_RECORD_SIZE;
+        index_point *point = idx->list + i;
+
+        point->out = (z_off64_t)get_le(rec, 8);
+        point->in = (z_off64_t)get_le(rec + 8, 8);
+        point->wsize = (uint32_t)get_le(rec + 28, 2);
+        point->bits = rec[30];
+        point->value = rec[31];
+        point->window = NULL;
+        idx->have++;
+        if (point->wsize) {
+            point->window = (unsigned char *)zng_alloc(point->wsize);
+            if (point->window == NULL)
+                ret = Z_MEM_ERROR;
+            else
+                ret = index_file_window(&strm, buf, rec, point->window);
+        }
+    }
+    PREFIX(inflateEnd)(&strm);
+    if (ret != Z_OK) {
+        inflate_index_free(idx);
+        return ret;
+    }
+    *index = (PREFIX(inflate_index) *)idx;
+    return Z_OK;
+}
+
+int32_t Z_EXPORT PREFIX(inflateIndexSeekSaved)(PREFIX3(stream) *strm, const uint8_t *buf, size_t len,
+                                               z_off64_t offset, z_off64_t *in_offset, z_off64_t *skip) {
+    const uint8_t *table, *rec;
+    unsigned char *window;
+    index_point point;
+    uint32_t count, lo, hi;
+    int32_t ret;
+
+    if (in_offset == NULL || skip == NULL || offset < 0)
+        return Z_STREAM_ERROR;
+    count = index_file_check(buf, len);
+    if (count == 0)
+        return Z_DATA_ERROR;
+    if ((uint64_t)offset > get_le(buf + 24, 8))
+        return Z_STREAM_ERROR;
+
+    /* Binary search for the last point with out <= offset */
+    table = buf + INDEX_HEADER_SIZE;
+    lo = 0;
+    hi = count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + ((hi - lo) >> 1);
+        if (get_le(table + (size_t)mid * INDEX_RECORD_SIZE, 8) <= (uint64_t)offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    rec = table + (size_t)lo * INDEX_RECORD_SIZE;
+    if (get_le(rec, 8) > (uint64_t)offset)
+        return Z_STREAM_ERROR;
+
+    /* Decompress only the window of that point, using strm itself */
+    window = (unsigned char *)zng_alloc(1U << MAX_WBITS);
+    if (window == NULL)
+        return Z_MEM_ERROR;
+    point.out = (z_off64_t)get_le(rec, 8);
+    point.in = (z_off64_t)get_le(rec + 8, 8);
+    point.wsize = (uint32_t)get_le(rec + 28, 2);
+    point.bits = rec[30];
+    point.value = rec[31];
+    point.window = window;
+    ret = index_file_window(strm, buf, rec, window);
+    if (ret == Z_OK)
+        ret = inflate_index_resume(strm, &point);
+    zng_free(window);
+    if (ret != Z_OK)
+        return ret;
+    *in_offset = point.in;
+    *skip = offset - point.out;
+    return Z_OK;
+}
+#endif
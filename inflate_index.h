@@ -0,0 +1,44 @@
+/* inflate_index.h -- Access points for random access into deflate streams
+ *
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef INFLATE_INDEX_H_
+#define INFLATE_INDEX_H_
+
+/* An access point is a deflate block boundary where inflate can be resumed
+ * without decompressing what came before: the position in the compressed data,
+ * the bits of the last byte before it that belong to the block, and the up to
+ * 32K of uncompressed data that matches may refer to. */
+typedef struct index_point_s {
+    z_off64_t out;          /* offset in the uncompressed data */
+    z_off64_t in;           /* offset of the first whole byte of compressed data */
+    uint32_t bits;          /* bits of the byte before in that belong to the block, 0..7 */
+    uint32_t value;         /* those bits, for inflatePrime() */
+    uint32_t wsize;         /* bytes in window */
+    unsigned char *window;  /* uncompressed data before out */
+} index_point;
+
+typedef struct inflate_index_s {
+    index_point *list;      /* access points, by increasing out */
+    uint32_t have;          /* number of access points in list */
+    uint32_t size;          /* number of access points allocated in list */
+    z_off64_t span;         /* requested uncompressed distance between points */
+    z_off64_t length;       /* length of the uncompressed data */
+    int32_t gzip;           /* true if the points are inside gzip members */
+} inflate_index;
+
+/* Decompresses everything that in provides and builds an index of it with
+   points span bytes apart.  For gzip streams, the members that follow the first
+   one are indexed too, and trailing data that is not a gzip member is ignored,
+   as gzread() does. */
+int32_t           Z_INTERNAL  inflate_index_build(in_func in, void *in_desc, int32_t windowBits, z_off64_t span,
+                                                  inflate_index **index);
+/* Returns the last access point at or before offset, or NULL if there is none */
+const index_point Z_INTERNAL *inflate_index_find(const inflate_index *index, z_off64_t offset);
+/* Resets strm to raw inflate and sets it up to continue at point, with the input
+   starting at point->in */
+int32_t           Z_INTERNAL  inflate_index_resume(PREFIX3(stream) *strm, const index_point *point);
+void              Z_INTERNAL  inflate_index_free(inflate_index *index);
+
+#endif
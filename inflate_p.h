@@ -16,10 +16,12 @@
 #  define ZALLOC_INFLATE_STATE(strm) ((struct inflate_state *)ZALLOC(strm, 1, sizeof(struct inflate_state)))
 #  define ZFREE_STATE(strm, addr) ZFREE(strm, addr)
 #  define ZCOPY_INFLATE_STATE(dst, src) memcpy(dst, src, sizeof(struct inflate_state))
-/* Memory management for the window. Useful for allocation the aligned window. */
-#  define ZALLOC_WINDOW(strm, items, size) ZALLOC(strm, items, size)
+/* Size of the inflate state when it is allocated together with the window. Useful for arch-specific extension blocks. */
+#  define INFLATE_STATE_SIZE sizeof(struct inflate_state)
+/* Alignment and size of the window allocated together with the inflate state. */
+#  define INFLATE_WINDOW_ALIGN 64
+#  define INFLATE_ADJUST_WINDOW_SIZE(size) (size)
 #  define ZCOPY_WINDOW(dest, src, n) memcpy(dest, src, n)
-#  define ZFREE_WINDOW(strm, addr) ZFREE(strm, addr)
 /* Invoked at the end of inflateResetKeep(). Useful for initializing arch-specific extension blocks. */
 #  define INFLATE_RESET_KEEP_HOOK(strm) do {} while (0)
 /* Invoked at the beginning of inflatePrime(). Useful for updating arch-specific buffers. */
@@ -134,7 +136,7 @@
     } while (0)
 
 #define INFLATE_FAST_MIN_HAVE 15
-#define INFLATE_FAST_MIN_LEFT 260
+#define INFLATE_FAST_MIN_LEFT 262
 
 /* Load 64 bits from IN and place the bytes at offset BITS in the result. */
 static inline uint64_t load_64_bits(const unsigned char *in, unsigned bits) {
@@ -0,0 +1,1299 @@
+/* inflate_parallel.c -- decompress a single deflate stream using multiple threads
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * Unlike the output of compressParallel, an arbitrary deflate stream has no
+ * marked places where decompression could start, and every block may refer to
+ * the 32K of output before it. The compressed data is therefore processed in
+ * batches that are split into chunks. The first chunk is inflated normally from
+ * where the previous batch ended. The other chunks are decoded speculatively:
+ * each one searches its range bit by bit for a position where a valid dynamic
+ * block header starts and decodes from there, storing references into the still
+ * unknown window before the chunk as markers instead of bytes. Once all chunks
+ * are done, every chunk that starts exactly where the one before it ended is
+ * accepted in order and its markers are replaced from the now known window. A
+ * chunk that does not line up, because its header was a false positive or the
+ * real block was not found, ends the batch, and the next batch continues from
+ * there with normal inflate. The output is therefore always the same as that of
+ * inflate, speculation only decides how much of it is produced in parallel.
+ * This is the approach used by rapidgzip.
+ *
+ * Streams that were written with Z_FULL_FLUSH at intervals do not need any
+ * speculation, their segments are found by the flush markers and inflated
+ * independently, see uncompressSegments below.
+ */
+
+#include "zbuild.h"
+#include "zutil.h"
+#include "zendian.h"
+#include "inftrees.h"
+#include "inflate.h"
+#include "inffixed_tbl.h"
+#include "zthread.h"
+#include "compress_parallel.h"
+#include "inflate_parallel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Size of the deflate window, kept in front of the output of each batch */
+#define WINDOW_SIZE 32768
+
+/* Speculative output values of at least MARKER stand for the byte at offset
+   value - MARKER in the window that precedes the chunk */
+#define MARKER 32768
+
+/* Output space made available to inflate for the first chunk at a time */
+#define OUTPUT_MIN (64 * 1024)
+
+/* Decoder modes */
+#define PAR_HEADER  0   /* zlib or gzip header */
+#define PAR_RAW     1   /* deflate data, decoded in batches */
+#define PAR_TRAILER 2   /* zlib or gzip trailer */
+#define PAR_DONE    3
+#define PAR_BAD     4
+
+/* Chunk results */
+#define CHUNK_FAIL      0   /* no usable block found */
+#define CHUNK_STOP      1   /* ended at the first block boundary at or after stop */
+#define CHUNK_SHORT     2   /* input ran out, ended at the last block boundary before that */
+#define CHUNK_FINAL     3   /* ended with the last block of the stream */
+#define CHUNK_ERROR     4   /* first chunk only, inflate failed with err */
+#define CHUNK_EXHAUSTED 5   /* input ran out before the first block was complete, stop searching */
+
+/* Block decoding results */
+#define DECODE_OK        0
+#define DECODE_INVALID   1
+#define DECODE_EXHAUSTED 2
+#define DECODE_MEMORY    3
+
+typedef struct parallel_chunk_s {
+    size_t from;            /* bit range to search for the first block */
+    size_t to;
+    size_t stop;            /* stop at the first block boundary at or after this bit */
+    int32_t status;
+    int32_t err;
+    size_t start;           /* bit position of the first block */
+    size_t end;             /* bit position after the last block */
+    size_t consumed;        /* input bytes used by the first chunk */
+    uint16_t *out;          /* speculative output, literals and markers */
+    size_t out_len;         /* for the first chunk, bytes written after the window */
+    size_t out_size;
+    code codes[ENOUGH];
+    uint16_t lens[320];
+    uint16_t work[288];
+} parallel_chunk;
+
+struct inflate_parallel_s {
+    PREFIX3(stream) strm;   /* decodes the header and the first chunk of each batch */
+    int32_t window_bits;
+    int32_t threads;
+    size_t chunk;
+    int32_t mode;
+    int32_t wrap;           /* 0 for raw deflate, 1 for zlib, 2 for gzip */
+    int32_t resume;         /* true if strm ended exactly where the next batch starts */
+    uint32_t bits;          /* bits of the byte before the next batch that belong to it */
+    uint32_t value;
+    uint32_t check;
+    uint32_t total;         /* uncompressed length modulo 2^32 */
+    uint8_t trailer[8];
+    uint32_t trailer_have;
+    uint8_t *out;           /* WINDOW_SIZE bytes of history followed by the output of the batch */
+    size_t out_size;
+    size_t whave;           /* valid history bytes right before the output */
+    size_t out_len;
+    size_t out_pos;         /* output delivered so far */
+    parallel_chunk *chunks;
+};
+
+typedef struct {
+    inflate_parallel *par;
+    const uint8_t *in;
+    size_t len;
+} parallel_batch_ctx;
+
+typedef struct {
+    const uint8_t *start;
+    const uint8_t *next;    /* next byte to load into hold */
+    const uint8_t *end;
+    uint64_t hold;
+    uint32_t bits;
+} bit_reader;
+
+static const uint16_t order[19] = /* permutation of code lengths */
+    {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+static inline uint64_t load_64_le(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if BYTE_ORDER == BIG_ENDIAN
+    v = ZSWAP64(v);
+#endif
+    return v;
+}
+
+/* ===========================================================================
+ * Bit reader for the speculative decoder, which unlike inflate needs to start
+ * at any bit and stop at the end of its input without consuming it.
+ */
+static inline void bits_refill(bit_reader *br) {
+    if (br->end - br->next >= 8) {
+        br->hold |= load_64_le(br->next) << br->bits;
+        br->next += (63 - br->bits) >> 3;
+        br->bits |= 56;
+    } else {
+        while (br->bits <= 56 && br->next < br->end) {
+            br->hold |= (uint64_t)*br->next++ << br->bits;
+            br->bits += 8;
+        }
+    }
+}
+
+static inline void bits_init(bit_reader *br, const uint8_t *in, size_t len, size_t pos) {
+    br->start = in;
+    br->next = in + (pos >> 3);
+    br->end = in + len;
+    br->hold = 0;
+    br->bits = 0;
+    bits_refill(br);
+    br->hold >>= pos & 7;
+    br->bits -= pos & 7;
+}
+
+static inline size_t bits_pos(const bit_reader *br) {
+    return (size_t)(br->next - br->start) * 8 - br->bits;
+}
+
+#define PEEK(n) ((uint32_t)br->hold & ((1U << (n)) - 1))
+#define DROP(n) do { br->hold >>= (n); br->bits -= (n); } while (0)
+#define NEED(n) \
+    do { \
+        if (br->bits < (uint32_t)(n)) { \
+            bits_refill(br); \
+            if (br->bits < (uint32_t)(n)) \
+                return DECODE_EXHAUSTED; \
+        } \
+    } while (0)
+
+static int32_t chunk_grow(parallel_chunk *c, size_t extra) {
+    uint16_t *grown;
+    size_t size;
+
+    if (c->out_size - c->out_len >= extra)
+        return 1;
+    size = MAX(c->out_size * 2, c->out_len + extra);
+    grown = (uint16_t *)realloc(c->out, size * sizeof(uint16_t));
+    if (grown == NULL)
+        return 0;
+    c->out = grown;
+    c->out_size = size;
+    return 1;
+}
+
+/* Decodes one symbol with a table built by zng_inflate_table */
+static inline int32_t decode_symbol(bit_reader *br, const code *table, unsigned root, code *sym) {
+    code here;
+
+    if (br->bits < 15)
+        bits_refill(br);
+    here = table[PEEK(root)];
+    if (here.op && (here.op & 0xf0) == 0) {
+        code last = here;
+        here = table[last.val + (PEEK(last.bits + last.op) >> last.bits)];
+        if (last.bits + here.bits > br->bits)
+            return DECODE_EXHAUSTED;
+        DROP(last.bits);
+    } else if (here.bits > br->bits) {
+        return DECODE_EXHAUSTED;
+    }
+    DROP(here.bits);
+    *sym = here;
+    return DECODE_OK;
+}
+
+static int32_t decode_stored(parallel_chunk *c, bit_reader *br) {
+    const uint8_t *in = br->start;
+    size_t len = (size_t)(br->end - br->start);
+    size_t pos = (bits_pos(br) + 7) >> 3;
+    uint32_t copy, i;
+
+    if (len - pos < 4)
+        return DECODE_EXHAUSTED;
+    copy = in[pos] | (in[pos + 1] << 8);
+    if (copy != (~(in[pos + 2] | (in[pos + 3] << 8)) & 0xffff))
+        return DECODE_INVALID;
+    pos += 4;
+    if (len - pos < copy)
+        return DECODE_EXHAUSTED;
+    if (!chunk_grow(c, copy))
+        return DECODE_MEMORY;
+    for (i = 0; i < copy; i++)
+        c->out[c->out_len++] = in[pos + i];
+    bits_init(br, in, len, (pos + copy) * 8);
+    return DECODE_OK;
+}
+
+static int32_t decode_tables(parallel_chunk *c, bit_reader *br, const code **lcode, unsigned *lbits,
+                             const code **dcode, unsigned *dbits) {
+    uint32_t nlen, ndist, ncode, have, copy;
+    uint16_t len;
+    code *next, here;
+    int32_t ret;
+
+    NEED(14);
+    nlen = PEEK(5) + 257;
+    DROP(5);
+    ndist = PEEK(5) + 1;
+    DROP(5);
+    ncode = PEEK(4) + 4;
+    DROP(4);
+    if (nlen > 286 || ndist > 30)
+        return DECODE_INVALID;
+
+    for (have = 0; have < ncode; have++) {
+        NEED(3);
+        c->lens[order[have]] = (uint16_t)PEEK(3);
+        DROP(3);
+    }
+    for (; have < 19; have++)
+        c->lens[order[have]] = 0;
+    next = c->codes;
+    *lcode = next;
+    *lbits = 7;
+    if (zng_inflate_table(CODES, c->lens, 19, &next, lbits, c->work))
+        return DECODE_INVALID;
+
+    have = 0;
+    while (have < nlen + ndist) {
+        ret = decode_symbol(br, *lcode, *lbits, &here);
+        if (ret != DECODE_OK)
+            return ret;
+        if (here.val < 16) {
+            c->lens[have++] = here.val;
+            continue;
+        }
+        if (here.val == 16) {
+            if (have == 0)
+                return DECODE_INVALID;
+            NEED(2);
+            len = c->lens[have - 1];
+            copy = 3 + PEEK(2);
+            DROP(2);
+        } else if (here.val == 17) {
+            NEED(3);
+            len = 0;
+            copy = 3 + PEEK(3);
+            DROP(3);
+        } else {
+            NEED(7);
+            len = 0;
+            copy = 11 + PEEK(7);
+            DROP(7);
+        }
+        if (have + copy > nlen + ndist)
+            return DECODE_INVALID;
+        while (copy--)
+            c->lens[have++] = len;
+    }
+    if (c->lens[256] == 0)
+        return DECODE_INVALID;
+
+    next = c->codes;
+    *lcode = next;
+    *lbits = INFLATE_ROOT_BITS;
+    if (zng_inflate_table(LENS, c->lens, nlen, &next, lbits, c->work))
+        return DECODE_INVALID;
+    *dcode = next;
+    *dbits = INFLATE_ROOT_BITS - 1;
+    if (zng_inflate_table(DISTS, c->lens + nlen, ndist, &next, dbits, c->work))
+        return DECODE_INVALID;
+    return DECODE_OK;
+}
+
+/* Decodes the literals and matches of one block. References to data before the
+   start of the chunk are written as markers. */
+static int32_t decode_codes(parallel_chunk *c, bit_reader *br, const code *lcode, unsigned lbits,
+                            const code *dcode, unsigned dbits) {
+    uint32_t len, dist, extra;
+    size_t have = c->out_len;
+    code here;
+    int32_t ret;
+
+    for (;;) {
+        if (c->out_size - have < 258) {
+            c->out_len = have;
+            if (!chunk_grow(c, 258))
+                return DECODE_MEMORY;
+        }
+        ret = decode_symbol(br, lcode, lbits, &here);
+        if (ret != DECODE_OK)
+            return ret;
+        if (here.op == 0) {
+            c->out[have++] = here.val;
+            continue;
+        }
+        if (here.op & 32)
+            break;
+        if (here.op & 64)
+            return DECODE_INVALID;
+
+        len = here.val;
+        extra = here.op & 15;
+        if (extra) {
+            NEED(extra);
+            len += PEEK(extra);
+            DROP(extra);
+        }
+        ret = decode_symbol(br, dcode, dbits, &here);
+        if (ret != DECODE_OK)
+            return ret;
+        if (here.op & 64)
+            return DECODE_INVALID;
+        dist = here.val;
+        extra = here.op & 15;
+        if (extra) {
+            NEED(extra);
+            dist += PEEK(extra);
+            DROP(extra);
+        }
+
+        if (dist > have) {
+            if (dist - have > WINDOW_SIZE)
+                return DECODE_INVALID;
+            while (len && have < dist) {
+                c->out[have] = (uint16_t)(MARKER + WINDOW_SIZE - (dist - have));
+                have++;
+                len--;
+            }
+        }
+        while (len--) {
+            c->out[have] = c->out[have - dist];
+            have++;
+        }
+    }
+    c->out_len = have;
+    return DECODE_OK;
+}
+
+/* ===========================================================================
+ * Decodes blocks starting at bit pos until the first block boundary at or after
+ * c->stop, the last block of the stream, or the end of the input.
+ */
+static int32_t chunk_decode(parallel_chunk *c, const uint8_t *in, size_t len, size_t pos) {
+    bit_reader reader, *br = &reader;
+    const code *lcode, *dcode;
+    unsigned lbits, dbits;
+    size_t boundary = pos, boundary_len = 0;
+    uint32_t last, type;
+    int32_t blocks = 0, ret;
+
+    c->out_len = 0;
+    bits_init(br, in, len, pos);
+    for (;;) {
+        if (br->bits < 3) {
+            bits_refill(br);
+            if (br->bits < 3) {
+                ret = DECODE_EXHAUSTED;
+                break;
+            }
+        }
+        last = PEEK(1);
+        type = PEEK(3) >> 1;
+        DROP(3);
+
+        if (type == 0) {
+            ret = decode_stored(c, br);
+        } else if (type == 1) {
+            ret = decode_codes(c, br, lenfix, 9, distfix, 5);
+        } else if (type == 2) {
+            ret = decode_tables(c, br, &lcode, &lbits, &dcode, &dbits);
+            if (ret == DECODE_OK)
+                ret = decode_codes(c, br, lcode, lbits, dcode, dbits);
+        } else {
+            ret = DECODE_INVALID;
+        }
+        if (ret != DECODE_OK)
+            break;
+
+        boundary = bits_pos(br);
+        boundary_len = c->out_len;
+        blocks++;
+        c->end = boundary;
+        if (last)
+            return CHUNK_FINAL;
+        if (boundary >= c->stop)
+            return CHUNK_STOP;
+    }
+
+    if (ret == DECODE_EXHAUSTED && blocks > 0) {
+        c->end = boundary;
+        c->out_len = boundary_len;
+        return CHUNK_SHORT;
+    }
+    return ret == DECODE_INVALID ? CHUNK_FAIL : CHUNK_EXHAUSTED;
+}
+
+/* Quick test whether a dynamic block header can start at bit pos: the block type,
+   the table sizes and a complete code length code. Headers within the last bytes
+   of the input are not considered. */
+static int32_t block_candidate(const uint8_t *in, size_t len, size_t pos) {
+    size_t byte = pos >> 3;
+    uint64_t v;
+    uint32_t ncode, i, left = 128;
+
+    if (len - byte < 16)
+        return 0;
+    v = load_64_le(in + byte) >> (pos & 7);
+    if ((v & 6) != 4 || ((v >> 3) & 31) > 29 || ((v >> 8) & 31) > 29)
+        return 0;
+    ncode = (uint32_t)((v >> 13) & 15) + 4;
+    pos += 17;
+    for (i = 0; i < ncode; i++, pos += 3) {
+        uint32_t n = ((in[pos >> 3] | (in[(pos >> 3) + 1] << 8)) >> (pos & 7)) & 7;
+        if (n) {
+            uint32_t weight = 1U << (7 - n);
+            if (weight > left)
+                return 0;
+            left -= weight;
+        }
+    }
+    return left == 0;
+}
+
+static void chunk_speculate(parallel_chunk *c, const uint8_t *in, size_t len) {
+    size_t pos;
+
+    c->status = CHUNK_FAIL;
+    for (pos = c->from; pos < c->to; pos++) {
+        int32_t status;
+
+        if (!block_candidate(in, len, pos))
+            continue;
+        status = chunk_decode(c, in, len, pos);
+        if (status == CHUNK_EXHAUSTED)
+            return;
+        if (status != CHUNK_FAIL) {
+            c->start = pos;
+            c->status = status;
+            return;
+        }
+    }
+}
+
+/* ===========================================================================
+ * Makes room for extra bytes of output after the used bytes of the batch.
+ */
+static int32_t output_reserve(inflate_parallel *p, size_t used, size_t extra) {
+    uint8_t *grown;
+    size_t size;
+
+    if (p->out_size - WINDOW_SIZE - used >= extra)
+        return 1;
+    size = MAX(p->out_size * 2, WINDOW_SIZE + used + extra);
+    grown = (uint8_t *)realloc(p->out, size);
+    if (grown == NULL)
+        return 0;
+    p->out = grown;
+    p->out_size = size;
+    return 1;
+}
+
+/* Inflates the first chunk of the batch, continuing from the end of the previous one */
+static void chunk_first(inflate_parallel *p, parallel_chunk *c, const uint8_t *in, size_t len) {
+    PREFIX3(stream) *strm = &p->strm;
+    struct inflate_state *state = (struct inflate_state *)strm->state;
+    int32_t flush = c->stop == SIZE_MAX ? Z_NO_FLUSH : Z_BLOCK;
+    int32_t ret = Z_OK;
+
+    c->status = CHUNK_ERROR;
+    c->out_len = 0;
+    c->consumed = 0;
+    if (!p->resume) {
+        ret = PREFIX(inflateReset2)(strm, -MAX_WBITS);
+        if (ret == Z_OK && p->bits)
+            ret = PREFIX(inflatePrime)(strm, (int32_t)p->bits, (int32_t)p->value);
+        if (ret == Z_OK && p->whave)
+            ret = PREFIX(inflateSetDictionary)(strm, p->out + WINDOW_SIZE - p->whave, (uint32_t)p->whave);
+        if (ret != Z_OK) {
+            c->err = ret;
+            return;
+        }
+    }
+
+    strm->next_in = in;
+    strm->avail_in = (uint32_t)len;
+    for (;;) {
+        if (!output_reserve(p, c->out_len, OUTPUT_MIN)) {
+            c->err = Z_MEM_ERROR;
+            return;
+        }
+        strm->next_out = p->out + WINDOW_SIZE + c->out_len;
+        strm->avail_out = (uint32_t)MIN(p->out_size - WINDOW_SIZE - c->out_len, (size_t)UINT32_MAX);
+        ret = PREFIX(inflate)(strm, flush);
+        c->out_len = (size_t)(strm->next_out - (p->out + WINDOW_SIZE));
+        c->consumed = len - strm->avail_in;
+
+        if (ret == Z_STREAM_END) {
+            c->status = CHUNK_FINAL;
+            return;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            c->err = ret;
+            return;
+        }
+        if (flush == Z_BLOCK && (strm->data_type & 128) && !(strm->data_type & 64) &&
+                c->consumed * 8 >= state->bits && c->consumed * 8 - state->bits >= c->stop) {
+            c->end = c->consumed * 8 - state->bits;
+            c->status = CHUNK_STOP;
+            return;
+        }
+        if (ret == Z_BUF_ERROR && strm->avail_in == 0 && strm->avail_out != 0) {
+            c->status = CHUNK_SHORT;
+            return;
+        }
+    }
+}
+
+static void parallel_job(void *ctx, int32_t worker, int32_t job) {
+    parallel_batch_ctx *b = (parallel_batch_ctx *)ctx;
+    parallel_chunk *c = &b->par->chunks[job];
+
+    Z_UNUSED(worker);
+    if (job == 0)
+        chunk_first(b->par, c, b->in, b->len);
+    else
+        chunk_speculate(c, b->in, b->len);
+}
+
+/* Appends the output of a speculative chunk, replacing its markers with the window
+   before it. Returns Z_DATA_ERROR if a marker refers to data before the stream. */
+static int32_t chunk_resolve(inflate_parallel *p, parallel_chunk *c, size_t used) {
+    const uint8_t *window;
+    uint8_t *dst;
+    size_t i, valid = p->whave + used;
+    uint16_t first = valid >= WINDOW_SIZE ? 0 : (uint16_t)(WINDOW_SIZE - valid);
+
+    if (!output_reserve(p, used, c->out_len))
+        return Z_MEM_ERROR;
+    dst = p->out + WINDOW_SIZE + used;
+    window = dst - WINDOW_SIZE;
+    for (i = 0; i < c->out_len; i++) {
+        uint16_t v = c->out[i];
+        if (v >= MARKER) {
+            v -= MARKER;
+            if (v < first)
+                return Z_DATA_ERROR;
+            dst[i] = window[v];
+        } else {
+            dst[i] = (uint8_t)v;
+        }
+    }
+    return Z_OK;
+}
+
+/* ===========================================================================
+ * Decodes one batch of deflate data from strm and leaves its output pending.
+ */
+static int32_t parallel_batch(inflate_parallel *p, PREFIX3(stream) *strm) {
+    parallel_batch_ctx ctx;
+    parallel_chunk *c;
+    const uint8_t *in = strm->next_in;
+    size_t len = strm->avail_in, chunk = p->chunk, used, keep, consumed;
+    int32_t count, i, last = 0, status, err;
+
+    /* keep the last 32K of output in front of the new output */
+    keep = MIN(WINDOW_SIZE, p->whave + p->out_len);
+    memmove(p->out + WINDOW_SIZE - keep, p->out + WINDOW_SIZE + p->out_len - keep, keep);
+    p->whave = keep;
+    p->out_len = 0;
+    p->out_pos = 0;
+
+    count = (int32_t)MIN((size_t)p->threads, len / chunk);
+    if (count < 1)
+        count = 1;
+    for (i = 0; i < count; i++) {
+        c = &p->chunks[i];
+        c->from = (size_t)i * chunk * 8;
+        c->to = c->from + chunk * 8;
+        c->stop = c->to;
+        /* the last chunk takes the rest unless another batch follows */
+        if (i + 1 == count && len < (size_t)(count + 1) * chunk) {
+            c->to = len * 8;
+            c->stop = SIZE_MAX;
+        }
+    }
+
+    ctx.par = p;
+    ctx.in = in;
+    ctx.len = len;
+    zthread_run_jobs(parallel_job, &ctx, count, count);
+
+    c = &p->chunks[0];
+    if (c->status == CHUNK_ERROR) {
+        strm->msg = p->strm.msg;
+        p->mode = PAR_BAD;
+        return c->err;
+    }
+
+    /* accept the chunks that continue exactly where the previous one ended */
+    used = c->out_len;
+    status = c->status;
+    for (i = 1; i < count && status == CHUNK_STOP; i++) {
+        parallel_chunk *next = &p->chunks[i];
+
+        if (next->status == CHUNK_FAIL || next->start != c->end)
+            break;
+        err = chunk_resolve(p, next, used);
+        if (err == Z_MEM_ERROR) {
+            p->mode = PAR_BAD;
+            return err;
+        }
+        if (err != Z_OK)
+            break;
+        used += next->out_len;
+        c = next;
+        status = c->status;
+        last = i;
+    }
+
+    if (last == 0) {
+        consumed = c->consumed;
+        p->resume = 1;
+    } else if (status == CHUNK_FINAL) {
+        consumed = (c->end + 7) >> 3;
+    } else {
+        consumed = c->end >> 3;
+        p->bits = 0;
+        p->value = 0;
+        if (c->end & 7) {
+            p->bits = 8 - (uint32_t)(c->end & 7);
+            p->value = in[consumed] >> (c->end & 7);
+            consumed++;
+        }
+        p->resume = 0;
+    }
+
+    if (p->wrap == 2)
+        p->check = PREFIX(crc32)(p->check, p->out + WINDOW_SIZE, (uint32_t)used);
+    else if (p->wrap == 1)
+        p->check = PREFIX(adler32)(p->check, p->out + WINDOW_SIZE, (uint32_t)used);
+    p->total += (uint32_t)used;
+    p->out_len = used;
+
+    strm->next_in += consumed;
+    strm->avail_in -= (uint32_t)consumed;
+    strm->total_in += consumed;
+    if (status == CHUNK_FINAL) {
+        p->mode = p->wrap ? PAR_TRAILER : PAR_DONE;
+        p->trailer_have = 0;
+    }
+    return Z_OK;
+}
+
+/* Decodes the zlib or gzip header with inflate */
+static int32_t parallel_header(inflate_parallel *p, PREFIX3(stream) *strm) {
+    struct inflate_state *state = (struct inflate_state *)p->strm.state;
+    uint32_t consumed;
+    int32_t ret;
+
+    p->strm.next_in = strm->next_in;
+    p->strm.avail_in = strm->avail_in;
+    p->strm.next_out = p->out;
+    p->strm.avail_out = 0;
+    ret = PREFIX(inflate)(&p->strm, Z_BLOCK);
+    consumed = strm->avail_in - p->strm.avail_in;
+    strm->next_in += consumed;
+    strm->avail_in -= consumed;
+    strm->total_in += consumed;
+
+    if (ret == Z_NEED_DICT) {
+        strm->msg = (char *)"preset dictionary not supported";
+        p->mode = PAR_BAD;
+        return ret;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        strm->msg = p->strm.msg;
+        p->mode = PAR_BAD;
+        return ret;
+    }
+    if (p->strm.data_type & 128) {
+        p->wrap = state->flags > 0 ? 2 : 1;
+        p->check = p->wrap == 2 ? CRC32_INITIAL_VALUE : ADLER32_INITIAL_VALUE;
+        p->bits = state->bits;
+        p->value = (uint32_t)(state->hold & ((1U << state->bits) - 1));
+        p->resume = 0;
+        p->mode = PAR_RAW;
+    }
+    return Z_OK;
+}
+
+/* Checks the zlib or gzip trailer against the decompressed data */
+static int32_t parallel_trailer(inflate_parallel *p, PREFIX3(stream) *strm) {
+    uint32_t need = p->wrap == 2 ? 8 : 4, check;
+
+    while (p->trailer_have < need && strm->avail_in) {
+        p->trailer[p->trailer_have++] = *strm->next_in++;
+        strm->avail_in--;
+        strm->total_in++;
+    }
+    if (p->trailer_have < need)
+        return Z_OK;
+
+    if (p->wrap == 2) {
+        check = p->trailer[0] | (p->trailer[1] << 8) | (p->trailer[2] << 16) | ((uint32_t)p->trailer[3] << 24);
+        if (check != p->check) {
+            strm->msg = (char *)"incorrect data check";
+            p->mode = PAR_BAD;
+            return Z_DATA_ERROR;
+        }
+        check = p->trailer[4] | (p->trailer[5] << 8) | (p->trailer[6] << 16) | ((uint32_t)p->trailer[7] << 24);
+        if (check != p->total) {
+            strm->msg = (char *)"incorrect length check";
+            p->mode = PAR_BAD;
+            return Z_DATA_ERROR;
+        }
+    } else {
+        check = ((uint32_t)p->trailer[0] << 24) | (p->trailer[1] << 16) | (p->trailer[2] << 8) | p->trailer[3];
+        if (check != p->check) {
+            strm->msg = (char *)"incorrect data check";
+            p->mode = PAR_BAD;
+            return Z_DATA_ERROR;
+        }
+    }
+    p->mode = PAR_DONE;
+    return Z_OK;
+}
+
+int32_t Z_INTERNAL inflate_parallel_run(inflate_parallel *p, PREFIX3(stream) *strm, int32_t flush) {
+    uint32_t had_in = strm->avail_in, had_out = strm->avail_out;
+    int32_t ret = Z_OK;
+
+    for (;;) {
+        /* deliver the output of the last batch before decoding more */
+        if (p->out_pos < p->out_len) {
+            size_t n = MIN(p->out_len - p->out_pos, (size_t)strm->avail_out);
+            memcpy(strm->next_out, p->out + WINDOW_SIZE + p->out_pos, n);
+            strm->next_out += n;
+            strm->avail_out -= (uint32_t)n;
+            strm->total_out += n;
+            p->out_pos += n;
+            if (p->out_pos < p->out_len)
+                break;
+        }
+
+        if (p->mode == PAR_HEADER) {
+            if (strm->avail_in == 0)
+                break;
+            ret = parallel_header(p, strm);
+            if (ret != Z_OK || p->mode == PAR_HEADER)
+                break;
+        } else if (p->mode == PAR_RAW) {
+            if (strm->avail_in == 0 || (strm->avail_in < inflate_parallel_batch(p) && flush != Z_FINISH))
+                break;
+            ret = parallel_batch(p, strm);
+            if (ret != Z_OK)
+                break;
+        } else if (p->mode == PAR_TRAILER) {
+            ret = parallel_trailer(p, strm);
+            if (ret != Z_OK || p->mode == PAR_TRAILER)
+                break;
+        } else if (p->mode == PAR_DONE) {
+            return Z_STREAM_END;
+        } else {
+            return Z_DATA_ERROR;
+        }
+    }
+
+    if (ret == Z_OK && had_in == strm->avail_in && had_out == strm->avail_out)
+        ret = Z_BUF_ERROR;
+    return ret;
+}
+
+size_t Z_INTERNAL inflate_parallel_batch(inflate_parallel *p) {
+    return (size_t)p->threads * p->chunk;
+}
+
+int32_t Z_INTERNAL inflate_parallel_pending(inflate_parallel *p) {
+    return p->out_pos < p->out_len || p->mode == PAR_DONE || p->mode == PAR_BAD;
+}
+
+void Z_INTERNAL inflate_parallel_reset(inflate_parallel *p) {
+    PREFIX(inflateReset2)(&p->strm, p->window_bits);
+    p->mode = p->window_bits < 0 ? PAR_RAW : PAR_HEADER;
+    p->wrap = 0;
+    p->resume = 0;
+    p->bits = 0;
+    p->value = 0;
+    p->check = 0;
+    p->total = 0;
+    p->trailer_have = 0;
+    p->whave = 0;
+    p->out_len = 0;
+    p->out_pos = 0;
+}
+
+int32_t Z_INTERNAL inflate_parallel_init(inflate_parallel **par, int32_t window_bits, int32_t threads, size_t chunk) {
+    inflate_parallel *p;
+    int32_t err;
+
+    *par = NULL;
+    if (threads < 0)
+        return Z_STREAM_ERROR;
+    if (threads == 0)
+        threads = zthread_cpu_count();
+    if (threads > ZTHREAD_MAX_WORKERS)
+        threads = ZTHREAD_MAX_WORKERS;
+    if (chunk == 0)
+        chunk = PARALLEL_CHUNK_SIZE_DEFAULT;
+    /* a batch has to fit in avail_in, and in the input buffer of gzread */
+    chunk = MIN(chunk, (size_t)(1 << 30) / (size_t)threads);
+
+    p = (inflate_parallel *)calloc(1, sizeof(inflate_parallel));
+    if (p == NULL)
+        return Z_MEM_ERROR;
+    p->window_bits = window_bits;
+    p->threads = threads;
+    p->chunk = chunk;
+    p->chunks = (parallel_chunk *)calloc((size_t)threads, sizeof(parallel_chunk));
+    p->out_size = WINDOW_SIZE + OUTPUT_MIN;
+    p->out = (uint8_t *)malloc(p->out_size);
+    if (p->chunks == NULL || p->out == NULL) {
+        free(p->out);
+        free(p->chunks);
+        free(p);
+        return Z_MEM_ERROR;
+    }
+
+    err = PREFIX(inflateInit2)(&p->strm, window_bits);
+    if (err != Z_OK) {
+        free(p->out);
+        free(p->chunks);
+        free(p);
+        return err;
+    }
+    inflate_parallel_reset(p);
+    *par = p;
+    return Z_OK;
+}
+
+void Z_INTERNAL inflate_parallel_end(inflate_parallel *p) {
+    int32_t i;
+
+    if (p == NULL)
+        return;
+    PREFIX(inflateEnd)(&p->strm);
+    for (i = 0; i < p->threads; i++)
+        free(p->chunks[i].out);
+    free(p->chunks);
+    free(p->out);
+    free(p);
+}
+
+#ifndef ZLIB_COMPAT
+/* ===========================================================================
+     Decompresses the source buffer into the destination buffer using up to
+   threads threads. The stream format is selected by windowBits as in
+   inflateInit2. The parameters and return values are otherwise the same as
+   for uncompress2.
+*/
+int32_t Z_EXPORT PREFIX(uncompressParallel)(uint8_t *dest, size_t *destLen, const uint8_t *source, size_t *sourceLen,
+                                            int32_t windowBits, int32_t threads, size_t chunkSize) {
+    inflate_parallel *par;
+    PREFIX3(stream) stream;
+    const uint32_t max = (uint32_t)-1;
+    size_t len, left, n;
+    uint8_t buf[1];     /* for detection of incomplete stream when *destLen == 0 */
+    int32_t err;
+
+    len = *sourceLen;
+    if (*destLen) {
+        left = *destLen;
+        *destLen = 0;
+    } else {
+        left = 1;
+        dest = buf;
+    }
+
+    err = inflate_parallel_init(&par, windowBits, threads, chunkSize);
+    if (err != Z_OK)
+        return err;
+
+    memset(&stream, 0, sizeof(stream));
+    stream.next_in = (z_const uint8_t *)source;
+    stream.next_out = dest;
+
+    do {
+        if (stream.avail_out == 0) {
+            stream.avail_out = left > (size_t)max ? max : (uint32_t)left;
+            left -= stream.avail_out;
+        }
+        if (len) {
+            n = MIN(len, (size_t)(max - stream.avail_in));
+            stream.avail_in += (uint32_t)n;
+            len -= n;
+        }
+        err = inflate_parallel_run(par, &stream, len ? Z_NO_FLUSH : Z_FINISH);
+    } while (err == Z_OK);
+
+    *sourceLen -= len + stream.avail_in;
+    if (dest != buf)
+        *destLen = (size_t)stream.total_out;
+    else if (stream.total_out && err == Z_BUF_ERROR)
+        left = 1;
+
+    inflate_parallel_end(par);
+    return err == Z_STREAM_END ? Z_OK :
+           err == Z_NEED_DICT ? Z_DATA_ERROR  :
+           err == Z_BUF_ERROR && left + stream.avail_out ? Z_DATA_ERROR :
+           err;
+}
+
+/* ===========================================================================
+ * Streams written with Z_FULL_FLUSH at intervals consist of segments that can
+ * be inflated without the data before them. Every full flush ends with an empty
+ * stored block, so segments start right after 00 00 ff ff. The same bytes can
+ * also occur inside compressed data or after a sync flush, which does not reset
+ * the window, so each segment is inflated on its own and only accepted if it
+ * started at a block boundary reached by the segment before it, and decoded
+ * without referring to data before it. Otherwise it is inflated sequentially.
+ */
+#define SEGMENT_SIZE_DEFAULT (256 * 1024)
+
+typedef struct inflate_segment_s {
+    const uint8_t *in;
+    size_t in_len;
+    int32_t last;           /* true if the segment has to end the deflate stream */
+
+    uint8_t *out;           /* allocated by the job, released after each round */
+    size_t out_len;
+    size_t used;            /* input bytes up to the end of the deflate stream, last segment only */
+    uint32_t check;
+    int32_t ok;             /* true if it decoded on its own and ended as required */
+} inflate_segment;
+
+typedef struct {
+    inflate_segment *segments;
+    int32_t check;
+    int32_t init[ZTHREAD_MAX_WORKERS];
+    PREFIX3(stream) strm[ZTHREAD_MAX_WORKERS];
+} inflate_segments_ctx;
+
+/* Returns the offsets of the full flush points in in that are at least min bytes apart, starting with
+   0 for the start of the deflate stream. */
+static size_t *segment_starts(const uint8_t *in, size_t len, size_t min, size_t *count) {
+    size_t *starts, size = 64, n = 1, pos, gap = min > 4 ? min - 4 : 0;
+
+    starts = (size_t *)malloc(size * sizeof(size_t));
+    if (starts == NULL)
+        return NULL;
+    starts[0] = 0;
+
+    pos = gap;
+    while (pos < len && len - pos >= 4) {
+        const uint8_t *hit = (const uint8_t *)memchr(in + pos, 0, len - pos - 3);
+        if (hit == NULL)
+            break;
+        pos = (size_t)(hit - in);
+        if (in[pos + 1] != 0 || in[pos + 2] != 0xff || in[pos + 3] != 0xff || len - pos == 4) {
+            pos++;
+            continue;
+        }
+        if (n == size) {
+            size_t *grown = (size_t *)realloc(starts, size * 2 * sizeof(size_t));
+            if (grown == NULL) {
+                free(starts);
+                return NULL;
+            }
+            starts = grown;
+            size *= 2;
+        }
+        starts[n++] = pos + 4;
+        pos += 4 + gap;
+    }
+    *count = n;
+    return starts;
+}
+
+/* ===========================================================================
+ * Inflates a single segment without a window with the stream of the given worker.
+ */
+static void inflate_segment_job(void *ctx, int32_t worker, int32_t job) {
+    inflate_segments_ctx *c = (inflate_segments_ctx *)ctx;
+    inflate_segment *seg = &c->segments[job];
+    PREFIX3(stream) *strm = &c->strm[worker];
+    struct inflate_state *state;
+    const uint32_t max = (uint32_t)-1;
+    size_t size, left_in = seg->in_len;
+    uint8_t *out;
+    int32_t ret = Z_OK;
+
+    seg->ok = 0;
+    seg->out = NULL;
+    seg->out_len = 0;
+
+    if (!c->init[worker]) {
+        memset(strm, 0, sizeof(*strm));
+        if (PREFIX(inflateInit2)(strm, -MAX_WBITS) != Z_OK)
+            return;
+        c->init[worker] = 1;
+    } else if (PREFIX(inflateReset)(strm) != Z_OK) {
+        return;
+    }
+    state = (struct inflate_state *)strm->state;
+
+    size = MAX(seg->in_len * 4, OUTPUT_MIN);
+    out = (uint8_t *)malloc(size);
+    if (out == NULL)
+        return;
+
+    strm->next_in = seg->in;
+    strm->avail_in = 0;
+    strm->next_out = out;
+    strm->avail_out = 0;
+    for (;;) {
+        size_t produced = (size_t)(strm->next_out - out);
+
+        if (strm->avail_out == 0) {
+            if (produced == size) {
+                uint8_t *grown = (uint8_t *)realloc(out, size * 2);
+                if (grown == NULL) {
+                    free(out);
+                    return;
+                }
+                out = grown;
+                strm->next_out = out + produced;
+                size *= 2;
+            }
+            strm->avail_out = (uint32_t)MIN(size - produced, (size_t)max);
+        }
+        if (strm->avail_in == 0) {
+            if (left_in == 0)
+                break;
+            strm->avail_in = (uint32_t)MIN(left_in, (size_t)max);
+            left_in -= strm->avail_in;
+        }
+        ret = PREFIX(inflate)(strm, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            break;
+    }
+
+    seg->out = out;
+    seg->out_len = (size_t)(strm->next_out - out);
+    if (ret == Z_STREAM_END) {
+        seg->ok = seg->last;
+        seg->used = seg->in_len - left_in - strm->avail_in;
+    } else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+        /* all input used, ending at a block boundary on a byte boundary */
+        seg->ok = !seg->last && (state->mode == TYPE || state->mode == TYPEDO) && state->bits == 0 && !state->last;
+    }
+
+    if (seg->ok && c->check == PARALLEL_CHECK_CRC)
+        seg->check = (uint32_t)PREFIX(crc32_z)(0, seg->out, seg->out_len);
+    else if (seg->ok && c->check == PARALLEL_CHECK_ADLER)
+        seg->check = (uint32_t)PREFIX(adler32_z)(1, seg->out, seg->out_len);
+}
+
+/* Inflates sequentially from the start of segment *next, using the output before it as window, until
+   the start of a later segment is reached at a block boundary, or the end of the deflate stream.
+   Returns Z_OK with *next updated, Z_STREAM_END with *end set to the end of the deflate stream, or an
+   error. */
+static int32_t segments_sequential(PREFIX3(stream) *strm, uint8_t *dest, size_t size, size_t *out,
+                                   const uint8_t *in, size_t in_len, const size_t *starts, size_t count,
+                                   size_t *next, size_t *end) {
+    struct inflate_state *state = (struct inflate_state *)strm->state;
+    const uint32_t max = (uint32_t)-1;
+    size_t dict = MIN(*out, WINDOW_SIZE), left_in, left_out, k = *next + 1;
+    int32_t ret;
+
+    ret = PREFIX(inflateReset2)(strm, -MAX_WBITS);
+    if (ret == Z_OK && dict)
+        ret = PREFIX(inflateSetDictionary)(strm, dest + *out - dict, (uint32_t)dict);
+    if (ret != Z_OK)
+        return ret;
+
+    strm->next_in = in + starts[*next];
+    strm->avail_in = 0;
+    left_in = in_len - starts[*next];
+    strm->next_out = dest + *out;
+    strm->avail_out = 0;
+    left_out = size - *out;
+    for (;;) {
+        if (strm->avail_out == 0) {
+            strm->avail_out = (uint32_t)MIN(left_out, (size_t)max);
+            left_out -= strm->avail_out;
+        }
+        if (strm->avail_in == 0) {
+            strm->avail_in = (uint32_t)MIN(left_in, (size_t)max);
+            left_in -= strm->avail_in;
+        }
+        ret = PREFIX(inflate)(strm, Z_BLOCK);
+        if (ret == Z_STREAM_END) {
+            *end = (size_t)(strm->next_in - in);
+            break;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            break;
+
+        if ((strm->data_type & 128) && !(strm->data_type & 64) && state->bits == 0) {
+            size_t at = (size_t)(strm->next_in - in);
+            while (k < count && starts[k] < at)
+                k++;
+            if (k < count && starts[k] == at) {
+                *next = k;
+                ret = Z_OK;
+                break;
+            }
+        }
+        if (ret == Z_BUF_ERROR) {
+            ret = strm->avail_in == 0 && left_in == 0 ? Z_DATA_ERROR : Z_BUF_ERROR;
+            break;
+        }
+    }
+    *out = (size_t)(strm->next_out - dest);
+    return ret;
+}
+
+/* ===========================================================================
+     Decompresses a stream with full flush points using up to threads threads,
+   see zlib-ng.h for the details.
+*/
+int32_t Z_EXPORT PREFIX(uncompressSegments)(uint8_t *dest, size_t *destLen, const uint8_t *source, size_t *sourceLen,
+                                            int32_t windowBits, int32_t threads, size_t segmentSize) {
+    inflate_segments_ctx *ctx;
+    inflate_segment *segments = NULL;
+    PREFIX3(stream) strm;
+    const uint32_t max = (uint32_t)-1;
+    const uint8_t *in;
+    size_t *starts = NULL, left, out = 0, in_len, header = 0, count, next = 0, end = 0, i;
+    uint32_t check = 0, trailer = 0;
+    int32_t wrap = 0, round, jobs, err, done = 0, failed;
+
+    left = *destLen;
+    *destLen = 0;
+    if (threads < 0)
+        return Z_STREAM_ERROR;
+    if (threads == 0)
+        threads = zthread_cpu_count();
+    if (threads > ZTHREAD_MAX_WORKERS)
+        threads = ZTHREAD_MAX_WORKERS;
+    if (segmentSize == 0)
+        segmentSize = SEGMENT_SIZE_DEFAULT;
+
+    memset(&strm, 0, sizeof(strm));
+    err = PREFIX(inflateInit2)(&strm, windowBits);
+    if (err != Z_OK)
+        return err;
+
+    /* Decode the header, if any */
+    if (windowBits >= 0) {
+        strm.next_in = source;
+        strm.avail_in = (uint32_t)MIN(*sourceLen, (size_t)max);
+        strm.next_out = dest;
+        strm.avail_out = 0;
+        err = PREFIX(inflate)(&strm, Z_BLOCK);
+        if (err == Z_MEM_ERROR)
+            goto done;
+        if ((err != Z_OK && err != Z_BUF_ERROR) || !(strm.data_type & 128)) {
+            err = Z_DATA_ERROR;
+            goto done;
+        }
+        wrap = ((struct inflate_state *)strm.state)->flags > 0 ? 2 : 1;
+        header = (size_t)strm.total_in;
+        check = wrap == 2 ? CRC32_INITIAL_VALUE : ADLER32_INITIAL_VALUE;
+        trailer = wrap == 2 ? 8 : 4;
+    }
+    in = source + header;
+    in_len = *sourceLen - header;
+
+    round = threads * 4;
+    starts = segment_starts(in, in_len, segmentSize, &count);
+    segments = (inflate_segment *)calloc((size_t)round, sizeof(inflate_segment));
+    ctx = (inflate_segments_ctx *)calloc(1, sizeof(inflate_segments_ctx));
+    if (starts == NULL || segments == NULL || ctx == NULL) {
+        free(ctx);
+        err = Z_MEM_ERROR;
+        goto done;
+    }
+    ctx->segments = segments;
+    ctx->check = wrap == 2 ? PARALLEL_CHECK_CRC : (wrap == 1 ? PARALLEL_CHECK_ADLER : PARALLEL_CHECK_NONE);
+
+    err = Z_OK;
+    while (!done && err == Z_OK) {
+        /* Inflate the next segments in parallel, segment next starts at a known block boundary */
+        jobs = (int32_t)MIN((size_t)round, count - next);
+        for (i = 0; i < (size_t)jobs; i++) {
+            size_t k = next + i;
+            segments[i].in = in + starts[k];
+            segments[i].in_len = (k + 1 < count ? starts[k + 1] : in_len) - starts[k];
+            segments[i].last = (k + 1 == count);
+        }
+        zthread_run_jobs(inflate_segment_job, ctx, MIN(threads, jobs), jobs);
+
+        for (i = 0; i < (size_t)jobs && segments[i].ok; i++) {
+            if (segments[i].out_len > left - out) {
+                err = Z_BUF_ERROR;
+                break;
+            }
+            memcpy(dest + out, segments[i].out, segments[i].out_len);
+            out += segments[i].out_len;
+            if (wrap == 2)
+                check = PREFIX(crc32_combine)(check, segments[i].check, (z_off64_t)segments[i].out_len);
+            else if (wrap == 1)
+                check = PREFIX(adler32_combine)(check, segments[i].check, (z_off64_t)segments[i].out_len);
+            if (segments[i].last) {
+                end = starts[next + i] + segments[i].used;
+                done = 1;
+            }
+        }
+        next += i;
+        failed = i < (size_t)jobs;
+        for (i = 0; i < (size_t)jobs; i++) {
+            free(segments[i].out);
+            segments[i].out = NULL;
+        }
+
+        /* A segment that could not be inflated on its own is continued from the one before it */
+        if (!done && err == Z_OK && failed) {
+            size_t from = out;
+            err = segments_sequential(&strm, dest, left, &out, in, in_len, starts, count, &next, &end);
+            if (wrap == 2)
+                check = (uint32_t)PREFIX(crc32_z)(check, dest + from, out - from);
+            else if (wrap == 1)
+                check = (uint32_t)PREFIX(adler32_z)(check, dest + from, out - from);
+            if (err == Z_STREAM_END) {
+                err = Z_OK;
+                done = 1;
+            }
+        }
+    }
+
+    /* Check the trailer */
+    if (err == Z_OK && in_len - end < trailer) {
+        err = Z_DATA_ERROR;
+    } else if (err == Z_OK && wrap == 2) {
+        const uint8_t *t = in + end;
+        if (check != (t[0] | (t[1] << 8) | (t[2] << 16) | ((uint32_t)t[3] << 24)) ||
+            (uint32_t)out != (t[4] | (t[5] << 8) | (t[6] << 16) | ((uint32_t)t[7] << 24)))
+            err = Z_DATA_ERROR;
+    } else if (err == Z_OK && wrap == 1) {
+        const uint8_t *t = in + end;
+        if (check != (((uint32_t)t[0] << 24) | (t[1] << 16) | (t[2] << 8) | t[3]))
+            err = Z_DATA_ERROR;
+    }
+
+    for (i = 0; i < ZTHREAD_MAX_WORKERS; i++) {
+        if (ctx->init[i])
+            PREFIX(inflateEnd)(&ctx->strm[i]);
+    }
+    free(ctx);
+
+done:
+    free(segments);
+    free(starts);
+    PREFIX(inflateEnd)(&strm);
+    if (err == Z_OK) {
+        *destLen = out;
+        *sourceLen = header + end + trailer;
+    }
+    return err;
+}
+#endif
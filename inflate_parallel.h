@@ -0,0 +1,34 @@
+/* inflate_parallel.h -- Internal speculative multi-threaded inflate, shared by
+ *                       the parallel uncompress utility function and the gzip
+ *                       file reader
+ *
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef INFLATE_PARALLEL_H_
+#define INFLATE_PARALLEL_H_
+
+#define PARALLEL_CHUNK_SIZE_DEFAULT (1024 * 1024)
+
+typedef struct inflate_parallel_s inflate_parallel;
+
+/* Creates a decoder for one zlib, gzip or raw deflate stream, selected by window_bits as in
+   inflateInit2. Compressed data is processed in batches of threads chunks of chunk bytes.
+   Returns Z_OK, Z_MEM_ERROR, or Z_STREAM_ERROR if a parameter is invalid. */
+int32_t Z_INTERNAL inflate_parallel_init(inflate_parallel **par, int32_t window_bits, int32_t threads, size_t chunk);
+/* Prepares the decoder for the next stream, discarding any pending output */
+void    Z_INTERNAL inflate_parallel_reset(inflate_parallel *par);
+void    Z_INTERNAL inflate_parallel_end(inflate_parallel *par);
+
+/* Decompresses from strm->next_in to strm->next_out like inflate, updating next_in, avail_in,
+   total_in, next_out, avail_out, total_out and msg of strm. The other fields of strm are not used.
+   Unless flush is Z_FINISH, nothing is decompressed until at least inflate_parallel_batch() bytes
+   of input are available. Returns Z_OK, Z_STREAM_END, Z_BUF_ERROR if no progress was possible, or
+   the error that inflate would return. */
+int32_t Z_INTERNAL inflate_parallel_run(inflate_parallel *par, PREFIX3(stream) *strm, int32_t flush);
+/* Amount of input that is decompressed in parallel at once */
+size_t  Z_INTERNAL inflate_parallel_batch(inflate_parallel *par);
+/* Returns true if inflate_parallel_run can make progress without more input */
+int32_t Z_INTERNAL inflate_parallel_pending(inflate_parallel *par);
+
+#endif
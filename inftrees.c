@@ -293,3 +293,32 @@ int Z_INTERNAL zng_inflate_table(codetype type, uint16_t *lens, unsigned codes,
     *bits = root;
     return 0;
 }
+
+/*
+   Build a pair table from the root table of a literal/length code, whose
+   indices are 0..2^lenbits-1.  Each entry of the pair table is the same as
+   the root table entry, except where the root table entry is a literal and the
+   index bits left over after it hold the whole code of another literal.  The
+   pair table entry then decodes both literals at once, using all the bits of
+   both codes.  Entries that are not literals are unchanged, so table links
+   still point into the root table's sub-tables.
+ */
+void Z_INTERNAL zng_inflate_pair_table(code *pairs, const code *lencode, unsigned lenbits) {
+    unsigned size = 1U << lenbits;
+    unsigned low;               /* index of the root table entry */
+    code here;                  /* first code */
+    code next;                  /* code after the first */
+
+    for (low = 0; low < size; low++) {
+        here = lencode[low];
+        if (here.op == 0 && here.bits < lenbits) {
+            next = lencode[low >> here.bits];
+            if (next.op == 0 && here.bits + next.bits <= lenbits) {
+                here.op = (unsigned char)128;
+                here.bits = (unsigned char)(here.bits + next.bits);
+                here.val = (uint16_t)(here.val | (next.val << 8));
+            }
+        }
+        pairs[low] = here;
+    }
+}
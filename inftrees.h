@@ -36,23 +36,45 @@ typedef struct {
     0001eeee - length or distance, eeee is the number of extra bits
     01100000 - end of block
     01000000 - invalid code
+    10000000 - two literals, the first in the low byte of val (pair tables only)
  */
 
+/* Root table size for literal/length codes of new streams, 10 or 11 bits.  The
+   root table for distance codes is one bit smaller.  The tables in the inflate
+   state are sized for INFLATE_MAX_ROOT_BITS, and inflateRootBits() chooses the
+   size per stream.  11 bits decode more codes with a single lookup, but the
+   tables need about twice the memory, which pays off only when they stay in the
+   L1 cache. */
+#define INFLATE_MIN_ROOT_BITS 10
+#define INFLATE_MAX_ROOT_BITS 11
+#ifndef INFLATE_ROOT_BITS
+#  define INFLATE_ROOT_BITS INFLATE_MIN_ROOT_BITS
+#endif
+#if INFLATE_ROOT_BITS < INFLATE_MIN_ROOT_BITS || INFLATE_ROOT_BITS > INFLATE_MAX_ROOT_BITS
+#  error "INFLATE_ROOT_BITS must be 10 or 11"
+#endif
+
 /* Maximum size of the dynamic table.  The maximum number of code structures is
-   1924, which is the sum of 1332 for literal/length codes and 592 for distance
-   codes.  These values were found by exhaustive searches using the program
+   3412 for 11 root bits, which is the sum of 2340 for literal/length codes and
+   1072 for distance codes.  10 root bits need less, 1924, which is the sum of
+   1332 and 592.  These values were found by exhaustive searches using the program
    examples/enough.c found in the zlib distributions.  The arguments to that
    program are the number of symbols, the initial root table size, and the
-   maximum bit length of a code.  "enough 286 10 15" for literal/length codes
-   returns 1332, and "enough 30 9 15" for distance codes returns 592.
-   The initial root table size (10 or 9) is found in the fifth argument of the
+   maximum bit length of a code.  "enough 286 10 15" and "enough 286 11 15" for
+   literal/length codes return 1332 and 2340, and "enough 30 9 15" and
+   "enough 30 10 15" for distance codes return 592 and 1072.
+   The initial root table size is found in the fifth argument of the
    inflate_table() calls in inflate.c and infback.c.  If the root table size is
    changed, then these maximum sizes would be need to be recalculated and
    updated. */
-#define ENOUGH_LENS 1332
-#define ENOUGH_DISTS 592
+#define ENOUGH_LENS 2340
+#define ENOUGH_DISTS 1072
 #define ENOUGH (ENOUGH_LENS+ENOUGH_DISTS)
 
+/* Size of a pair table, which has an entry for each index of a literal/length
+   root table. */
+#define ENOUGH_PAIRS (1 << INFLATE_MAX_ROOT_BITS)
+
 /* Type of code to build for inflate_table() */
 typedef enum {
     CODES,
@@ -62,5 +84,6 @@ typedef enum {
 
 int Z_INTERNAL zng_inflate_table (codetype type, uint16_t *lens, unsigned codes,
                                   code * *table, unsigned *bits, uint16_t *work);
+void Z_INTERNAL zng_inflate_pair_table(code *pairs, const code *lencode, unsigned lenbits);
 
 #endif /* INFTREES_H_ */
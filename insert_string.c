@@ -18,5 +18,6 @@
 #define UPDATE_HASH          update_hash_c
 #define INSERT_STRING        insert_string_c
 #define QUICK_INSERT_STRING  quick_insert_string_c
+#define CLEAR_STRING         clear_string_c
 
 #include "insert_string_tpl.h"
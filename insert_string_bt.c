@@ -0,0 +1,192 @@
+/* insert_string_bt.c -- insert_string binary tree variant
+ *
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * Instead of a hash chain, each hash bucket holds a binary search tree of the
+ * strings in the window that start with the same four bytes. Strings are
+ * ordered by the up to STD_MAX_MATCH bytes that follow them: strings that
+ * compare smaller than a node are stored in its left subtree, linked through
+ * prev, and larger ones in its right subtree, linked through bt_right. head
+ * holds the root of each tree.
+ *
+ * A new string always becomes the root of its tree. While descending from the
+ * old root to split the tree into the new left and right subtrees, every node
+ * visited is compared with the new string, so the insertion finds the longest
+ * match on the way, typically in a logarithmic number of steps instead of a
+ * walk through all strings with the same hash.
+ *
+ * Trees are pruned when a node is too far back to be referenced, and by the
+ * window sliding done for the hash chains, which clears older links to zero.
+ */
+
+#include "zbuild.h"
+#include "zutil.h"
+#include "deflate.h"
+#include "functable.h"
+
+#define HASH_SLIDE           16
+
+#define HASH_CALC(h, val)    h = ((val * 2654435761U) >> HASH_SLIDE);
+
+/* ===========================================================================
+ * Return the length of the common prefix of scan and match, up to limit bytes,
+ * starting at offset len which is known to be equal in both.
+ */
+static inline uint32_t bt_compare(const uint8_t *scan, const uint8_t *match, uint32_t len, uint32_t limit) {
+    if (limit == STD_MAX_MATCH) {
+        /* Same bounds as longest_match, use the optimized comparison */
+        if (len < 2) {
+            if (scan[0] != match[0])
+                return 0;
+            if (scan[1] != match[1])
+                return 1;
+        }
+        return 2 + functable.compare256(scan + 2, match + 2);
+    }
+    while (len < limit && scan[len] == match[len])
+        len++;
+    return len;
+}
+
+/* ===========================================================================
+ * Insert string str as the new root of its tree. Return the longest match with
+ * the strings visited on the way and set match_start. The first match_known bytes
+ * of that match were not compared but follow from the tree order.
+ */
+static uint32_t bt_insert(deflate_state *const s, uint32_t str, uint32_t *match_start, uint32_t *match_known) {
+    const uint8_t *scan = s->window + str;
+    Pos *left = s->prev;
+    Pos *right = s->bt_right;
+    Pos *left_link = &left[str & s->w_mask];
+    Pos *right_link = &right[str & s->w_mask];
+    uint32_t limit = MIN(STD_MAX_MATCH, s->strstart + s->lookahead - str);
+    uint32_t chain_length = s->max_chain_length;
+    uint32_t left_len = 0, right_len = 0;
+    uint32_t best_len = 0;
+    uint32_t val, h, cur_match;
+
+    memcpy(&val, scan, sizeof(val));
+    HASH_CALC(h, val);
+    h &= s->hash_mask;
+
+    cur_match = s->head[h];
+    s->head[h] = (Pos)str;
+    s->bt_next = str + 1;
+
+    for (;;) {
+        const uint8_t *match;
+        uint32_t known, len;
+
+        if (cur_match == 0 || str - cur_match > MAX_DIST(s) || chain_length-- == 0) {
+            *left_link = 0;
+            *right_link = 0;
+            break;
+        }
+
+        /* Every string in this subtree shares at least MIN(left_len, right_len)
+         * bytes with str, since it lies between the two nodes it descended from */
+        match = s->window + cur_match;
+        known = MIN(left_len, right_len);
+        len = bt_compare(scan, match, known, limit);
+
+        if (len > best_len) {
+            best_len = len;
+            *match_start = cur_match;
+            *match_known = known;
+        }
+        if (len >= limit) {
+            /* Equal as far as can be compared, str replaces the node */
+            *left_link = left[cur_match & s->w_mask];
+            *right_link = right[cur_match & s->w_mask];
+            break;
+        }
+
+        if (match[len] < scan[len]) {
+            /* The node and its left subtree are smaller, continue with its right subtree */
+            *left_link = (Pos)cur_match;
+            left_link = &right[cur_match & s->w_mask];
+            cur_match = *left_link;
+            left_len = len;
+        } else {
+            *right_link = (Pos)cur_match;
+            right_link = &left[cur_match & s->w_mask];
+            cur_match = *right_link;
+            right_len = len;
+        }
+    }
+    return best_len;
+}
+
+/* ===========================================================================
+ * Insert string str in the trees, searching for the longest match at the same time,
+ * which longest_match_bt returns. Return the previous root of the tree.
+ */
+Z_INTERNAL Pos quick_insert_string_bt(deflate_state *const s, uint32_t str) {
+    const uint8_t *scan = s->window + str;
+    uint32_t match_start = 0, match_known = 0;
+    uint32_t val, h, match_len;
+    Pos head;
+
+    if (UNLIKELY(str < s->bt_next)) {
+        /* Already in the trees, inserting it again would break them */
+        s->bt_match_length = 0;
+        return 0;
+    }
+
+    memcpy(&val, scan, sizeof(val));
+    HASH_CALC(h, val);
+    head = s->head[h & s->hash_mask];
+
+    match_len = bt_insert(s, str, &match_start, &match_known);
+    if (match_len >= STD_MIN_MATCH) {
+        const uint8_t *match = s->window + match_start;
+
+        /* Strings inserted near the end of the available input are ordered by fewer
+         * bytes than later ones, so the prefix that follows from the tree order can
+         * be too long */
+        if (match_known > 0 && memcmp(scan, match, match_known) != 0)
+            match_len = bt_compare(scan, match, 0, match_known);
+    }
+
+    s->bt_match_length = match_len;
+    s->bt_match_start = match_start;
+    return head;
+}
+
+/* ===========================================================================
+ * Insert count strings starting at str in the trees.
+ */
+Z_INTERNAL void insert_string_bt(deflate_state *const s, uint32_t str, uint32_t count) {
+    uint32_t end = str + count;
+    uint32_t match_start, match_known;
+
+    str = MAX(str, s->bt_next);
+    for (; str < end; str++)
+        bt_insert(s, str, &match_start, &match_known);
+}
+
+/* ===========================================================================
+ * Return the longest match found by the last call to quick_insert_string_bt.
+ */
+Z_INTERNAL uint32_t longest_match_bt(deflate_state *const s, Pos cur_match) {
+    Z_UNUSED(cur_match);
+
+    s->match_start = s->bt_match_start;
+    return s->bt_match_length;
+}
+
+/* ===========================================================================
+ * Slide the right subtree links, see slide_hash_c. The left links share prev with
+ * the hash chains and are slid by slide_hash.
+ */
+Z_INTERNAL void slide_hash_bt(deflate_state *s) {
+    Pos *table = s->bt_right;
+    Pos wsize = (Pos)s->w_size;
+    unsigned int i;
+
+    for (i = 0; i < s->w_size; i++) {
+        Pos m = table[i];
+        table[i] = (Pos)(m >= wsize ? m - wsize : 0);
+    }
+    s->bt_next = s->bt_next >= wsize ? s->bt_next - wsize : 0;
+}
@@ -15,7 +15,7 @@
 #define HASH_CALC_VAR        s->ins_h
 #define HASH_CALC_VAR_INIT
 #define HASH_CALC_READ       val = strstart[0]
-#define HASH_CALC_MASK       (32768u - 1u)
+#define HASH_CALC_MASK       (s->hash_mask & (32768u - 1u))
 #define HASH_CALC_OFFSET     (STD_MIN_MATCH-1)
 
 #define UPDATE_HASH          update_hash_roll
@@ -26,7 +26,7 @@
 #  define HASH_CALC_OFFSET 0
 #endif
 #ifndef HASH_CALC_MASK
-#  define HASH_CALC_MASK HASH_MASK
+#  define HASH_CALC_MASK s->hash_mask
 #endif
 #ifndef HASH_CALC_READ
 #  if BYTE_ORDER == LITTLE_ENDIAN
@@ -105,4 +105,26 @@ Z_INTERNAL void INSERT_STRING(deflate_state *const s, uint32_t str, uint32_t cou
         }
     }
 }
+
+#ifdef CLEAR_STRING
+/* ===========================================================================
+ * Clear the hash table entries of count strings starting at str. This empties
+ * the hash table faster than clearing all of it when only few strings have been
+ * inserted, as long as the window has not changed since they were inserted.
+ */
+Z_INTERNAL void CLEAR_STRING(deflate_state *const s, uint32_t str, uint32_t count) {
+    uint8_t *strstart = s->window + str + HASH_CALC_OFFSET;
+    uint8_t *strend = strstart + count;
+
+    for (; strstart < strend; strstart++) {
+        uint32_t val;
+
+        HASH_CALC_VAR_INIT;
+        HASH_CALC_READ;
+        HASH_CALC(s, HASH_CALC_VAR, val);
+        HASH_CALC_VAR &= HASH_CALC_MASK;
+        s->head[HASH_CALC_VAR] = 0;
+    }
+}
+#endif
 #endif
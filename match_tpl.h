@@ -42,7 +42,7 @@ Z_INTERNAL uint32_t LONGEST_MATCH(deflate_state *const s, Pos cur_match) {
 #else
     int32_t early_exit;
 #endif
-    uint32_t chain_length, nice_match, best_len, offset;
+    uint32_t chain_length, chain_start, nice_match, best_len, offset;
     uint32_t lookahead = s->lookahead;
     Pos match_offset = 0;
 #ifdef UNALIGNED_OK
@@ -50,10 +50,16 @@ Z_INTERNAL uint32_t LONGEST_MATCH(deflate_state *const s, Pos cur_match) {
 #endif
     uint8_t scan_end[8];
 
+/* Count the chain links followed in s->chain_steps */
+#define RETURN_MATCH(len) { \
+    s->chain_steps += chain_start - chain_length; \
+    return (len); \
+}
+
 #define GOTO_NEXT_CHAIN \
     if (--chain_length && (cur_match = prev[cur_match & wmask]) > limit) \
         continue; \
-    return best_len;
+    RETURN_MATCH(best_len);
 
     /* The code is optimized for STD_MAX_MATCH-2 multiple of 16. */
     Assert(STD_MAX_MATCH == 258, "Code too clever");
@@ -96,6 +102,7 @@ Z_INTERNAL uint32_t LONGEST_MATCH(deflate_state *const s, Pos cur_match) {
      * we prevent matches with the string of window index 0
      */
     limit = strstart > MAX_DIST(s) ? (Pos)(strstart - MAX_DIST(s)) : 0;
+    chain_start = chain_length;
 #ifdef LONGEST_MATCH_SLOW
     limit_base = limit;
     if (best_len >= STD_MIN_MATCH) {
@@ -185,10 +192,10 @@ Z_INTERNAL uint32_t LONGEST_MATCH(deflate_state *const s, Pos cur_match) {
 
             /* Do not look for matches beyond the end of the input. */
             if (len > lookahead)
-                return lookahead;
+                RETURN_MATCH(lookahead);
             best_len = len;
             if (best_len >= nice_match)
-                return best_len;
+                RETURN_MATCH(best_len);
 
             offset = best_len-1;
 #ifdef UNALIGNED_OK
@@ -272,18 +279,20 @@ Z_INTERNAL uint32_t LONGEST_MATCH(deflate_state *const s, Pos cur_match) {
 #endif
         GOTO_NEXT_CHAIN;
     }
-    return best_len;
+    RETURN_MATCH(best_len);
 
 #ifdef LONGEST_MATCH_SLOW
 break_matching:
 
     if (best_len < s->lookahead)
-        return best_len;
+        RETURN_MATCH(best_len);
 
-    return s->lookahead;
+    RETURN_MATCH(s->lookahead);
 #endif
 }
 
+#undef GOTO_NEXT_CHAIN
+#undef RETURN_MATCH
 #undef LONGEST_MATCH_SLOW
 #undef LONGEST_MATCH
 #undef COMPARE256
@@ -0,0 +1,123 @@
+/* state_pool.c -- Reusable memory blocks for deflate and inflate states
+ *
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#include "zbuild.h"
+#include "zutil_p.h"
+#include "zthread.h"
+#include "state_pool.h"
+
+/* Header in front of every block, padded so that the block starts on a cache line */
+typedef struct pool_block_s {
+    struct pool_block_s *next;  /* next free block */
+    state_pool *pool;           /* pool the block belongs to */
+    size_t size;
+} pool_block;
+
+#define POOL_HEADER_SIZE 64
+
+struct state_pool_s {
+    zmutex_t mutex;
+    pool_block *free;           /* blocks kept for reuse */
+    uint32_t count;             /* number of blocks in free */
+    uint32_t max_blocks;        /* most blocks kept for reuse */
+    uint32_t in_use;            /* blocks handed out and not given back yet */
+    int32_t destroyed;          /* free the pool once in_use drops to 0 */
+};
+
+state_pool Z_INTERNAL *state_pool_create(uint32_t max_blocks) {
+    state_pool *pool = (state_pool *)zng_alloc(sizeof(state_pool));
+
+    if (pool == NULL)
+        return NULL;
+    memset(pool, 0, sizeof(state_pool));
+    if (zmutex_init(&pool->mutex) != 0) {
+        zng_free(pool);
+        return NULL;
+    }
+    pool->max_blocks = max_blocks;
+    return pool;
+}
+
+/* Frees the blocks in list, which is no longer reachable from the pool */
+static void free_blocks(pool_block *list) {
+    while (list != NULL) {
+        pool_block *next = list->next;
+        zng_free(list);
+        list = next;
+    }
+}
+
+void Z_INTERNAL state_pool_destroy(state_pool *pool) {
+    pool_block *list;
+    uint32_t in_use;
+
+    zmutex_lock(&pool->mutex);
+    list = pool->free;
+    pool->free = NULL;
+    pool->count = 0;
+    pool->destroyed = 1;
+    in_use = pool->in_use;
+    zmutex_unlock(&pool->mutex);
+
+    free_blocks(list);
+    if (in_use == 0) {
+        zmutex_destroy(&pool->mutex);
+        zng_free(pool);
+    }
+}
+
+void Z_INTERNAL *state_pool_get(state_pool *pool, size_t size) {
+    pool_block *block, **link;
+
+    zmutex_lock(&pool->mutex);
+    for (link = &pool->free; *link != NULL; link = &(*link)->next) {
+        if ((*link)->size == size)
+            break;
+    }
+    block = *link;
+    if (block != NULL) {
+        *link = block->next;
+        pool->count--;
+    }
+    pool->in_use++;
+    zmutex_unlock(&pool->mutex);
+
+    if (block == NULL) {
+        block = (pool_block *)zng_alloc(POOL_HEADER_SIZE + size);
+        if (block == NULL) {
+            zmutex_lock(&pool->mutex);
+            pool->in_use--;
+            zmutex_unlock(&pool->mutex);
+            return NULL;
+        }
+        block->pool = pool;
+        block->size = size;
+    }
+    return (unsigned char *)block + POOL_HEADER_SIZE;
+}
+
+void Z_INTERNAL state_pool_put(void *ptr) {
+    pool_block *block = (pool_block *)((unsigned char *)ptr - POOL_HEADER_SIZE);
+    state_pool *pool = block->pool;
+    int32_t free_pool = 0;
+
+    zmutex_lock(&pool->mutex);
+    pool->in_use--;
+    if (!pool->destroyed && pool->count < pool->max_blocks) {
+        block->next = pool->free;
+        pool->free = block;
+        pool->count++;
+        block = NULL;
+    }
+    free_pool = pool->destroyed && pool->in_use == 0;
+    zmutex_unlock(&pool->mutex);
+
+    if (block != NULL)
+        zng_free(block);
+    if (free_pool) {
+        zmutex_destroy(&pool->mutex);
+        zng_free(pool);
+    }
+}
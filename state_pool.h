@@ -0,0 +1,23 @@
+/* state_pool.h -- Reusable memory blocks for deflate and inflate states
+ *
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef STATE_POOL_H_
+#define STATE_POOL_H_
+
+/* A pool keeps the blocks released by ended streams, so that streams created
+ * later with the same parameters reuse them instead of calling the allocator.
+ * Blocks are 64-byte aligned and not cleared. The pool may be used from several
+ * threads at once, and is only freed once every block handed out is back. */
+typedef struct state_pool_s state_pool;
+
+state_pool Z_INTERNAL *state_pool_create(uint32_t max_blocks);
+void       Z_INTERNAL  state_pool_destroy(state_pool *pool);
+
+/* Returns a block of size bytes, or NULL if out of memory */
+void       Z_INTERNAL *state_pool_get(state_pool *pool, size_t size);
+/* Gives back a block returned by state_pool_get */
+void       Z_INTERNAL  state_pool_put(void *block);
+
+#endif
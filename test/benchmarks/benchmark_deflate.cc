@@ -0,0 +1,130 @@
+/* benchmark_deflate.cc -- benchmark compression levels on the test corpus
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#  include "zbuild.h"
+#  ifdef ZLIB_COMPAT
+#    include "zlib.h"
+#  else
+#    include "zlib-ng.h"
+#  endif
+}
+
+#ifndef BENCHMARK_DATA_DIR
+#  define BENCHMARK_DATA_DIR "test/data"
+#endif
+
+static const char *deflate_files[] = {
+    BENCHMARK_DATA_DIR "/lcet10.txt",
+    BENCHMARK_DATA_DIR "/paper-100k.pdf"
+};
+
+class deflate_level: public benchmark::Fixture {
+private:
+    uint8_t *inbuff = NULL;
+    uint8_t *outbuff = NULL;
+    size_t inlen = 0;
+    size_t outsize = 0;
+
+public:
+    void SetUp(const ::benchmark::State& state) {
+        FILE *f = fopen(deflate_files[state.range(0)], "rb");
+        if (f == NULL)
+            return;
+        fseek(f, 0, SEEK_END);
+        inlen = (size_t)ftell(f);
+        fseek(f, 0, SEEK_SET);
+
+        inbuff = (uint8_t *)malloc(inlen);
+        if (inbuff != NULL && fread(inbuff, 1, inlen, f) != inlen) {
+            free(inbuff);
+            inbuff = NULL;
+        }
+        fclose(f);
+
+        outsize = PREFIX(compressBound)((z_uintmax_t)inlen);
+        outbuff = (uint8_t *)malloc(outsize);
+    }
+
+    /* Compresses at level with a stream that starts below level 8, which has no room
+       for the binary trees and keeps searching the hash chains */
+    z_uintmax_t CompressChains(int32_t level) {
+        PREFIX3(stream) strm;
+        z_uintmax_t outlen;
+
+        memset(&strm, 0, sizeof(strm));
+        if (PREFIX(deflateInit)(&strm, 1) != Z_OK)
+            return 0;
+        PREFIX(deflateParams)(&strm, level, Z_DEFAULT_STRATEGY);
+        strm.next_in = inbuff;
+        strm.avail_in = (uint32_t)inlen;
+        strm.next_out = outbuff;
+        strm.avail_out = (uint32_t)outsize;
+        PREFIX(deflate)(&strm, Z_FINISH);
+        outlen = (z_uintmax_t)strm.total_out;
+        PREFIX(deflateEnd)(&strm);
+        return outlen;
+    }
+
+    void Bench(benchmark::State& state, bool chains) {
+        int32_t level = (int32_t)state.range(1);
+        z_uintmax_t outlen = 0;
+
+        if (inbuff == NULL || outbuff == NULL) {
+            state.SkipWithError("Cannot read test data");
+            return;
+        }
+
+        for (auto _ : state) {
+            if (chains) {
+                outlen = CompressChains(level);
+            } else {
+                outlen = outsize;
+                PREFIX(compress2)(outbuff, &outlen, inbuff, (z_uintmax_t)inlen, level);
+            }
+            benchmark::DoNotOptimize(outbuff);
+        }
+
+        state.SetBytesProcessed(state.iterations() * (int64_t)inlen);
+        state.counters["ratio"] = (double)outlen / (double)inlen;
+    }
+
+    void TearDown(const ::benchmark::State& state) {
+        free(inbuff);
+        free(outbuff);
+        inbuff = outbuff = NULL;
+    }
+};
+
+BENCHMARK_DEFINE_F(deflate_level, compress)(benchmark::State& state) {
+    Bench(state, false);
+}
+BENCHMARK_REGISTER_F(deflate_level, compress)
+    ->ArgsProduct({benchmark::CreateDenseRange(0, sizeof(deflate_files) / sizeof(deflate_files[0]) - 1, 1),
+                   benchmark::CreateDenseRange(1, 10, 1)})
+    ->Unit(benchmark::kMillisecond);
+
+/* Level 10 with the hash chains instead of the binary trees */
+BENCHMARK_DEFINE_F(deflate_level, chains)(benchmark::State& state) {
+    Bench(state, true);
+}
+BENCHMARK_REGISTER_F(deflate_level, chains)
+    ->ArgsProduct({benchmark::CreateDenseRange(0, sizeof(deflate_files) / sizeof(deflate_files[0]) - 1, 1),
+                   {Z_OPTIMAL_COMPRESSION}})
+    ->Unit(benchmark::kMillisecond);
+
+/* Z_FASTEST_COMPRESSION next to level 1 */
+BENCHMARK_DEFINE_F(deflate_level, fastest)(benchmark::State& state) {
+    Bench(state, false);
+}
+BENCHMARK_REGISTER_F(deflate_level, fastest)
+    ->ArgsProduct({benchmark::CreateDenseRange(0, sizeof(deflate_files) / sizeof(deflate_files[0]) - 1, 1),
+                   {1, Z_FASTEST_COMPRESSION}})
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,142 @@
+/* benchmark_gzio.cc -- benchmark reading and writing many gzip files at once
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#  include "zbuild.h"
+#  ifdef ZLIB_COMPAT
+#    include "zlib.h"
+#  else
+#    include "zlib-ng.h"
+#  endif
+}
+
+#ifdef WITH_GZFILEOP
+#define GZIO_FILE_SIZE (256 * 1024)
+#define GZIO_CHUNK     (16 * 1024)
+#define GZIO_BUFFER    (32 * 1024)
+
+/* Modes compared, plain read() and write() against 'A', which keeps several
+   reads or writes in flight per file with io_uring where available */
+static const char *gzio_read_modes[] = { "rb", "rbA4" };
+static const char *gzio_write_modes[] = { "wb1", "wb1A4" };
+
+/* Streams a number of files at once in chunks, going round the files, like a
+   server handling many connections on one thread.  Each file has its own
+   gzFile, and with it its own buffers and reads or writes in flight. */
+class gzio_files: public benchmark::Fixture {
+private:
+    uint8_t *data = NULL;
+    uint8_t *buf = NULL;
+    int count = 0;
+
+    void Name(char *name, size_t size, int i) {
+        snprintf(name, size, "benchmark_gzio_%d.gz", i);
+    }
+
+public:
+    void SetUp(const ::benchmark::State& state) {
+        uint32_t seed = 1;
+        char name[64];
+
+        count = (int)state.range(1);
+        data = (uint8_t *)malloc(GZIO_FILE_SIZE);
+        buf = (uint8_t *)malloc(GZIO_CHUNK);
+        if (data == NULL || buf == NULL)
+            return;
+        for (int i = 0; i < GZIO_FILE_SIZE; i++) {
+            seed = seed * 1103515245 + 12345;
+            data[i] = (uint8_t)"abcdefghij"[(seed >> 16) % ((seed >> 28) + 1)];
+        }
+        for (int i = 0; i < count; i++) {
+            Name(name, sizeof(name), i);
+            gzFile file = PREFIX(gzopen)(name, "wb1");
+            if (file == NULL || PREFIX(gzwrite)(file, data, GZIO_FILE_SIZE) != GZIO_FILE_SIZE ||
+                    PREFIX(gzclose)(file) != Z_OK) {
+                free(data);
+                data = NULL;
+                return;
+            }
+        }
+    }
+
+    void Bench(benchmark::State& state, bool writing) {
+        const char *mode = writing ? gzio_write_modes[state.range(0)] : gzio_read_modes[state.range(0)];
+        gzFile *files = (gzFile *)calloc((size_t)count, sizeof(gzFile));
+        char name[64];
+
+        if (data == NULL || buf == NULL || files == NULL) {
+            free(files);
+            state.SkipWithError("Cannot create test files");
+            return;
+        }
+
+        for (auto _ : state) {
+            bool failed = false;
+
+            for (int i = 0; i < count && !failed; i++) {
+                Name(name, sizeof(name), i);
+                files[i] = PREFIX(gzopen)(name, mode);
+                failed = files[i] == NULL || PREFIX(gzbuffer)(files[i], GZIO_BUFFER) != 0;
+            }
+            for (int pos = 0; pos < GZIO_FILE_SIZE && !failed; pos += GZIO_CHUNK) {
+                for (int i = 0; i < count && !failed; i++) {
+                    if (writing)
+                        failed = PREFIX(gzwrite)(files[i], data + pos, GZIO_CHUNK) != GZIO_CHUNK;
+                    else
+                        failed = PREFIX(gzread)(files[i], buf, GZIO_CHUNK) != GZIO_CHUNK;
+                }
+                benchmark::DoNotOptimize(buf);
+            }
+            for (int i = 0; i < count; i++) {
+                if (files[i] != NULL && PREFIX(gzclose)(files[i]) != Z_OK)
+                    failed = true;
+                files[i] = NULL;
+            }
+            if (failed) {
+                state.SkipWithError(writing ? "Writing failed" : "Reading failed");
+                break;
+            }
+        }
+        free(files);
+
+        state.SetBytesProcessed(state.iterations() * (int64_t)count * GZIO_FILE_SIZE);
+    }
+
+    void TearDown(const ::benchmark::State& state) {
+        char name[64];
+
+        for (int i = 0; i < count; i++) {
+            Name(name, sizeof(name), i);
+            remove(name);
+        }
+        free(data);
+        free(buf);
+        data = buf = NULL;
+    }
+};
+
+BENCHMARK_DEFINE_F(gzio_files, read)(benchmark::State& state) {
+    Bench(state, false);
+}
+BENCHMARK_REGISTER_F(gzio_files, read)
+    ->ArgNames({"mode", "files"})
+    ->ArgsProduct({{0, 1}, {1, 16, 128, 256}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_DEFINE_F(gzio_files, write)(benchmark::State& state) {
+    Bench(state, true);
+}
+BENCHMARK_REGISTER_F(gzio_files, write)
+    ->ArgNames({"mode", "files"})
+    ->ArgsProduct({{0, 1}, {1, 16, 128, 256}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+#endif
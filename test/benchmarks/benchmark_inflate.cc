@@ -0,0 +1,137 @@
+/* benchmark_inflate.cc -- benchmark inflate root table sizes on the test corpus
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#  include "zbuild.h"
+#  ifdef ZLIB_COMPAT
+#    include "zlib.h"
+#  else
+#    include "zlib-ng.h"
+#  endif
+}
+
+#ifndef ZLIB_COMPAT
+#ifndef BENCHMARK_DATA_DIR
+#  define BENCHMARK_DATA_DIR "test/data"
+#endif
+
+#define INFLATE_CHUNK (16 * 1024)
+
+static const char *inflate_files[] = {
+    BENCHMARK_DATA_DIR "/lcet10.txt",
+    BENCHMARK_DATA_DIR "/paper-100k.pdf"
+};
+
+/* Inflates in chunks and reads a buffer of the given size after each chunk, like
+   an application working on the output would.  The root tables take 10KB with
+   10 bits and 20KB with 11 bits, and decide whether they, the window and that
+   buffer still fit in the L1 cache together. */
+class inflate_root_bits: public benchmark::Fixture {
+private:
+    uint8_t *inbuff = NULL;
+    uint8_t *compr = NULL;
+    uint8_t *outbuff = NULL;
+    uint8_t *other = NULL;
+    size_t inlen = 0;
+    size_t comprlen = 0;
+
+public:
+    void SetUp(const ::benchmark::State& state) {
+        z_uintmax_t comprsize;
+        FILE *f = fopen(inflate_files[state.range(0)], "rb");
+        if (f == NULL)
+            return;
+        fseek(f, 0, SEEK_END);
+        inlen = (size_t)ftell(f);
+        fseek(f, 0, SEEK_SET);
+
+        inbuff = (uint8_t *)malloc(inlen);
+        if (inbuff != NULL && fread(inbuff, 1, inlen, f) != inlen) {
+            free(inbuff);
+            inbuff = NULL;
+        }
+        fclose(f);
+        if (inbuff == NULL)
+            return;
+
+        comprsize = PREFIX(compressBound)((z_uintmax_t)inlen);
+        compr = (uint8_t *)malloc(comprsize);
+        outbuff = (uint8_t *)malloc(inlen);
+        other = (uint8_t *)calloc(1, (size_t)state.range(3) * 1024 + 1);
+        if (compr == NULL || PREFIX(compress2)(compr, &comprsize, inbuff, (z_uintmax_t)inlen,
+                (int32_t)state.range(1)) != Z_OK) {
+            free(compr);
+            compr = NULL;
+            return;
+        }
+        comprlen = (size_t)comprsize;
+    }
+
+    void Bench(benchmark::State& state) {
+        int32_t bits = (int32_t)state.range(2);
+        size_t other_size = (size_t)state.range(3) * 1024;
+        PREFIX3(stream) strm;
+        uint32_t sum = 0;
+
+        if (compr == NULL || outbuff == NULL || other == NULL) {
+            state.SkipWithError("Cannot read test data");
+            return;
+        }
+
+        memset(&strm, 0, sizeof(strm));
+        if (PREFIX(inflateInit)(&strm) != Z_OK || PREFIX(inflateRootBits)(&strm, bits) != Z_OK) {
+            PREFIX(inflateEnd)(&strm);
+            state.SkipWithError("Cannot set the root table size");
+            return;
+        }
+
+        for (auto _ : state) {
+            int32_t err = Z_OK;
+
+            PREFIX(inflateReset)(&strm);
+            strm.next_in = compr;
+            strm.avail_in = (uint32_t)comprlen;
+            strm.next_out = outbuff;
+            while (err == Z_OK) {
+                strm.avail_out = (uint32_t)MIN(INFLATE_CHUNK, inlen - strm.total_out);
+                err = PREFIX(inflate)(&strm, Z_NO_FLUSH);
+                for (size_t i = 0; i < other_size; i += 64)
+                    sum += other[i];
+            }
+            if (err != Z_STREAM_END) {
+                state.SkipWithError("Inflate failed");
+                break;
+            }
+            benchmark::DoNotOptimize(outbuff);
+        }
+        benchmark::DoNotOptimize(sum);
+        PREFIX(inflateEnd)(&strm);
+
+        state.SetBytesProcessed(state.iterations() * (int64_t)inlen);
+    }
+
+    void TearDown(const ::benchmark::State& state) {
+        free(inbuff);
+        free(compr);
+        free(outbuff);
+        free(other);
+        inbuff = compr = outbuff = other = NULL;
+    }
+};
+
+BENCHMARK_DEFINE_F(inflate_root_bits, inflate)(benchmark::State& state) {
+    Bench(state);
+}
+BENCHMARK_REGISTER_F(inflate_root_bits, inflate)
+    ->ArgNames({"file", "level", "bits", "other_kb"})
+    ->ArgsProduct({benchmark::CreateDenseRange(0, sizeof(inflate_files) / sizeof(inflate_files[0]) - 1, 1),
+                   {1, 6, 9}, {10, 11}, {0, 16, 32}})
+    ->Unit(benchmark::kMicrosecond);
+#endif
@@ -17,7 +17,7 @@ extern "C" {
 #endif
 
 
-int main(int argc, const char** argv) {
+int main(int argc, char** argv) {
 #ifndef BUILD_ALT
     cpu_check_features(&test_cpu_features);
 #endif
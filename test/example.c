@@ -16,6 +16,8 @@
 #include <stdarg.h>
 #include <inttypes.h>
 
+#include "test_shared_ng.h"
+
 #include "monolithic_examples.h"
 
 
@@ -0,0 +1,126 @@
+/* test_compress_parallel.cc - Test compressParallel() with different wrappers, block sizes and thread counts */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#ifndef ZLIB_COMPAT
+
+#define PARALLEL_DATA_SIZE (512 * 1024 + 123)
+
+class compress_parallel : public ::testing::Test {
+public:
+    uint8_t *source = NULL;
+    size_t source_len = PARALLEL_DATA_SIZE;
+
+    void SetUp() override {
+        uint32_t seed = 12345;
+
+        source = (uint8_t *)malloc(source_len);
+        ASSERT_TRUE(source != NULL);
+        /* Mix of repetitive text and noise so that both matches and literals are produced */
+        for (size_t i = 0; i < source_len; i++) {
+            uint32_t r = test_rand(&seed);
+            if ((i / 1000) % 3 == 0)
+                source[i] = (uint8_t)(r >> 24);
+            else
+                source[i] = (uint8_t)("hello parallel deflate "[i % 23]);
+        }
+    }
+
+    void TearDown() override {
+        free(source);
+    }
+};
+
+TEST_F(compress_parallel, wrappers) {
+    static const int32_t window_bits[] = { MAX_WBITS, -MAX_WBITS, MAX_WBITS + 16 };
+
+    for (size_t w = 0; w < sizeof(window_bits) / sizeof(window_bits[0]); w++) {
+        size_t compr_len = zng_compressParallelBound(source_len, window_bits[w], 64 * 1024);
+        uint8_t *compr = (uint8_t *)malloc(compr_len);
+        ASSERT_TRUE(compr != NULL);
+
+        int32_t err = zng_compressParallel(compr, &compr_len, source, source_len, Z_DEFAULT_COMPRESSION,
+                                           window_bits[w], 4, 64 * 1024);
+        EXPECT_EQ(err, Z_OK);
+
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, window_bits[w]), Z_OK);
+        free(compr);
+    }
+}
+
+TEST_F(compress_parallel, uncompress) {
+    size_t compr_len = zng_compressParallelBound(source_len, MAX_WBITS, 0);
+    size_t uncompr_len = source_len;
+    uint8_t *compr = (uint8_t *)malloc(compr_len);
+    uint8_t *uncompr = (uint8_t *)malloc(uncompr_len);
+    ASSERT_TRUE(compr != NULL && uncompr != NULL);
+
+    EXPECT_EQ(zng_compressParallel(compr, &compr_len, source, source_len, 9, MAX_WBITS, 0, 0), Z_OK);
+    EXPECT_EQ(zng_uncompress(uncompr, &uncompr_len, compr, compr_len), Z_OK);
+    EXPECT_EQ(uncompr_len, source_len);
+    EXPECT_EQ(memcmp(uncompr, source, source_len), 0);
+
+    free(uncompr);
+    free(compr);
+}
+
+TEST_F(compress_parallel, thread_count_independent) {
+    size_t bound = zng_compressParallelBound(source_len, MAX_WBITS + 16, 32 * 1024);
+    size_t single_len = bound, multi_len = bound;
+    uint8_t *single = (uint8_t *)malloc(bound);
+    uint8_t *multi = (uint8_t *)malloc(bound);
+    ASSERT_TRUE(single != NULL && multi != NULL);
+
+    for (int32_t level = 0; level <= 9; level++) {
+        single_len = multi_len = bound;
+        EXPECT_EQ(zng_compressParallel(single, &single_len, source, source_len, level, MAX_WBITS + 16, 1,
+                                       32 * 1024), Z_OK);
+        EXPECT_EQ(zng_compressParallel(multi, &multi_len, source, source_len, level, MAX_WBITS + 16, 8,
+                                       32 * 1024), Z_OK);
+        EXPECT_EQ(single_len, multi_len);
+        EXPECT_EQ(memcmp(single, multi, single_len), 0);
+        EXPECT_EQ(inflate_check(multi, multi_len, source, source_len, MAX_WBITS + 16), Z_OK);
+    }
+
+    free(multi);
+    free(single);
+}
+
+TEST_F(compress_parallel, empty_input) {
+    uint8_t compr[64];
+    size_t compr_len = sizeof(compr);
+
+    EXPECT_LE(zng_compressParallelBound(0, MAX_WBITS, 0), sizeof(compr));
+    EXPECT_EQ(zng_compressParallel(compr, &compr_len, source, 0, Z_DEFAULT_COMPRESSION, MAX_WBITS, 2, 0), Z_OK);
+
+    EXPECT_EQ(inflate_check(compr, compr_len, source, 0, MAX_WBITS), Z_OK);
+}
+
+TEST_F(compress_parallel, errors) {
+    uint8_t compr[64];
+    size_t compr_len = sizeof(compr);
+
+    EXPECT_EQ(zng_compressParallel(compr, &compr_len, source, source_len, 1, MAX_WBITS, 2, 0), Z_BUF_ERROR);
+    compr_len = sizeof(compr);
+    EXPECT_EQ(zng_compressParallel(compr, &compr_len, source, source_len, 42, MAX_WBITS, 2, 0), Z_STREAM_ERROR);
+    compr_len = sizeof(compr);
+    EXPECT_EQ(zng_compressParallel(compr, &compr_len, source, source_len, 1, 42, 2, 0), Z_STREAM_ERROR);
+    compr_len = sizeof(compr);
+    EXPECT_EQ(zng_compressParallel(compr, &compr_len, source, source_len, 1, MAX_WBITS, -1, 0), Z_STREAM_ERROR);
+}
+
+#endif
@@ -0,0 +1,100 @@
+/* test_deflate_accel.cc - Test deflate() at Z_FASTEST_COMPRESSION, which skips ahead after misses */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#define ACCEL_DATA_SIZE (128 * 1024 + 3)
+#define ACCEL_PART_SIZE (16 * 1024)
+
+class deflate_accel : public compress_fixture<> {
+public:
+    void SetUp() override {
+        uint32_t seed = 17;
+
+        ASSERT_TRUE(alloc(ACCEL_DATA_SIZE));
+        /* Parts of random bytes and parts of repeated phrases, taking turns */
+        for (uint32_t i = 0; i < source_len; i++) {
+            uint32_t r = test_rand(&seed);
+            if ((i / ACCEL_PART_SIZE) % 2 == 0)
+                source[i] = (uint8_t)(r >> 16);
+            else
+                source[i] = (uint8_t)"telemetry ok: temp=21 load=0.4\n"[(i + (r >> 30)) % 31];
+        }
+
+    }
+};
+
+TEST_F(deflate_accel, level) {
+    uint32_t compr_len = compress(Z_FASTEST_COMPRESSION, MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, source_len,
+                                  compr_size);
+    EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+}
+
+TEST_F(deflate_accel, strategies) {
+    static const int32_t strategies[] = { Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED };
+
+    for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+        uint32_t compr_len = compress(Z_FASTEST_COMPRESSION, MAX_WBITS, MAX_MEM_LEVEL, strategies[i], source_len,
+                                      compr_size);
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+    }
+}
+
+/* Output space of a single byte at a time, with the smallest and largest symbol buffers */
+TEST_F(deflate_accel, small_output) {
+    for (int32_t mem_level = 1; mem_level <= MAX_MEM_LEVEL; mem_level += MAX_MEM_LEVEL - 1) {
+        uint32_t compr_len = compress(Z_FASTEST_COMPRESSION, MAX_WBITS, mem_level, Z_DEFAULT_STRATEGY, source_len, 1);
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+    }
+}
+
+/* Switching between Z_FASTEST_COMPRESSION and the other levels between flushes */
+TEST_F(deflate_accel, params) {
+    static const int32_t levels[] = { Z_FASTEST_COMPRESSION, 1, 6, Z_FASTEST_COMPRESSION, 0, 3, Z_FASTEST_COMPRESSION, 9 };
+    static const int32_t strategies[] = { Z_DEFAULT_STRATEGY, Z_FIXED };
+    PREFIX3(stream) c_stream;
+    uint32_t pos;
+    int i = 0;
+    int err;
+
+    memset(&c_stream, 0, sizeof(c_stream));
+    err = PREFIX(deflateInit)(&c_stream, Z_FASTEST_COMPRESSION);
+    EXPECT_EQ(err, Z_OK);
+
+    c_stream.next_out = compr;
+    c_stream.avail_out = compr_size;
+    for (pos = 0; pos < source_len; pos += 4000, i++) {
+        EXPECT_EQ(PREFIX(deflateParams)(&c_stream, levels[i % 8], strategies[(i / 8) % 2]), Z_OK);
+        c_stream.next_in = source + pos;
+        c_stream.avail_in = MIN(4000, source_len - pos);
+        EXPECT_EQ(PREFIX(deflate)(&c_stream, i % 3 == 0 ? Z_SYNC_FLUSH : Z_NO_FLUSH), Z_OK);
+        EXPECT_EQ(c_stream.avail_in, 0);
+    }
+    EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_FINISH), Z_STREAM_END);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+
+    EXPECT_EQ(inflate_check(compr, (uint32_t)c_stream.total_out, source, source_len, MAX_WBITS), Z_OK);
+}
+
+TEST_F(deflate_accel, invalid) {
+    PREFIX3(stream) c_stream;
+
+    memset(&c_stream, 0, sizeof(c_stream));
+    EXPECT_EQ(PREFIX(deflateInit)(&c_stream, Z_FASTEST_COMPRESSION - 1), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(deflateInit)(&c_stream, Z_FASTEST_COMPRESSION), Z_OK);
+    EXPECT_EQ(PREFIX(deflateParams)(&c_stream, Z_FASTEST_COMPRESSION - 1, Z_DEFAULT_STRATEGY), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+}
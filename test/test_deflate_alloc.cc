@@ -0,0 +1,90 @@
+/* test_deflate_alloc.cc - Test the allocations made by deflate */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deflate.h"
+
+#include <gtest/gtest.h>
+
+#include "test_shared.h"
+
+typedef struct alloc_count_s {
+    int32_t allocs;
+    int32_t frees;
+} alloc_count;
+
+/* Counts the calls and returns memory that is only 8-byte aligned */
+static void *count_alloc(void *opaque, unsigned items, unsigned size) {
+    uint8_t *ptr = (uint8_t *)malloc((size_t)items * size + 8);
+
+    ((alloc_count *)opaque)->allocs++;
+    return ptr == NULL ? NULL : ptr + 8;
+}
+
+static void count_free(void *opaque, void *ptr) {
+    ((alloc_count *)opaque)->frees++;
+    free((uint8_t *)ptr - 8);
+}
+
+static void check_layout(PREFIX3(stream) *strm) {
+    deflate_state *s = (deflate_state *)strm->state;
+
+    EXPECT_EQ((uintptr_t)s->window % 64, 0u);
+    EXPECT_EQ((uintptr_t)s->head % 64, 0u);
+    EXPECT_EQ((uintptr_t)s->prev % 64, 0u);
+    EXPECT_EQ((uintptr_t)s->pending_buf % 64, 0u);
+}
+
+TEST(deflate_alloc, single_block) {
+    static const int32_t levels[] = { 0, 1, 2, 6 };
+    static const char hello[] = "hello, hello, hello!";
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        PREFIX3(stream) c_stream, c_copy;
+        alloc_count count = { 0, 0 };
+        uint8_t compr[128], copy_out[128];
+
+        memset(&c_stream, 0, sizeof(c_stream));
+        c_stream.zalloc = count_alloc;
+        c_stream.zfree = count_free;
+        c_stream.opaque = &count;
+        EXPECT_EQ(PREFIX(deflateInit)(&c_stream, levels[i]), Z_OK);
+        EXPECT_EQ(count.allocs, 1);
+        check_layout(&c_stream);
+
+        c_stream.next_in = (z_const uint8_t *)hello;
+        c_stream.avail_in = sizeof(hello) / 2;
+        c_stream.next_out = compr;
+        c_stream.avail_out = sizeof(compr);
+        EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_NO_FLUSH), Z_OK);
+
+        EXPECT_EQ(PREFIX(deflateCopy)(&c_copy, &c_stream), Z_OK);
+        EXPECT_EQ(count.allocs, 2);
+        check_layout(&c_copy);
+        memcpy(copy_out, compr, sizeof(compr));
+        c_copy.next_out = copy_out + (c_stream.next_out - compr);
+
+        /* Both streams must continue identically */
+        c_stream.avail_in = sizeof(hello) - sizeof(hello) / 2;
+        EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_FINISH), Z_STREAM_END);
+        c_copy.avail_in = sizeof(hello) - sizeof(hello) / 2;
+        EXPECT_EQ(PREFIX(deflate)(&c_copy, Z_FINISH), Z_STREAM_END);
+        EXPECT_EQ(c_copy.total_out, c_stream.total_out);
+        EXPECT_EQ(memcmp(copy_out, compr, c_stream.total_out), 0);
+
+        EXPECT_EQ(PREFIX(deflateEnd)(&c_copy), Z_OK);
+        EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+        EXPECT_EQ(count.allocs, 2);
+        EXPECT_EQ(count.frees, 2);
+    }
+}
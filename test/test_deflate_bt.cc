@@ -0,0 +1,167 @@
+/* test_deflate_bt.cc - Test deflate() with the binary tree match finder */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "deflate.h"
+#include "test_shared_ng.h"
+
+#define BT_DATA_SIZE (192 * 1024 + 13)
+
+class deflate_bt : public compress_fixture<> {
+public:
+    void SetUp() override {
+        uint32_t seed = 1234, pos = 0;
+
+        ASSERT_TRUE(alloc(BT_DATA_SIZE, 4096));
+        /* Runs, short repeated patterns and copies of earlier data, so that the
+         * trees hold many strings that are equal for the full match length */
+        while (pos < source_len) {
+            uint32_t len, i, r;
+
+            r = test_rand(&seed);
+            len = MIN(((r >> 16) & 511) + 1, source_len - pos);
+            switch ((r >> 12) & 3) {
+            case 0:
+                memset(source + pos, 'a' + ((r >> 8) & 3), len);
+                break;
+            case 1:
+                for (i = 0; i < len; i++)
+                    source[pos + i] = "ACGT"[(r >> (i & 15)) & 3];
+                break;
+            case 2:
+                for (i = 0; i < len; i++)
+                    source[pos + i] = (uint8_t)"abab-abc"[i & 7];
+                break;
+            default:
+                if (pos > len) {
+                    memcpy(source + pos, source + (r % (pos - len)), len);
+                } else {
+                    for (i = 0; i < len; i++)
+                        source[pos + i] = (uint8_t)(r >> (i & 7));
+                }
+                break;
+            }
+            pos += len;
+        }
+    }
+};
+
+TEST_F(deflate_bt, sync_flush) {
+    static const uint32_t chunks[] = { 1, 7, 300, 4096, 100000 };
+
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        uint32_t compr_len = compress_flushed(Z_OPTIMAL_COMPRESSION, MAX_WBITS, 8, Z_DEFAULT_STRATEGY, chunks[i],
+                                              chunks[i] == 1 ? Z_NO_FLUSH : Z_SYNC_FLUSH);
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+    }
+}
+
+/* The window slides many times */
+TEST_F(deflate_bt, small_window) {
+    uint32_t compr_len = compress_flushed(Z_OPTIMAL_COMPRESSION, 9, 8, Z_DEFAULT_STRATEGY, 1000, Z_NO_FLUSH);
+    EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+}
+
+/* Levels 8 and 9 move from the hash chains to the trees on data where the chains get long */
+TEST_F(deflate_bt, long_chains) {
+    uint32_t seed = 99;
+
+    for (uint32_t i = 0; i < source_len; i++)
+        source[i] = "AB"[(test_rand(&seed) >> 16) & 1];
+
+    for (int32_t level = 8; level <= Z_BEST_COMPRESSION; level++) {
+        PREFIX3(stream) c_stream;
+        uint32_t compr_len;
+
+        memset(&c_stream, 0, sizeof(c_stream));
+        EXPECT_EQ(PREFIX(deflateInit2)(&c_stream, level, Z_DEFLATED, MAX_WBITS, 8, Z_DEFAULT_STRATEGY), Z_OK);
+        compr_len = deflate_flushed(&c_stream, source, source_len, compr, 5000, Z_SYNC_FLUSH);
+#ifndef NO_BT_MATCH
+        EXPECT_TRUE(((deflate_state *)c_stream.state)->bt_right != NULL);
+#endif
+        EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+    }
+}
+
+TEST_F(deflate_bt, params) {
+    static const int32_t levels[] = { 10, 9, 8, 10, 1, 10, 6, 10 };
+    const uint32_t step = source_len / (sizeof(levels) / sizeof(levels[0])) + 1;
+    PREFIX3(stream) c_stream;
+    int err;
+
+    memset(&c_stream, 0, sizeof(c_stream));
+    err = PREFIX(deflateInit)(&c_stream, levels[0]);
+    EXPECT_EQ(err, Z_OK);
+
+    c_stream.next_in = source;
+    c_stream.next_out = compr;
+    c_stream.avail_out = compr_size;
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        err = PREFIX(deflateParams)(&c_stream, levels[i], Z_DEFAULT_STRATEGY);
+        EXPECT_EQ(err, Z_OK);
+        c_stream.avail_in = MIN(step, source_len - (uint32_t)c_stream.total_in);
+        err = PREFIX(deflate)(&c_stream, Z_NO_FLUSH);
+        EXPECT_EQ(err, Z_OK);
+    }
+    err = PREFIX(deflate)(&c_stream, Z_FINISH);
+    EXPECT_EQ(err, Z_STREAM_END);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+
+    EXPECT_EQ(inflate_check(compr, (uint32_t)c_stream.total_out, source, source_len, MAX_WBITS), Z_OK);
+}
+
+TEST_F(deflate_bt, copy) {
+    PREFIX3(stream) c_stream, c_copy;
+    uint8_t *copy_out = (uint8_t *)malloc(compr_size);
+    const uint32_t half = source_len / 2;
+    int err;
+
+    ASSERT_TRUE(copy_out != NULL);
+    memset(&c_stream, 0, sizeof(c_stream));
+    err = PREFIX(deflateInit)(&c_stream, Z_OPTIMAL_COMPRESSION);
+    EXPECT_EQ(err, Z_OK);
+
+    c_stream.next_in = source;
+    c_stream.avail_in = half;
+    c_stream.next_out = compr;
+    c_stream.avail_out = compr_size;
+    err = PREFIX(deflate)(&c_stream, Z_NO_FLUSH);
+    EXPECT_EQ(err, Z_OK);
+
+    memset(&c_copy, 0, sizeof(c_copy));
+    EXPECT_EQ(PREFIX(deflateCopy)(&c_copy, &c_stream), Z_OK);
+    memcpy(copy_out, compr, c_stream.total_out);
+    c_copy.next_out = copy_out + c_stream.total_out;
+
+    /* Both streams must continue identically from the copied trees */
+    c_stream.avail_in = source_len - half;
+    err = PREFIX(deflate)(&c_stream, Z_FINISH);
+    EXPECT_EQ(err, Z_STREAM_END);
+
+    c_copy.avail_in = source_len - half;
+    err = PREFIX(deflate)(&c_copy, Z_FINISH);
+    EXPECT_EQ(err, Z_STREAM_END);
+
+    EXPECT_EQ(c_copy.total_out, c_stream.total_out);
+    EXPECT_EQ(memcmp(copy_out, compr, c_stream.total_out), 0);
+
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_copy), Z_OK);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+    free(copy_out);
+
+    EXPECT_EQ(inflate_check(compr, (uint32_t)c_stream.total_out, source, source_len, MAX_WBITS), Z_OK);
+}
@@ -0,0 +1,123 @@
+/* test_deflate_optimal.cc - Test deflate() with optimal parsing (level 10) */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#define OPTIMAL_DATA_SIZE (256 * 1024 + 77)
+
+class deflate_optimal : public compress_fixture<> {
+public:
+    void SetUp() override {
+        static const char *words[] = {
+            "the ", "deflate ", "stream ", "of ", "compressed ", "data ", "is ", "a ", "sequence ",
+            "blocks ", "literal ", "match ", "distance ", "length ", "huffman ", "code ", "tree ",
+            "window ", "and ", "in ", "to ", "with ", "which ", "optimal ", "parse ", ".\n", ", "
+        };
+        uint32_t seed = 4321, pos = 0;
+
+        ASSERT_TRUE(alloc(OPTIMAL_DATA_SIZE));
+        /* Pseudo text made of a small vocabulary, so that matches of all lengths and distances occur */
+        while (pos < source_len) {
+            const char *word = words[(test_rand(&seed) >> 16) % (sizeof(words) / sizeof(words[0]))];
+            size_t len = strlen(word);
+            if (len > source_len - pos)
+                len = source_len - pos;
+            memcpy(source + pos, word, len);
+            pos += (uint32_t)len;
+        }
+    }
+};
+
+/* Output space of a single byte at a time */
+TEST_F(deflate_optimal, small_output) {
+    uint32_t compr_len = compress(Z_OPTIMAL_COMPRESSION, MAX_WBITS, 8, Z_DEFAULT_STRATEGY, source_len, 1);
+    EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+}
+
+TEST_F(deflate_optimal, ratio) {
+    uint32_t level9_len = compress(Z_BEST_COMPRESSION, MAX_WBITS, 8, Z_DEFAULT_STRATEGY, source_len, compr_size);
+    uint32_t level10_len = compress(Z_OPTIMAL_COMPRESSION, MAX_WBITS, 8, Z_DEFAULT_STRATEGY, source_len, compr_size);
+
+    EXPECT_LE(level10_len, level9_len);
+    EXPECT_EQ(inflate_check(compr, level10_len, source, source_len, MAX_WBITS), Z_OK);
+}
+
+TEST_F(deflate_optimal, params) {
+    static const int32_t levels[] = { Z_BEST_COMPRESSION, Z_OPTIMAL_COMPRESSION, Z_BEST_SPEED,
+                                      Z_OPTIMAL_COMPRESSION, Z_NO_COMPRESSION, Z_OPTIMAL_COMPRESSION };
+    const uint32_t step = source_len / (sizeof(levels) / sizeof(levels[0])) + 1;
+    PREFIX3(stream) c_stream;
+    int err;
+
+    memset(&c_stream, 0, sizeof(c_stream));
+    err = PREFIX(deflateInit)(&c_stream, levels[0]);
+    EXPECT_EQ(err, Z_OK);
+
+    c_stream.next_in = source;
+    c_stream.next_out = compr;
+    c_stream.avail_out = compr_size;
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        err = PREFIX(deflateParams)(&c_stream, levels[i], Z_DEFAULT_STRATEGY);
+        EXPECT_EQ(err, Z_OK);
+        c_stream.avail_in = MIN(step, source_len - (uint32_t)c_stream.total_in);
+        err = PREFIX(deflate)(&c_stream, Z_NO_FLUSH);
+        EXPECT_EQ(err, Z_OK);
+    }
+    err = PREFIX(deflate)(&c_stream, Z_FINISH);
+    EXPECT_EQ(err, Z_STREAM_END);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+
+    EXPECT_EQ(inflate_check(compr, (uint32_t)c_stream.total_out, source, source_len, MAX_WBITS), Z_OK);
+}
+
+/* Many small records, each flushed, so that segments are parsed up to the end of the window */
+TEST_F(deflate_optimal, sync_flush) {
+    static const int32_t window_bits[] = { 9, MAX_WBITS };
+
+    for (size_t i = 0; i < sizeof(window_bits) / sizeof(window_bits[0]); i++) {
+        PREFIX3(stream) c_stream;
+        uint32_t pos = 0, record = 0;
+        int err;
+
+        memset(&c_stream, 0, sizeof(c_stream));
+        err = PREFIX(deflateInit2)(&c_stream, Z_OPTIMAL_COMPRESSION, Z_DEFLATED, window_bits[i], MAX_MEM_LEVEL,
+                                   Z_DEFAULT_STRATEGY);
+        EXPECT_EQ(err, Z_OK);
+
+        c_stream.next_out = compr;
+        c_stream.avail_out = compr_size;
+        while (pos < source_len) {
+            record = record % 509 + 37;
+            c_stream.next_in = source + pos;
+            c_stream.avail_in = MIN(record, source_len - pos);
+            pos += c_stream.avail_in;
+            EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_SYNC_FLUSH), Z_OK);
+            EXPECT_EQ(c_stream.avail_in, 0);
+        }
+        EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_FINISH), Z_STREAM_END);
+        EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+
+        EXPECT_EQ(inflate_check(compr, (uint32_t)c_stream.total_out, source, source_len, MAX_WBITS), Z_OK);
+    }
+}
+
+TEST_F(deflate_optimal, invalid_level) {
+    PREFIX3(stream) c_stream;
+
+    memset(&c_stream, 0, sizeof(c_stream));
+    EXPECT_EQ(PREFIX(deflateInit)(&c_stream, Z_OPTIMAL_COMPRESSION + 1), Z_STREAM_ERROR);
+}
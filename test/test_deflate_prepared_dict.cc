@@ -0,0 +1,160 @@
+/* test_deflate_prepared_dict.cc - Test deflatePrepareDictionary() and deflateSetPreparedDictionary() */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#ifndef ZLIB_COMPAT
+#define DICT_SIZE (40 * 1024)
+#define MSG_SIZE  2000
+
+class deflate_prepared_dict : public ::testing::TestWithParam<std::tuple<int32_t, int32_t>> {
+public:
+    uint8_t dict[DICT_SIZE];
+    uint8_t msg[MSG_SIZE];
+
+    void SetUp() override {
+        static const char *words[] = {
+            "request ", "response ", "user_id ", "session ", "timestamp ", "status ", "ok ", "error ",
+            "payload ", "{\"key\": ", "\"value\", ", "}\n", "[1, 2, 3] ", "true ", "false ", "null "
+        };
+        uint32_t seed = 99, pos = 0;
+
+        /* Messages are made of the same vocabulary as the dictionary */
+        while (pos < DICT_SIZE + MSG_SIZE) {
+            test_rand(&seed);
+            const char *word = words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))];
+            for (size_t i = 0; word[i] != 0 && pos < DICT_SIZE + MSG_SIZE; i++, pos++) {
+                if (pos < DICT_SIZE)
+                    dict[pos] = (uint8_t)word[i];
+                else
+                    msg[pos - DICT_SIZE] = (uint8_t)word[i];
+            }
+        }
+    }
+
+    /* Compresses msg with strm, which has its dictionary set already */
+    uint32_t compress(PREFIX3(stream) *strm, uint8_t *compr, uint32_t compr_size) {
+        strm->next_in = msg;
+        strm->avail_in = MSG_SIZE;
+        strm->next_out = compr;
+        strm->avail_out = compr_size;
+        EXPECT_EQ(PREFIX(deflate)(strm, Z_FINISH), Z_STREAM_END);
+        return (uint32_t)strm->total_out;
+    }
+};
+
+TEST_P(deflate_prepared_dict, same_output) {
+    int32_t level = std::get<0>(GetParam());
+    int32_t window_bits = std::get<1>(GetParam());
+    PREFIX3(stream) c_stream, p_stream;
+    uint8_t compr[MSG_SIZE * 2], prepared[MSG_SIZE * 2];
+    uint32_t compr_len, prepared_len;
+    zng_dictionary *prep = NULL;
+    unsigned long dict_adler;
+
+    memset(&c_stream, 0, sizeof(c_stream));
+    EXPECT_EQ(PREFIX(deflateInit2)(&c_stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY), Z_OK);
+    EXPECT_EQ(PREFIX(deflatePrepareDictionary)(&c_stream, dict, DICT_SIZE, &prep), Z_OK);
+    ASSERT_TRUE(prep != NULL);
+    dict_adler = c_stream.adler;
+    compr_len = compress(&c_stream, compr, sizeof(compr));
+
+    /* A stream that attaches the prepared dictionary after being used before */
+    memset(&p_stream, 0, sizeof(p_stream));
+    EXPECT_EQ(PREFIX(deflateInit2)(&p_stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY), Z_OK);
+    compress(&p_stream, prepared, sizeof(prepared));
+    EXPECT_EQ(PREFIX(deflateReset)(&p_stream), Z_OK);
+
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(PREFIX(deflateSetPreparedDictionary)(&p_stream, prep), Z_OK);
+        EXPECT_EQ(p_stream.adler, dict_adler);
+        prepared_len = compress(&p_stream, prepared, sizeof(prepared));
+
+        EXPECT_EQ(prepared_len, compr_len);
+        EXPECT_EQ(memcmp(prepared, compr, compr_len), 0);
+        EXPECT_EQ(PREFIX(deflateReset)(&p_stream), Z_OK);
+    }
+
+    EXPECT_EQ(PREFIX(deflateFreeDictionary)(prep), Z_OK);
+    EXPECT_EQ(PREFIX(deflateEnd)(&p_stream), Z_OK);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+
+    /* Decompress with the original dictionary */
+    if (window_bits > 0) {
+        PREFIX3(stream) d_stream;
+        uint8_t uncompr[MSG_SIZE];
+        int32_t err;
+
+        memset(&d_stream, 0, sizeof(d_stream));
+        EXPECT_EQ(PREFIX(inflateInit2)(&d_stream, window_bits), Z_OK);
+        d_stream.next_in = compr;
+        d_stream.avail_in = compr_len;
+        d_stream.next_out = uncompr;
+        d_stream.avail_out = sizeof(uncompr);
+        err = PREFIX(inflate)(&d_stream, Z_FINISH);
+        EXPECT_EQ(err, Z_NEED_DICT);
+        EXPECT_EQ(PREFIX(inflateSetDictionary)(&d_stream, dict, DICT_SIZE), Z_OK);
+        EXPECT_EQ(PREFIX(inflate)(&d_stream, Z_FINISH), Z_STREAM_END);
+        EXPECT_EQ(d_stream.total_out, (size_t)MSG_SIZE);
+        EXPECT_EQ(memcmp(uncompr, msg, MSG_SIZE), 0);
+        PREFIX(inflateEnd)(&d_stream);
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(deflate_prepared_dict, deflate_prepared_dict,
+    testing::Combine(testing::Values(1, 3, 6, 8, 9, 10), testing::Values(15, 10, -15)));
+
+TEST_F(deflate_prepared_dict, errors) {
+    PREFIX3(stream) c_stream, o_stream;
+    zng_dictionary *prep = NULL;
+    uint8_t compr[MSG_SIZE * 2];
+
+    memset(&c_stream, 0, sizeof(c_stream));
+    EXPECT_EQ(PREFIX(deflateInit)(&c_stream, 9), Z_OK);
+    EXPECT_EQ(PREFIX(deflatePrepareDictionary)(&c_stream, dict, DICT_SIZE, NULL), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(deflatePrepareDictionary)(&c_stream, NULL, DICT_SIZE, &prep), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(deflatePrepareDictionary)(&c_stream, dict, DICT_SIZE, &prep), Z_OK);
+    ASSERT_TRUE(prep != NULL);
+
+    /* A dictionary can only be set before compressing */
+    EXPECT_EQ(PREFIX(deflateSetPreparedDictionary)(&c_stream, prep), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(deflateSetPreparedDictionary)(&c_stream, NULL), Z_STREAM_ERROR);
+    compress(&c_stream, compr, sizeof(compr));
+    EXPECT_EQ(PREFIX(deflateSetPreparedDictionary)(&c_stream, prep), Z_STREAM_ERROR);
+
+    /* Level with a different match finder */
+    memset(&o_stream, 0, sizeof(o_stream));
+    EXPECT_EQ(PREFIX(deflateInit)(&o_stream, 6), Z_OK);
+    EXPECT_EQ(PREFIX(deflateSetPreparedDictionary)(&o_stream, prep), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(deflateEnd)(&o_stream), Z_OK);
+
+    /* Different window size */
+    memset(&o_stream, 0, sizeof(o_stream));
+    EXPECT_EQ(PREFIX(deflateInit2)(&o_stream, 9, Z_DEFLATED, 12, 8, Z_DEFAULT_STRATEGY), Z_OK);
+    EXPECT_EQ(PREFIX(deflateSetPreparedDictionary)(&o_stream, prep), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(deflateEnd)(&o_stream), Z_OK);
+
+    /* Gzip streams have no dictionary */
+    memset(&o_stream, 0, sizeof(o_stream));
+    EXPECT_EQ(PREFIX(deflateInit2)(&o_stream, 9, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY), Z_OK);
+    EXPECT_EQ(PREFIX(deflateSetPreparedDictionary)(&o_stream, prep), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(deflateEnd)(&o_stream), Z_OK);
+
+    EXPECT_EQ(PREFIX(deflateFreeDictionary)(prep), Z_OK);
+    EXPECT_EQ(PREFIX(deflateFreeDictionary)(NULL), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+}
+#endif
@@ -0,0 +1,94 @@
+/* test_deflate_quick_dynamic.cc - Test deflate() at level 1 sending blocks with dynamic trees */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#define QUICK_DATA_SIZE (160 * 1024 + 7)
+
+class deflate_quick_dynamic : public compress_fixture<> {
+public:
+    void SetUp() override {
+        uint32_t seed = 7;
+
+        ASSERT_TRUE(alloc(QUICK_DATA_SIZE));
+        /* Skewed literals with some repeats, which the fixed trees code poorly */
+        for (uint32_t i = 0; i < source_len; i++) {
+            uint32_t r = test_rand(&seed);
+            if (i >= 64 && (r >> 28) == 0)
+                source[i] = source[i - 1 - ((r >> 16) & 63)];
+            else
+                source[i] = (uint8_t)"eeeeeettttaaoinsrh \n"[(r >> 16) % 20];
+        }
+
+    }
+};
+
+/* Dynamic trees make the output smaller than the fixed trees of Z_FIXED */
+TEST_F(deflate_quick_dynamic, smaller) {
+    uint32_t fixed_len, dynamic_len;
+
+    fixed_len = compress(1, MAX_WBITS, MAX_MEM_LEVEL, Z_FIXED, source_len, compr_size);
+    EXPECT_EQ(inflate_check(compr, fixed_len, source, source_len, MAX_WBITS), Z_OK);
+    dynamic_len = compress(1, MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, source_len, compr_size);
+    EXPECT_EQ(inflate_check(compr, dynamic_len, source, source_len, MAX_WBITS), Z_OK);
+    EXPECT_LT(dynamic_len, fixed_len - fixed_len / 16);
+}
+
+TEST_F(deflate_quick_dynamic, strategies) {
+    static const int32_t strategies[] = { Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED };
+
+    for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+        uint32_t compr_len = compress(1, MAX_WBITS, MAX_MEM_LEVEL, strategies[i], source_len, compr_size);
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+    }
+}
+
+/* Output space of a single byte at a time, with the smallest and largest symbol buffers */
+TEST_F(deflate_quick_dynamic, small_output) {
+    for (int32_t mem_level = 1; mem_level <= MAX_MEM_LEVEL; mem_level += MAX_MEM_LEVEL - 1) {
+        uint32_t compr_len = compress(1, MAX_WBITS, mem_level, Z_DEFAULT_STRATEGY, source_len, 1);
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+    }
+}
+
+/* Switching between fixed and dynamic trees between flushes */
+TEST_F(deflate_quick_dynamic, params) {
+    PREFIX3(stream) c_stream;
+    uint32_t pos;
+    int32_t strategy = Z_DEFAULT_STRATEGY;
+    int err;
+
+    memset(&c_stream, 0, sizeof(c_stream));
+    err = PREFIX(deflateInit)(&c_stream, 1);
+    EXPECT_EQ(err, Z_OK);
+
+    c_stream.next_out = compr;
+    c_stream.avail_out = compr_size;
+    for (pos = 0; pos < source_len; pos += 3000) {
+        if (pos % 9000 == 0) {
+            strategy = strategy == Z_FIXED ? Z_DEFAULT_STRATEGY : Z_FIXED;
+            EXPECT_EQ(PREFIX(deflateParams)(&c_stream, pos % 27000 == 0 ? 2 : 1, strategy), Z_OK);
+        }
+        c_stream.next_in = source + pos;
+        c_stream.avail_in = MIN(3000, source_len - pos);
+        EXPECT_EQ(PREFIX(deflate)(&c_stream, pos % 6000 == 0 ? Z_SYNC_FLUSH : Z_NO_FLUSH), Z_OK);
+        EXPECT_EQ(c_stream.avail_in, 0);
+    }
+    EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_FINISH), Z_STREAM_END);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+
+    EXPECT_EQ(inflate_check(compr, (uint32_t)c_stream.total_out, source, source_len, MAX_WBITS), Z_OK);
+}
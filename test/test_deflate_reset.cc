@@ -0,0 +1,138 @@
+/* test_deflate_reset.cc - Test that deflateReset() forgets all history */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#define RESET_DATA_SIZE (96 * 1024)
+
+class deflate_reset : public compress_fixture<::testing::TestWithParam<int32_t>> {
+public:
+    uint8_t *msg = NULL;
+    uint8_t *expect = NULL;
+
+    void SetUp() override {
+        uint32_t seed = 77;
+
+        ASSERT_TRUE(alloc(RESET_DATA_SIZE, 64));
+        msg = (uint8_t *)malloc(RESET_DATA_SIZE);
+        expect = (uint8_t *)malloc(compr_size);
+        ASSERT_TRUE(msg != NULL && expect != NULL);
+        /* Text like data made of a few letters, so that most strings repeat */
+        for (uint32_t i = 0; i < RESET_DATA_SIZE; i++)
+            source[i] = (uint8_t)"abcdefgh  \n"[(test_rand(&seed) >> 16) % 11];
+    }
+
+    void TearDown() override {
+        free(expect);
+        free(msg);
+        compress_fixture::TearDown();
+    }
+
+    /* Copies len bytes at offset to msg. deflate may look at the bytes after the end of the
+     * input in the window, which are left over from earlier streams, so the message ends with
+     * bytes that occur nowhere else to keep matches from reaching them. */
+    const uint8_t *message(uint32_t offset, uint32_t len) {
+        memcpy(msg, source + offset, len);
+        for (uint32_t i = 0; i < MIN(len, 8); i++)
+            msg[len - 1 - i] = (uint8_t)(i + 1);
+        return msg;
+    }
+
+    /* Compresses with a fresh stream */
+    uint32_t compress_fresh(uint8_t *out, const uint8_t *in, uint32_t len) {
+        PREFIX3(stream) strm;
+        uint32_t out_len;
+
+        memset(&strm, 0, sizeof(strm));
+        EXPECT_EQ(PREFIX(deflateInit)(&strm, GetParam()), Z_OK);
+        out_len = deflate_flushed(&strm, in, len, out, len, Z_NO_FLUSH);
+        EXPECT_EQ(PREFIX(deflateEnd)(&strm), Z_OK);
+        return out_len;
+    }
+};
+
+TEST_P(deflate_reset, same_as_fresh) {
+    static const uint32_t lens[] = { 3, 200, 1000, 4096, 5000, 70000 };
+    static const uint32_t chunks[] = { 1, 3, 100, RESET_DATA_SIZE };
+    static const int32_t flushes[] = { Z_NO_FLUSH, Z_SYNC_FLUSH, Z_FULL_FLUSH };
+    PREFIX3(stream) strm;
+    uint32_t n = 0;
+
+    memset(&strm, 0, sizeof(strm));
+    EXPECT_EQ(PREFIX(deflateInit)(&strm, GetParam()), Z_OK);
+
+    /* Every stream must produce the same output as a fresh stream, whatever the
+     * stream before it compressed and how its input was provided */
+    for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+            for (size_t f = 0; f < sizeof(flushes) / sizeof(flushes[0]); f++) {
+                uint32_t len = lens[(l + n) % (sizeof(lens) / sizeof(lens[0]))];
+                uint32_t offset = (n * 7919) % (RESET_DATA_SIZE - len);
+                uint32_t expect_len, compr_len;
+
+                /* Flushing after every few bytes would overflow the output buffer */
+                if (flushes[f] != Z_NO_FLUSH && chunks[c] < 100)
+                    len = MIN(len, 1000);
+                deflate_flushed(&strm, source + offset, len, compr, chunks[c], flushes[f]);
+                EXPECT_EQ(PREFIX(deflateReset)(&strm), Z_OK);
+
+                /* Compress the next message in one piece, so that it only matches the same
+                 * strings as a fresh stream if the hash table has been fully cleared */
+                len = lens[l];
+                offset = (offset + 13) % (RESET_DATA_SIZE - len);
+                expect_len = compress_fresh(expect, message(offset, len), len);
+                compr_len = deflate_flushed(&strm, msg, len, compr, len, Z_NO_FLUSH);
+                EXPECT_EQ(compr_len, expect_len);
+                EXPECT_EQ(memcmp(compr, expect, expect_len), 0);
+                EXPECT_EQ(PREFIX(deflateReset)(&strm), Z_OK);
+                n++;
+            }
+        }
+    }
+    EXPECT_EQ(PREFIX(deflateEnd)(&strm), Z_OK);
+}
+
+TEST_P(deflate_reset, params) {
+    static const int32_t levels[] = { 0, 1, 3, 6, 9, 10 };
+    PREFIX3(stream) strm;
+    uint32_t expect_len, compr_len;
+
+    memset(&strm, 0, sizeof(strm));
+    EXPECT_EQ(PREFIX(deflateInit)(&strm, GetParam()), Z_OK);
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        /* Switch levels in the middle of a short message, then reset */
+        strm.next_in = source;
+        strm.avail_in = 300;
+        strm.next_out = compr;
+        strm.avail_out = compr_size;
+        EXPECT_EQ(PREFIX(deflate)(&strm, Z_NO_FLUSH), Z_OK);
+        EXPECT_EQ(PREFIX(deflateParams)(&strm, levels[i], Z_DEFAULT_STRATEGY), Z_OK);
+        strm.avail_in = 300;
+        EXPECT_EQ(PREFIX(deflate)(&strm, Z_FINISH), Z_STREAM_END);
+        EXPECT_EQ(PREFIX(deflateReset)(&strm), Z_OK);
+        EXPECT_EQ(PREFIX(deflateParams)(&strm, GetParam(), Z_DEFAULT_STRATEGY), Z_OK);
+
+        expect_len = compress_fresh(expect, message(150, 400), 400);
+        compr_len = deflate_flushed(&strm, msg, 400, compr, 400, Z_NO_FLUSH);
+        EXPECT_EQ(compr_len, expect_len);
+        EXPECT_EQ(memcmp(compr, expect, expect_len), 0);
+        EXPECT_EQ(PREFIX(deflateReset)(&strm), Z_OK);
+    }
+    EXPECT_EQ(PREFIX(deflateEnd)(&strm), Z_OK);
+}
+
+INSTANTIATE_TEST_SUITE_P(deflate_reset, deflate_reset, testing::Values(1, 2, 3, 4, 6, 8, 9, 10));
@@ -0,0 +1,101 @@
+/* test_deflate_reuse.cc - Test deflate() sending blocks with the trees of earlier blocks */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#define REUSE_DATA_SIZE (256 * 1024)
+
+class deflate_reuse : public compress_fixture<> {
+public:
+    void SetUp() override {
+        static const char *fields[] = {
+            "\"id\":", "\"name\":\"", "\"temp\":", "\"status\":\"ok\",", "\"ts\":", "\"host\":\"node-"
+        };
+        uint32_t seed = 99;
+
+        /* Each record is flushed, which adds up to six bytes */
+        ASSERT_TRUE(alloc(REUSE_DATA_SIZE, (REUSE_DATA_SIZE / 64) * 6));
+        source_len = 0;
+        /* Records with the same fields, so that consecutive blocks have similar statistics */
+        while (source_len < REUSE_DATA_SIZE - 64) {
+            uint32_t r = test_rand(&seed);
+            source_len += (uint32_t)snprintf((char *)source + source_len, 64, "%s%u,%s",
+                fields[(r >> 16) % (sizeof(fields) / sizeof(fields[0]))], (r >> 8) % 100000,
+                (r >> 28) == 0 ? "\n" : " ");
+        }
+
+    }
+};
+
+TEST_F(deflate_reuse, sync_flush) {
+    static const uint32_t records[] = { 300, 1024, 4096, 20000 };
+
+    for (int32_t level = 1; level <= Z_OPTIMAL_COMPRESSION; level++) {
+        for (size_t i = 0; i < sizeof(records) / sizeof(records[0]); i++) {
+            uint32_t compr_len = compress_flushed(level, MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, records[i],
+                                                  Z_SYNC_FLUSH);
+            EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+        }
+    }
+}
+
+TEST_F(deflate_reuse, strategies) {
+    static const int32_t strategies[] = { Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED };
+
+    for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+        uint32_t compr_len = compress_flushed(6, MAX_WBITS, MAX_MEM_LEVEL, strategies[i], 2048, Z_SYNC_FLUSH);
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+        compr_len = compress_flushed(6, MAX_WBITS, MAX_MEM_LEVEL, strategies[i], 2048, Z_PARTIAL_FLUSH);
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+    }
+}
+
+/* Streams that are reset, or that change levels and strategies between flushes */
+TEST_F(deflate_reuse, reset) {
+    PREFIX3(stream) c_stream;
+    uint32_t half = source_len / 2;
+    uint32_t pos;
+    int err;
+
+    memset(&c_stream, 0, sizeof(c_stream));
+    err = PREFIX(deflateInit)(&c_stream, 6);
+    EXPECT_EQ(err, Z_OK);
+
+    /* A stream that is thrown away */
+    c_stream.next_in = source + half;
+    c_stream.avail_in = source_len - half;
+    c_stream.next_out = compr;
+    c_stream.avail_out = compr_size;
+    EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_SYNC_FLUSH), Z_OK);
+
+    EXPECT_EQ(PREFIX(deflateReset)(&c_stream), Z_OK);
+    c_stream.next_out = compr;
+    c_stream.avail_out = compr_size;
+    for (pos = 0; pos < source_len; pos += 1500) {
+        if (pos == 1500 * 40) {
+            EXPECT_EQ(PREFIX(deflateParams)(&c_stream, 9, Z_HUFFMAN_ONLY), Z_OK);
+        } else if (pos == 1500 * 80) {
+            EXPECT_EQ(PREFIX(deflateParams)(&c_stream, 2, Z_DEFAULT_STRATEGY), Z_OK);
+        }
+        c_stream.next_in = source + pos;
+        c_stream.avail_in = MIN(1500, source_len - pos);
+        EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_SYNC_FLUSH), Z_OK);
+    }
+    EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_FINISH), Z_STREAM_END);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+
+    EXPECT_EQ(inflate_check(compr, (uint32_t)c_stream.total_out, source, source_len, MAX_WBITS), Z_OK);
+}
@@ -0,0 +1,105 @@
+/* test_deflate_sample.cc - Test deflate() skipping the match search on incompressible input */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#define SAMPLE_DATA_SIZE (384 * 1024 + 11)
+#define SAMPLE_PART_SIZE (96 * 1024)
+
+class deflate_sample : public compress_fixture<> {
+public:
+    void SetUp() override {
+        uint32_t seed = 31;
+
+        ASSERT_TRUE(alloc(SAMPLE_DATA_SIZE));
+        /* Parts of random bytes and parts of text, taking turns */
+        for (uint32_t i = 0; i < source_len; i++) {
+            uint32_t r = test_rand(&seed);
+            if ((i / SAMPLE_PART_SIZE) % 2 == 0)
+                source[i] = (uint8_t)(r >> 16);
+            else
+                source[i] = (uint8_t)"sampled spans of text compress well\n"[(i + (r >> 31)) % 36];
+        }
+
+    }
+};
+
+/* Skipping the match search costs little compared with input in pieces too small to be sampled */
+TEST_F(deflate_sample, levels) {
+    for (int32_t level = Z_FASTEST_COMPRESSION; level <= Z_OPTIMAL_COMPRESSION; level++) {
+        uint32_t sampled_len, unsampled_len;
+
+        if (level == Z_DEFAULT_COMPRESSION)
+            continue;
+        unsampled_len = compress_flushed(level, MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, 1024, Z_NO_FLUSH);
+        EXPECT_EQ(inflate_check(compr, unsampled_len, source, source_len, MAX_WBITS), Z_OK);
+        sampled_len = compress_flushed(level, MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, source_len, Z_NO_FLUSH);
+        EXPECT_EQ(inflate_check(compr, sampled_len, source, source_len, MAX_WBITS), Z_OK);
+        EXPECT_LT(sampled_len, unsampled_len + unsampled_len / 100);
+    }
+}
+
+/* Input in pieces around the sizes that are sampled, so that the spans start in the middle of a lazy match */
+TEST_F(deflate_sample, chunks) {
+    static const uint32_t chunks[] = { 1000, 4095, 4096, 65535, 65537, 200000 };
+
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        uint32_t compr_len = compress_flushed(1, MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, chunks[i], Z_NO_FLUSH);
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+        compr_len = compress_flushed(6, MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, chunks[i], Z_NO_FLUSH);
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+        compr_len = compress_flushed(9, MAX_WBITS, MAX_MEM_LEVEL, Z_FILTERED, chunks[i], Z_NO_FLUSH);
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+        compr_len = compress_flushed(9, MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, chunks[i], Z_SYNC_FLUSH);
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+    }
+}
+
+TEST_F(deflate_sample, strategies) {
+    static const int32_t strategies[] = { Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED };
+
+    for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+        uint32_t compr_len = compress_flushed(6, MAX_WBITS, MAX_MEM_LEVEL, strategies[i], 70000, Z_NO_FLUSH);
+        EXPECT_EQ(inflate_check(compr, compr_len, source, source_len, MAX_WBITS), Z_OK);
+    }
+}
+
+/* Changing levels and strategies while the match search is skipped */
+TEST_F(deflate_sample, params) {
+    static const int32_t levels[] = { 8, 1, 0, 3, 10, Z_FASTEST_COMPRESSION, 6 };
+    PREFIX3(stream) c_stream;
+    uint32_t pos;
+    int i = 0;
+    int err;
+
+    memset(&c_stream, 0, sizeof(c_stream));
+    err = PREFIX(deflateInit)(&c_stream, 9);
+    EXPECT_EQ(err, Z_OK);
+
+    c_stream.next_out = compr;
+    c_stream.avail_out = compr_size;
+    for (pos = 0; pos < source_len; pos += 20000, i++) {
+        EXPECT_EQ(PREFIX(deflateParams)(&c_stream, levels[i % 7], i % 5 == 4 ? Z_FIXED : Z_DEFAULT_STRATEGY), Z_OK);
+        c_stream.next_in = source + pos;
+        c_stream.avail_in = MIN(20000, source_len - pos);
+        EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_NO_FLUSH), Z_OK);
+        EXPECT_EQ(c_stream.avail_in, 0);
+    }
+    EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_FINISH), Z_STREAM_END);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+
+    EXPECT_EQ(inflate_check(compr, (uint32_t)c_stream.total_out, source, source_len, MAX_WBITS), Z_OK);
+}
@@ -0,0 +1,115 @@
+/* test_deflate_sized.cc - Test deflateInitSized() */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#ifndef ZLIB_COMPAT
+#define SIZED_DATA_SIZE (80 * 1024)
+
+/* Adds up the bytes allocated by the stream */
+static void *count_alloc(void *opaque, unsigned items, unsigned size) {
+    *(size_t *)opaque += (size_t)items * size;
+    return calloc(items, size);
+}
+
+static void count_free(void *opaque, void *ptr) {
+    Z_UNUSED(opaque);
+    free(ptr);
+}
+
+class deflate_sized : public compress_fixture<::testing::TestWithParam<int32_t>> {
+public:
+    void SetUp() override {
+        uint32_t seed = 31;
+
+        ASSERT_TRUE(alloc(SIZED_DATA_SIZE));
+        for (uint32_t i = 0; i < SIZED_DATA_SIZE; i++)
+            source[i] = (uint8_t)"the quick brown fox\n"[(test_rand(&seed) >> 16) % 20];
+    }
+
+    /* Compresses len bytes with a stream sized for hint bytes and checks the result */
+    size_t round_trip(uint32_t len, size_t hint, int32_t window_bits) {
+        PREFIX3(stream) c_stream;
+        size_t allocated = 0;
+        unsigned long bound;
+
+        memset(&c_stream, 0, sizeof(c_stream));
+        c_stream.zalloc = count_alloc;
+        c_stream.zfree = count_free;
+        c_stream.opaque = &allocated;
+        EXPECT_EQ(PREFIX(deflateInitSized)(&c_stream, GetParam(), Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY,
+                                           hint), Z_OK);
+        bound = PREFIX(deflateBound)(&c_stream, len);
+
+        /* Reset the stream once, it must keep working with the sizes chosen */
+        for (int i = 0; i < 2; i++) {
+            EXPECT_EQ(PREFIX(deflateReset)(&c_stream), Z_OK);
+            c_stream.next_in = source;
+            c_stream.avail_in = len;
+            c_stream.next_out = compr;
+            c_stream.avail_out = compr_size;
+            EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_FINISH), Z_STREAM_END);
+        }
+        EXPECT_LE(c_stream.total_out, bound);
+        EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+
+        EXPECT_EQ(inflate_check(compr, c_stream.total_out, source, len, window_bits), Z_OK);
+        return allocated;
+    }
+};
+
+TEST_P(deflate_sized, round_trip) {
+    static const uint32_t lens[] = { 1, 100, 1000, 4000, 40000, SIZED_DATA_SIZE };
+    static const int32_t window_bits[] = { MAX_WBITS, -MAX_WBITS, MAX_WBITS + 16, 10 };
+
+    for (size_t w = 0; w < sizeof(window_bits) / sizeof(window_bits[0]); w++) {
+        for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+            round_trip(lens[l], lens[l], window_bits[w]);
+            /* More input than expected */
+            round_trip(lens[l], lens[l] / 16 + 1, window_bits[w]);
+        }
+    }
+}
+
+TEST_P(deflate_sized, memory) {
+    size_t full = round_trip(2000, 0, MAX_WBITS);
+
+    /* A short input needs a fraction of the memory */
+    EXPECT_LT(round_trip(2000, 2000, MAX_WBITS) * 4, full);
+    /* Long inputs get the usual sizes */
+    EXPECT_EQ(round_trip(2000, SIZED_DATA_SIZE, MAX_WBITS), full);
+}
+
+INSTANTIATE_TEST_SUITE_P(deflate_sized, deflate_sized, testing::Values(0, 1, 2, 3, 6, 9, 10));
+
+TEST(deflate_sized_header, window_size) {
+    PREFIX3(stream) c_stream;
+    uint8_t compr[64];
+
+    memset(&c_stream, 0, sizeof(c_stream));
+    EXPECT_EQ(PREFIX(deflateInitSized)(&c_stream, 6, Z_DEFLATED, MAX_WBITS, 8, Z_DEFAULT_STRATEGY, 10), Z_OK);
+    c_stream.next_in = (z_const uint8_t *)"hello";
+    c_stream.avail_in = 5;
+    c_stream.next_out = compr;
+    c_stream.avail_out = sizeof(compr);
+    EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_FINISH), Z_STREAM_END);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+
+    /* The zlib header announces the smallest window */
+    EXPECT_EQ(compr[0] >> 4, 9 - 8);
+    EXPECT_EQ(PREFIX(deflateInitSized)(&c_stream, 6, 0, MAX_WBITS, 8, Z_DEFAULT_STRATEGY, 10), Z_STREAM_ERROR);
+}
+#endif
@@ -0,0 +1,112 @@
+/* test_deflate_split.cc - Test deflate() splitting blocks where the data changes */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#define SPLIT_DATA_SIZE (192 * 1024 + 13)
+#define SPLIT_PART_SIZE (12 * 1024)
+
+class deflate_split : public compress_fixture<> {
+public:
+    void SetUp() override {
+        static const char *words[] = {
+            "block ", "split ", "tree ", "entropy ", "segment ", "histogram ", "literal ", "match ",
+            "the ", "of ", "and ", "cost ", "header ", ".\n"
+        };
+        uint32_t seed = 2024, pos = 0;
+
+        ASSERT_TRUE(alloc(SPLIT_DATA_SIZE));
+        /* Parts of pseudo text and parts of bytes from a small binary alphabet, taking turns */
+        while (pos < source_len) {
+            uint32_t end = MIN(pos + SPLIT_PART_SIZE, source_len);
+            bool text = (pos / SPLIT_PART_SIZE) % 2 == 0;
+            while (pos < end) {
+                uint32_t r = test_rand(&seed);
+                if (text) {
+                    const char *word = words[(r >> 16) % (sizeof(words) / sizeof(words[0]))];
+                    size_t len = MIN(strlen(word), end - pos);
+                    memcpy(source + pos, word, len);
+                    pos += (uint32_t)len;
+                } else {
+                    source[pos++] = (uint8_t)(0x80 + ((r >> 16) & 15));
+                }
+            }
+        }
+
+    }
+
+    /* Decompresses and checks the data, returning the number of deflate blocks */
+    int uncompress(uint32_t compr_len, uint32_t len) {
+        PREFIX3(stream) d_stream;
+        uint8_t *uncompr = (uint8_t *)malloc(len + 1);
+        int err, blocks = 0;
+
+        EXPECT_TRUE(uncompr != NULL);
+        if (uncompr == NULL)
+            return 0;
+        memset(&d_stream, 0, sizeof(d_stream));
+        err = PREFIX(inflateInit)(&d_stream);
+        EXPECT_EQ(err, Z_OK);
+
+        d_stream.next_in = compr;
+        d_stream.avail_in = compr_len;
+        d_stream.next_out = uncompr;
+        d_stream.avail_out = len + 1;
+
+        do {
+            err = PREFIX(inflate)(&d_stream, Z_BLOCK);
+            if (err == Z_OK && (d_stream.data_type & 128) && !(d_stream.data_type & 64))
+                blocks++;
+        } while (err == Z_OK);
+        EXPECT_EQ(err, Z_STREAM_END);
+        EXPECT_EQ(d_stream.total_out, len);
+        EXPECT_EQ(memcmp(uncompr, source, len), 0);
+
+        PREFIX(inflateEnd)(&d_stream);
+        free(uncompr);
+        return blocks;
+    }
+};
+
+/* Text and binary that fit in one symbol buffer are still sent as separate blocks */
+TEST_F(deflate_split, blocks) {
+    uint32_t len = 2 * SPLIT_PART_SIZE;
+
+    EXPECT_GE(uncompress(compress(6, MAX_WBITS, 8, Z_DEFAULT_STRATEGY, len, compr_size), len), 2);
+    EXPECT_EQ(uncompress(compress(6, MAX_WBITS, 8, Z_FIXED, len, compr_size), len), 1);
+}
+
+TEST_F(deflate_split, levels) {
+    for (int32_t level = 1; level <= Z_OPTIMAL_COMPRESSION; level++) {
+        uncompress(compress(level, MAX_WBITS, 8, Z_DEFAULT_STRATEGY, source_len, compr_size), source_len);
+    }
+}
+
+TEST_F(deflate_split, strategies) {
+    static const int32_t strategies[] = { Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED };
+
+    for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+        uncompress(compress(6, MAX_WBITS, 8, strategies[i], source_len, compr_size), source_len);
+    }
+}
+
+/* Output space of a single byte at a time, with the smallest and largest symbol buffers */
+TEST_F(deflate_split, small_output) {
+    for (int32_t mem_level = 1; mem_level <= MAX_MEM_LEVEL; mem_level += MAX_MEM_LEVEL - 1) {
+        uncompress(compress(6, MAX_WBITS, mem_level, Z_DEFAULT_STRATEGY, source_len, 1), source_len);
+        uncompress(compress(9, MAX_WBITS, mem_level, Z_HUFFMAN_ONLY, source_len, 1), source_len);
+    }
+}
@@ -0,0 +1,211 @@
+/* test_gzio_map.cc - Test reading .gz files through a memory mapping */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#define MAP_DATA_SIZE (512 * 1024)
+#define MAP_TESTFILE  "foo_map.gz"
+
+class gzip_map : public ::testing::Test {
+public:
+    uint8_t *source = NULL;
+    uint8_t *uncompr = NULL;
+
+    void SetUp() override {
+        uint32_t seed = 11;
+
+        source = (uint8_t *)malloc(MAP_DATA_SIZE);
+        uncompr = (uint8_t *)malloc(MAP_DATA_SIZE);
+        ASSERT_TRUE(source != NULL && uncompr != NULL);
+        for (uint32_t i = 0; i < MAP_DATA_SIZE; i++) {
+            test_rand(&seed);
+            source[i] = (uint8_t)"abcdefgh"[(seed >> 16) % ((seed >> 30) + 2)];
+        }
+    }
+
+    void TearDown() override {
+        remove(MAP_TESTFILE);
+        free(uncompr);
+        free(source);
+    }
+
+    /* Reads the whole file in pieces of len bytes */
+    void ReadAll(const char *mode, uint32_t len) {
+        gzFile file = PREFIX(gzopen)(MAP_TESTFILE, mode);
+
+        ASSERT_TRUE(file != NULL);
+        memset(uncompr, 0, MAP_DATA_SIZE);
+        for (uint32_t pos = 0; pos < MAP_DATA_SIZE; pos += len) {
+            int n = (int)MIN(len, MAP_DATA_SIZE - pos);
+            ASSERT_EQ(PREFIX(gzread)(file, uncompr + pos, len), n);
+        }
+        EXPECT_EQ(memcmp(uncompr, source, MAP_DATA_SIZE), 0);
+        EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1), 0);
+        EXPECT_EQ(PREFIX(gzeof)(file), 1);
+        EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+    }
+};
+
+#ifndef NO_GZCOMPRESS
+TEST_F(gzip_map, read) {
+    uint32_t half = MAP_DATA_SIZE / 2;
+    gzFile file;
+
+    /* Two gzip members */
+    file = PREFIX(gzopen)(MAP_TESTFILE, "wb");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source, half), (int)half);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+    file = PREFIX(gzopen)(MAP_TESTFILE, "ab");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source + half, MAP_DATA_SIZE - half), (int)(MAP_DATA_SIZE - half));
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+    ReadAll("rbM", 1000);
+    ReadAll("rbM", 100000);
+    ReadAll("rbMA", 4096);
+    ReadAll("rbMP2", 65536);
+}
+
+TEST_F(gzip_map, seek) {
+    FILE *f;
+    long size;
+    gzFile file;
+
+    file = PREFIX(gzopen)(MAP_TESTFILE, "wb");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source, MAP_DATA_SIZE), MAP_DATA_SIZE);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+    f = fopen(MAP_TESTFILE, "rb");
+    ASSERT_TRUE(f != NULL);
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fclose(f);
+
+    file = PREFIX(gzopen)(MAP_TESTFILE, "rbM");
+    ASSERT_TRUE(file != NULL);
+
+    /* The offset does not count what is mapped but not yet decompressed */
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 10), 10);
+    EXPECT_LT(PREFIX(gzoffset)(file), size);
+
+    /* Backwards seeks rewind and map the file again */
+    EXPECT_EQ(PREFIX(gzseek)(file, 200000, SEEK_SET), 200000);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1000), 1000);
+    EXPECT_EQ(memcmp(uncompr, source + 200000, 1000), 0);
+    EXPECT_EQ(PREFIX(gzseek)(file, 1000, SEEK_SET), 1000);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, MAP_DATA_SIZE), MAP_DATA_SIZE - 1000);
+    EXPECT_EQ(memcmp(uncompr, source + 1000, MAP_DATA_SIZE - 1000), 0);
+    EXPECT_EQ(PREFIX(gzoffset)(file), size);
+
+#ifndef ZLIB_COMPAT
+    /* Building an index reads through the mapping too */
+    EXPECT_EQ(PREFIX(gzbuildindex)(file, 65536), 0);
+    EXPECT_EQ(PREFIX(gzseek)(file, 400000, SEEK_SET), 400000);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1000), 1000);
+    EXPECT_EQ(memcmp(uncompr, source + 400000, 1000), 0);
+    EXPECT_EQ(PREFIX(gzseek)(file, 100000, SEEK_SET), 100000);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1000), 1000);
+    EXPECT_EQ(memcmp(uncompr, source + 100000, 1000), 0);
+#endif
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+}
+
+/* Stored blocks make the file larger than one mapped window */
+TEST_F(gzip_map, windows) {
+    const uint32_t rounds = 140;
+    gzFile file;
+    uint32_t i, pos;
+
+    file = PREFIX(gzopen)(MAP_TESTFILE, "wb0");
+    ASSERT_TRUE(file != NULL);
+    for (i = 0; i < rounds; i++)
+        ASSERT_EQ(PREFIX(gzwrite)(file, source, MAP_DATA_SIZE), MAP_DATA_SIZE);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+    file = PREFIX(gzopen)(MAP_TESTFILE, "rbM");
+    ASSERT_TRUE(file != NULL);
+    for (i = 0; i < rounds; i++) {
+        /* Reads that do not line up with the windows or the data */
+        for (pos = 0; pos < MAP_DATA_SIZE; pos += 100000) {
+            int n = (int)MIN(100000, MAP_DATA_SIZE - pos);
+            ASSERT_EQ(PREFIX(gzread)(file, uncompr + pos, n), n);
+        }
+        ASSERT_EQ(memcmp(uncompr, source, MAP_DATA_SIZE), 0);
+    }
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1), 0);
+    EXPECT_EQ(PREFIX(gzeof)(file), 1);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+}
+#endif
+
+/* Data without a gzip header is read instead of copied from the mapping */
+TEST_F(gzip_map, copy) {
+    FILE *f = fopen(MAP_TESTFILE, "wb");
+    gzFile file;
+
+    ASSERT_TRUE(f != NULL);
+    EXPECT_EQ(fwrite(source, 1, MAP_DATA_SIZE, f), (size_t)MAP_DATA_SIZE);
+    fclose(f);
+
+    ReadAll("rbM", 5000);
+
+    file = PREFIX(gzopen)(MAP_TESTFILE, "rbM");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 100), 100);
+    EXPECT_EQ(PREFIX(gzdirect)(file), 1);
+    EXPECT_EQ(PREFIX(gzseek)(file, 300000, SEEK_CUR), 300100);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1000), 1000);
+    EXPECT_EQ(memcmp(uncompr, source + 300100, 1000), 0);
+    EXPECT_EQ(PREFIX(gzseek)(file, 10, SEEK_SET), 10);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, MAP_DATA_SIZE), MAP_DATA_SIZE - 10);
+    EXPECT_EQ(memcmp(uncompr, source + 10, MAP_DATA_SIZE - 10), 0);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+}
+
+#if !defined(_WIN32) && !defined(NO_GZCOMPRESS)
+/* A pipe cannot be mapped, so it is read as usual */
+TEST_F(gzip_map, pipe) {
+    uint8_t compr[MAP_DATA_SIZE / 4];
+    z_size_t compr_len = sizeof(compr);
+    gzFile file;
+    int fds[2];
+
+    file = PREFIX(gzopen)(MAP_TESTFILE, "wb9");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source, 60000), 60000);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+    FILE *f = fopen(MAP_TESTFILE, "rb");
+    ASSERT_TRUE(f != NULL);
+    compr_len = fread(compr, 1, compr_len, f);
+    fclose(f);
+    ASSERT_LT(compr_len, (z_size_t)60000);
+
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(write(fds[1], compr, compr_len), (ssize_t)compr_len);
+    close(fds[1]);
+    file = PREFIX(gzdopen)(fds[0], "rbM");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, MAP_DATA_SIZE), 60000);
+    EXPECT_EQ(memcmp(uncompr, source, 60000), 0);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+}
+#endif
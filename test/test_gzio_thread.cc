@@ -0,0 +1,372 @@
+/* test_gzio_thread.cc - Test reading and writing .gz files on a separate thread */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#define THREAD_DATA_SIZE (512 * 1024)
+#define THREAD_TESTFILE  "foo_thread.gz"
+
+class gzip_thread : public ::testing::Test {
+public:
+    uint8_t *source = NULL;
+    uint8_t *uncompr = NULL;
+
+    void SetUp() override {
+        uint32_t seed = 7;
+
+        source = (uint8_t *)malloc(THREAD_DATA_SIZE);
+        uncompr = (uint8_t *)malloc(THREAD_DATA_SIZE);
+        ASSERT_TRUE(source != NULL && uncompr != NULL);
+        for (uint32_t i = 0; i < THREAD_DATA_SIZE; i++) {
+            test_rand(&seed);
+            source[i] = (uint8_t)"abcdefgh"[(seed >> 16) % ((seed >> 30) + 2)];
+        }
+    }
+
+    void TearDown() override {
+        remove(THREAD_TESTFILE);
+        free(uncompr);
+        free(source);
+    }
+
+    /* Reads the whole file in pieces of len bytes through a small buffer, so that it is refilled often */
+    void ReadAll(const char *mode, uint32_t len) {
+        gzFile file = PREFIX(gzopen)(THREAD_TESTFILE, mode);
+
+        ASSERT_TRUE(file != NULL);
+        EXPECT_EQ(PREFIX(gzbuffer)(file, 4096), 0);
+        memset(uncompr, 0, THREAD_DATA_SIZE);
+        for (uint32_t pos = 0; pos < THREAD_DATA_SIZE; pos += len) {
+            int n = (int)MIN(len, THREAD_DATA_SIZE - pos);
+            ASSERT_EQ(PREFIX(gzread)(file, uncompr + pos, len), n);
+        }
+        EXPECT_EQ(memcmp(uncompr, source, THREAD_DATA_SIZE), 0);
+        EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1), 0);
+        EXPECT_EQ(PREFIX(gzeof)(file), 1);
+        EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+    }
+};
+
+#ifndef NO_GZCOMPRESS
+TEST_F(gzip_thread, read_ahead) {
+    uint32_t half = THREAD_DATA_SIZE / 2;
+    gzFile file;
+
+    /* Two gzip members */
+    file = PREFIX(gzopen)(THREAD_TESTFILE, "wb");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source, half), (int)half);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+    file = PREFIX(gzopen)(THREAD_TESTFILE, "ab");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source + half, THREAD_DATA_SIZE - half), (int)(THREAD_DATA_SIZE - half));
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+    ReadAll("rbA", 1000);
+    ReadAll("rbA1", 65536);
+    ReadAll("rbA8", 333);
+    ReadAll("rbA3P2", 100000);
+}
+
+TEST_F(gzip_thread, read_ahead_seek) {
+    FILE *f;
+    long size;
+    gzFile file;
+
+    file = PREFIX(gzopen)(THREAD_TESTFILE, "wb");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source, THREAD_DATA_SIZE), THREAD_DATA_SIZE);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+    f = fopen(THREAD_TESTFILE, "rb");
+    ASSERT_TRUE(f != NULL);
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fclose(f);
+
+    file = PREFIX(gzopen)(THREAD_TESTFILE, "rbA");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzbuffer)(file, 4096), 0);
+
+    /* The offset does not count what the thread has read ahead */
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 10), 10);
+    EXPECT_LE(PREFIX(gzoffset)(file), 4096);
+
+    /* Backwards seeks rewind, which has to stop the thread first */
+    EXPECT_EQ(PREFIX(gzseek)(file, 200000, SEEK_SET), 200000);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1000), 1000);
+    EXPECT_EQ(memcmp(uncompr, source + 200000, 1000), 0);
+    EXPECT_EQ(PREFIX(gzseek)(file, 1000, SEEK_SET), 1000);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, THREAD_DATA_SIZE), THREAD_DATA_SIZE - 1000);
+    EXPECT_EQ(memcmp(uncompr, source + 1000, THREAD_DATA_SIZE - 1000), 0);
+    EXPECT_EQ(PREFIX(gzoffset)(file), size);
+
+#ifndef ZLIB_COMPAT
+    /* Jumping to an index point repositions the file the same way */
+    EXPECT_EQ(PREFIX(gzbuildindex)(file, 65536), 0);
+    EXPECT_EQ(PREFIX(gzseek)(file, 400000, SEEK_SET), 400000);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1000), 1000);
+    EXPECT_EQ(memcmp(uncompr, source + 400000, 1000), 0);
+    EXPECT_EQ(PREFIX(gzseek)(file, 100000, SEEK_SET), 100000);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1000), 1000);
+    EXPECT_EQ(memcmp(uncompr, source + 100000, 1000), 0);
+#endif
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+}
+#endif
+
+/* Data without a gzip header is copied, and seeking in it uses the file offset */
+TEST_F(gzip_thread, read_ahead_copy) {
+    FILE *f = fopen(THREAD_TESTFILE, "wb");
+    gzFile file;
+
+    ASSERT_TRUE(f != NULL);
+    EXPECT_EQ(fwrite(source, 1, THREAD_DATA_SIZE, f), (size_t)THREAD_DATA_SIZE);
+    fclose(f);
+
+    ReadAll("rbA", 5000);
+
+    file = PREFIX(gzopen)(THREAD_TESTFILE, "rbA2");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzbuffer)(file, 4096), 0);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 100), 100);
+    EXPECT_EQ(PREFIX(gzdirect)(file), 1);
+    EXPECT_EQ(PREFIX(gzseek)(file, 300000, SEEK_CUR), 300100);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1000), 1000);
+    EXPECT_EQ(memcmp(uncompr, source + 300100, 1000), 0);
+    EXPECT_EQ(PREFIX(gzseek)(file, 10, SEEK_SET), 10);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, THREAD_DATA_SIZE), THREAD_DATA_SIZE - 10);
+    EXPECT_EQ(memcmp(uncompr, source + 10, THREAD_DATA_SIZE - 10), 0);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+}
+
+#ifndef NO_GZCOMPRESS
+TEST_F(gzip_thread, write) {
+    static const char *modes[] = { "wbA", "wbA1", "wb9A8", "wbA3h" };
+    uint32_t half = THREAD_DATA_SIZE / 2;
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        gzFile file = PREFIX(gzopen)(THREAD_TESTFILE, modes[i]);
+        uint32_t pos;
+
+        ASSERT_TRUE(file != NULL);
+        EXPECT_EQ(PREFIX(gzbuffer)(file, 4096), 0);
+
+        /* Small writes through the input buffer, and writes larger than it */
+        for (pos = 0; pos < half; pos += 1024)
+            EXPECT_EQ(PREFIX(gzwrite)(file, source + pos, 1024), 1024);
+        EXPECT_EQ(PREFIX(gzputc)(file, source[pos]), source[pos]);
+        pos++;
+        EXPECT_EQ(PREFIX(gzsetparams)(file, 1, Z_DEFAULT_STRATEGY), Z_OK);
+        EXPECT_EQ(PREFIX(gzwrite)(file, source + pos, 100000), 100000);
+        pos += 100000;
+
+        /* After a flush everything written so far is in the file */
+        EXPECT_EQ(PREFIX(gzflush)(file, Z_SYNC_FLUSH), Z_OK);
+        {
+            FILE *f = fopen(THREAD_TESTFILE, "rb");
+            ASSERT_TRUE(f != NULL);
+            fseek(f, 0, SEEK_END);
+            EXPECT_EQ(PREFIX(gzoffset)(file), (z_off64_t)ftell(f));
+            fclose(f);
+        }
+
+        EXPECT_EQ(PREFIX(gzwrite)(file, source + pos, THREAD_DATA_SIZE - pos), (int)(THREAD_DATA_SIZE - pos));
+        EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+        ReadAll("rb", 65536);
+    }
+
+    /* Transparent writing */
+    gzFile file = PREFIX(gzopen)(THREAD_TESTFILE, "wbTA");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source, THREAD_DATA_SIZE), THREAD_DATA_SIZE);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+    ReadAll("rb", 65536);
+}
+
+/* Blocks compressed by several threads form a single gzip member */
+TEST_F(gzip_thread, write_parallel) {
+    static const char *modes[] = { "wbP4", "wbP", "wb1P2", "wb9P3", "wbP2h", "wbA2P3" };
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        gzFile file = PREFIX(gzopen)(THREAD_TESTFILE, modes[i]);
+        uint32_t pos;
+
+        ASSERT_TRUE(file != NULL);
+        EXPECT_EQ(PREFIX(gzbuffer)(file, 4096), 0);
+        for (pos = 0; pos < 100000; pos += 1000)
+            EXPECT_EQ(PREFIX(gzwrite)(file, source + pos, 1000), 1000);
+        EXPECT_EQ(PREFIX(gzflush)(file, Z_SYNC_FLUSH), Z_OK);
+        EXPECT_EQ(PREFIX(gzflush)(file, Z_SYNC_FLUSH), Z_OK);
+        EXPECT_EQ(PREFIX(gzwrite)(file, source + pos, 150000), 150000);
+        pos += 150000;
+        EXPECT_EQ(PREFIX(gzflush)(file, Z_FULL_FLUSH), Z_OK);
+        EXPECT_EQ(PREFIX(gzsetparams)(file, 2, Z_DEFAULT_STRATEGY), Z_OK);
+        EXPECT_EQ(PREFIX(gzwrite)(file, source + pos, 7), 7);
+        pos += 7;
+        EXPECT_EQ(PREFIX(gzsetparams)(file, 7, Z_FILTERED), Z_OK);
+        EXPECT_EQ(PREFIX(gzwrite)(file, source + pos, THREAD_DATA_SIZE - pos), (int)(THREAD_DATA_SIZE - pos));
+        EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+        ReadAll("rb", 65536);
+    }
+
+    /* A second Z_FINISH without new data does not start another member, and inflate reads the member */
+    {
+        gzFile file = PREFIX(gzopen)(THREAD_TESTFILE, "wbP3");
+        uint8_t *compr = (uint8_t *)malloc(THREAD_DATA_SIZE * 2);
+        PREFIX3(stream) strm;
+        size_t compr_len;
+        FILE *f;
+
+        ASSERT_TRUE(file != NULL && compr != NULL);
+        EXPECT_EQ(PREFIX(gzwrite)(file, source, THREAD_DATA_SIZE), THREAD_DATA_SIZE);
+        EXPECT_EQ(PREFIX(gzflush)(file, Z_FINISH), Z_OK);
+        EXPECT_EQ(PREFIX(gzflush)(file, Z_FINISH), Z_OK);
+        EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+        f = fopen(THREAD_TESTFILE, "rb");
+        ASSERT_TRUE(f != NULL);
+        compr_len = fread(compr, 1, THREAD_DATA_SIZE * 2, f);
+        fclose(f);
+
+        memset(&strm, 0, sizeof(strm));
+        ASSERT_EQ(PREFIX(inflateInit2)(&strm, MAX_WBITS + 16), Z_OK);
+        strm.next_in = compr;
+        strm.avail_in = (uint32_t)compr_len;
+        strm.next_out = uncompr;
+        strm.avail_out = THREAD_DATA_SIZE;
+        EXPECT_EQ(PREFIX(inflate)(&strm, Z_FINISH), Z_STREAM_END);
+        EXPECT_EQ(strm.avail_in, 0U);
+        EXPECT_EQ(strm.avail_out, 0U);
+        EXPECT_EQ(memcmp(uncompr, source, THREAD_DATA_SIZE), 0);
+        EXPECT_EQ(PREFIX(inflateEnd)(&strm), Z_OK);
+        free(compr);
+    }
+
+    /* An empty file is still a gzip member */
+    gzFile file = PREFIX(gzopen)(THREAD_TESTFILE, "wbP2");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+    file = PREFIX(gzopen)(THREAD_TESTFILE, "rb");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1), 0);
+    EXPECT_EQ(PREFIX(gzdirect)(file), 0);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+}
+
+/* The parallel writer sets the same extra flags in the gzip header as deflate() */
+TEST_F(gzip_thread, write_parallel_header) {
+    static const int levels[] = { 1, 6, 9, Z_OPTIMAL_COMPRESSION };
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        uint8_t head[2][10];
+
+        for (int parallel = 0; parallel < 2; parallel++) {
+            gzFile file = PREFIX(gzopen)(THREAD_TESTFILE, parallel ? "wbP2" : "wb");
+            FILE *f;
+
+            ASSERT_TRUE(file != NULL);
+            EXPECT_EQ(PREFIX(gzsetparams)(file, levels[i], Z_DEFAULT_STRATEGY), Z_OK);
+            EXPECT_EQ(PREFIX(gzwrite)(file, source, 1000), 1000);
+            EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+            f = fopen(THREAD_TESTFILE, "rb");
+            ASSERT_TRUE(f != NULL);
+            EXPECT_EQ(fread(head[parallel], 1, 10, f), 10U);
+            fclose(f);
+        }
+        EXPECT_EQ(head[1][8], head[0][8]);
+    }
+}
+
+/* Files streamed at the same time each keep their own reads and writes in flight */
+TEST_F(gzip_thread, many_files) {
+    const int count = 16;
+    const uint32_t chunk = 5000;
+    gzFile files[count];
+    char name[32];
+    int i;
+    uint32_t pos;
+
+    for (i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "foo_thread_%d.gz", i);
+        files[i] = PREFIX(gzopen)(name, i & 1 ? "wbA2" : "wbA3T");
+        ASSERT_TRUE(files[i] != NULL);
+        EXPECT_EQ(PREFIX(gzbuffer)(files[i], 4096), 0);
+    }
+    for (pos = 0; pos < THREAD_DATA_SIZE / 4; pos += chunk)
+        for (i = 0; i < count; i++)
+            ASSERT_EQ(PREFIX(gzwrite)(files[i], source + pos + i, chunk), (int)chunk);
+    for (i = 0; i < count; i++)
+        EXPECT_EQ(PREFIX(gzclose)(files[i]), Z_OK);
+
+    for (i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "foo_thread_%d.gz", i);
+        files[i] = PREFIX(gzopen)(name, "rbA2");
+        ASSERT_TRUE(files[i] != NULL);
+        EXPECT_EQ(PREFIX(gzbuffer)(files[i], 4096), 0);
+    }
+    for (pos = 0; pos < THREAD_DATA_SIZE / 4; pos += chunk) {
+        for (i = 0; i < count; i++) {
+            ASSERT_EQ(PREFIX(gzread)(files[i], uncompr, chunk), (int)chunk);
+            ASSERT_EQ(memcmp(uncompr, source + pos + i, chunk), 0);
+        }
+    }
+    for (i = 0; i < count; i++) {
+        EXPECT_EQ(PREFIX(gzread)(files[i], uncompr, 1), 0);
+        EXPECT_EQ(PREFIX(gzclose)(files[i]), Z_OK);
+        snprintf(name, sizeof(name), "foo_thread_%d.gz", i);
+        remove(name);
+    }
+}
+
+#ifndef _WIN32
+/* Write errors happen on the writer thread, and are reported when flushing or closing */
+TEST_F(gzip_thread, write_error) {
+    FILE *f = fopen(THREAD_TESTFILE, "wb");
+    gzFile file;
+    int fd, err;
+
+    ASSERT_TRUE(f != NULL);
+    fclose(f);
+
+    fd = open(THREAD_TESTFILE, O_RDONLY);
+    ASSERT_NE(fd, -1);
+    file = PREFIX(gzdopen)(fd, "wbA");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source, 1000), 1000);
+    EXPECT_EQ(PREFIX(gzflush)(file, Z_FULL_FLUSH), Z_ERRNO);
+    PREFIX(gzerror)(file, &err);
+    EXPECT_EQ(err, Z_ERRNO);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source, 1000), 0);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_ERRNO);
+
+    fd = open(THREAD_TESTFILE, O_RDONLY);
+    ASSERT_NE(fd, -1);
+    file = PREFIX(gzdopen)(fd, "wbA2");
+    ASSERT_TRUE(file != NULL);
+    for (uint32_t pos = 0; pos < THREAD_DATA_SIZE; pos += 10000)
+        PREFIX(gzwrite)(file, source + pos, MIN(10000, THREAD_DATA_SIZE - pos));
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_ERRNO);
+}
+#endif
+#endif
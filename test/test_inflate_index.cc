@@ -0,0 +1,281 @@
+/* test_inflate_index.cc - Test random access with inflate and gzip indexes */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#ifndef ZLIB_COMPAT
+#define INDEX_DATA_SIZE (1024 * 1024)
+#define INDEX_SPAN      (64 * 1024)
+#define INDEX_IN_CHUNK  5000
+#define INDEX_READ_SIZE 1000
+#define INDEX_TESTFILE  "foo_index.gz"
+
+typedef struct index_out_s {
+    uint8_t *buf;
+    size_t len;
+    size_t size;
+} index_out;
+
+typedef struct index_in_s {
+    const uint8_t *buf;
+    uint32_t len;
+    uint32_t pos;
+} index_in;
+
+/* Provides the input in small chunks, so that blocks straddle them */
+static uint32_t index_in_func(void *desc, z_const unsigned char **buf) {
+    index_in *in = (index_in *)desc;
+    uint32_t len = MIN(INDEX_IN_CHUNK, in->len - in->pos);
+
+    *buf = in->buf + in->pos;
+    in->pos += len;
+    return len;
+}
+
+static int32_t index_out_func(void *desc, uint8_t *buf, uint32_t len) {
+    index_out *out = (index_out *)desc;
+
+    if (out->len + len > out->size) {
+        uint8_t *grown = (uint8_t *)realloc(out->buf, (out->len + len) * 2);
+        if (grown == NULL)
+            return 1;
+        out->buf = grown;
+        out->size = (out->len + len) * 2;
+    }
+    memcpy(out->buf + out->len, buf, len);
+    out->len += len;
+    return 0;
+}
+
+class inflate_index : public compress_fixture<::testing::TestWithParam<int32_t>> {
+public:
+    uint32_t compr_len = 0;
+
+    void SetUp() override {
+        uint32_t seed = 12;
+
+        /* Words from a small vocabulary with runs of noise, so that there are
+           both long matches and blocks that end on any bit */
+        ASSERT_TRUE(alloc(INDEX_DATA_SIZE, 32));
+        for (uint32_t i = 0; i < INDEX_DATA_SIZE; i++) {
+            test_rand(&seed);
+            if ((seed >> 28) == 0)
+                source[i] = (uint8_t)(seed >> 16);
+            else
+                source[i] = (uint8_t)"the quick brown fox jumps over a lazy dog\n"[(seed >> 16) % 42];
+        }
+
+        compr_len = compress(6, GetParam(), 8, Z_DEFAULT_STRATEGY, source_len, compr_size);
+    }
+
+    /* Inflates from where a seek to offset left d_stream and compares the
+       data after skipping */
+    void CheckRead(PREFIX3(stream) *d_stream, z_off64_t offset, z_off64_t in_offset, z_off64_t skip,
+                   uint8_t *uncompr) {
+        uint32_t len = (uint32_t)MIN(INDEX_READ_SIZE, INDEX_DATA_SIZE - offset);
+
+        ASSERT_LE(in_offset, compr_len);
+        ASSERT_LE(skip, offset);
+
+        /* Access points are at the first block boundary after each span */
+        EXPECT_LT(skip, INDEX_SPAN * 2);
+
+        d_stream->next_in = compr + in_offset;
+        d_stream->avail_in = compr_len - (uint32_t)in_offset;
+        d_stream->next_out = uncompr;
+        d_stream->avail_out = (uint32_t)skip + len;
+        EXPECT_GE(PREFIX(inflate)(d_stream, Z_NO_FLUSH), Z_OK);
+        EXPECT_EQ(d_stream->avail_out, 0U);
+        EXPECT_EQ(memcmp(uncompr + skip, source + offset, len), 0);
+    }
+};
+
+TEST_P(inflate_index, seek) {
+    PREFIX(inflate_index) *index = NULL;
+    PREFIX3(stream) d_stream;
+    index_in in = { compr, compr_len, 0 };
+    uint8_t *uncompr = (uint8_t *)malloc(INDEX_DATA_SIZE);
+    uint32_t seed = 3;
+
+    ASSERT_TRUE(uncompr != NULL);
+    ASSERT_EQ(PREFIX(inflateIndexBuild)(index_in_func, &in, GetParam(), INDEX_SPAN, &index), Z_OK);
+    ASSERT_TRUE(index != NULL);
+    EXPECT_EQ(PREFIX(inflateIndexLength)(index), INDEX_DATA_SIZE);
+
+    memset(&d_stream, 0, sizeof(d_stream));
+    ASSERT_EQ(PREFIX(inflateInit2)(&d_stream, GetParam()), Z_OK);
+    for (int i = 0; i < 50; i++) {
+        z_off64_t offset, in_offset, skip;
+
+        test_rand(&seed);
+        offset = (i == 0) ? 0 : (i == 1) ? INDEX_DATA_SIZE - 1 : (seed >> 8) % INDEX_DATA_SIZE;
+        ASSERT_EQ(PREFIX(inflateIndexSeek)(&d_stream, index, offset, &in_offset, &skip), Z_OK);
+        CheckRead(&d_stream, offset, in_offset, skip, uncompr);
+    }
+    EXPECT_EQ(PREFIX(inflateEnd)(&d_stream), Z_OK);
+    EXPECT_EQ(PREFIX(inflateIndexFree)(index), Z_OK);
+    free(uncompr);
+}
+
+TEST_P(inflate_index, errors) {
+    PREFIX(inflate_index) *index = NULL;
+    PREFIX3(stream) d_stream;
+    index_in in = { compr, compr_len / 2, 0 };
+    z_off64_t in_offset, skip;
+
+    EXPECT_EQ(PREFIX(inflateIndexBuild)(index_in_func, &in, GetParam(), 0, &index), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(inflateIndexBuild)(index_in_func, &in, GetParam(), INDEX_SPAN, &index), Z_BUF_ERROR);
+    EXPECT_TRUE(index == NULL);
+
+    in.len = compr_len;
+    in.pos = 0;
+    ASSERT_EQ(PREFIX(inflateIndexBuild)(index_in_func, &in, GetParam(), INDEX_SPAN, &index), Z_OK);
+    memset(&d_stream, 0, sizeof(d_stream));
+    ASSERT_EQ(PREFIX(inflateInit2)(&d_stream, GetParam()), Z_OK);
+    EXPECT_EQ(PREFIX(inflateIndexSeek)(&d_stream, index, -1, &in_offset, &skip), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(inflateIndexSeek)(&d_stream, index, INDEX_DATA_SIZE + 1, &in_offset, &skip), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(inflateIndexSeek)(&d_stream, index, INDEX_DATA_SIZE, &in_offset, &skip), Z_OK);
+    EXPECT_EQ(PREFIX(inflateEnd)(&d_stream), Z_OK);
+    EXPECT_EQ(PREFIX(inflateIndexFree)(index), Z_OK);
+    EXPECT_EQ(PREFIX(inflateIndexFree)(NULL), Z_STREAM_ERROR);
+}
+
+/* Seeks with a saved index, both in place and after loading it */
+TEST_P(inflate_index, saved) {
+    PREFIX(inflate_index) *index = NULL, *loaded = NULL;
+    PREFIX3(stream) d_stream;
+    index_in in = { compr, compr_len, 0 };
+    index_out out = { NULL, 0, 0 };
+    uint8_t *uncompr = (uint8_t *)malloc(INDEX_DATA_SIZE);
+    uint32_t seed = 4;
+
+    ASSERT_TRUE(uncompr != NULL);
+    ASSERT_EQ(PREFIX(inflateIndexBuild)(index_in_func, &in, GetParam(), INDEX_SPAN, &index), Z_OK);
+    ASSERT_EQ(PREFIX(inflateIndexSave)(index, index_out_func, &out), Z_OK);
+    EXPECT_EQ(PREFIX(inflateIndexFree)(index), Z_OK);
+
+    /* Smaller than the uncompressed windows of the points there may be */
+    EXPECT_LT(out.len, (size_t)(INDEX_DATA_SIZE / INDEX_SPAN + 1) * 32768);
+
+    ASSERT_EQ(PREFIX(inflateIndexLoad)(out.buf, out.len, &loaded), Z_OK);
+    EXPECT_EQ(PREFIX(inflateIndexLength)(loaded), INDEX_DATA_SIZE);
+
+    memset(&d_stream, 0, sizeof(d_stream));
+    ASSERT_EQ(PREFIX(inflateInit2)(&d_stream, GetParam()), Z_OK);
+    for (int i = 0; i < 50; i++) {
+        z_off64_t offset, in_offset, skip;
+
+        test_rand(&seed);
+        offset = (i == 0) ? 0 : (i == 1) ? INDEX_DATA_SIZE - 1 : (seed >> 8) % INDEX_DATA_SIZE;
+        ASSERT_EQ(PREFIX(inflateIndexSeekSaved)(&d_stream, out.buf, out.len, offset, &in_offset, &skip), Z_OK);
+        CheckRead(&d_stream, offset, in_offset, skip, uncompr);
+        ASSERT_EQ(PREFIX(inflateIndexSeek)(&d_stream, loaded, offset, &in_offset, &skip), Z_OK);
+        CheckRead(&d_stream, offset, in_offset, skip, uncompr);
+    }
+    EXPECT_EQ(PREFIX(inflateIndexFree)(loaded), Z_OK);
+
+    /* Damaged or truncated data is rejected */
+    z_off64_t in_offset, skip;
+    EXPECT_EQ(PREFIX(inflateIndexLoad)(out.buf, out.len - 1, &loaded), Z_DATA_ERROR);
+    EXPECT_EQ(PREFIX(inflateIndexLoad)(out.buf, 31, &loaded), Z_DATA_ERROR);
+    out.buf[40] ^= 1;
+    EXPECT_EQ(PREFIX(inflateIndexLoad)(out.buf, out.len, &loaded), Z_DATA_ERROR);
+    EXPECT_EQ(PREFIX(inflateIndexSeekSaved)(&d_stream, out.buf, out.len, 0, &in_offset, &skip), Z_DATA_ERROR);
+    out.buf[40] ^= 1;
+    out.buf[4] = 2;
+    EXPECT_EQ(PREFIX(inflateIndexLoad)(out.buf, out.len, &loaded), Z_DATA_ERROR);
+    EXPECT_TRUE(loaded == NULL);
+
+    EXPECT_EQ(PREFIX(inflateEnd)(&d_stream), Z_OK);
+    free(out.buf);
+    free(uncompr);
+}
+
+INSTANTIATE_TEST_SUITE_P(inflate_index, inflate_index, testing::Values(-MAX_WBITS, MAX_WBITS, MAX_WBITS + 16));
+
+#if defined(WITH_GZFILEOP) && !defined(NO_GZCOMPRESS)
+/* Two gzip members, so that seeks cross from one into the other */
+TEST(inflate_index_gz, seek) {
+    uint8_t *source = (uint8_t *)malloc(INDEX_DATA_SIZE);
+    uint8_t *uncompr = (uint8_t *)malloc(INDEX_DATA_SIZE);
+    uint32_t seed = 5;
+    gzFile file;
+
+    ASSERT_TRUE(source != NULL && uncompr != NULL);
+    for (uint32_t i = 0; i < INDEX_DATA_SIZE; i++) {
+        test_rand(&seed);
+        source[i] = (uint8_t)"abcdefgh ijklmnop\n"[(seed >> 16) % 18];
+    }
+
+    file = PREFIX(gzopen)(INDEX_TESTFILE, "wb");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source, INDEX_DATA_SIZE / 3), INDEX_DATA_SIZE / 3);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+    file = PREFIX(gzopen)(INDEX_TESTFILE, "ab");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source + INDEX_DATA_SIZE / 3, INDEX_DATA_SIZE - INDEX_DATA_SIZE / 3),
+              INDEX_DATA_SIZE - INDEX_DATA_SIZE / 3);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+    file = PREFIX(gzopen)(INDEX_TESTFILE, "rb");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzbuildindex)(file, 0), -1);
+    EXPECT_EQ(PREFIX(gzbuildindex)(file, INDEX_SPAN), 0);
+    EXPECT_EQ(PREFIX(gztell)(file), 0);
+
+    for (int i = 0; i < 50; i++) {
+        z_off64_t offset;
+        int len;
+
+        test_rand(&seed);
+        offset = (seed >> 8) % INDEX_DATA_SIZE;
+        len = (int)MIN(INDEX_READ_SIZE, INDEX_DATA_SIZE - offset);
+        EXPECT_EQ(PREFIX(gzseek)(file, offset, SEEK_SET), offset);
+        EXPECT_EQ(PREFIX(gzread)(file, uncompr, INDEX_READ_SIZE), len);
+        EXPECT_EQ(memcmp(uncompr, source + offset, len), 0);
+        EXPECT_EQ(PREFIX(gztell)(file), offset + len);
+    }
+
+    /* Read on from the first member into the second one, past its trailer */
+    EXPECT_EQ(PREFIX(gzseek)(file, 1000, SEEK_SET), 1000);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, INDEX_DATA_SIZE), INDEX_DATA_SIZE - 1000);
+    EXPECT_EQ(memcmp(uncompr, source + 1000, INDEX_DATA_SIZE - 1000), 0);
+    EXPECT_EQ(PREFIX(gzeof)(file), 1);
+
+    /* A rewind goes back to gzip decoding, including the check of the trailer */
+    EXPECT_EQ(PREFIX(gzrewind)(file), 0);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, INDEX_DATA_SIZE), INDEX_DATA_SIZE);
+    EXPECT_EQ(memcmp(uncompr, source, INDEX_DATA_SIZE), 0);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+    /* Transparent files need no index */
+    file = PREFIX(gzopen)(INDEX_TESTFILE, "wbT");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source, 1000), 1000);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+    file = PREFIX(gzopen)(INDEX_TESTFILE, "rb");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzbuildindex)(file, INDEX_SPAN), 0);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1000), 1000);
+    EXPECT_EQ(memcmp(uncompr, source, 1000), 0);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+    remove(INDEX_TESTFILE);
+    free(uncompr);
+    free(source);
+}
+#endif
+#endif
@@ -0,0 +1,130 @@
+/* test_inflate_pairs.cc - Test decoding literal pairs in inflate_fast() */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#define PAIRS_DATA_SIZE (64 * 1024)
+
+typedef struct back_out_s {
+    uint8_t *buf;
+    uint32_t len;
+} back_out;
+
+static uint32_t back_in_func(void *desc, z_const unsigned char **buf) {
+    Z_UNUSED(desc);
+    *buf = NULL;
+    return 0;
+}
+
+static int32_t back_out_func(void *desc, unsigned char *buf, uint32_t len) {
+    back_out *out = (back_out *)desc;
+
+    if (out->len + len > PAIRS_DATA_SIZE)
+        return 1;
+    memcpy(out->buf + out->len, buf, len);
+    out->len += len;
+    return 0;
+}
+
+class inflate_pairs : public compress_fixture<::testing::TestWithParam<int32_t>> {
+public:
+    uint8_t *uncompr = NULL;
+    uint32_t compr_len = 0;
+
+    void SetUp() override {
+        uint32_t seed = 7;
+
+        /* Skewed letter frequencies give short codes that pair up */
+        ASSERT_TRUE(alloc(PAIRS_DATA_SIZE));
+        uncompr = (uint8_t *)malloc(PAIRS_DATA_SIZE);
+        ASSERT_TRUE(uncompr != NULL);
+        for (uint32_t i = 0; i < PAIRS_DATA_SIZE; i++) {
+            test_rand(&seed);
+            source[i] = (uint8_t)"eeeeeeeetttttaaaoinshrdlu \n.,"[(seed >> 16) % 29];
+        }
+
+        compr_len = compress(6, -MAX_WBITS, 8, GetParam(), source_len, compr_size);
+    }
+
+    void TearDown() override {
+        free(uncompr);
+        compress_fixture::TearDown();
+    }
+};
+
+/* Output buffers around the size inflate_fast() needs, so that it stops with
+   few bytes left after both single literals and pairs */
+TEST_P(inflate_pairs, small_output) {
+    for (uint32_t out_size = 255; out_size < 270; out_size++) {
+        PREFIX3(stream) d_stream;
+        int32_t err = Z_OK;
+
+        memset(&d_stream, 0, sizeof(d_stream));
+        ASSERT_EQ(PREFIX(inflateInit2)(&d_stream, -MAX_WBITS), Z_OK);
+        d_stream.next_in = compr;
+        d_stream.avail_in = compr_len;
+        d_stream.next_out = uncompr;
+        while (err == Z_OK) {
+            d_stream.avail_out = MIN(out_size, PAIRS_DATA_SIZE - (uint32_t)d_stream.total_out);
+            err = PREFIX(inflate)(&d_stream, Z_NO_FLUSH);
+        }
+        EXPECT_EQ(err, Z_STREAM_END);
+        EXPECT_EQ(d_stream.total_out, PAIRS_DATA_SIZE);
+        EXPECT_EQ(memcmp(uncompr, source, PAIRS_DATA_SIZE), 0);
+        EXPECT_EQ(PREFIX(inflateEnd)(&d_stream), Z_OK);
+    }
+}
+
+/* The copy must decode with its own pair table */
+TEST_P(inflate_pairs, copy) {
+    PREFIX3(stream) d_stream, d_copy;
+
+    memset(&d_stream, 0, sizeof(d_stream));
+    ASSERT_EQ(PREFIX(inflateInit2)(&d_stream, -MAX_WBITS), Z_OK);
+    d_stream.next_in = compr;
+    d_stream.avail_in = compr_len / 2;
+    d_stream.next_out = uncompr;
+    d_stream.avail_out = PAIRS_DATA_SIZE;
+    EXPECT_EQ(PREFIX(inflate)(&d_stream, Z_NO_FLUSH), Z_OK);
+    EXPECT_EQ(PREFIX(inflateCopy)(&d_copy, &d_stream), Z_OK);
+    EXPECT_EQ(PREFIX(inflateEnd)(&d_stream), Z_OK);
+
+    d_copy.avail_in = compr_len - compr_len / 2;
+    EXPECT_EQ(PREFIX(inflate)(&d_copy, Z_NO_FLUSH), Z_STREAM_END);
+    EXPECT_EQ(d_copy.total_out, PAIRS_DATA_SIZE);
+    EXPECT_EQ(memcmp(uncompr, source, PAIRS_DATA_SIZE), 0);
+    EXPECT_EQ(PREFIX(inflateEnd)(&d_copy), Z_OK);
+}
+
+/* inflateBack() writes to the window, where pairs are not used */
+TEST_P(inflate_pairs, back) {
+    PREFIX3(stream) d_stream;
+    uint8_t *window = (uint8_t *)malloc(1 << MAX_WBITS);
+    back_out out = { uncompr, 0 };
+
+    ASSERT_TRUE(window != NULL);
+    memset(&d_stream, 0, sizeof(d_stream));
+    ASSERT_EQ(PREFIX(inflateBackInit)(&d_stream, MAX_WBITS, window), Z_OK);
+    d_stream.next_in = compr;
+    d_stream.avail_in = compr_len;
+    EXPECT_EQ(PREFIX(inflateBack)(&d_stream, back_in_func, NULL, back_out_func, &out), Z_STREAM_END);
+    EXPECT_EQ(out.len, PAIRS_DATA_SIZE);
+    EXPECT_EQ(memcmp(uncompr, source, PAIRS_DATA_SIZE), 0);
+    EXPECT_EQ(PREFIX(inflateBackEnd)(&d_stream), Z_OK);
+    free(window);
+}
+
+INSTANTIATE_TEST_SUITE_P(inflate_pairs, inflate_pairs, testing::Values(Z_DEFAULT_STRATEGY, Z_HUFFMAN_ONLY));
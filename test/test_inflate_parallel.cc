@@ -0,0 +1,314 @@
+/* test_inflate_parallel.cc - Test speculative and segmented parallel decompression */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#ifndef ZLIB_COMPAT
+#define PARALLEL_DATA_SIZE (1024 * 1024)
+#define PARALLEL_CHUNK     4096
+#define PARALLEL_TESTFILE  "foo_parallel.gz"
+
+/* Words from a small vocabulary with runs of noise, so that blocks end on any
+   bit and matches reach back across chunk boundaries */
+static void parallel_source(uint8_t *source, uint32_t seed) {
+    for (uint32_t i = 0; i < PARALLEL_DATA_SIZE; i++) {
+        test_rand(&seed);
+        if ((seed >> 28) == 0)
+            source[i] = (uint8_t)(seed >> 16);
+        else
+            source[i] = (uint8_t)"the quick brown fox jumps over a lazy dog\n"[(seed >> 16) % 42];
+    }
+}
+
+class inflate_parallel : public compress_fixture<::testing::TestWithParam<int32_t>> {
+public:
+    uint8_t *uncompr = NULL;
+    size_t compr_len = 0;
+
+    void SetUp() override {
+        /* Room for trailing data after the stream */
+        ASSERT_TRUE(alloc(PARALLEL_DATA_SIZE, 32));
+        uncompr = (uint8_t *)malloc(PARALLEL_DATA_SIZE);
+        ASSERT_TRUE(uncompr != NULL);
+        parallel_source(source, 12);
+    }
+
+    void TearDown() override {
+        free(uncompr);
+        compress_fixture::TearDown();
+    }
+
+    void Compress(int32_t level, int32_t strategy) {
+        compr_len = compress(level, GetParam(), 8, strategy, source_len, compr_size);
+    }
+
+    /* Flushes with the given flush mode after every interval bytes of input */
+    void CompressFlush(int32_t flush, uint32_t interval) {
+        compr_len = compress_flushed(6, GetParam(), 8, Z_DEFAULT_STRATEGY, interval, flush);
+    }
+
+    void UncompressSegments(int32_t threads, size_t segment_size) {
+        size_t uncompr_len = PARALLEL_DATA_SIZE;
+        size_t in_len = compr_len + 16;
+
+        memset(compr + compr_len, 0x55, 16);
+        memset(uncompr, 0, PARALLEL_DATA_SIZE);
+        EXPECT_EQ(PREFIX(uncompressSegments)(uncompr, &uncompr_len, compr, &in_len, WindowBits(), threads,
+                  segment_size), Z_OK);
+        EXPECT_EQ(uncompr_len, PARALLEL_DATA_SIZE);
+        EXPECT_EQ(in_len, compr_len);
+        EXPECT_EQ(memcmp(uncompr, source, PARALLEL_DATA_SIZE), 0);
+    }
+
+    /* Automatic header detection for zlib and gzip */
+    int32_t WindowBits() {
+        return GetParam() < 0 ? GetParam() : MAX_WBITS + 32;
+    }
+};
+
+TEST_P(inflate_parallel, round_trip) {
+    static const int32_t settings[][2] = {
+        {1, Z_DEFAULT_STRATEGY}, {6, Z_DEFAULT_STRATEGY}, {9, Z_DEFAULT_STRATEGY},
+        {6, Z_FIXED}, {6, Z_HUFFMAN_ONLY}, {0, Z_DEFAULT_STRATEGY}
+    };
+
+    for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+        Compress(settings[i][0], settings[i][1]);
+        for (int32_t threads = 1; threads <= 8; threads *= 2) {
+            size_t uncompr_len = PARALLEL_DATA_SIZE;
+            size_t in_len = compr_len;
+
+            memset(uncompr, 0, PARALLEL_DATA_SIZE);
+            EXPECT_EQ(PREFIX(uncompressParallel)(uncompr, &uncompr_len, compr, &in_len, WindowBits(), threads,
+                      PARALLEL_CHUNK), Z_OK);
+            EXPECT_EQ(uncompr_len, PARALLEL_DATA_SIZE);
+            EXPECT_EQ(in_len, compr_len);
+            EXPECT_EQ(memcmp(uncompr, source, PARALLEL_DATA_SIZE), 0);
+        }
+    }
+}
+
+TEST_P(inflate_parallel, trailing_data) {
+    size_t uncompr_len = PARALLEL_DATA_SIZE;
+    size_t in_len;
+
+    Compress(6, Z_DEFAULT_STRATEGY);
+    memset(compr + compr_len, 0x55, 32);
+    in_len = compr_len + 32;
+    EXPECT_EQ(PREFIX(uncompressParallel)(uncompr, &uncompr_len, compr, &in_len, WindowBits(), 4, 0), Z_OK);
+    EXPECT_EQ(uncompr_len, PARALLEL_DATA_SIZE);
+    EXPECT_EQ(in_len, compr_len);
+    EXPECT_EQ(memcmp(uncompr, source, PARALLEL_DATA_SIZE), 0);
+}
+
+TEST_P(inflate_parallel, errors) {
+    size_t uncompr_len, in_len;
+
+    Compress(6, Z_DEFAULT_STRATEGY);
+
+    /* Truncated input */
+    uncompr_len = PARALLEL_DATA_SIZE;
+    in_len = compr_len - 10;
+    EXPECT_EQ(PREFIX(uncompressParallel)(uncompr, &uncompr_len, compr, &in_len, WindowBits(), 4,
+              PARALLEL_CHUNK), Z_DATA_ERROR);
+
+    /* Output buffer too small */
+    uncompr_len = PARALLEL_DATA_SIZE - 1;
+    in_len = compr_len;
+    EXPECT_EQ(PREFIX(uncompressParallel)(uncompr, &uncompr_len, compr, &in_len, WindowBits(), 4,
+              PARALLEL_CHUNK), Z_BUF_ERROR);
+    EXPECT_EQ(uncompr_len, PARALLEL_DATA_SIZE - 1);
+    EXPECT_EQ(memcmp(uncompr, source, PARALLEL_DATA_SIZE - 1), 0);
+
+    uncompr_len = PARALLEL_DATA_SIZE;
+    in_len = compr_len;
+    EXPECT_EQ(PREFIX(uncompressParallel)(uncompr, &uncompr_len, compr, &in_len, WindowBits(), -1,
+              PARALLEL_CHUNK), Z_STREAM_ERROR);
+
+    /* Wrong check value in the trailer */
+    if (GetParam() > 0) {
+        compr[compr_len - 1] ^= 1;
+        uncompr_len = PARALLEL_DATA_SIZE;
+        in_len = compr_len;
+        EXPECT_EQ(PREFIX(uncompressParallel)(uncompr, &uncompr_len, compr, &in_len, WindowBits(), 4,
+                  PARALLEL_CHUNK), Z_DATA_ERROR);
+    }
+}
+
+TEST_P(inflate_parallel, segments) {
+    /* Full flush points every 64K of input */
+    CompressFlush(Z_FULL_FLUSH, 65536);
+    for (int32_t threads = 1; threads <= 8; threads *= 2) {
+        UncompressSegments(threads, PARALLEL_CHUNK);
+        UncompressSegments(threads, 0);
+    }
+
+    /* Sync flushes look the same but keep the history, so these fall back to inflating sequentially */
+    CompressFlush(Z_SYNC_FLUSH, 65536);
+    UncompressSegments(4, PARALLEL_CHUNK);
+
+    /* Full and sync flushes mixed */
+    {
+        PREFIX3(stream) c_stream;
+
+        memset(&c_stream, 0, sizeof(c_stream));
+        ASSERT_EQ(PREFIX(deflateInit2)(&c_stream, 6, Z_DEFLATED, GetParam(), 8, Z_DEFAULT_STRATEGY), Z_OK);
+        c_stream.next_in = source;
+        c_stream.next_out = compr;
+        c_stream.avail_out = (uint32_t)compr_size;
+        for (uint32_t pos = 0, i = 0; pos < PARALLEL_DATA_SIZE; pos += 32768, i++) {
+            c_stream.avail_in = 32768;
+            EXPECT_EQ(PREFIX(deflate)(&c_stream, i % 3 ? Z_SYNC_FLUSH : Z_FULL_FLUSH), Z_OK);
+        }
+        EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_FINISH), Z_STREAM_END);
+        compr_len = (size_t)c_stream.total_out;
+        EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+    }
+    UncompressSegments(4, PARALLEL_CHUNK);
+
+    /* No flush points at all */
+    Compress(6, Z_DEFAULT_STRATEGY);
+    UncompressSegments(4, PARALLEL_CHUNK);
+    Compress(1, Z_DEFAULT_STRATEGY);
+    UncompressSegments(2, 0);
+}
+
+TEST_P(inflate_parallel, segments_errors) {
+    size_t uncompr_len, in_len;
+
+    CompressFlush(Z_FULL_FLUSH, 65536);
+
+    /* Truncated input */
+    uncompr_len = PARALLEL_DATA_SIZE;
+    in_len = compr_len - 10;
+    EXPECT_EQ(PREFIX(uncompressSegments)(uncompr, &uncompr_len, compr, &in_len, WindowBits(), 4,
+              PARALLEL_CHUNK), Z_DATA_ERROR);
+
+    /* Output buffer too small, in a segment inflated in parallel and in one inflated sequentially */
+    uncompr_len = PARALLEL_DATA_SIZE - 1;
+    in_len = compr_len;
+    EXPECT_EQ(PREFIX(uncompressSegments)(uncompr, &uncompr_len, compr, &in_len, WindowBits(), 4,
+              PARALLEL_CHUNK), Z_BUF_ERROR);
+    CompressFlush(Z_SYNC_FLUSH, 65536);
+    uncompr_len = PARALLEL_DATA_SIZE - 1;
+    in_len = compr_len;
+    EXPECT_EQ(PREFIX(uncompressSegments)(uncompr, &uncompr_len, compr, &in_len, WindowBits(), 4,
+              PARALLEL_CHUNK), Z_BUF_ERROR);
+
+    uncompr_len = PARALLEL_DATA_SIZE;
+    in_len = compr_len;
+    EXPECT_EQ(PREFIX(uncompressSegments)(uncompr, &uncompr_len, compr, &in_len, WindowBits(), -1,
+              PARALLEL_CHUNK), Z_STREAM_ERROR);
+
+    /* Wrong check value in the trailer */
+    if (GetParam() > 0) {
+        CompressFlush(Z_FULL_FLUSH, 65536);
+        compr[compr_len - 1] ^= 1;
+        uncompr_len = PARALLEL_DATA_SIZE;
+        in_len = compr_len;
+        EXPECT_EQ(PREFIX(uncompressSegments)(uncompr, &uncompr_len, compr, &in_len, WindowBits(), 4,
+                  PARALLEL_CHUNK), Z_DATA_ERROR);
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(inflate_parallel, inflate_parallel, testing::Values(-MAX_WBITS, MAX_WBITS, MAX_WBITS + 16));
+
+#if defined(WITH_GZFILEOP) && !defined(NO_GZCOMPRESS)
+/* Two gzip members read with parallel inflate, in small and large reads */
+TEST(inflate_parallel_gz, read) {
+    uint8_t *source = (uint8_t *)malloc(PARALLEL_DATA_SIZE);
+    uint8_t *uncompr = (uint8_t *)malloc(PARALLEL_DATA_SIZE);
+    uint32_t half = PARALLEL_DATA_SIZE / 2;
+    gzFile file;
+
+    ASSERT_TRUE(source != NULL && uncompr != NULL);
+    parallel_source(source, 5);
+
+    file = PREFIX(gzopen)(PARALLEL_TESTFILE, "wb");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source, half), (int)half);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+    file = PREFIX(gzopen)(PARALLEL_TESTFILE, "ab");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source + half, PARALLEL_DATA_SIZE - half), (int)(PARALLEL_DATA_SIZE - half));
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+    file = PREFIX(gzopen)(PARALLEL_TESTFILE, "rbP4");
+    ASSERT_TRUE(file != NULL);
+    for (uint32_t pos = 0; pos < PARALLEL_DATA_SIZE; pos += 1000) {
+        int len = (int)MIN(1000, PARALLEL_DATA_SIZE - pos);
+        EXPECT_EQ(PREFIX(gzread)(file, uncompr + pos, 1000), len);
+    }
+    EXPECT_EQ(memcmp(uncompr, source, PARALLEL_DATA_SIZE), 0);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, 1), 0);
+    EXPECT_EQ(PREFIX(gzeof)(file), 1);
+
+    EXPECT_EQ(PREFIX(gzseek)(file, 1000, SEEK_SET), 1000);
+    memset(uncompr, 0, PARALLEL_DATA_SIZE);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, PARALLEL_DATA_SIZE), PARALLEL_DATA_SIZE - 1000);
+    EXPECT_EQ(memcmp(uncompr, source + 1000, PARALLEL_DATA_SIZE - 1000), 0);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+    /* One thread per processor */
+    file = PREFIX(gzopen)(PARALLEL_TESTFILE, "rbP");
+    ASSERT_TRUE(file != NULL);
+    memset(uncompr, 0, PARALLEL_DATA_SIZE);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, PARALLEL_DATA_SIZE), PARALLEL_DATA_SIZE);
+    EXPECT_EQ(memcmp(uncompr, source, PARALLEL_DATA_SIZE), 0);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+    /* More threads than fit in a batch at the default chunk size */
+    file = PREFIX(gzopen)(PARALLEL_TESTFILE, "rbP64");
+    ASSERT_TRUE(file != NULL);
+    memset(uncompr, 0, PARALLEL_DATA_SIZE);
+    EXPECT_EQ(PREFIX(gzread)(file, uncompr, PARALLEL_DATA_SIZE), PARALLEL_DATA_SIZE);
+    EXPECT_EQ(memcmp(uncompr, source, PARALLEL_DATA_SIZE), 0);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+
+    /* A truncated file is reported like without threads */
+    file = PREFIX(gzopen)(PARALLEL_TESTFILE, "wb");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(PREFIX(gzwrite)(file, source, half), (int)half);
+    EXPECT_EQ(PREFIX(gzclose)(file), Z_OK);
+    {
+        FILE *f = fopen(PARALLEL_TESTFILE, "rb");
+        uint8_t *compr = (uint8_t *)malloc(PARALLEL_DATA_SIZE);
+        size_t len;
+        int err;
+
+        ASSERT_TRUE(f != NULL && compr != NULL);
+        len = fread(compr, 1, PARALLEL_DATA_SIZE, f);
+        fclose(f);
+        f = fopen(PARALLEL_TESTFILE, "wb");
+        ASSERT_TRUE(f != NULL);
+        EXPECT_EQ(fwrite(compr, 1, len - 6, f), len - 6);
+        fclose(f);
+        free(compr);
+
+        file = PREFIX(gzopen)(PARALLEL_TESTFILE, "rbP2");
+        ASSERT_TRUE(file != NULL);
+        EXPECT_EQ(PREFIX(gzread)(file, uncompr, PARALLEL_DATA_SIZE), (int)half);
+        PREFIX(gzerror)(file, &err);
+        EXPECT_EQ(err, Z_BUF_ERROR);
+        EXPECT_EQ(PREFIX(gzclose)(file), Z_BUF_ERROR);
+    }
+
+    remove(PARALLEL_TESTFILE);
+    free(uncompr);
+    free(source);
+}
+#endif
+#endif
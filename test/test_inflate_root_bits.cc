@@ -0,0 +1,104 @@
+/* test_inflate_root_bits.cc - Test inflate with each supported root table size */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inftrees.h"
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#ifndef ZLIB_COMPAT
+#define ROOT_DATA_SIZE (128 * 1024)
+
+class inflate_root_bits : public compress_fixture<> {
+public:
+    uint8_t *uncompr = NULL;
+    uint32_t compr_len = 0;
+
+    void SetUp() override {
+        uint32_t seed = 11;
+
+        /* Roughly geometric byte frequencies give literal codes of all lengths,
+           including the ones longer than the root table */
+        ASSERT_TRUE(alloc(ROOT_DATA_SIZE));
+        uncompr = (uint8_t *)malloc(ROOT_DATA_SIZE);
+        ASSERT_TRUE(uncompr != NULL);
+        for (uint32_t i = 0; i < ROOT_DATA_SIZE; i++) {
+            uint8_t c = 0;
+            test_rand(&seed);
+            while (c < 255 && (seed >> (8 + c % 16)) & 1)
+                c++;
+            if (c == 16)
+                c = (uint8_t)(seed >> 24);
+            source[i] = c;
+        }
+
+        compr_len = compress(6, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY, source_len, compr_size);
+    }
+
+    void TearDown() override {
+        free(uncompr);
+        compress_fixture::TearDown();
+    }
+
+    /* Inflates in chunks of out_size bytes, changing the root bits to
+       next_bits halfway */
+    void Check(int32_t bits, int32_t next_bits, uint32_t out_size) {
+        PREFIX3(stream) d_stream;
+        int32_t err = Z_OK;
+
+        memset(&d_stream, 0, sizeof(d_stream));
+        ASSERT_EQ(PREFIX(inflateInit2)(&d_stream, -MAX_WBITS), Z_OK);
+        ASSERT_EQ(PREFIX(inflateRootBits)(&d_stream, bits), Z_OK);
+        d_stream.next_in = compr;
+        d_stream.avail_in = compr_len;
+        d_stream.next_out = uncompr;
+        while (err == Z_OK) {
+            if (d_stream.total_out >= ROOT_DATA_SIZE / 2) {
+                EXPECT_EQ(PREFIX(inflateRootBits)(&d_stream, next_bits), Z_OK);
+            }
+            d_stream.avail_out = MIN(out_size, ROOT_DATA_SIZE - (uint32_t)d_stream.total_out);
+            err = PREFIX(inflate)(&d_stream, Z_NO_FLUSH);
+            EXPECT_LE(PREFIX(inflateCodesUsed)(&d_stream), (unsigned long)ENOUGH);
+        }
+        EXPECT_EQ(err, Z_STREAM_END);
+        EXPECT_EQ(d_stream.total_out, ROOT_DATA_SIZE);
+        EXPECT_EQ(memcmp(uncompr, source, ROOT_DATA_SIZE), 0);
+        EXPECT_EQ(PREFIX(inflateEnd)(&d_stream), Z_OK);
+    }
+};
+
+TEST_F(inflate_root_bits, round_trip) {
+    for (int32_t bits = INFLATE_MIN_ROOT_BITS; bits <= INFLATE_MAX_ROOT_BITS; bits++) {
+        Check(bits, bits, ROOT_DATA_SIZE);
+        Check(bits, bits, 300);
+    }
+}
+
+TEST_F(inflate_root_bits, change) {
+    Check(INFLATE_MIN_ROOT_BITS, INFLATE_MAX_ROOT_BITS, 4096);
+    Check(INFLATE_MAX_ROOT_BITS, INFLATE_MIN_ROOT_BITS, 4096);
+}
+
+TEST_F(inflate_root_bits, invalid) {
+    PREFIX3(stream) d_stream;
+
+    memset(&d_stream, 0, sizeof(d_stream));
+    EXPECT_EQ(PREFIX(inflateRootBits)(&d_stream, INFLATE_MAX_ROOT_BITS), Z_STREAM_ERROR);
+    ASSERT_EQ(PREFIX(inflateInit2)(&d_stream, -MAX_WBITS), Z_OK);
+    EXPECT_EQ(PREFIX(inflateRootBits)(&d_stream, INFLATE_MIN_ROOT_BITS - 1), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(inflateRootBits)(&d_stream, INFLATE_MAX_ROOT_BITS + 1), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(inflateEnd)(&d_stream), Z_OK);
+}
+#endif
@@ -21,6 +21,6 @@ extern "C" {
 GTEST_API_ int main(int argc, const char **argv) {
   printf("Running main() from %s\n", __FILE__);
   cpu_check_features(&test_cpu_features);
-  testing::InitGoogleTest(&argc, argv);
+  testing::InitGoogleTest(&argc, const_cast<char **>(argv));
   return RUN_ALL_TESTS();
 }
@@ -1,6 +1,9 @@
 #ifndef TEST_SHARED_NG_H
 #define TEST_SHARED_NG_H
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "test_shared.h"
 
 /* Test definitions that can only be used in the zlib-ng build environment. */
@@ -20,4 +23,125 @@ static inline int deflate_prime_32(PREFIX3(stream) *stream, uint32_t value) {
     return err;
 }
 
+/* Linear congruential generator for test data that is the same on every platform */
+static inline uint32_t test_rand(uint32_t *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed;
+}
+
+/* Inflates compr_len bytes of compressed data with the given windowBits. Returns Z_OK if they
+ * decompress to exactly the len bytes of data, Z_DATA_ERROR if to anything else, or the error
+ * of inflateInit2 or inflate. */
+static inline int32_t inflate_check(const uint8_t *compr, size_t compr_len, const uint8_t *data, size_t len,
+                                    int32_t window_bits) {
+    PREFIX3(stream) strm;
+    uint8_t *uncompr = (uint8_t *)malloc(len + 1);
+    int32_t err;
+
+    if (uncompr == NULL)
+        return Z_MEM_ERROR;
+    memset(&strm, 0, sizeof(strm));
+    err = PREFIX(inflateInit2)(&strm, window_bits);
+    if (err == Z_OK) {
+        strm.next_in = (z_const unsigned char *)compr;
+        strm.avail_in = (uint32_t)compr_len;
+        strm.next_out = uncompr;
+        strm.avail_out = (uint32_t)len + 1;
+
+        err = PREFIX(inflate)(&strm, Z_FINISH);
+        if (err == Z_STREAM_END)
+            err = strm.avail_in == 0 && strm.total_out == len && memcmp(uncompr, data, len) == 0 ? Z_OK : Z_DATA_ERROR;
+        else if (err == Z_OK || err == Z_BUF_ERROR)
+            err = Z_DATA_ERROR;
+        PREFIX(inflateEnd)(&strm);
+    }
+    free(uncompr);
+    return err;
+}
+
+#ifdef __cplusplus
+#include <gtest/gtest.h>
+
+/* Fixture for tests that compress source_len bytes of test data from source into compr.
+ * The tests allocate both buffers with alloc() and fill source in their SetUp(). */
+template <typename T = ::testing::Test>
+class compress_fixture : public T {
+public:
+    uint8_t *source = NULL;
+    uint32_t source_len = 0;
+    uint8_t *compr = NULL;
+    uint32_t compr_size = 0;
+
+    /* Allocates len bytes of source, and compr with room for them compressed plus extra bytes */
+    bool alloc(uint32_t len, uint32_t extra = 0) {
+        source_len = len;
+        source = (uint8_t *)malloc(len);
+        compr_size = (uint32_t)PREFIX(deflateBound)(NULL, len) + extra;
+        compr = (uint8_t *)malloc(compr_size);
+        return source != NULL && compr != NULL;
+    }
+
+    void TearDown() override {
+        free(compr);
+        free(source);
+    }
+
+    /* Compresses len bytes of source with a new stream, providing output space in pieces of chunk bytes */
+    uint32_t compress(int32_t level, int32_t window_bits, int32_t mem_level, int32_t strategy, uint32_t len,
+                      uint32_t chunk) {
+        PREFIX3(stream) c_stream;
+        int32_t err;
+
+        memset(&c_stream, 0, sizeof(c_stream));
+        err = PREFIX(deflateInit2)(&c_stream, level, Z_DEFLATED, window_bits, mem_level, strategy);
+        EXPECT_EQ(err, Z_OK);
+
+        c_stream.next_in = source;
+        c_stream.avail_in = len;
+        c_stream.next_out = compr;
+
+        do {
+            c_stream.avail_out = MIN(chunk, compr_size - (uint32_t)c_stream.total_out);
+            err = PREFIX(deflate)(&c_stream, Z_FINISH);
+        } while (err == Z_OK);
+        EXPECT_EQ(err, Z_STREAM_END);
+
+        EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+        return (uint32_t)c_stream.total_out;
+    }
+
+    /* Compresses len bytes of in into out with strm, giving deflate() the input in pieces of chunk
+     * bytes and flushing with flush after each of them */
+    uint32_t deflate_flushed(PREFIX3(stream) *strm, const uint8_t *in, uint32_t len, uint8_t *out, uint32_t chunk,
+                             int32_t flush) {
+        int32_t err = Z_OK;
+
+        strm->next_in = (z_const unsigned char *)in;
+        strm->next_out = out;
+        strm->avail_out = compr_size;
+        for (uint32_t pos = 0; pos < len && err == Z_OK; pos += chunk) {
+            strm->avail_in = MIN(chunk, len - pos);
+            err = PREFIX(deflate)(strm, flush);
+            EXPECT_EQ(err, Z_OK);
+            EXPECT_EQ(strm->avail_in, 0);
+        }
+        EXPECT_EQ(PREFIX(deflate)(strm, Z_FINISH), Z_STREAM_END);
+        return (uint32_t)strm->total_out;
+    }
+
+    /* Compresses source with a new stream the way deflate_flushed() does */
+    uint32_t compress_flushed(int32_t level, int32_t window_bits, int32_t mem_level, int32_t strategy,
+                              uint32_t chunk, int32_t flush) {
+        PREFIX3(stream) c_stream;
+        uint32_t compr_len;
+
+        memset(&c_stream, 0, sizeof(c_stream));
+        EXPECT_EQ(PREFIX(deflateInit2)(&c_stream, level, Z_DEFLATED, window_bits, mem_level, strategy), Z_OK);
+        compr_len = deflate_flushed(&c_stream, source, source_len, compr, chunk, flush);
+        EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+        return compr_len;
+    }
+};
+#endif
+
 #endif
@@ -0,0 +1,190 @@
+/* test_state_pool.cc - Test deflate and inflate state pools */
+
+#include "zbuild.h"
+#ifdef ZLIB_COMPAT
+#  include "zlib.h"
+#else
+#  include "zlib-ng.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WITH_THREADS
+#  include <thread>
+#endif
+
+#include <gtest/gtest.h>
+
+#include "test_shared_ng.h"
+
+#ifndef ZLIB_COMPAT
+#define POOL_DATA_SIZE 4000
+
+/* Counts the calls, streams taking their state from a pool must not make any */
+static void *count_alloc(void *opaque, unsigned items, unsigned size) {
+    (*(int32_t *)opaque)++;
+    return calloc(items, size);
+}
+
+static void count_free(void *opaque, void *ptr) {
+    (*(int32_t *)opaque)++;
+    free(ptr);
+}
+
+static void make_data(uint8_t *buf, uint32_t len, uint32_t seed) {
+    for (uint32_t i = 0; i < len; i++) {
+        test_rand(&seed);
+        buf[i] = (uint8_t)"pool of states\n"[(seed >> 16) % 15];
+    }
+}
+
+/* Compresses and decompresses buf with streams from the pools and returns the states used */
+static void round_trip(zng_deflate_pool *dpool, zng_inflate_pool *ipool, int32_t level, int32_t window_bits,
+                       uint32_t seed, void **dstate, void **istate) {
+    PREFIX3(stream) c_stream, d_stream;
+    uint8_t source[POOL_DATA_SIZE], uncompr[POOL_DATA_SIZE], compr[POOL_DATA_SIZE * 2];
+    int32_t calls = 0;
+
+    make_data(source, sizeof(source), seed);
+
+    memset(&c_stream, 0, sizeof(c_stream));
+    c_stream.zalloc = count_alloc;
+    c_stream.zfree = count_free;
+    c_stream.opaque = &calls;
+    ASSERT_EQ(PREFIX(deflateInitPool)(&c_stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY, dpool), Z_OK);
+    *dstate = c_stream.state;
+    c_stream.next_in = source;
+    c_stream.avail_in = sizeof(source);
+    c_stream.next_out = compr;
+    c_stream.avail_out = sizeof(compr);
+    EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_FINISH), Z_STREAM_END);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_OK);
+
+    memset(&d_stream, 0, sizeof(d_stream));
+    d_stream.zalloc = count_alloc;
+    d_stream.zfree = count_free;
+    d_stream.opaque = &calls;
+    ASSERT_EQ(PREFIX(inflateInitPool)(&d_stream, window_bits, ipool), Z_OK);
+    *istate = d_stream.state;
+    d_stream.next_in = compr;
+    d_stream.avail_in = (uint32_t)c_stream.total_out;
+    d_stream.next_out = uncompr;
+    d_stream.avail_out = sizeof(uncompr);
+    EXPECT_EQ(PREFIX(inflate)(&d_stream, Z_FINISH), Z_STREAM_END);
+    EXPECT_EQ(d_stream.total_out, sizeof(source));
+    EXPECT_EQ(memcmp(uncompr, source, sizeof(source)), 0);
+    EXPECT_EQ(PREFIX(inflateEnd)(&d_stream), Z_OK);
+
+    /* Levels that need no extra tables get all their memory from the pool */
+    if (level < 9) {
+        EXPECT_EQ(calls, 0);
+    }
+}
+
+TEST(state_pool, reuse) {
+    zng_deflate_pool *dpool = PREFIX(deflatePoolCreate)(2);
+    zng_inflate_pool *ipool = PREFIX(inflatePoolCreate)(2);
+    void *dstate, *istate, *dfirst, *ifirst;
+
+    ASSERT_TRUE(dpool != NULL && ipool != NULL);
+    round_trip(dpool, ipool, 6, MAX_WBITS, 1, &dfirst, &ifirst);
+    for (uint32_t i = 0; i < 4; i++) {
+        round_trip(dpool, ipool, 6, MAX_WBITS, i + 2, &dstate, &istate);
+        EXPECT_EQ(dstate, dfirst);
+        EXPECT_EQ(istate, ifirst);
+    }
+
+    /* Other levels below 8, which have no binary trees, keep the memory size, other window sizes do not */
+    round_trip(dpool, ipool, 1, MAX_WBITS, 7, &dstate, &istate);
+    EXPECT_EQ(dstate, dfirst);
+    round_trip(dpool, ipool, 3, MAX_WBITS, 8, &dstate, &istate);
+    EXPECT_EQ(dstate, dfirst);
+    round_trip(dpool, ipool, 6, 10, 9, &dstate, &istate);
+    EXPECT_NE(dstate, dfirst);
+    /* Inflate always has room for the largest window */
+    EXPECT_EQ(istate, ifirst);
+    round_trip(dpool, ipool, 6, -MAX_WBITS, 10, &dstate, &istate);
+    round_trip(dpool, ipool, 6, MAX_WBITS + 16, 11, &dstate, &istate);
+
+    EXPECT_EQ(PREFIX(deflatePoolDestroy)(dpool), Z_OK);
+    EXPECT_EQ(PREFIX(inflatePoolDestroy)(ipool), Z_OK);
+}
+
+TEST(state_pool, destroy_in_use) {
+    zng_deflate_pool *dpool = PREFIX(deflatePoolCreate)(4);
+    zng_inflate_pool *ipool = PREFIX(inflatePoolCreate)(4);
+    PREFIX3(stream) c_stream, c_copy, d_stream, d_copy;
+    uint8_t source[POOL_DATA_SIZE], uncompr[POOL_DATA_SIZE], compr[POOL_DATA_SIZE * 2];
+
+    ASSERT_TRUE(dpool != NULL && ipool != NULL);
+    make_data(source, sizeof(source), 5);
+
+    memset(&c_stream, 0, sizeof(c_stream));
+    ASSERT_EQ(PREFIX(deflateInitPool)(&c_stream, 6, Z_DEFLATED, MAX_WBITS, 8, Z_DEFAULT_STRATEGY, dpool), Z_OK);
+    memset(&d_stream, 0, sizeof(d_stream));
+    ASSERT_EQ(PREFIX(inflateInitPool)(&d_stream, MAX_WBITS, ipool), Z_OK);
+
+    /* The streams must outlive the pools */
+    EXPECT_EQ(PREFIX(deflatePoolDestroy)(dpool), Z_OK);
+    EXPECT_EQ(PREFIX(inflatePoolDestroy)(ipool), Z_OK);
+
+    c_stream.next_in = source;
+    c_stream.avail_in = sizeof(source) / 2;
+    c_stream.next_out = compr;
+    c_stream.avail_out = sizeof(compr);
+    EXPECT_EQ(PREFIX(deflate)(&c_stream, Z_NO_FLUSH), Z_OK);
+    EXPECT_EQ(PREFIX(deflateCopy)(&c_copy, &c_stream), Z_OK);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_stream), Z_DATA_ERROR);
+    c_copy.avail_in = sizeof(source) - sizeof(source) / 2;
+    EXPECT_EQ(PREFIX(deflate)(&c_copy, Z_FINISH), Z_STREAM_END);
+    EXPECT_EQ(PREFIX(deflateEnd)(&c_copy), Z_OK);
+
+    d_stream.next_in = compr;
+    d_stream.avail_in = (uint32_t)c_copy.total_out / 2;
+    d_stream.next_out = uncompr;
+    d_stream.avail_out = sizeof(uncompr);
+    EXPECT_EQ(PREFIX(inflate)(&d_stream, Z_NO_FLUSH), Z_OK);
+    EXPECT_EQ(PREFIX(inflateCopy)(&d_copy, &d_stream), Z_OK);
+    EXPECT_EQ(PREFIX(inflateEnd)(&d_stream), Z_OK);
+    d_copy.avail_in = (uint32_t)c_copy.total_out - (uint32_t)c_copy.total_out / 2;
+    EXPECT_EQ(PREFIX(inflate)(&d_copy, Z_FINISH), Z_STREAM_END);
+    EXPECT_EQ(d_copy.total_out, sizeof(source));
+    EXPECT_EQ(memcmp(uncompr, source, sizeof(source)), 0);
+    EXPECT_EQ(PREFIX(inflateEnd)(&d_copy), Z_OK);
+}
+
+TEST(state_pool, invalid) {
+    PREFIX3(stream) strm;
+
+    memset(&strm, 0, sizeof(strm));
+    EXPECT_EQ(PREFIX(deflateInitPool)(&strm, 6, Z_DEFLATED, MAX_WBITS, 8, Z_DEFAULT_STRATEGY, NULL), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(inflateInitPool)(&strm, MAX_WBITS, NULL), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(deflatePoolDestroy)(NULL), Z_STREAM_ERROR);
+    EXPECT_EQ(PREFIX(inflatePoolDestroy)(NULL), Z_STREAM_ERROR);
+}
+
+#ifdef WITH_THREADS
+TEST(state_pool, threads) {
+    zng_deflate_pool *dpool = PREFIX(deflatePoolCreate)(2);
+    zng_inflate_pool *ipool = PREFIX(inflatePoolCreate)(2);
+    std::thread threads[4];
+
+    ASSERT_TRUE(dpool != NULL && ipool != NULL);
+    for (uint32_t t = 0; t < 4; t++) {
+        threads[t] = std::thread([=]() {
+            void *dstate, *istate;
+
+            for (uint32_t i = 0; i < 32; i++)
+                round_trip(dpool, ipool, (int32_t)(t + 1), MAX_WBITS, t * 32 + i, &dstate, &istate);
+        });
+    }
+    for (uint32_t t = 0; t < 4; t++)
+        threads[t].join();
+
+    EXPECT_EQ(PREFIX(deflatePoolDestroy)(dpool), Z_OK);
+    EXPECT_EQ(PREFIX(inflatePoolDestroy)(ipool), Z_OK);
+}
+#endif
+#endif
@@ -67,14 +67,16 @@ static const static_tree_desc  static_bl_desc =
  */
 
 static void init_block       (deflate_state *s);
-static void pqdownheap       (deflate_state *s, ct_data *tree, int k);
+static void sort_leaves      (deflate_state *s, const ct_data *tree, int count, int *sorted);
 static void gen_bitlen       (deflate_state *s, tree_desc *desc);
 static void build_tree       (deflate_state *s, tree_desc *desc);
 static void scan_tree        (deflate_state *s, ct_data *tree, int max_code);
-static void send_tree        (deflate_state *s, ct_data *tree, int max_code);
+static void send_tree        (deflate_state *s, const ct_data *tree, const ct_data *bl_tree, int max_code);
 static int  build_bl_tree    (deflate_state *s);
-static void send_all_trees   (deflate_state *s, int lcodes, int dcodes, int blcodes);
-static void compress_block   (deflate_state *s, const ct_data *ltree, const ct_data *dtree);
+static void send_all_trees   (deflate_state *s, const ct_data *ltree, const ct_data *dtree, const ct_data *bl_tree,
+                              int lcodes, int dcodes, int blcodes);
+static void compress_block   (deflate_state *s, const ct_data *ltree, const ct_data *dtree,
+                              unsigned sx, unsigned end);
 static int  detect_data_type (deflate_state *s);
 static void bi_flush         (deflate_state *s);
 
@@ -91,6 +93,8 @@ void Z_INTERNAL zng_tr_init(deflate_state *s) {
     s->bl_desc.dyn_tree = s->bl_tree;
     s->bl_desc.stat_desc = &static_bl_desc;
 
+    s->prev_lcodes = 0;
+
     s->bi_buf = 0;
     s->bi_valid = 0;
 #ifdef ZLIB_DEBUG
@@ -121,57 +125,45 @@ static void init_block(deflate_state *s) {
     s->sym_next = s->matches = 0;
 }
 
-#define SMALLEST 1
-/* Index within the heap array of least frequent node in the Huffman tree */
-
-
-/* ===========================================================================
- * Remove the smallest element from the heap and recreate the heap with
- * one less element. Updates heap and heap_len.
- */
-#define pqremove(s, tree, top) \
-{\
-    top = s->heap[SMALLEST]; \
-    s->heap[SMALLEST] = s->heap[s->heap_len--]; \
-    pqdownheap(s, tree, SMALLEST); \
-}
-
-/* ===========================================================================
- * Compares to subtrees, using the tree depth as tie breaker when
- * the subtrees have equal frequency. This minimizes the worst case length.
- */
-#define smaller(tree, n, m, depth) \
-    (tree[n].Freq < tree[m].Freq || \
-    (tree[n].Freq == tree[m].Freq && depth[n] <= depth[m]))
-
 /* ===========================================================================
- * Restore the heap property by moving down the tree starting at node k,
- * exchanging a node with the smallest of its two sons if necessary, stopping
- * when the heap property is re-established (each father smaller than its
- * two sons).
+ * Sort the count leaves in heap[1..count] by increasing frequency into
+ * sorted[], with a radix sort on the two bytes of the frequency. The second
+ * pass is skipped when all the frequencies fit in a byte, which is the usual
+ * case for the distance and bit length trees.
  */
-static void pqdownheap(deflate_state *s, ct_data *tree, int k) {
-    /* tree: the tree to restore */
-    /* k: node to move down */
-    int v = s->heap[k];
-    int j = k << 1;  /* left son of k */
-    while (j <= s->heap_len) {
-        /* Set j to the smallest of the two sons: */
-        if (j < s->heap_len && smaller(tree, s->heap[j+1], s->heap[j], s->depth)) {
-            j++;
+static void sort_leaves(deflate_state *s, const ct_data *tree, int count, int *sorted) {
+    uint16_t bucket[256];
+    uint16_t high = 0;
+    int *from = s->heap + 1;
+    int *to = sorted;
+    int shift, n;
+
+    for (n = 0; n < count; n++)
+        high |= tree[from[n]].Freq;
+
+    for (shift = 0; shift < 16; shift += 8) {
+        unsigned int total = 0;
+
+        if (shift == 8) {
+            if (high < 256)
+                break;
+            /* sort on the high byte what the first pass left in sorted[] */
+            from = sorted;
+            to = s->heap + 1;
         }
-        /* Exit if v is smaller than both sons */
-        if (smaller(tree, v, s->heap[j], s->depth))
-            break;
-
-        /* Exchange v with the smallest son */
-        s->heap[k] = s->heap[j];
-        k = j;
-
-        /* And continue down the tree, setting j to the left son of k */
-        j <<= 1;
+        memset(bucket, 0, sizeof(bucket));
+        for (n = 0; n < count; n++)
+            bucket[(tree[from[n]].Freq >> shift) & 0xff]++;
+        for (n = 0; n < 256; n++) {
+            unsigned int c = bucket[n];
+            bucket[n] = (uint16_t)total;
+            total += c;
+        }
+        for (n = 0; n < count; n++)
+            to[bucket[(tree[from[n]].Freq >> shift) & 0xff]++] = from[n];
     }
-    s->heap[k] = v;
+    if (to != sorted)
+        memcpy(sorted, to, count * sizeof(int));
 }
 
 /* ===========================================================================
@@ -326,13 +318,14 @@ static void build_tree(deflate_state *s, tree_desc *desc) {
     ct_data *tree         = desc->dyn_tree;
     const ct_data *stree  = desc->stat_desc->static_tree;
     int elems             = desc->stat_desc->elems;
-    int n, m;          /* iterate over heap elements */
+    int n, m;          /* iterate over tree elements */
     int max_code = -1; /* largest code with non zero frequency */
     int node;          /* new node being created */
+    int next, leaf, i;
+    int pair[2];
+    int leaves[L_CODES];
 
-    /* Construct the initial heap, with least frequent element in
-     * heap[SMALLEST]. The sons of heap[n] are heap[2*n] and heap[2*n+1].
-     * heap[0] is not used.
+    /* Gather the leaves in heap[1..heap_len]. heap[0] is not used.
      */
     s->heap_len = 0;
     s->heap_max = HEAP_SIZE;
@@ -340,7 +333,6 @@ static void build_tree(deflate_state *s, tree_desc *desc) {
     for (n = 0; n < elems; n++) {
         if (tree[n].Freq != 0) {
             s->heap[++(s->heap_len)] = max_code = n;
-            s->depth[n] = 0;
         } else {
             tree[n].Len = 0;
         }
@@ -354,7 +346,6 @@ static void build_tree(deflate_state *s, tree_desc *desc) {
     while (s->heap_len < 2) {
         node = s->heap[++(s->heap_len)] = (max_code < 2 ? ++max_code : 0);
         tree[node].Freq = 1;
-        s->depth[node] = 0;
         s->opt_len--;
         if (stree)
             s->static_len -= stree[node].Len;
@@ -362,27 +353,31 @@ static void build_tree(deflate_state *s, tree_desc *desc) {
     }
     desc->max_code = max_code;
 
-    /* The elements heap[heap_len/2+1 .. heap_len] are leaves of the tree,
-     * establish sub-heaps of increasing lengths:
-     */
-    for (n = s->heap_len/2; n >= 1; n--)
-        pqdownheap(s, tree, n);
-
     /* Construct the Huffman tree by repeatedly combining the least two
-     * frequent nodes.
+     * frequent nodes. With the leaves sorted, this needs no heap: the new
+     * nodes are created in order of increasing frequency, so the next least
+     * frequent node is either the next leaf or the oldest unused new node.
+     * Leaves are taken first on equal frequencies, which keeps the tree
+     * shallow.
      */
-    node = elems;              /* next internal node of the tree */
+    sort_leaves(s, tree, s->heap_len, leaves);
+    leaf = 0;
+    next = node = elems;       /* next unused and next created internal nodes */
     do {
-        pqremove(s, tree, n);  /* n = node of least frequency */
-        m = s->heap[SMALLEST]; /* m = node of next least frequency */
+        for (i = 0; i < 2; i++) {
+            if (leaf < s->heap_len && (next == node || tree[leaves[leaf]].Freq <= tree[next].Freq))
+                pair[i] = leaves[leaf++];
+            else
+                pair[i] = next++;
+        }
+        n = pair[0];           /* n = node of least frequency */
+        m = pair[1];           /* m = node of next least frequency */
 
         s->heap[--(s->heap_max)] = n; /* keep the nodes sorted by frequency */
         s->heap[--(s->heap_max)] = m;
 
         /* Create a new node father of n and m */
         tree[node].Freq = tree[n].Freq + tree[m].Freq;
-        s->depth[node] = (unsigned char)((s->depth[n] >= s->depth[m] ?
-                                          s->depth[n] : s->depth[m]) + 1);
         tree[n].Dad = tree[m].Dad = (uint16_t)node;
 #ifdef DUMP_BL_TREE
         if (tree == s->bl_tree) {
@@ -390,12 +385,10 @@ static void build_tree(deflate_state *s, tree_desc *desc) {
                     node, tree[node].Freq, n, tree[n].Freq, m, tree[m].Freq);
         }
 #endif
-        /* and insert the new node in the heap */
-        s->heap[SMALLEST] = node++;
-        pqdownheap(s, tree, SMALLEST);
-    } while (s->heap_len >= 2);
+        node++;
+    } while (leaf < s->heap_len || node - next >= 2);
 
-    s->heap[--(s->heap_max)] = s->heap[SMALLEST];
+    s->heap[--(s->heap_max)] = node - 1; /* the root */
 
     /* At this point, the fields freq and dad are set. We can now
      * generate the bit lengths.
@@ -406,6 +399,71 @@ static void build_tree(deflate_state *s, tree_desc *desc) {
     gen_codes((ct_data *)tree, max_code, s->bl_count);
 }
 
+/* ===========================================================================
+ * Store the cost in bits of every code of a tree, including extra bits.
+ * Codes that are absent from the tree are given a cost one bit longer than
+ * the longest code, so that the optimal parser can still choose them.
+ */
+static void symbol_costs(const ct_data *tree, int elems, const int *extra, int base, uint8_t *cost) {
+    unsigned int max_len = 0;
+    int n;
+
+    for (n = 0; n < elems; n++) {
+        if (tree[n].Len > max_len)
+            max_len = tree[n].Len;
+    }
+    max_len = MIN(max_len + 1, MAX_BITS);
+
+    for (n = 0; n < elems; n++) {
+        unsigned int len = tree[n].Len ? tree[n].Len : max_len;
+        if (extra != NULL && n >= base)
+            len += (unsigned int)extra[n - base];
+        cost[n] = (uint8_t)len;
+    }
+}
+
+/* ===========================================================================
+ * Compute the bit cost of each literal/length and distance code as if the
+ * block was encoded with Huffman trees built for the given frequencies, or
+ * with the static trees if lfreq is NULL. The trees of the current block are
+ * left untouched.
+ */
+void Z_INTERNAL zng_tr_symbol_costs(deflate_state *s, const uint16_t *lfreq, const uint16_t *dfreq,
+                                    uint8_t *lcost, uint8_t *dcost) {
+    ct_data ltree[HEAP_SIZE];
+    ct_data dtree[2*D_CODES+1];
+    tree_desc ldesc, ddesc;
+    unsigned long opt_len, static_len;
+    int n;
+
+    if (lfreq == NULL) {
+        symbol_costs(static_ltree, L_CODES, extra_lbits, LITERALS+1, lcost);
+        symbol_costs(static_dtree, D_CODES, extra_dbits, 0, dcost);
+        return;
+    }
+
+    for (n = 0; n < L_CODES; n++)
+        ltree[n].Freq = lfreq[n];
+    for (n = 0; n < D_CODES; n++)
+        dtree[n].Freq = dfreq[n];
+
+    ldesc.dyn_tree = ltree;
+    ldesc.stat_desc = &static_l_desc;
+    ddesc.dyn_tree = dtree;
+    ddesc.stat_desc = &static_d_desc;
+
+    /* build_tree accumulates the block length, which belongs to the current block */
+    opt_len = s->opt_len;
+    static_len = s->static_len;
+    build_tree(s, &ldesc);
+    build_tree(s, &ddesc);
+    s->opt_len = opt_len;
+    s->static_len = static_len;
+
+    symbol_costs(ltree, L_CODES, extra_lbits, LITERALS+1, lcost);
+    symbol_costs(dtree, D_CODES, extra_dbits, 0, dcost);
+}
+
 /* ===========================================================================
  * Scan a literal or distance tree to determine the frequencies of the codes
  * in the bit length tree.
@@ -458,8 +516,8 @@ static void scan_tree(deflate_state *s, ct_data *tree, int max_code) {
  * Send a literal or distance tree in compressed form, using the codes in
  * bl_tree.
  */
-static void send_tree(deflate_state *s, ct_data *tree, int max_code) {
-    /* tree: the tree to be scanned */
+static void send_tree(deflate_state *s, const ct_data *tree, const ct_data *bl_tree, int max_code) {
+    /* tree: the tree to be sent */
     /* max_code and its largest code of non zero frequency */
     int n;                     /* iterates over all tree elements */
     int prevlen = -1;          /* last emitted length */
@@ -484,24 +542,24 @@ static void send_tree(deflate_state *s, ct_data *tree, int max_code) {
             continue;
         } else if (count < min_count) {
             do {
-                send_code(s, curlen, s->bl_tree, bi_buf, bi_valid);
+                send_code(s, curlen, bl_tree, bi_buf, bi_valid);
             } while (--count != 0);
 
         } else if (curlen != 0) {
             if (curlen != prevlen) {
-                send_code(s, curlen, s->bl_tree, bi_buf, bi_valid);
+                send_code(s, curlen, bl_tree, bi_buf, bi_valid);
                 count--;
             }
             Assert(count >= 3 && count <= 6, " 3_6?");
-            send_code(s, REP_3_6, s->bl_tree, bi_buf, bi_valid);
+            send_code(s, REP_3_6, bl_tree, bi_buf, bi_valid);
             send_bits(s, count-3, 2, bi_buf, bi_valid);
 
         } else if (count <= 10) {
-            send_code(s, REPZ_3_10, s->bl_tree, bi_buf, bi_valid);
+            send_code(s, REPZ_3_10, bl_tree, bi_buf, bi_valid);
             send_bits(s, count-3, 3, bi_buf, bi_valid);
 
         } else {
-            send_code(s, REPZ_11_138, s->bl_tree, bi_buf, bi_valid);
+            send_code(s, REPZ_11_138, bl_tree, bi_buf, bi_valid);
             send_bits(s, count-11, 7, bi_buf, bi_valid);
         }
         count = 0;
@@ -557,7 +615,8 @@ static int build_bl_tree(deflate_state *s) {
  * lengths of the bit length codes, the literal tree and the distance tree.
  * IN assertion: lcodes >= 257, dcodes >= 1, blcodes >= 4.
  */
-static void send_all_trees(deflate_state *s, int lcodes, int dcodes, int blcodes) {
+static void send_all_trees(deflate_state *s, const ct_data *ltree, const ct_data *dtree, const ct_data *bl_tree,
+                           int lcodes, int dcodes, int blcodes) {
     int rank;                    /* index in bl_order */
 
     Assert(lcodes >= 257 && dcodes >= 1 && blcodes >= 4, "not enough codes");
@@ -573,7 +632,7 @@ static void send_all_trees(deflate_state *s, int lcodes, int dcodes, int blcodes
     send_bits(s, blcodes-4,  4, bi_buf, bi_valid); /* not -3 as stated in appnote.txt */
     for (rank = 0; rank < blcodes; rank++) {
         Tracev((stderr, "\nbl code %2u ", bl_order[rank]));
-        send_bits(s, s->bl_tree[bl_order[rank]].Len, 3, bi_buf, bi_valid);
+        send_bits(s, bl_tree[bl_order[rank]].Len, 3, bi_buf, bi_valid);
     }
     Tracev((stderr, "\nbl tree: sent %lu", s->bits_sent));
 
@@ -581,10 +640,10 @@ static void send_all_trees(deflate_state *s, int lcodes, int dcodes, int blcodes
     s->bi_buf = bi_buf;
     s->bi_valid = bi_valid;
 
-    send_tree(s, (ct_data *)s->dyn_ltree, lcodes-1); /* literal tree */
+    send_tree(s, ltree, bl_tree, lcodes-1); /* literal tree */
     Tracev((stderr, "\nlit tree: sent %lu", s->bits_sent));
 
-    send_tree(s, (ct_data *)s->dyn_dtree, dcodes-1); /* distance tree */
+    send_tree(s, dtree, bl_tree, dcodes-1); /* distance tree */
     Tracev((stderr, "\ndist tree: sent %lu", s->bits_sent));
 }
 
@@ -628,40 +687,185 @@ void Z_INTERNAL zng_tr_align(deflate_state *s) {
 }
 
 /* ===========================================================================
- * Determine the best encoding for the current block: dynamic trees, static
- * trees or store, and write out the encoded block.
+ * Estimates of the cost of sending data with Huffman trees, without building
+ * the trees: the entropy of the codes, computed with fixed point logarithms,
+ * plus the typical cost of sending the trees themselves.
  */
-void Z_INTERNAL zng_tr_flush_block(deflate_state *s, char *buf, uint32_t stored_len, int last) {
+#define EST_TREE_BITS  72     /* estimated bits of a header and bit length tree */
+#define EST_CODE_BITS  4      /* estimated bits to send the length of a code */
+
+/* Fraction of log2(x) in 1/256 bits, indexed by the 8 bits of x after its leading one */
+static const uint8_t log2_frac[256] = {
+      0,   1,   3,   4,   6,   7,   9,  10,  11,  13,  14,  16,  17,  18,  20,  21,
+     22,  24,  25,  26,  28,  29,  30,  32,  33,  34,  36,  37,  38,  40,  41,  42,
+     44,  45,  46,  47,  49,  50,  51,  52,  54,  55,  56,  57,  59,  60,  61,  62,
+     63,  65,  66,  67,  68,  69,  71,  72,  73,  74,  75,  77,  78,  79,  80,  81,
+     82,  84,  85,  86,  87,  88,  89,  90,  92,  93,  94,  95,  96,  97,  98,  99,
+    100, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111, 112, 113, 114, 116, 117,
+    118, 119, 120, 121, 122, 123, 124, 125, 126, 127, 128, 129, 130, 131, 132, 133,
+    134, 135, 136, 137, 138, 139, 140, 141, 142, 143, 144, 145, 146, 147, 148, 149,
+    150, 151, 152, 153, 154, 155, 155, 156, 157, 158, 159, 160, 161, 162, 163, 164,
+    165, 166, 167, 168, 169, 169, 170, 171, 172, 173, 174, 175, 176, 177, 178, 178,
+    179, 180, 181, 182, 183, 184, 185, 185, 186, 187, 188, 189, 190, 191, 192, 192,
+    193, 194, 195, 196, 197, 198, 198, 199, 200, 201, 202, 203, 203, 204, 205, 206,
+    207, 208, 208, 209, 210, 211, 212, 212, 213, 214, 215, 216, 216, 217, 218, 219,
+    220, 220, 221, 222, 223, 224, 224, 225, 226, 227, 228, 228, 229, 230, 231, 231,
+    232, 233, 234, 234, 235, 236, 237, 238, 238, 239, 240, 241, 241, 242, 243, 244,
+    244, 245, 246, 247, 247, 248, 249, 249, 250, 251, 252, 252, 253, 254, 255, 255
+};
+
+/* ===========================================================================
+ * Return log2(x) in 1/256 bits, for x > 0.
+ */
+static uint32_t fixed_log2(uint32_t x) {
+    uint32_t l, frac;
+
+#if defined(__GNUC__) || defined(__clang__)
+    l = 31 - (uint32_t)__builtin_clz(x);
+#else
+    l = 0;
+    if (x >> 16)
+        l = 16;
+    if (x >> (l + 8))
+        l += 8;
+    if (x >> (l + 4))
+        l += 4;
+    if (x >> (l + 2))
+        l += 2;
+    if (x >> (l + 1))
+        l += 1;
+#endif
+    frac = (x << (31 - l)) >> 23;
+    return (l << 8) + log2_frac[frac & 0xff];
+}
+
+/* ===========================================================================
+ * Tree reuse. The trees of the last dynamic block are kept, and a block that
+ * only uses codes they have is sent with them when that costs at most
+ * 1/REUSE_SLACK more than new trees are expected to. That saves building the
+ * trees and the bit length tree, which is a large part of the work for the
+ * small blocks of streams that are flushed often, such as with Z_SYNC_FLUSH.
+ * A block cannot refer back to earlier trees, so they are sent again as they
+ * were. What new trees would cost is the estimate for the block, scaled by how
+ * far off the estimate was for the last block that got new trees.
+ */
+#define REUSE_SLACK    64
+
+/* ===========================================================================
+ * Add the cost of sending the codes counted in tree with the code lengths of
+ * prev, which has codes codes, to opt_len, and with the code lengths of stree
+ * to static_len. Add the estimate for new trees in 1/256 bits to est. Clear
+ * fits if prev does not have all the codes that are counted.
+ */
+static void reuse_cost(deflate_state *s, const ct_data *tree, const ct_data *prev, int codes, const ct_data *stree,
+                       const int *extra, int base, int elems, uint64_t *est, int *fits) {
+    uint64_t sum = 0;     /* sum of f * log2(f) over the codes */
+    uint32_t total = 0;   /* number of codes */
+    int n;
+
+    for (n = 0; n < elems; n++) {
+        uint32_t f = tree[n].Freq;
+        unsigned xbits;
+        if (f == 0)
+            continue;
+        xbits = n >= base ? (unsigned)extra[n - base] : 0;
+        if (n < codes && prev[n].Len != 0)
+            s->opt_len += (unsigned long)f * (prev[n].Len + xbits);
+        else
+            *fits = 0;
+        s->static_len += (unsigned long)f * (stree[n].Len + xbits);
+        sum += (uint64_t)f * fixed_log2(f);
+        total += f;
+        *est += ((uint64_t)f * xbits << 8) + EST_CODE_BITS * 256;
+    }
+    if (total != 0)
+        *est += (uint64_t)total * fixed_log2(total) - sum;
+}
+
+/* ===========================================================================
+ * Check whether the current block is best sent with the trees of the last
+ * dynamic block. If so, set opt_len and static_len for that and return 1.
+ * Set est to the estimate for new trees either way.
+ * IN assertion: the fields Freq of dyn_ltree and dyn_dtree are set.
+ */
+static int reuse_trees(deflate_state *s, uint64_t *est) {
+    int fits = s->prev_lcodes != 0 && s->strategy != Z_FIXED;
+
+    *est = EST_TREE_BITS * 256;
+    reuse_cost(s, s->dyn_ltree, s->prev_ltree, s->prev_lcodes, static_ltree, extra_lbits, LITERALS+1, L_CODES,
+               est, &fits);
+    reuse_cost(s, s->dyn_dtree, s->prev_dtree, s->prev_dcodes, static_dtree, extra_dbits, 0, D_CODES, est, &fits);
+    if (fits) {
+        uint64_t expect = (*est * s->prev_est_scale) >> 8;
+        fits = ((uint64_t)(s->opt_len + s->prev_tree_len) << 8) <= expect + expect / REUSE_SLACK;
+    }
+    if (!fits) {
+        s->opt_len = s->static_len = 0L;
+        return 0;
+    }
+    s->opt_len += s->prev_tree_len;
+    return 1;
+}
+
+/* ===========================================================================
+ * Keep the trees of a dynamic block that is sent with new trees, for reuse,
+ * along with how its bit length opt_len compares to the estimate est. The
+ * guards that scan_tree() left after the codes are copied too, for
+ * send_tree().
+ */
+static void reuse_keep(deflate_state *s, int lcodes, int dcodes, int blcodes, unsigned long tree_len,
+                       uint64_t est) {
+    memcpy(s->prev_ltree, s->dyn_ltree, (lcodes + 1) * sizeof(ct_data));
+    memcpy(s->prev_dtree, s->dyn_dtree, (dcodes + 1) * sizeof(ct_data));
+    memcpy(s->prev_bl_tree, s->bl_tree, BL_CODES * sizeof(ct_data));
+    s->prev_lcodes = lcodes;
+    s->prev_dcodes = dcodes;
+    s->prev_blcodes = blcodes;
+    s->prev_tree_len = tree_len;
+    s->prev_est_scale = (unsigned int)MIN(((uint64_t)s->opt_len << 16) / est, 4 << 8);
+}
+
+/* ===========================================================================
+ * Determine the best encoding for the symbols from sx up to end: dynamic
+ * trees, static trees or store, and write out the encoded block. The trees
+ * must have the frequencies of those symbols.
+ */
+static void flush_block(deflate_state *s, char *buf, uint32_t stored_len, unsigned sx, unsigned end, int last) {
     /* buf: input block, or NULL if too old */
     /* stored_len: length of input block */
     /* last: one if this is the last block for a file */
     unsigned long opt_lenb, static_lenb; /* opt_len and static_len in bytes */
+    unsigned long data_len = 0;  /* opt_len without the tree representations */
     int max_blindex = 0;  /* index of last bit length code of non zero freq */
+    int reuse = 0;        /* true if sending with the trees of the last dynamic block */
+    uint64_t est = 0;     /* estimated bit length with new trees, in 1/256 bits */
 
     /* Build the Huffman trees unless a stored block is forced */
-    if (UNLIKELY(s->sym_next == 0)) {
+    if (UNLIKELY(sx == end)) {
         /* Emit an empty static tree block with no codes */
         opt_lenb = static_lenb = 0;
         s->static_len = 7;
-    } else if (s->level > 0) {
-        /* Check if the file is binary or text */
-        if (s->strm->data_type == Z_UNKNOWN)
-            s->strm->data_type = detect_data_type(s);
-
-        /* Construct the literal and distance trees */
-        build_tree(s, (tree_desc *)(&(s->l_desc)));
-        Tracev((stderr, "\nlit data: dyn %lu, stat %lu", s->opt_len, s->static_len));
-
-        build_tree(s, (tree_desc *)(&(s->d_desc)));
-        Tracev((stderr, "\ndist data: dyn %lu, stat %lu", s->opt_len, s->static_len));
-        /* At this point, opt_len and static_len are the total bit lengths of
-         * the compressed block data, excluding the tree representations.
-         */
-
-        /* Build the bit length tree for the above two trees, and get the index
-         * in bl_order of the last bit length code to send.
+    } else if (s->level != 0) {
+        /* Construct the literal and distance trees, unless those of the last
+         * dynamic block will do.
          */
-        max_blindex = build_bl_tree(s);
+        reuse = reuse_trees(s, &est);
+        if (!reuse) {
+            build_tree(s, (tree_desc *)(&(s->l_desc)));
+            Tracev((stderr, "\nlit data: dyn %lu, stat %lu", s->opt_len, s->static_len));
+
+            build_tree(s, (tree_desc *)(&(s->d_desc)));
+            Tracev((stderr, "\ndist data: dyn %lu, stat %lu", s->opt_len, s->static_len));
+            /* At this point, opt_len and static_len are the total bit lengths of
+             * the compressed block data, excluding the tree representations.
+             */
+            data_len = s->opt_len;
+
+            /* Build the bit length tree for the above two trees, and get the index
+             * in bl_order of the last bit length code to send.
+             */
+            max_blindex = build_bl_tree(s);
+        }
 
         /* Determine the best encoding. Compute the block lengths in bytes. */
         opt_lenb = (s->opt_len+3+7) >> 3;
@@ -669,7 +873,7 @@ void Z_INTERNAL zng_tr_flush_block(deflate_state *s, char *buf, uint32_t stored_
 
         Tracev((stderr, "\nopt %lu(%lu) stat %lu(%lu) stored %u lit %u ",
                 opt_lenb, s->opt_len, static_lenb, s->static_len, stored_len,
-                s->sym_next / 3));
+                (end - sx) / 3));
 
         if (static_lenb <= opt_lenb || s->strategy == Z_FIXED)
             opt_lenb = static_lenb;
@@ -691,18 +895,249 @@ void Z_INTERNAL zng_tr_flush_block(deflate_state *s, char *buf, uint32_t stored_
 
     } else if (static_lenb == opt_lenb) {
         zng_tr_emit_tree(s, STATIC_TREES, last);
-        compress_block(s, (const ct_data *)static_ltree, (const ct_data *)static_dtree);
+        compress_block(s, (const ct_data *)static_ltree, (const ct_data *)static_dtree, sx, end);
         cmpr_bits_add(s, s->static_len);
+    } else if (reuse) {
+        zng_tr_emit_tree(s, DYN_TREES, last);
+        send_all_trees(s, (const ct_data *)s->prev_ltree, (const ct_data *)s->prev_dtree,
+                       (const ct_data *)s->prev_bl_tree, s->prev_lcodes, s->prev_dcodes, s->prev_blcodes);
+        compress_block(s, (const ct_data *)s->prev_ltree, (const ct_data *)s->prev_dtree, sx, end);
+        cmpr_bits_add(s, s->opt_len);
     } else {
         zng_tr_emit_tree(s, DYN_TREES, last);
-        send_all_trees(s, s->l_desc.max_code+1, s->d_desc.max_code+1, max_blindex+1);
-        compress_block(s, (const ct_data *)s->dyn_ltree, (const ct_data *)s->dyn_dtree);
+        send_all_trees(s, (const ct_data *)s->dyn_ltree, (const ct_data *)s->dyn_dtree, (const ct_data *)s->bl_tree,
+                       s->l_desc.max_code+1, s->d_desc.max_code+1, max_blindex+1);
+        compress_block(s, (const ct_data *)s->dyn_ltree, (const ct_data *)s->dyn_dtree, sx, end);
         cmpr_bits_add(s, s->opt_len);
+        reuse_keep(s, s->l_desc.max_code+1, s->d_desc.max_code+1, max_blindex+1, s->opt_len - data_len, est);
     }
     Assert(s->compressed_len == s->bits_sent, "bad compressed size");
     /* The above check is made mod 2^32, for files larger than 512 MB
      * and unsigned long implemented on 32 bits.
      */
+}
+
+/* ===========================================================================
+ * Block splitting. The symbols of a block are cut into segments of at least
+ * SPLIT_SEGMENT symbols, which are counted once, and the block is split at the
+ * segment boundary where sending the two sides with trees of their own saves
+ * the most, if that saves more than sending another set of trees costs. The
+ * sides are split again the same way, so that neighbouring segments with
+ * similar statistics stay merged in one block. The cost of a block is
+ * estimated from the entropy of its literal/length and distance histograms and
+ * the number of codes it uses, without building the trees.
+ *
+ * The number of blocks is limited so that the compressed data cannot overwrite
+ * the symbols that are still to be sent (see the analysis in deflate.c). Every
+ * block but the last can add up to 27 bits to the fixed-code bound, for its
+ * header, its end of block code and the padding of a stored block, which
+ * leaves enough of the 139 bits to spare for three such blocks.
+ *
+ * Counting the symbols costs about as much as sending them, so the fastest
+ * levels send their blocks whole.
+ */
+#define SPLIT_MIN_LEVEL  4      /* lowest level to split blocks at */
+#define SPLIT_SEGMENT    1024   /* minimum number of symbols in a segment */
+#define SPLIT_SEGMENTS   16     /* maximum number of segments */
+#define SPLIT_CODES      (L_CODES+D_CODES)
+#define SPLIT_MAX_BLOCKS 4      /* maximum number of blocks to split into */
+
+/* ===========================================================================
+ * Add the symbols in sym_buf from sx up to end to the histogram freq, which
+ * has the literal/length codes followed by the distance codes. Return the
+ * number of input bytes that they stand for.
+ */
+static uint32_t split_count(deflate_state *s, uint16_t *freq, unsigned sx, unsigned end) {
+    uint32_t bytes = 0;
+    unsigned dist;      /* distance of matched string */
+    int lc;             /* match length or unmatched char (if dist == 0) */
+
+    while (sx < end) {
+        dist = s->sym_buf[sx++] & 0xff;
+        dist += (unsigned)(s->sym_buf[sx++] & 0xff) << 8;
+        lc = s->sym_buf[sx++];
+        if (dist == 0) {
+            freq[lc]++;
+            bytes++;
+        } else {
+            dist--;
+            freq[zng_length_code[lc]+LITERALS+1]++;
+            freq[L_CODES+d_code(dist)]++;
+            bytes += lc + STD_MIN_MATCH;
+        }
+    }
+    return bytes;
+}
+
+/* ===========================================================================
+ * Count the symbols of each segment of size entries in sym_buf into hist, and
+ * the number of input bytes that they stand for into bytes.
+ */
+static void split_segments(deflate_state *s, uint16_t hist[][SPLIT_CODES], uint32_t *bytes, unsigned size) {
+    unsigned sx;
+    int seg;
+
+    for (sx = 0, seg = 0; sx < s->sym_next; sx += size, seg++) {
+        memset(hist[seg], 0, sizeof(hist[seg]));
+        bytes[seg] = split_count(s, hist[seg], sx, MIN(sx + size, s->sym_next));
+    }
+}
+
+/* ===========================================================================
+ * Estimate the cost in 1/256 bits of sending the codes counted in freq, less
+ * those counted in sub if not NULL, with a tree built for them. Only the codes
+ * listed in used, of which the first lcodes are literal/length codes, can have
+ * been counted.
+ */
+static uint64_t split_cost(const uint32_t *freq, const uint32_t *sub, const uint16_t *used, int lcodes, int codes) {
+    uint64_t bits = EST_TREE_BITS * 256;
+    uint64_t sum = 0;     /* sum of f * log2(f) over the codes of a tree */
+    uint32_t total = 0;   /* number of codes in a tree */
+    int n;
+
+    for (n = 0; n < codes; n++) {
+        uint32_t f = freq[used[n]] - (sub != NULL ? sub[used[n]] : 0);
+        if (f != 0) {
+            sum += (uint64_t)f * fixed_log2(f);
+            total += f;
+            bits += EST_CODE_BITS * 256;
+        }
+        if (n == lcodes - 1 || n == codes - 1) {
+            /* the entropy of a tree is total * log2(total) - sum */
+            if (total != 0)
+                bits += (uint64_t)total * fixed_log2(total) - sum;
+            sum = 0;
+            total = 0;
+        }
+    }
+    return bits;
+}
+
+/* ===========================================================================
+ * Return the segment at which the segments from first up to last, with the
+ * histograms hist, are best split into two blocks, or 0 if they are best sent
+ * as one block.
+ */
+static int split_find(uint16_t hist[][SPLIT_CODES], int first, int last) {
+    uint32_t total[SPLIT_CODES], head[SPLIT_CODES];
+    uint16_t used[SPLIT_CODES];
+    uint64_t best, cost;
+    int n, seg, split = 0, lcodes = 0, codes = 0;
+
+    if (last - first < 2)
+        return 0;
+
+    memset(total, 0, sizeof(total));
+    memset(head, 0, sizeof(head));
+    for (seg = first; seg < last; seg++) {
+        for (n = 0; n < SPLIT_CODES; n++)
+            total[n] += hist[seg][n];
+    }
+    for (n = 0; n < SPLIT_CODES; n++) {
+        if (n == L_CODES)
+            lcodes = codes;
+        if (total[n] != 0)
+            used[codes++] = (uint16_t)n;
+    }
+    best = split_cost(total, NULL, used, lcodes, codes);
+
+    for (seg = first + 1; seg < last; seg++) {
+        for (n = 0; n < codes; n++)
+            head[used[n]] += hist[seg-1][used[n]];
+        cost = split_cost(head, NULL, used, lcodes, codes) + split_cost(total, head, used, lcodes, codes);
+        if (cost < best) {
+            best = cost;
+            split = seg;
+        }
+    }
+    return split;
+}
+
+/* ===========================================================================
+ * Set the frequencies of the trees to those of the segments from first up to
+ * last, to send them as a block of their own. Return the number of input bytes
+ * that they stand for.
+ */
+static uint32_t split_tally(deflate_state *s, uint16_t hist[][SPLIT_CODES], const uint32_t *bytes,
+                            int first, int last) {
+    uint32_t len = 0;
+    int seg, n;
+
+    for (n = 0; n < L_CODES; n++)
+        s->dyn_ltree[n].Freq = 0;
+    for (n = 0; n < D_CODES; n++)
+        s->dyn_dtree[n].Freq = 0;
+    for (n = 0; n < BL_CODES; n++)
+        s->bl_tree[n].Freq = 0;
+
+    for (seg = first; seg < last; seg++) {
+        for (n = 0; n < L_CODES; n++)
+            s->dyn_ltree[n].Freq += hist[seg][n];
+        for (n = 0; n < D_CODES; n++)
+            s->dyn_dtree[n].Freq += hist[seg][L_CODES+n];
+        len += bytes[seg];
+    }
+
+    s->dyn_ltree[END_BLOCK].Freq = 1;
+    s->opt_len = s->static_len = 0L;
+    return len;
+}
+
+/* ===========================================================================
+ * Write out the current block, split into several blocks where the statistics
+ * of the data change enough for new trees to pay off.
+ */
+void Z_INTERNAL zng_tr_flush_block(deflate_state *s, char *buf, uint32_t stored_len, int last) {
+    /* buf: input block, or NULL if too old */
+    /* stored_len: length of input block */
+    /* last: one if this is the last block for a file */
+    uint16_t hist[SPLIT_SEGMENTS][SPLIT_CODES]; /* histogram of each segment */
+    uint32_t bytes[SPLIT_SEGMENTS];             /* input bytes of each segment */
+    int split[SPLIT_MAX_BLOCKS+1];              /* segments where the blocks start */
+    unsigned size = 0;                          /* entries in sym_buf per segment */
+    int blocks = 1, n;
+
+    /* Check if the file is binary or text */
+    if (s->level != 0 && s->sym_next != 0 && s->strm->data_type == Z_UNKNOWN)
+        s->strm->data_type = detect_data_type(s);
+
+    if (s->level >= SPLIT_MIN_LEVEL && s->strategy != Z_FIXED && s->sym_next >= 2 * SPLIT_SEGMENT * 3) {
+        unsigned syms = s->sym_next / 3;
+        size = MAX(SPLIT_SEGMENT, (syms + SPLIT_SEGMENTS - 1) / SPLIT_SEGMENTS) * 3;
+        split[0] = 0;
+        split[1] = (int)((s->sym_next + size - 1) / size);
+        split_segments(s, hist, bytes, size);
+
+        n = 0;
+        while (n < blocks && blocks < SPLIT_MAX_BLOCKS) {
+            int seg = split_find(hist, split[n], split[n+1]);
+            if (seg == 0) {
+                n++;
+                continue;
+            }
+            memmove(split + n + 2, split + n + 1, (blocks - n) * sizeof(int));
+            split[n+1] = seg;
+            blocks++;
+        }
+    }
+
+    if (blocks == 1) {
+        flush_block(s, buf, stored_len, 0, s->sym_next, last);
+    } else {
+        for (n = 0; n < blocks; n++) {
+            unsigned sx = (unsigned)split[n] * size;
+            unsigned end = n == blocks - 1 ? s->sym_next : (unsigned)split[n+1] * size;
+            uint32_t len = split_tally(s, hist, bytes, split[n], split[n+1]);
+
+            Tracev((stderr, "\nsplit %u-%u", sx / 3, end / 3));
+            flush_block(s, buf, len, sx, end, last && n == blocks - 1);
+            Assert(len <= stored_len, "bad split length");
+            stored_len -= len;
+            if (buf != NULL)
+                buf += len;
+        }
+        Assert(stored_len == 0, "bad split length");
+    }
     init_block(s);
 
     if (last) {
@@ -714,14 +1149,16 @@ void Z_INTERNAL zng_tr_flush_block(deflate_state *s, char *buf, uint32_t stored_
 /* ===========================================================================
  * Send the block data compressed using the given Huffman trees
  */
-static void compress_block(deflate_state *s, const ct_data *ltree, const ct_data *dtree) {
+static void compress_block(deflate_state *s, const ct_data *ltree, const ct_data *dtree,
+                           unsigned sx, unsigned end) {
     /* ltree: literal tree */
     /* dtree: distance tree */
+    /* sx: running index in sym_buf */
+    /* end: index in sym_buf to stop at */
     unsigned dist;      /* distance of matched string */
     int lc;             /* match length or unmatched char (if dist == 0) */
-    unsigned sx = 0;    /* running index in sym_buf */
 
-    if (s->sym_next != 0) {
+    if (sx != end) {
         do {
             dist = s->sym_buf[sx++] & 0xff;
             dist += (unsigned)(s->sym_buf[sx++] & 0xff) << 8;
@@ -734,7 +1171,7 @@ static void compress_block(deflate_state *s, const ct_data *ltree, const ct_data
 
             /* Check that the overlay between pending_buf and sym_buf is ok: */
             Assert(s->pending < s->lit_bufsize + sx, "pending_buf overflow");
-        } while (sx < s->sym_next);
+        } while (sx < end);
     }
 
     zng_emit_end_block(s, ltree, 0);
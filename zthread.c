@@ -0,0 +1,254 @@
+/* zthread.c -- Minimal portable threading primitives used internally in zlib-ng
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#include "zbuild.h"
+#include "zthread.h"
+
+#ifdef WITH_THREADS
+#  ifndef _WIN32
+#    include <unistd.h>
+#  endif
+#endif
+
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+static DWORD WINAPI zthread_entry(LPVOID arg) {
+    zthread_t *thread = (zthread_t *)arg;
+    thread->func(thread->arg);
+    return 0;
+}
+#  else
+static void *zthread_entry(void *arg) {
+    zthread_t *thread = (zthread_t *)arg;
+    thread->func(thread->arg);
+    return NULL;
+}
+#  endif
+#endif
+
+int32_t Z_INTERNAL zthread_create(zthread_t *thread, zthread_func func, void *arg) {
+    thread->func = func;
+    thread->arg = arg;
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    thread->handle = CreateThread(NULL, 0, zthread_entry, thread, 0, NULL);
+    return thread->handle == NULL ? -1 : 0;
+#  else
+    return pthread_create(&thread->handle, NULL, zthread_entry, thread) == 0 ? 0 : -1;
+#  endif
+#else
+    return -1;
+#endif
+}
+
+void Z_INTERNAL zthread_join(zthread_t *thread) {
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#  else
+    pthread_join(thread->handle, NULL);
+#  endif
+#else
+    Z_UNUSED(thread);
+#endif
+}
+
+int32_t Z_INTERNAL zmutex_init(zmutex_t *mutex) {
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    InitializeCriticalSection(&mutex->cs);
+    return 0;
+#  else
+    return pthread_mutex_init(&mutex->mutex, NULL) == 0 ? 0 : -1;
+#  endif
+#else
+    mutex->unused = 0;
+    return 0;
+#endif
+}
+
+void Z_INTERNAL zmutex_destroy(zmutex_t *mutex) {
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    DeleteCriticalSection(&mutex->cs);
+#  else
+    pthread_mutex_destroy(&mutex->mutex);
+#  endif
+#else
+    Z_UNUSED(mutex);
+#endif
+}
+
+void Z_INTERNAL zmutex_lock(zmutex_t *mutex) {
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    EnterCriticalSection(&mutex->cs);
+#  else
+    pthread_mutex_lock(&mutex->mutex);
+#  endif
+#else
+    Z_UNUSED(mutex);
+#endif
+}
+
+void Z_INTERNAL zmutex_unlock(zmutex_t *mutex) {
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    LeaveCriticalSection(&mutex->cs);
+#  else
+    pthread_mutex_unlock(&mutex->mutex);
+#  endif
+#else
+    Z_UNUSED(mutex);
+#endif
+}
+
+int32_t Z_INTERNAL zcond_init(zcond_t *cond) {
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    InitializeConditionVariable(&cond->cv);
+    return 0;
+#  else
+    return pthread_cond_init(&cond->cond, NULL) == 0 ? 0 : -1;
+#  endif
+#else
+    cond->unused = 0;
+    return 0;
+#endif
+}
+
+void Z_INTERNAL zcond_destroy(zcond_t *cond) {
+#if defined(WITH_THREADS) && !defined(_WIN32)
+    pthread_cond_destroy(&cond->cond);
+#else
+    Z_UNUSED(cond);
+#endif
+}
+
+void Z_INTERNAL zcond_wait(zcond_t *cond, zmutex_t *mutex) {
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    SleepConditionVariableCS(&cond->cv, &mutex->cs, INFINITE);
+#  else
+    pthread_cond_wait(&cond->cond, &mutex->mutex);
+#  endif
+#else
+    Z_UNUSED(cond);
+    Z_UNUSED(mutex);
+#endif
+}
+
+void Z_INTERNAL zcond_signal(zcond_t *cond) {
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    WakeConditionVariable(&cond->cv);
+#  else
+    pthread_cond_signal(&cond->cond);
+#  endif
+#else
+    Z_UNUSED(cond);
+#endif
+}
+
+void Z_INTERNAL zcond_broadcast(zcond_t *cond) {
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    WakeAllConditionVariable(&cond->cv);
+#  else
+    pthread_cond_broadcast(&cond->cond);
+#  endif
+#else
+    Z_UNUSED(cond);
+#endif
+}
+
+int32_t Z_INTERNAL zthread_cpu_count(void) {
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int32_t)info.dwNumberOfProcessors : 1;
+#  elif defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int32_t)count : 1;
+#  else
+    return 1;
+#  endif
+#else
+    return 1;
+#endif
+}
+
+/* ===========================================================================
+ * Job scheduler, each worker repeatedly takes the next unclaimed job index.
+ */
+typedef struct {
+    zthread_job_func job;
+    void *ctx;
+    int32_t jobs;
+    int32_t next;
+    zmutex_t lock;
+} zthread_jobs;
+
+typedef struct {
+    zthread_jobs *jobs;
+    int32_t id;
+} zthread_jobs_worker_arg;
+
+static void zthread_jobs_worker(void *arg) {
+    zthread_jobs_worker_arg *worker = (zthread_jobs_worker_arg *)arg;
+    zthread_jobs *jobs = worker->jobs;
+    int32_t current;
+
+    for (;;) {
+        zmutex_lock(&jobs->lock);
+        current = jobs->next < jobs->jobs ? jobs->next++ : -1;
+        zmutex_unlock(&jobs->lock);
+        if (current < 0)
+            break;
+        jobs->job(jobs->ctx, worker->id, current);
+    }
+}
+
+void Z_INTERNAL zthread_run_jobs(zthread_job_func job, void *ctx, int32_t workers, int32_t jobs) {
+    zthread_t threads[ZTHREAD_MAX_WORKERS];
+    zthread_jobs_worker_arg args[ZTHREAD_MAX_WORKERS];
+    zthread_jobs state;
+    int32_t started = 0;
+    int32_t i;
+
+    if (workers > jobs)
+        workers = jobs;
+    if (workers > ZTHREAD_MAX_WORKERS)
+        workers = ZTHREAD_MAX_WORKERS;
+
+    if (workers <= 1 || zmutex_init(&state.lock) != 0) {
+        for (i = 0; i < jobs; i++)
+            job(ctx, 0, i);
+        return;
+    }
+
+    state.job = job;
+    state.ctx = ctx;
+    state.jobs = jobs;
+    state.next = 0;
+
+    for (i = 0; i < workers; i++) {
+        args[i].jobs = &state;
+        args[i].id = i;
+    }
+
+    /* The calling thread is worker 0 */
+    for (i = 1; i < workers; i++) {
+        if (zthread_create(&threads[started], zthread_jobs_worker, &args[i]) != 0)
+            break;
+        started++;
+    }
+    zthread_jobs_worker(&args[0]);
+
+    for (i = 0; i < started; i++)
+        zthread_join(&threads[i]);
+    zmutex_destroy(&state.lock);
+}
@@ -0,0 +1,87 @@
+/* zthread.h -- Minimal portable threading primitives used internally in zlib-ng
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef ZTHREAD_H_
+#define ZTHREAD_H_
+
+/* When WITH_THREADS is not defined all primitives are stubs: thread creation
+ * fails, locking is a no-op and zthread_run_jobs() runs every job in the
+ * calling thread. Callers must therefore always be able to make progress
+ * without a second thread. */
+
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+#    include <windows.h>
+#  else
+#    include <pthread.h>
+#  endif
+#endif
+
+typedef void (*zthread_func)(void *arg);
+
+typedef struct zthread_s {
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    HANDLE handle;
+#  else
+    pthread_t handle;
+#  endif
+#endif
+    zthread_func func;
+    void *arg;
+} zthread_t;
+
+typedef struct zmutex_s {
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    CRITICAL_SECTION cs;
+#  else
+    pthread_mutex_t mutex;
+#  endif
+#else
+    int unused;
+#endif
+} zmutex_t;
+
+typedef struct zcond_s {
+#ifdef WITH_THREADS
+#  ifdef _WIN32
+    CONDITION_VARIABLE cv;
+#  else
+    pthread_cond_t cond;
+#  endif
+#else
+    int unused;
+#endif
+} zcond_t;
+
+/* Job callback for zthread_run_jobs(), worker is in range [0, workers) and job is in range [0, jobs).
+ * A worker runs one job at a time, so per-worker resources can be indexed by worker. */
+typedef void (*zthread_job_func)(void *ctx, int32_t worker, int32_t job);
+
+/* Starts func(arg) on a new thread, the thread structure must stay valid until zthread_join. Returns 0 on success. */
+int32_t Z_INTERNAL zthread_create(zthread_t *thread, zthread_func func, void *arg);
+void    Z_INTERNAL zthread_join(zthread_t *thread);
+
+int32_t Z_INTERNAL zmutex_init(zmutex_t *mutex);
+void    Z_INTERNAL zmutex_destroy(zmutex_t *mutex);
+void    Z_INTERNAL zmutex_lock(zmutex_t *mutex);
+void    Z_INTERNAL zmutex_unlock(zmutex_t *mutex);
+
+int32_t Z_INTERNAL zcond_init(zcond_t *cond);
+void    Z_INTERNAL zcond_destroy(zcond_t *cond);
+void    Z_INTERNAL zcond_wait(zcond_t *cond, zmutex_t *mutex);
+void    Z_INTERNAL zcond_signal(zcond_t *cond);
+void    Z_INTERNAL zcond_broadcast(zcond_t *cond);
+
+/* Returns the number of online processors, or 1 if unknown or threads are disabled */
+int32_t Z_INTERNAL zthread_cpu_count(void);
+
+#define ZTHREAD_MAX_WORKERS 64
+
+/* Runs jobs 0 .. jobs - 1 using up to workers threads including the calling thread (worker 0),
+ * and returns once all jobs have completed. Jobs are handed out in increasing order. */
+void    Z_INTERNAL zthread_run_jobs(zthread_job_func job, void *ctx, int32_t workers, int32_t jobs);
+
+#endif